@@ -466,9 +466,10 @@ shared_gencode_init(IF_X64_ELSE(gencode_mode_t gencode_mode, void))
 #endif
 
 #ifdef TRACE_HEAD_CACHE_INCR
-    pc = check_size_and_cache_line(gencode, pc);
-    gencode->trace_head_incr = pc;
-    pc = emit_trace_head_incr_shared(GLOBAL_DCONTEXT, pc, gencode->fcache_return);
+    /* only thread-private fragments link through trace_head_incr, which
+     * counts in a thread's own table, so there is no shared version
+     */
+    gencode->trace_head_incr = NULL;
 #endif
 
 #ifdef CLIENT_INTERFACE
@@ -911,8 +911,6 @@ cache_pc get_new_thread_start(dcontext_t *dcontext _IF_X64(gencode_mode_t mode))
 #ifdef TRACE_HEAD_CACHE_INCR
 byte *emit_trace_head_incr(dcontext_t *dcontext, byte *pc,
                            byte *fcache_return_pc);
-byte * 
-emit_trace_head_incr_shared(dcontext_t *dcontext, byte *pc, byte *fcache_return_pc);
 #endif
 
 #ifdef CLIENT_INTERFACE
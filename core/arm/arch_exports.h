@@ -144,9 +144,17 @@ typedef struct _local_state_extended_t {
     table_stat_state_t table_space;
 } local_state_extended_t;
 
-/* local_state_[extended_]t is allocated in os-specific thread-local storage (TLS),
- * accessible off of fs:.  But, the actual segment offset varies, so
- * os_tls_offset() must be used to obtain an fs: offset from a slot.
+/* local_state_[extended_]t is allocated in os-specific thread-local storage (TLS).
+ * On ARM its base lives in the user read/write thread ID register (TPIDRURW),
+ * and the spill slots and then the IBL mask/table pairs sit at fixed offsets
+ * from it, so cache code reaches any slot with one mrc plus one ldr/str:
+ *
+ *     mrc p15, 0, rB, c13, c0, 2     ; rB = TLS base
+ *     ldr rX, [rB, #os_tls_offset(slot)]
+ *
+ * A restore can use rX itself as rB; a spill needs a dead rB (see
+ * instr_create_save_to_tls_seq()).  os_tls_offset() must still be used to
+ * obtain the offset from a slot, and must stay below TLS_MAX_IMM_OFFSET.
  */
 #define TLS_R0_SLOT             ((ushort)offsetof(spill_state_t, r0))
 #define TLS_R3_SLOT             ((ushort)offsetof(spill_state_t, r3))
@@ -168,6 +176,9 @@ typedef struct _local_state_extended_t {
                                   + offsetof(table_stat_state_t, stats)))
 #endif
 
+/* the ldr/str immediate is 12 bits */
+#define TLS_MAX_IMM_OFFSET       4095
+
 #define TLS_NUM_SLOTS                                  \
    (DYNAMO_OPTION(ibl_table_in_tls) ?                  \
     sizeof(local_state_extended_t) / sizeof(void *) :  \
@@ -493,6 +504,10 @@ static inline int64 atomic_add_exchange_int64(volatile int64 *var, int64 value)
     __asm__ __volatile__("nop" : )
 
 # define SPINLOCK_PAUSE()   __asm__ __volatile__("nop")
+/* ARMv7 is weakly ordered: a reader that sees a newly published pointer must
+ * also see the data written before it, so we need a real dmb here.
+ */
+# define MEMORY_BARRIER() __asm__ __volatile__("dmb" : : : "memory")
 
 /* TODO SJF Check all this is corect */
 /*
@@ -1506,6 +1521,7 @@ build_basic_block_fragment(dcontext_t *dcontext, app_pc start_pc,
 
 void interp(dcontext_t *dcontext);
 uint extend_trace(dcontext_t *dcontext, fragment_t *f, linkstub_t *prev_l);
+int coalesce_trace_spills(dcontext_t *dcontext, app_pc tag, instrlist_t *trace);
 int append_trace_speculate_last_ibl(dcontext_t *dcontext, instrlist_t *trace,
                                     app_pc speculate_next_tag, bool record_translation);
 
@@ -1733,6 +1749,9 @@ bool is_observed_call_site(dcontext_t *dcontext, app_pc retaddr);
 
 /* in optimize.c */
 void optimize_trace(dcontext_t *dcontext, app_pc tag, instrlist_t *trace);
+#ifdef SIDELINE
+void prefetch_note_samples(app_pc tag, int samples, int total);
+#endif
 #ifdef DEBUG
 void print_optimization_stats(void); 
 #endif
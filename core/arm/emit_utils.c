@@ -80,8 +80,12 @@
 #endif
 
 #ifdef TRACE_HEAD_CACHE_INCR 
-/* linkstub_t field */
-#  define LINKSTUB_TARGET_FRAG_OFFS  (offsetof(direct_linkstub_t, target_fragment))
+/* linkstub_t fields */
+#  define LINKSTUB_TARGET_FRAG_OFFS  (offsetof(common_direct_linkstub_t, target_fragment))
+#  define LINKSTUB_TH_COUNTER_OFFS   (offsetof(common_direct_linkstub_t, th_counter))
+/* fragment_t fields */
+#  define FRAGMENT_START_PC_OFFS     (offsetof(fragment_t, start_pc))
+#  define FRAGMENT_PREFIX_SIZE_OFFS  (offsetof(fragment_t, prefix_size))
 #endif
 
 #ifdef PROFILE_LINKCOUNT
@@ -121,15 +125,11 @@ void end_return_lookup(void);
 /* we are sharing bbs w/o ibs -- we assume that a bb
  * w/ a direct branch cannot have an ib and thus is shared
  */
-#ifdef TRACE_HEAD_CACHE_INCR
-/* incr routine can't tell whether coming from shared bb
- * or non-shared fragment (such as a trace) so must always
- * use shared stubs
+/* The trace_head_incr routine is thread-private and only private fragments
+ * link through it (see monitor_is_linkable()), so unlike x86 we do not need
+ * every direct stub to be shared for TRACE_HEAD_CACHE_INCR.
  */
-#  define FRAG_DB_SHARED(flags) true
-#else
-#  define FRAG_DB_SHARED(flags) (TEST(FRAG_SHARED, (flags)))
-#endif
+#define FRAG_DB_SHARED(flags) (TEST(FRAG_SHARED, (flags)))
 
 //Moved
 /* PR 244737: even thread-private fragments use TLS on x64.  We accomplish
@@ -523,55 +523,44 @@ insert_spill_or_restore(dcontext_t *dcontext, cache_pc pc, uint flags, bool spil
                         uint dc_offs, bool require_addr16)
 {
     DEBUG_DECLARE(cache_pc start_pc = pc;)
-#ifdef NO
-//TODO SJF INSTR
-    byte opcode = ((reg == REG_RR0) ?
-                   (spill ? MOV_XAX2MEM_OPCODE : MOV_MEM2XAX_OPCODE) :
-                   (spill ? MOV_REG2MEM_OPCODE : MOV_MEM2REG_OPCODE));
+    instrlist_t ilist;
+    instrlist_init(&ilist);
+
+    /* There is no short-displacement form to pick on ARM, so require_addr16
+     * does not apply.  Only os_tls_init() under HAVE_TLS installs our base in
+     * TPIDRURW: without it, the dcontext is the only place to go.
+     */
+#ifdef HAVE_TLS
     if (shared) {
-        /* mov %ebx, fs:os_tls_offset(tls_offs) */
-        /* trying hard to keep the size of the stub 5 for eax, 6 else */
-        /* FIXME: case 5231 when staying on trace space is better,
-         * when going through this to the IBL routine speed asks for
-         * not adding the prefix.
+        /* Restore:  mrc p15, 0, reg, c13, c0, 2; ldr reg, [reg, #offs]
+         * Spill:    push {rB}; mrc p15, 0, rB, c13, c0, 2;
+         *           str reg, [rB, #offs]; pop {rB}
+         * Stubs have no register known to be dead, hence the push for spills.
          */
-        bool addr16 = (require_addr16 || use_addr_prefix_on_short_disp());
-        if (addr16) {
-            *pc = ADDR_PREFIX_OPCODE; 
-            pc++;
-        }
-        *pc = TLS_SEG_OPCODE; pc++;
-        *pc = opcode; pc++;
-        if (reg != REG_RR0) {
-            /* 0x1e for ebx, 0x0e for ecx, 0x06 for eax
-             * w/o addr16 those are 0x1d, 0x0d, 0x05
-             */
-            *pc = MODRM_BYTE(0/*mod*/, reg_get_bits(reg), addr16 ? 6 : 5/*rm*/);
-            pc++;
-        }
-        if (addr16) {
-            *((ushort *)pc) = os_tls_offset(tls_offs);
-            pc+=2;
+        if (spill) {
+            instr_create_save_to_tls_seq(&ilist, dcontext, reg, REG_NULL, tls_offs,
+                                         INSERT_APPEND, NULL);
         } else {
-            *((uint *)pc) = os_tls_offset(tls_offs);
-            pc+=4;
+            instr_create_restore_from_tls_seq(&ilist, dcontext, reg, tls_offs,
+                                              INSERT_APPEND, NULL);
         }
-    } else {
-        /* mov %ebx,((int)&dcontext)+dc_offs */
-        *pc = opcode; pc++;
-        if (reg != REG_RR0) {
-            /* 0x1d for ebx, 0x0d for ecx, 0x05 for eax */
-            *pc = MODRM_BYTE(0/*mod*/, reg_get_bits(reg), 5/*rm*/); pc++;
+    } else
+#endif
+    {
+        /* thread-private: use the absolute address of the dcontext field */
+        if (spill) {
+            instr_create_save_to_dcontext(&ilist, dcontext, reg, dc_offs,
+                                          INSERT_APPEND, NULL, true/*absolute*/);
+        } else {
+            instr_create_restore_from_dcontext(&ilist, dcontext, reg, dc_offs,
+                                               INSERT_APPEND, NULL, true/*absolute*/);
         }
-        IF_X64(ASSERT_NOT_IMPLEMENTED(false));
-        *((uint *)pc) = (uint)(ptr_uint_t) UNPROT_OFFS(dcontext, dc_offs); pc+=4;
     }
-    ASSERT(IF_X64_ELSE(false, !shared) || (pc - start_pc) == 
-           (reg == REG_RR0 ? SIZE_MOV_XAX_TO_TLS(flags, require_addr16) :
-            SIZE_MOV_XBX_TO_TLS(flags, require_addr16)));
-    ASSERT(IF_X64_ELSE(false, !shared) || !spill || reg == REG_RR0 ||
+    pc = instrlist_encode(dcontext, &ilist, pc, false /* no instr targets */);
+    ASSERT(pc != NULL);
+    instrlist_clear(dcontext, &ilist);
+    ASSERT(IF_HAVE_TLS_ELSE(!shared, true) || !spill ||
            instr_raw_is_tls_spill(start_pc, reg, tls_offs));
-#endif //NO
     return pc;
 }
 
@@ -1400,6 +1389,34 @@ is_exit_cti_patchable(dcontext_t *dcontext, instr_t *inst, uint frag_flags)
     }
 }
 
+#ifdef TRACE_HEAD_CACHE_INCR
+/* Returns the pc of the branch to fcache_return that ends the direct exit
+ * stub at stub_pc.  Everything before it in the stub is a meta sequence
+ * with no branches (see insert_exit_stub_other_flags()), so it is the
+ * first b we decode.
+ */
+static cache_pc
+direct_stub_exit_branch_pc(dcontext_t *dcontext, fragment_t *f, cache_pc stub_pc)
+{
+    cache_pc stub_end = stub_pc + DIRECT_EXIT_STUB_SIZE(f->flags);
+    cache_pc pc = stub_pc, prev_pc;
+    instr_t instr;
+    instr_init(dcontext, &instr);
+    while (pc != NULL && pc < stub_end) {
+        instr_reset(dcontext, &instr);
+        prev_pc = pc;
+        pc = decode_cti(dcontext, pc, &instr);
+        if (pc != NULL && instr_get_opcode(&instr) == OP_b) {
+            instr_free(dcontext, &instr);
+            return prev_pc;
+        }
+    }
+    instr_free(dcontext, &instr);
+    ASSERT_NOT_REACHED();
+    return NULL;
+}
+#endif
+
 /* returns true if exit cti no longer points at stub
  * (certain situations, like profiling or TRACE_HEAD_CACHE_INCR, go
  * through the stub even when linked)
@@ -1476,9 +1493,11 @@ link_direct_exit(dcontext_t *dcontext, fragment_t *f, linkstub_t *l, fragment_t
         LOG(THREAD, LOG_LINKS, 4,
             "\tlinking F%d."PFX" to incr routine b/c F%d is trace head\n",
             f->id, EXIT_CTI_PC(f, l), targetf->id);
-        /* FIXME: more efficient way than multiple calls to get size-5? */
-        ASSERT(linkstub_size(dcontext, f, l) == DIRECT_EXIT_STUB_SIZE(f->flags));
-        patch_branch(dcontext, stub_pc + DIRECT_EXIT_STUB_SIZE(f->flags) - 5,
+        ASSERT(!TEST(FRAG_SHARED, f->flags));
+        /* the exit cti keeps targeting the stub, whose final branch we
+         * point at the incr routine instead of fcache_return
+         */
+        patch_branch(dcontext, direct_stub_exit_branch_pc(dcontext, f, stub_pc),
                      trace_head_incr_routine(dcontext), hot_patch);
         return false; /* going through stub */
     }
@@ -1531,7 +1550,7 @@ unlink_direct_exit(dcontext_t *dcontext, fragment_t *f, linkstub_t *l)
         pc = (byte *) stub_pc;
 # endif
 # ifdef TRACE_HEAD_CACHE_INCR
-        if (dl->target_fragment != NULL) { /* HACK to tell if targeted trace head */
+        if (dl->cdl.target_fragment != NULL) { /* HACK to tell if targeted trace head */
             /* make unlinked jmp go back to fcache_return */
             patch_branch(dcontext, pc + LINKCOUNT_UNLINKED_ENTRY(f->flags) + 10,
                          get_direct_exit_target(dcontext, f->flags),
@@ -1545,15 +1564,13 @@ unlink_direct_exit(dcontext_t *dcontext, fragment_t *f, linkstub_t *l)
 #endif
 
 #ifdef TRACE_HEAD_CACHE_INCR
-    if (dl->target_fragment != NULL) { /* HACK to tell if targeted trace head */
+    if (dl->cdl.target_fragment != NULL) { /* HACK to tell if targeted trace head */
 # ifdef CUSTOM_EXIT_STUBS
         byte *pc = (byte *) (EXIT_FIXED_STUB_PC(dcontext, f, l));
 # else
         byte *pc = (byte *) (EXIT_STUB_PC(dcontext, f, l));
 # endif
-        /* FIXME: more efficient way than multiple calls to get size-5? */
-        ASSERT(linkstub_size(dcontext, f, l) == DIRECT_EXIT_STUB_SIZE(f->flags));
-        patch_branch(dcontext, pc + DIRECT_EXIT_STUB_SIZE(f->flags) - 5,
+        patch_branch(dcontext, direct_stub_exit_branch_pc(dcontext, f, pc),
                      get_direct_exit_target(dcontext, f->flags),
                      HOT_PATCHABLE);
     }
@@ -7261,86 +7278,92 @@ emit_new_thread_dynamo_start(dcontext_t *dcontext, byte *pc)
 
 #ifdef TRACE_HEAD_CACHE_INCR
 /* trace_t heads come here instead of back to dynamo to have their counters
- * incremented.
+ * counted down.  A linked exit to a trace head runs its whole exit stub, whose
+ * final branch we point here instead of at fcache_return: the app's r0, r1
+ * and r7 are in the dcontext, r1 holds the linkstub (also in last_exit) and
+ * r0 and next_tag hold the target tag.  The countdown lives in this thread's
+ * trace head counter table (see monitor_trace_head_cache_counter()) and the
+ * linkstub points at it.  We only go back to dispatch once the head is hot,
+ * as if the exit had been unlinked.
+ *
+ *      SAVE_TO_DC cpsr                 # we need the flags for the compare
+ *      ldr  r7, [r1, #th_counter]
+ *      ldr  r0, [r7]
+ *      sub  r0, r0, #1
+ *      cmp  r0, #0
+ *      ble  is_hot                     # leave cache_left at 1 for DR to credit
+ *      str  r0, [r7]
+ *      ldr  r7, [r1, #target_fragment]
+ *      ldr  r0, [r7, #start_pc]
+ *      ldrb r7, [r7, #prefix_size]
+ *      add  r7, r0, r7                 # entry pc, as a direct link targets
+ *      RESTORE_FROM_DC cpsr
+ *      RESTORE_FROM_DC r0, next_tag    # what a linked exit leaves in r0
+ *      RESTORE_FROM_DC r1
+ *      push {r7}
+ *      RESTORE_FROM_DC r7
+ *      pop  {pc}
+ *    is_hot:
+ *      RESTORE_FROM_DC cpsr
+ *      b    fcache_return              # r1 still holds the linkstub
  */
 byte * 
 emit_trace_head_incr(dcontext_t *dcontext, byte *pc, byte *fcache_return_pc)
 {
-    /*  save ecx
-        save eax->xbx slot
-        mov target_fragment_offs(eax), eax
-        movzx counter_offs(eax), ecx
-        lea 1(ecx), ecx                 # increment counter
-        mov data16 cx, counter_offs(eax)
-        lea -hot_threshold(ecx), ecx    # compare to hot_threshold
-        jecxz is_hot
-        mov start_pc_offs(eax), ecx
-        movzx prefix_size_offs(eax), eax
-        lea (ecx,eax,1), ecx
-        mov ecx, trace_head_pc_offs + dcontext   # special slot to avoid target prefix
-        restore ecx
-        restore eax
-        jmp * trace_head_pc_offs + dcontext
-      is_hot:
-        restore ebx slot to eax         # put &l into eax
-        restore ecx
-        jmp fcache_return
-     */
-#ifdef NO
-//TODO SJF
     instrlist_t ilist;
-    instr_t *is_hot =
-        instr_create_restore_from_dcontext(dcontext, REG_EAX, R3_OFFSET);
-    instr_t *in;
-
-    /* PR 248210: unsupported feature on x64 */
-    IF_X64(ASSERT_NOT_IMPLEMENTED(false));
+    instr_t *is_hot = INSTR_CREATE_label(dcontext);
+    bool absolute = true;
 
     instrlist_init(&ilist);
-    APP(&ilist, instr_create_save_to_dcontext(dcontext, REG_ECX, R1_OFFSET));
-    if (DYNAMO_OPTION(shared_bbs)) {
-        /* HACK to get shared exit stub, which puts eax into fs:scratch1, to work
-         * w/ thread-private THCI: we pull eax out of the tls slot and into mcontext.
-         * This requires that all direct stubs for cti that can link to trace
-         * heads use the shared stub -- so if traces can link to trace heads, their
-         * exits must use the shared stubs, even if the traces are thread-private.
-         */
-        APP(&ilist, RESTORE_FROM_TLS(dcontext, REG_ECX, EXIT_STUB_SPILL_SLOT));
-        APP(&ilist, instr_create_save_to_dcontext(dcontext, REG_ECX, R0_OFFSET));
-    }
-    APP(&ilist, instr_create_save_to_dcontext(dcontext, REG_EAX, R3_OFFSET));
-    APP(&ilist, INSTR_CREATE_mov_reg(dcontext, opnd_create_reg(REG_EAX),
-                            OPND_CREATE_MEM32(REG_EAX, LINKSTUB_TARGET_FRAG_OFFS)));
-    ASSERT_NOT_IMPLEMENTED(false && "must handle LINKSTUB_CBR_FALLTHROUGH case by calculating target tag")
-    APP(&ilist, INSTR_CREATE_movzx(dcontext, opnd_create_reg(REG_ECX),
-                                   opnd_create_base_disp(REG_EAX, REG_NULL, 0,
-                                                         FRAGMENT_COUNTER_OFFS, OPSZ_2)));
-    APP(&ilist, INSTR_CREATE_lea(dcontext, opnd_create_reg(REG_ECX),
-                              opnd_create_base_disp(REG_ECX, REG_NULL, 0, 1, OPSZ_lea)));
-    /* data16 prefix is set auto-magically */
-    APP(&ilist, INSTR_CREATE_mov_reg(dcontext,
-                                    opnd_create_base_disp(REG_EAX, REG_NULL, 0,
-                                                          FRAGMENT_COUNTER_OFFS, OPSZ_2),
-                                    opnd_create_reg(REG_CX)));
-    APP(&ilist, INSTR_CREATE_lea(dcontext, opnd_create_reg(REG_ECX),
-                              opnd_create_base_disp(REG_ECX, REG_NULL, 0,
-                                            -((int)INTERNAL_OPTION(trace_threshold)), OPSZ_lea)));
-    APP(&ilist, INSTR_CREATE_jecxz(dcontext, opnd_create_instr(is_hot)));
-    APP(&ilist, INSTR_CREATE_mov_reg(dcontext, opnd_create_reg(REG_ECX),
-                         OPND_CREATE_MEM32(REG_EAX, FRAGMENT_START_PC_OFFS)));
-    APP(&ilist, INSTR_CREATE_movzx(dcontext, opnd_create_reg(REG_EAX),
-                                   opnd_create_base_disp(REG_EAX, REG_NULL, 0,
-                                                         FRAGMENT_PREFIX_SIZE_OFFS, OPSZ_1)));
-    APP(&ilist, INSTR_CREATE_lea(dcontext, opnd_create_reg(REG_ECX),
-                                 opnd_create_base_disp(REG_ECX, REG_EAX, 1, 0, OPSZ_lea)));
-    APP(&ilist, instr_create_save_to_dcontext(dcontext, REG_ECX, TRACE_HEAD_PC_OFFSET));
-    APP(&ilist, instr_create_restore_from_dcontext(dcontext, REG_ECX, R1_OFFSET));
-    APP(&ilist, instr_create_restore_from_dcontext(dcontext, REG_EAX, R0_OFFSET));
-    APP(&ilist, INSTR_CREATE_branch_ind(dcontext,
-                          opnd_create_dcontext_field(dcontext, TRACE_HEAD_PC_OFFSET)));
+    SAVE_TO_DC(&ilist, dcontext, REG_CPSR, CPSR_OFFSET, INSERT_APPEND, NULL);
+    APP(&ilist, INSTR_CREATE_ldr_imm(dcontext, opnd_create_reg(REG_RR7),
+                                     opnd_create_mem_reg(REG_RR1),
+                                     OPND_CREATE_IMM12(LINKSTUB_TH_COUNTER_OFFS),
+                                     COND_ALWAYS));
+    APP(&ilist, INSTR_CREATE_ldr_imm(dcontext, opnd_create_reg(REG_RR0),
+                                     opnd_create_mem_reg(REG_RR7),
+                                     OPND_CREATE_IMM12(0), COND_ALWAYS));
+    APP(&ilist, INSTR_CREATE_sub_imm(dcontext, opnd_create_reg(REG_RR0),
+                                     opnd_create_reg(REG_RR0),
+                                     OPND_CREATE_IMM12(1), COND_ALWAYS));
+    APP(&ilist, INSTR_CREATE_cmp_imm(dcontext, opnd_create_reg(REG_RR0),
+                                     OPND_CREATE_IMM12(0), COND_ALWAYS));
+    APP(&ilist, INSTR_CREATE_b(dcontext, opnd_create_instr(is_hot),
+                               COND_SIGNED_LESS_THAN_OR_EQUAL));
+    APP(&ilist, INSTR_CREATE_str_imm(dcontext, opnd_create_reg(REG_RR0),
+                                     opnd_create_mem_reg(REG_RR7),
+                                     OPND_CREATE_IMM12(0), COND_ALWAYS));
+
+    /* not hot yet: enter the head past its prefix, as a direct link would */
+    APP(&ilist, INSTR_CREATE_ldr_imm(dcontext, opnd_create_reg(REG_RR7),
+                                     opnd_create_mem_reg(REG_RR1),
+                                     OPND_CREATE_IMM12(LINKSTUB_TARGET_FRAG_OFFS),
+                                     COND_ALWAYS));
+    APP(&ilist, INSTR_CREATE_ldr_imm(dcontext, opnd_create_reg(REG_RR0),
+                                     opnd_create_mem_reg(REG_RR7),
+                                     OPND_CREATE_IMM12(FRAGMENT_START_PC_OFFS),
+                                     COND_ALWAYS));
+    APP(&ilist, INSTR_CREATE_ldrb_imm(dcontext, opnd_create_reg(REG_RR7),
+                                      opnd_create_mem_reg(REG_RR7),
+                                      OPND_CREATE_IMM12(FRAGMENT_PREFIX_SIZE_OFFS),
+                                      COND_ALWAYS));
+    APP(&ilist, INSTR_CREATE_add_reg(dcontext, opnd_create_reg(REG_RR7),
+                                     opnd_create_reg(REG_RR0), opnd_create_reg(REG_RR7),
+                                     OPND_CREATE_IMM5(0), COND_ALWAYS));
+    RESTORE_FROM_DC(&ilist, dcontext, REG_CPSR, CPSR_OFFSET, INSERT_APPEND, NULL);
+    RESTORE_FROM_DC(&ilist, dcontext, REG_RR0, NEXT_TAG_OFFSET, INSERT_APPEND, NULL);
+    RESTORE_FROM_DC(&ilist, dcontext, REG_RR1, R1_OFFSET, INSERT_APPEND, NULL);
+    APP(&ilist, INSTR_CREATE_push(dcontext, opnd_create_reg_list(REGLIST_R7),
+                                  COND_ALWAYS));
+    RESTORE_FROM_DC(&ilist, dcontext, REG_RR7, R7_OFFSET, INSERT_APPEND, NULL);
+    APP(&ilist, INSTR_CREATE_pop(dcontext, opnd_create_reg_list(REGLIST_R15),
+                                 COND_ALWAYS));
+
+    /* hot: back to dispatch, which will count this execution and start a trace */
     APP(&ilist, is_hot);
-    APP(&ilist, instr_create_restore_from_dcontext(dcontext, REG_ECX, R1_OFFSET));
-    APP(&ilist, INSTR_CREATE_branch(dcontext, opnd_create_pc(fcache_return_pc)));
+    RESTORE_FROM_DC(&ilist, dcontext, REG_CPSR, CPSR_OFFSET, INSERT_APPEND, NULL);
+    APP(&ilist, INSTR_CREATE_b(dcontext, opnd_create_pc(fcache_return_pc),
+                               COND_ALWAYS));
 
     /* now encode the instructions */
     pc = instrlist_encode(dcontext, &ilist, pc, true /* instr targets */);
@@ -7348,17 +7371,10 @@ emit_trace_head_incr(dcontext_t *dcontext, byte *pc, byte *fcache_return_pc)
 
     /* free the instrlist_t elements */
     instrlist_clear(dcontext, &ilist);
-#endif //NO
 
     return pc;
 }
 
-byte * 
-emit_trace_head_incr_shared(dcontext_t *dcontext, byte *pc, byte *fcache_return_pc)
-{
-    ASSERT_NOT_IMPLEMENTED(false);
-}
-
 #endif /* TRACE_HEAD_CACHE_INCR */
 
 #ifdef CLIENT_INTERFACE
@@ -95,7 +95,8 @@ const char * const reg_names[] = {
     "<invalid>",
     "es",   "cs",   "ss",   "ds",   "fs",   "gs",
 
-    "debug1","debug2", "control1", "control2", "cpsr"
+    "debug1","debug2", "control1", "control2", "cpsr",
+    "tpidrurw", "tpidruro", "tpidrprw"
     /* XXX: when you update here, update dr_reg_fixer[] in instr.c too */
 };
 
@@ -1980,6 +1981,14 @@ encode_1dst_reg_1src_reg_1src_imm_4(decode_info_t* di, instr_t* instr, byte* pc)
             word[1] |= b;
             break;
 
+          //ldrd/strd base, as produced by the decoder
+          case MEM_REG_kind:
+            b = opnd.value.reg;
+            
+            b--; //To get actual reg number
+            word[1] |= b;
+            break;
+
           default:
             CLIENT_ASSERT(false, "instr_encode error: invalid opnd type" );
             break;
@@ -3024,24 +3033,48 @@ encode_1dst_reg_1src_reglist(decode_info_t* di, instr_t* instr, byte* pc)
    return pc;
 }
 
+/* Fills in the CRn, coproc, opc2 and CRm fields of an mrc/mcr that moves
+ * between Rt and the cp15 register cpreg, along with Rt itself.
+ * Only the c13 thread ID registers are supported so far.
+ */
+static void
+encode_coproc_cp15_reg(reg_id_t cpreg, reg_id_t rt, byte* word)
+{
+    byte opc2;
+
+    switch( cpreg )
+    {
+      case DR_REG_TPIDRURW: opc2 = 2; break;
+      case DR_REG_TPIDRURO: opc2 = 3; break;
+      case DR_REG_TPIDRPRW: opc2 = 4; break;
+      default:
+        CLIENT_ASSERT(false, "instr_encode error: unsupported coprocessor register" );
+        return;
+    }
+    CLIENT_ASSERT(rt >= REG_RR0 && rt <= REG_RR14,
+                  "instr_encode error: invalid mrc/mcr register" );
+
+    //opc1 is 0, CRn is c13
+    word[1] |= 0xd;
+    //Rt, coproc is p15
+    word[2] |= ((rt - REG_RR0) << 4) | 0xf;
+    //opc2, bit 4 set, CRm is c0
+    word[3] |= (opc2 << 5) | 0x10;
+}
+
 byte*
 encode_coproc_mrc(decode_info_t* di, instr_t* instr, byte* pc)
 {
     byte word[4] = {0};  //Instr encoding in byte array
-    uint        opc;
-    byte        b, t;
-    uint        opc_bits;
-    opnd_t      opnd;
-    instr_info_t* info;
-    uint  instr_type;
-    int value; 
-
-    opc = instr_get_opcode(instr);
+    byte        b;
 
     /*
        Instruction encoded as 31-0
-       |cond|1010|imm24|
+       |cond|1110|opc1|1|CRn|Rt|coproc|opc2|1|CRm|
+       dst 0 is Rt, src 0 is the coprocessor register
      */
+    CLIENT_ASSERT(instr_num_dsts(instr) == 1 && instr_num_srcs(instr) == 1,
+                  "instr_encode error: mrc needs Rt and a coprocessor register" );
 
     /*********** Encode condition code. TODO Move to decode_info_t *********/
 
@@ -3057,16 +3090,14 @@ encode_coproc_mrc(decode_info_t* di, instr_t* instr, byte* pc)
         word[0] |= (b << 4);
     }
 
-    switch( opc )
-    {
-        //TODO MCR/MRC encoding
-        //SJF May not need this as not doing full encode prob
-    }
+    word[0] |= 0xe;
+    //L bit: to ARM register
+    word[1] |= 0x10;
+    encode_coproc_cp15_reg(opnd_get_reg(instr_get_src(instr, 0)),
+                           opnd_get_reg(instr_get_dst(instr, 0)), word);
 
     pc = write_word_to_fcache(pc, word );
 
-   // Have a separate function for branch instrs to calc correct address
-   // Branch instrs are pretty simple anyway
    return pc;
 }
 
@@ -3074,20 +3105,15 @@ byte*
 encode_coproc_mcr(decode_info_t* di, instr_t* instr, byte* pc)
 {
     byte word[4] = {0};  //Instr encoding in byte array
-    uint        opc;
-    byte        b, t;
-    uint        opc_bits;
-    opnd_t      opnd;
-    instr_info_t* info;
-    uint  instr_type;
-    int value; 
-
-    opc = instr_get_opcode(instr);
+    byte        b;
 
     /*
        Instruction encoded as 31-0
-       |cond|1010|imm24|
+       |cond|1110|opc1|0|CRn|Rt|coproc|opc2|1|CRm|
+       dst 0 is the coprocessor register, src 0 is Rt
      */
+    CLIENT_ASSERT(instr_num_dsts(instr) == 1 && instr_num_srcs(instr) == 1,
+                  "instr_encode error: mcr needs Rt and a coprocessor register" );
 
     /*********** Encode condition code. TODO Move to decode_info_t *********/
 
@@ -3103,20 +3129,15 @@ encode_coproc_mcr(decode_info_t* di, instr_t* instr, byte* pc)
         word[0] |= (b << 4);
     }
 
-    switch( opc )
-    {
-        //TODO MCR/MRC encoding
-        //SJF May not need this as not doing full encode prob
-    }
+    word[0] |= 0xe;
+    encode_coproc_cp15_reg(opnd_get_reg(instr_get_dst(instr, 0)),
+                           opnd_get_reg(instr_get_src(instr, 0)), word);
 
     pc = write_word_to_fcache(pc, word );
 
-   // Have a separate function for branch instrs to calc correct address
-   // Branch instrs are pretty simple anyway
    return pc;
 }
 
-
 byte*
 encode_branch_instrs(decode_info_t* di, instr_t* instr, byte* pc)
 {
@@ -3213,6 +3234,24 @@ encode_branch_instrs(decode_info_t* di, instr_t* instr, byte* pc)
               word[3] = b;
               break;
 
+            case INSTR_kind:
+              /* Emit sets each note to the instr's offset in the ilist, so
+               * the distance does not depend on where we're writing.
+               */
+              value = (ptr_int_t)opnd_get_instr(opnd)->note - di->cur_note - 8;
+              di->has_instr_opnds = true;
+
+              b = (byte)(convert_immed_to_shifted_immed( value, OPSZ_4_24, opcode_is_sign_extend( opc )) >> 16);
+              word[1] = b;
+
+              b = (byte)(convert_immed_to_shifted_immed( value, OPSZ_4_24, opcode_is_sign_extend( opc )) >> 8);
+              word[2] = b;
+
+              b = (byte)(convert_immed_to_shifted_immed( value, OPSZ_4_24, opcode_is_sign_extend( opc )) & 0xff);
+
+              word[3] = b;
+              break;
+
             default:
               CLIENT_ASSERT(false, "instr_encode error: invalid opnd type" );
               break;
@@ -3819,6 +3858,8 @@ instr_encode_common(dcontext_t *dcontext, instr_t *instr, byte *copy_pc, byte *f
     /* used for PR 253327 addr32 rip-relative and instr_t targets */
     di.start_pc = cache_pc;
     di.final_pc = final_pc;
+    /* instr_t* operand support: needed while encoding branches to meta labels */
+    di.cur_note = (ptr_int_t) instr->note;
 
     di.size_immed = OPSZ_NA;
     di.size_immed2 = OPSZ_NA;
@@ -3871,9 +3912,6 @@ instr_encode_common(dcontext_t *dcontext, instr_t *instr, byte *copy_pc, byte *f
         
     }
 
-    /* instr_t* operand support */
-    di.cur_note = (ptr_int_t) instr->note;
-    
     //SJF Should be 4
     sz = decode_sizeof(dcontext, di.start_pc, 0);
 
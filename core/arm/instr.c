@@ -201,6 +201,20 @@ opnd_get_reg(opnd_t opnd)
 }
 #define opnd_get_reg OPND_GET_REG
 
+reg_list_t
+opnd_get_reg_list(opnd_t opnd)
+{
+    CLIENT_ASSERT(OPND_IS_REGLIST(opnd), "opnd_get_reg_list called on non-reglist opnd");
+    return opnd.value.reg_list;
+}
+
+reg_id_t
+opnd_get_mem_reg(opnd_t opnd)
+{
+    CLIENT_ASSERT(OPND_IS_MEM_REG(opnd), "opnd_get_mem_reg called on non-mem-reg opnd");
+    return opnd.value.reg;
+}
+
 opnd_size_t
 opnd_get_size(opnd_t opnd)
 {
@@ -304,6 +318,28 @@ opnd_create_immed_int(ptr_int_t i, opnd_size_t size)
     return opnd;
 }
 
+bool
+opnd_encode_modified_imm(uint val, OUT uint *imm12)
+{
+    uint rot;
+    for (rot = 0; rot < 16; rot++) {
+        uint v = (rot == 0) ? val : (val << (2 * rot) | val >> (32 - 2 * rot));
+        if (v <= 0xff) {
+            *imm12 = rot << 8 | v;
+            return true;
+        }
+    }
+    return false;
+}
+
+uint
+opnd_decode_modified_imm(uint imm12)
+{
+    uint rot = 2 * ((imm12 >> 8) & 0xf);
+    uint imm8 = imm12 & 0xff;
+    return (rot == 0) ? imm8 : (imm8 >> rot | imm8 << (32 - rot));
+}
+
 /* NOTE: requires caller to be under PRESERVE_FLOATING_POINT_STATE */
 opnd_t
 opnd_create_immed_float(float i)
@@ -777,6 +813,7 @@ const reg_id_t dr_reg_fixer[]={
     REG_DEBUG1,  REG_DEBUG2,
     REG_CONTROL1,  REG_CONTROL2,
     REG_INVALID,
+    DR_REG_TPIDRURW, DR_REG_TPIDRURO, DR_REG_TPIDRPRW,
 };
 
 #ifdef DEBUG
@@ -815,6 +852,14 @@ opnd_uses_reg(opnd_t opnd, reg_id_t reg)
     case REG_kind: 
         return (dr_reg_fixer[reg] == dr_reg_fixer[opnd_get_reg(opnd)]);
 
+    case MEM_REG_kind: 
+        return (dr_reg_fixer[reg] == dr_reg_fixer[opnd_get_mem_reg(opnd)]);
+
+    case REG_LIST_kind: 
+        /* bit n of the list is Rn */
+        return (reg >= DR_REG_R0 && reg <= DR_REG_R15 &&
+                (opnd_get_reg_list(opnd) & (1 << (reg - DR_REG_R0))) != 0);
+
     case BASE_DISP_kind: 
         return (dr_reg_fixer[reg] == dr_reg_fixer[opnd_get_base(opnd)] || 
                 dr_reg_fixer[reg] == dr_reg_fixer[opnd_get_index(opnd)] ||
@@ -3532,6 +3577,43 @@ instr_has_p_flag( instr_t* instr )
 }
 
 
+/************ Functions to read back the flags set against an instr ***********/
+
+DR_API
+bool
+instr_get_p_flag( instr_t* instr )
+{
+  return instr->p_flag;
+}
+
+DR_API
+bool
+instr_get_u_flag( instr_t* instr )
+{
+  return instr->u_flag;
+}
+
+DR_API
+bool
+instr_get_w_flag( instr_t* instr )
+{
+  return instr->w_flag;
+}
+
+DR_API
+bool
+instr_get_s_flag( instr_t* instr )
+{
+  return instr->s_flag;
+}
+
+DR_API
+int
+instr_get_shift_type( instr_t* instr )
+{
+  return instr->shift_type;
+}
+
 /************ SJF: Functions to allow setting of flags against an instr type ***********/
 
 DR_API
@@ -3589,6 +3671,8 @@ instr_set_s_flag( dcontext_t* dcontext, instr_t* instr, bool val )
   }
 
   instr->s_flag = val;
+  /* the S bit is part of the encoding: don't reuse the original bits */
+  instr_being_modified(instr, false/*raw bits invalid*/);
 }
 
 DR_API
@@ -3910,17 +3994,44 @@ bool instr_same(instr_t *inst1,instr_t *inst2)
     return true;
 }
 
+/* Our IR lists a store's Rt as a dst and its address as a src, and ldm/stm
+ * list their base as a dst, so operand position says nothing about which
+ * way memory is accessed: we go by opcode instead.
+ */
+static bool
+opcode_is_load(int opc)
+{
+    return ((opc >= OP_ldc_imm && opc <= OP_ldrt) || opc == OP_pop ||
+            opc == OP_rfe || opc == OP_swp || opc == OP_swpb || opc == OP_vpop ||
+            (opc >= OP_vld1_mse && opc <= OP_vldr));
+}
+
+static bool
+opcode_is_store(int opc)
+{
+    return ((opc >= OP_stc && opc <= OP_strt) || opc == OP_push ||
+            opc == OP_srs || opc == OP_swp || opc == OP_swpb || opc == OP_vpush ||
+            (opc >= OP_vst1_mse && opc <= OP_vstr));
+}
+
+static bool
+opnd_is_memory_access(opnd_t opnd)
+{
+    return (opnd_is_memory_reference(opnd) || opnd_is_mem_reg(opnd));
+}
+
 bool instr_reads_memory(instr_t *instr)
 {
     int a;
-    opnd_t curop;
     int opc = instr_get_opcode(instr);
 
+    if (opcode_is_load(opc))
+        return true;
+    if (opcode_is_store(opc))
+        return false;
     for (a=0; a<instr_num_srcs(instr); a++) {
-        curop = instr_get_src(instr,a);
-        if (opnd_is_memory_reference(curop)) {
+        if (opnd_is_memory_access(instr_get_src(instr,a)))
             return true;
-        }
     }
     return false;
 }
@@ -3928,12 +4039,15 @@ bool instr_reads_memory(instr_t *instr)
 bool instr_writes_memory(instr_t *instr)
 {
     int a;
-    opnd_t curop;
+    int opc = instr_get_opcode(instr);
+
+    if (opcode_is_store(opc))
+        return true;
+    if (opcode_is_load(opc))
+        return false;
     for (a=0; a<instr_num_dsts(instr); a++) {
-        curop = instr_get_dst(instr,a);
-        if (opnd_is_memory_reference(curop)) {
+        if (opnd_is_memory_access(instr_get_dst(instr,a)))
             return true;
-        }
     }
     return false;
 }
@@ -6279,25 +6393,25 @@ opnd_create_sized_tls_slot(int offs, opnd_size_t size)
 bool
 instr_raw_is_tls_spill(byte *pc, reg_id_t reg, ushort offs)
 {
-    ASSERT_NOT_IMPLEMENTED(reg != REG_RR0);
-
-#ifdef NO
-    /* looking for:   67 64 89 1e e4 0e    addr16 mov    %ebx -> %fs:0xee4   */
-    /* ASSUMPTION: when addr16 prefix is used, prefix order is fixed */
-    return ((*pc == ADDR_PREFIX_OPCODE && 
-            *(pc+1) == TLS_SEG_OPCODE && 
-            *(pc+2) == MOV_REG2MEM_OPCODE &&
-            /* 0x1e for ebx, 0x0e for ecx, 0x06 for eax */
-            *(pc+3) == MODRM_BYTE(0/*mod*/, reg_get_bits(reg), 6/*rm*/) &&
-            *((ushort*)(pc+4)) == os_tls_offset(offs)) ||
-        /* PR 209709: allow for no addr16 prefix */
-        (*pc == TLS_SEG_OPCODE && 
-         *(pc+1) == MOV_REG2MEM_OPCODE &&
-         /* 0x1e for ebx, 0x0e for ecx, 0x06 for eax */
-         *(pc+2) == MODRM_BYTE(0/*mod*/, reg_get_bits(reg), 6/*rm*/) &&
-         *((uint*)(pc+4)) == os_tls_offset(offs)));
-#endif
-   return false;
+    /* looking for:   push {rB}                  (optional)
+     *                mrc p15, 0, rB, c13, c0, 2
+     *                str reg, [rB, #offs]
+     * ignoring the condition fields, which are always AL for spills
+     */
+    uint push = *(uint *)pc;
+    uint mrc, str, base;
+    if ((push & 0x0fff0000) == 0x092d0000) /* stmdb sp!, {...} */
+        pc += 4;
+    else
+        push = 0;
+    mrc = *(uint *)pc;
+    str = *(uint *)(pc + 4);
+    base = (mrc >> 12) & 0xf;
+    return ((mrc & 0x0fff0fff) == 0x0e1d0f50 &&
+            (push == 0 || (push & 0xffff) == (1U << base)) &&
+            (str & 0x0fff0000) == (0x05800000 | (base << 16)) &&
+            ((str >> 12) & 0xf) == (uint)(reg - REG_RR0) &&
+            (str & 0xfff) == os_tls_offset(offs));
 }
 
 /* this routine may upgrade a level 1 instr */
@@ -6473,6 +6587,118 @@ instr_create_restore_from_tls(dcontext_t *dcontext, reg_id_t reg, ushort offs)
                                 opnd_create_reg(REG_NULL), OPND_CREATE_IMM5(0), COND_ALWAYS );
 }
 
+/* Loads DR's TLS base, which lives in TPIDRURW, into reg */
+instr_t *
+instr_create_load_tls_base(dcontext_t *dcontext, reg_id_t reg)
+{
+    return INSTR_CREATE_mrc(dcontext, opnd_create_reg(reg),
+                            opnd_create_reg(DR_REG_TPIDRURW), COND_ALWAYS);
+}
+
+/* A freshly created ldr/str has its flags clear, which would make it
+ * post-indexed with a subtracted offset: we want [base, #+offs].
+ */
+static instr_t *
+tls_slot_addressing(dcontext_t *dcontext, instr_t *instr)
+{
+    instr_set_p_flag(dcontext, instr, true);
+    instr_set_u_flag(dcontext, instr, true);
+    instr_set_w_flag(dcontext, instr, false);
+    return instr;
+}
+
+/* str reg, [base, #slot]: base must already hold the TLS base */
+instr_t *
+instr_create_save_to_tls_base(dcontext_t *dcontext, reg_id_t reg, reg_id_t base,
+                              ushort offs)
+{
+    ASSERT(os_tls_offset(offs) <= TLS_MAX_IMM_OFFSET);
+    return tls_slot_addressing(dcontext,
+        INSTR_CREATE_str_imm(dcontext, opnd_create_reg(reg), opnd_create_mem_reg(base),
+                             OPND_CREATE_IMM12(os_tls_offset(offs)), COND_ALWAYS));
+}
+
+/* ldr reg, [base, #slot]: base must already hold the TLS base */
+instr_t *
+instr_create_restore_from_tls_base(dcontext_t *dcontext, reg_id_t reg, reg_id_t base,
+                                   ushort offs)
+{
+    ASSERT(os_tls_offset(offs) <= TLS_MAX_IMM_OFFSET);
+    return tls_slot_addressing(dcontext,
+        INSTR_CREATE_ldr_imm(dcontext, opnd_create_reg(reg), opnd_create_mem_reg(base),
+                             OPND_CREATE_IMM12(os_tls_offset(offs)), COND_ALWAYS));
+}
+
+/* Inserts instr at where relative to *rel_instr.  Successive INSERT_POST
+ * calls must chain off the previous instr to keep their order, so *rel_instr
+ * is updated for those.
+ */
+static void
+insert_tls_seq_instr(instrlist_t *ilist, instr_t *instr, int where, instr_t **rel_instr)
+{
+    switch( where )
+    {
+      case INSERT_APPEND:
+        instrlist_meta_append( ilist, instr );
+        break;
+      case INSERT_PRE:
+        instrlist_meta_preinsert( ilist, *rel_instr, instr );
+        break;
+      case INSERT_POST:
+        instrlist_meta_postinsert( ilist, *rel_instr, instr );
+        *rel_instr = instr;
+        break;
+      default:
+        CLIENT_ASSERT(false, "insert_tls_seq_instr: invalid insert position");
+    }
+}
+
+/* Restores reg from TLS slot offs with mrc + ldr, using reg itself for the base */
+void
+instr_create_restore_from_tls_seq(instrlist_t *ilist, dcontext_t *dcontext, reg_id_t reg,
+                                  ushort offs, int where, instr_t *rel_instr)
+{
+    CLIENT_ASSERT(reg >= REG_RR0 && reg <= REG_RR14,
+                  "instr_create_restore_from_tls_seq: invalid reg");
+    insert_tls_seq_instr(ilist, instr_create_load_tls_base(dcontext, reg),
+                         where, &rel_instr);
+    insert_tls_seq_instr(ilist, instr_create_restore_from_tls_base(dcontext, reg, reg, offs),
+                         where, &rel_instr);
+}
+
+/* Spills reg to TLS slot offs with mrc + str.  base must be dead at the
+ * insertion point, as it is clobbered with the TLS base.  If the caller has
+ * no dead register it can pass REG_NULL, and we save a scratch register on
+ * the stack around the sequence, as instr_create_save_to_dcontext() does.
+ */
+void
+instr_create_save_to_tls_seq(instrlist_t *ilist, dcontext_t *dcontext, reg_id_t reg,
+                             reg_id_t base, ushort offs, int where, instr_t *rel_instr)
+{
+    bool push = (base == REG_NULL);
+    CLIENT_ASSERT(reg >= REG_RR0 && reg <= REG_RR15 && reg != base,
+                  "instr_create_save_to_tls_seq: invalid reg");
+    if( push )
+    {
+        /* the push would change the value being spilled */
+        CLIENT_ASSERT(reg != REG_RR13, "instr_create_save_to_tls_seq: cannot spill sp");
+        base = (reg == REG_RR0) ? REG_RR1 : REG_RR0;
+        insert_tls_seq_instr(ilist, INSTR_CREATE_push(dcontext,
+                                        opnd_create_reg_list(1 << (base - REG_RR0)),
+                                        COND_ALWAYS), where, &rel_instr);
+    }
+    insert_tls_seq_instr(ilist, instr_create_load_tls_base(dcontext, base),
+                         where, &rel_instr);
+    insert_tls_seq_instr(ilist, instr_create_save_to_tls_base(dcontext, reg, base, offs),
+                         where, &rel_instr);
+    if( push )
+    {
+        insert_tls_seq_instr(ilist, INSTR_CREATE_pop(dcontext,
+                                        opnd_create_reg_list(1 << (base - REG_RR0)),
+                                        COND_ALWAYS), where, &rel_instr);
+    }
+}
+
 /* For -x86_to_x64, we can spill to 64-bit extra registers (xref i#751). */
 instr_t *
 instr_create_save_to_reg(dcontext_t *dcontext, reg_id_t reg1, reg_id_t reg2)
@@ -224,6 +224,9 @@ enum {
 
     DR_REG_CPSR,
 
+    /* cp15 c13 thread ID registers, accessed with mrc/mcr */
+    DR_REG_TPIDRURW,    DR_REG_TPIDRURO, DR_REG_TPIDRPRW,
+
 #ifdef NO // TODO SJF Remove the debug regs for now.
     /* Coprocessor registers from the ARM tech manual ??? Is this right. All for CP15 */
     /* TODO Maybe rearrange these to group by function instead of location */
@@ -290,8 +293,7 @@ enum {
     DR_REG_VBAR,        DR_REG_MVBAR,   DR_REG_ISR,     DR_REG_HVBAR,
 
     /* c13 registers */
-    DR_REG_FCSEIDR,     DR_REG_CONTEXTIDR,DR_REG_TPIDRURW,DR_REG_TPIDRURO,
-    DR_REG_TPIDRPRW,    DR_REG_HTPIDR,
+    DR_REG_FCSEIDR,     DR_REG_CONTEXTIDR,DR_REG_HTPIDR,
 
     /* c14/generic timer registers */
     DR_REG_CNTFRQ,      DR_REG_CNTPCT,  DR_REG_CNTKCTL, DR_REG_CNTP_TVAL,
@@ -400,8 +402,8 @@ extern const reg_id_t dr_reg_fixer[];
  * Last valid register enum value.  Note: DR_REG_INVALID is now smaller 
  * than this value.
  */
-#define DR_REG_LAST_VALID_ENUM  DR_REG_CPSR 
-#define DR_REG_LAST_ENUM        DR_REG_CPSR /**< Last value of register enums */
+#define DR_REG_LAST_VALID_ENUM  DR_REG_TPIDRPRW
+#define DR_REG_LAST_ENUM        DR_REG_TPIDRPRW /**< Last value of register enums */
 #define DR_REG_LIST_MIN         0       //0000 0000 0000 0000
 #define DR_REG_LIST_MAX         0xffff  //1111 1111 1111 1111
 /* DR_API EXPORT END */
@@ -727,6 +729,23 @@ DR_API
 opnd_t 
 opnd_create_immed_int(ptr_int_t i, opnd_size_t data_size);
 
+DR_API
+/**
+ * Returns whether \p val can be written as an A1 data-processing modified
+ * immediate (an 8-bit value rotated right by an even amount).  If so, sets
+ * \p imm12 to the rotate:imm8 field that OPND_CREATE_IMM12() expects.
+ */
+bool
+opnd_encode_modified_imm(uint val, OUT uint *imm12);
+
+DR_API
+/**
+ * Returns the value of the A1 data-processing modified immediate field
+ * \p imm12, the inverse of opnd_encode_modified_imm().
+ */
+uint
+opnd_decode_modified_imm(uint imm12);
+
 DR_API
 /** 
  * Returns an immediate float operand with value \p f.
@@ -1007,6 +1026,20 @@ DR_API
 bool 
 opnd_is_reg(opnd_t opnd);
 
+DR_API
+/** Returns true iff \p opnd is a register list operand (as used by ldm/stm/push/pop). */
+bool
+opnd_is_reglist(opnd_t opnd);
+
+DR_API
+/**
+ * Returns true iff \p opnd is a memory operand addressed by a single base
+ * register, whose offset and indexing mode are held in the containing
+ * instruction's remaining operands and flags.
+ */
+bool
+opnd_is_mem_reg(opnd_t opnd);
+
 DR_API
 INSTR_INLINE
 /** Returns true iff \p opnd is an immediate (integer or float) operand. */
@@ -1197,6 +1230,22 @@ DR_API
 reg_id_t  
 opnd_get_reg(opnd_t opnd);
 
+DR_API
+/**
+ * Assumes \p opnd is a register list operand.
+ * Returns its mask of REGLIST_ bits.
+ */
+reg_list_t
+opnd_get_reg_list(opnd_t opnd);
+
+DR_API
+/**
+ * Assumes \p opnd is a memory operand created by opnd_create_mem_reg().
+ * Returns its base register.
+ */
+reg_id_t
+opnd_get_mem_reg(opnd_t opnd);
+
 DR_API
 /** Assumes opnd is an immediate integer, returns its value. */
 ptr_int_t
@@ -2010,43 +2059,72 @@ struct _instr_t {
 
 DR_API
 bool
-instr_set_p_flag( dcontext_t* dcontext, instr_t* instr, bool val );
+instr_set_p_flag( dcontext_t *dcontext, instr_t* instr, bool val );
 
 DR_API
 bool
-instr_set_u_flag( dcontext_t* dcontext, instr_t* instr, bool val );
+instr_set_u_flag( dcontext_t *dcontext, instr_t* instr, bool val );
 
 DR_API
 bool
-instr_set_s_flag( dcontext_t* dcontext, instr_t* instr, bool val );
+instr_set_s_flag( dcontext_t *dcontext, instr_t* instr, bool val );
 
 DR_API
 bool
-instr_set_w_flag( dcontext_t* dcontext, instr_t* instr, bool val );
+instr_set_w_flag( dcontext_t *dcontext, instr_t* instr, bool val );
 
 DR_API
 bool
-instr_set_l_flag( dcontext_t* dcontext, instr_t* instr, bool val );
+instr_set_l_flag( dcontext_t *dcontext, instr_t* instr, bool val );
 
 DR_API
 bool
-instr_set_b_flag( dcontext_t* dcontext, instr_t* instr, bool val );
+instr_set_b_flag( dcontext_t *dcontext, instr_t* instr, bool val );
 
 DR_API
 bool
-instr_set_d_flag( dcontext_t* dcontext, instr_t* instr, bool val );
+instr_set_d_flag( dcontext_t *dcontext, instr_t* instr, bool val );
 
 DR_API
 bool
-instr_set_h_flag( dcontext_t* dcontext, instr_t* instr, bool val );
+instr_set_h_flag( dcontext_t *dcontext, instr_t* instr, bool val );
 
 DR_API
 bool
-instr_set_m_flag( dcontext_t* dcontext, instr_t* instr, bool val );
+instr_set_m_flag( dcontext_t *dcontext, instr_t* instr, bool val );
 
 DR_API
 bool
-instr_set_r_flag( dcontext_t* dcontext, instr_t* instr, bool val );
+instr_set_r_flag( dcontext_t *dcontext, instr_t* instr, bool val );
+
+DR_API
+bool
+instr_set_shift_type( dcontext_t *dcontext, instr_t* instr, int val );
+
+DR_API
+/** Returns whether \p instr is pre-indexed (its offset applies before the access). */
+bool
+instr_get_p_flag( instr_t* instr );
+
+DR_API
+/** Returns whether \p instr adds (rather than subtracts) its offset. */
+bool
+instr_get_u_flag( instr_t* instr );
+
+DR_API
+/** Returns whether \p instr writes its updated address back to its base register. */
+bool
+instr_get_w_flag( instr_t* instr );
+
+DR_API
+/** Returns whether \p instr updates the CPSR condition flags (its S bit). */
+bool
+instr_get_s_flag( instr_t* instr );
+
+DR_API
+/** Returns the shift type applied to \p instr's register offset or operand. */
+int
+instr_get_shift_type( instr_t* instr );
 
 DR_API
 bool
@@ -2099,7 +2177,7 @@ instrlist_append_move_32bits_to_reg(instrlist_t *ilist, dcontext_t *dcontext,
 
 
 instrlist_t*
-instrlist_rewrite_relative_to_absolute( dcontext_t* dcontext, instrlist_t* ilist );
+instrlist_rewrite_relative_to_absolute( dcontext_t *dcontext, instrlist_t* ilist );
 
 
 
@@ -3078,15 +3156,20 @@ instr_same(instr_t *instr1, instr_t *instr2);
 
 DR_API
 /**
- * Returns true iff any of \p instr's source operands is a memory reference.
- *
- * Returns false for multi-byte nops with a memory operand.
+ * Returns true iff \p instr reads memory.  Loads, pops, and swaps are
+ * recognized by opcode, as the operand lists of ARM memory instructions do
+ * not follow the read/write split; otherwise returns true iff any of
+ * \p instr's source operands is a memory reference.
  */
 bool
 instr_reads_memory(instr_t *instr);
 
 DR_API
-/** Returns true iff any of \p instr's destination operands is a memory reference. */
+/**
+ * Returns true iff \p instr writes memory.  Stores, pushes, and swaps are
+ * recognized by opcode; otherwise returns true iff any of \p instr's
+ * destination operands is a memory reference.
+ */
 bool 
 instr_writes_memory(instr_t *instr);
 
@@ -3341,6 +3424,30 @@ instr_is_cti_short_rewrite(instr_t *instr, byte *pc);
 byte *
 remangle_short_rewrite(dcontext_t *dcontext, instr_t *instr, byte *pc, app_pc target);
 
+DR_API
+/**
+ * Returns \p instr's condition code (COND_ALWAYS for an unpredicated
+ * instruction), or -1 if \p instr is NULL.
+ */
+int
+instr_get_cond(instr_t *instr);
+
+/* sets instr's condition code; invalidates its raw bits */
+void
+instr_set_cond(instr_t *instr, int cond);
+
+/* returns true if instr is encoded without a condition field */
+bool
+instr_is_unconditional(instr_t *instr);
+
+DR_API
+/**
+ * Returns the condition code that holds exactly when \p cond does not
+ * (COND_ALWAYS for COND_ALWAYS), or -1 if \p cond is invalid.
+ */
+int
+invert_cond_code(int cond);
+
 DR_API
 /**
  * Returns true iff \p instr is a conditional branch
@@ -3932,6 +4039,19 @@ instr_is_reg_spill_or_restore(dcontext_t *dcontext, instr_t *instr,
  * client use the rest. */
 instr_t * instr_create_save_to_tls(dcontext_t *dcontext, reg_id_t reg, ushort offs);
 instr_t * instr_create_restore_from_tls(dcontext_t *dcontext, reg_id_t reg, ushort offs);
+/* DR's TLS base lives in TPIDRURW: see the layout comment in arch_exports.h */
+instr_t * instr_create_load_tls_base(dcontext_t *dcontext, reg_id_t reg);
+instr_t * instr_create_save_to_tls_base(dcontext_t *dcontext, reg_id_t reg,
+                                        reg_id_t base, ushort offs);
+instr_t * instr_create_restore_from_tls_base(dcontext_t *dcontext, reg_id_t reg,
+                                             reg_id_t base, ushort offs);
+void instr_create_restore_from_tls_seq(instrlist_t *ilist, dcontext_t *dcontext,
+                                       reg_id_t reg, ushort offs, int where,
+                                       instr_t *rel_instr);
+/* base, if REG_NULL, is saved on the stack around the sequence */
+void instr_create_save_to_tls_seq(instrlist_t *ilist, dcontext_t *dcontext,
+                                  reg_id_t reg, reg_id_t base, ushort offs,
+                                  int where, instr_t *rel_instr);
 /* For -x86_to_x64, we can spill to 64-bit extra registers (xref i#751). */
 instr_t * instr_create_save_to_reg(dcontext_t *dcontext, reg_id_t reg1, reg_id_t reg2);
 instr_t * instr_create_restore_from_reg(dcontext_t *dcontext,
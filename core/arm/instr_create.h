@@ -284,8 +284,8 @@
     instr_create_1dst_2src((dc), OP_asr_imm, (d), (s), (i), (c))
 #define INSTR_CREATE_asr_reg(dc, d, s, i, c) \
     instr_create_1dst_2src((dc), OP_asr_reg, (d), (s), (i), (c))
-#define INSTR_CREATE_b(dc, s) \
-    instr_create_0dst_1src((dc), OP_b, (s))
+#define INSTR_CREATE_b(dc, s, c) \
+    instr_create_0dst_1src((dc), OP_b, (s), (c))
 #define INSTR_CREATE_bfc(dc) \
     instr_create_0dst_0src((dc), OP_bfc)
 #define INSTR_CREATE_bfi(dc) \
@@ -326,8 +326,8 @@
     instr_create_0dst_0src((dc), OP_cmn_reg)
 #define INSTR_CREATE_cmn_rsr(dc) \
     instr_create_0dst_0src((dc), OP_cmn_rsr)
-#define INSTR_CREATE_cmp_imm(dc) \
-    instr_create_0dst_0src((dc), OP_cmp_imm)
+#define INSTR_CREATE_cmp_imm(dc, d, i, c) \
+    instr_create_1dst_1src((dc), OP_cmp_imm, (d), (i), (c))
 #define INSTR_CREATE_cmp_reg(dc) \
     instr_create_0dst_0src((dc), OP_cmp_reg)
 #define INSTR_CREATE_cmp_rsr(dc) \
@@ -382,22 +382,22 @@
     instr_create_1dst_1src((dc), OP_ldr_lit, (d), (i), (c))
 #define INSTR_CREATE_ldr_reg(dc, d, s1, s2, i, c) \
     instr_create_1dst_3src((dc), OP_ldr_reg, (d), (s1), (s2), (i), (c))
-#define INSTR_CREATE_ldrb_imm(dc) \
-    instr_create_0dst_0src((dc), OP_ldrb_imm)
+#define INSTR_CREATE_ldrb_imm(dc, d, s1, s2, c) \
+    instr_create_1dst_2src((dc), OP_ldrb_imm, (d), (s1), (s2), (c))
 #define INSTR_CREATE_ldrb_lit(dc) \
     instr_create_0dst_0src((dc), OP_ldrb_lit)
 #define INSTR_CREATE_ldrb_reg(dc) \
     instr_create_0dst_0src((dc), OP_ldrb_reg)
 #define INSTR_CREATE_ldrbt(dc) \
     instr_create_0dst_0src((dc), OP_ldrbt)
-#define INSTR_CREATE_ldrd_imm(dc) \
-    instr_create_0dst_0src((dc), OP_ldrd_imm)
+#define INSTR_CREATE_ldrd_imm(dc, d, s, i, c) \
+    instr_create_1dst_2src((dc), OP_ldrd_imm, (d), (s), (i), (c))
 #define INSTR_CREATE_ldrd_lit(dc) \
     instr_create_0dst_0src((dc), OP_ldrd_lit)
 #define INSTR_CREATE_ldrd_reg(dc) \
     instr_create_0dst_0src((dc), OP_ldrd_reg)
-#define INSTR_CREATE_ldrex(dc) \
-    instr_create_0dst_0src((dc), OP_ldrex)
+#define INSTR_CREATE_ldrex(dc, d, s, c) \
+    instr_create_1dst_1src((dc), OP_ldrex, (d), (s), (c))
 #define INSTR_CREATE_ldrexb(dc) \
     instr_create_0dst_0src((dc), OP_ldrexb)
 #define INSTR_CREATE_ldrexd(dc) \
@@ -438,8 +438,9 @@
     instr_create_0dst_0src((dc), OP_lsr_imm)
 #define INSTR_CREATE_lsr_reg(dc) \
     instr_create_0dst_0src((dc), OP_lsr_reg)
-#define INSTR_CREATE_mcr(dc) \
-    instr_create_0dst_0src((dc), OP_mcr)
+/* d is the coprocessor register, e.g. DR_REG_TPIDRURW; s is Rt */
+#define INSTR_CREATE_mcr(dc, d, s, c) \
+    instr_create_1dst_1src((dc), OP_mcr, (d), (s), (c))
 #define INSTR_CREATE_mcr2(dc) \
     instr_create_0dst_0src((dc), OP_mcr2)
 #define INSTR_CREATE_mcrr(dc) \
@@ -456,8 +457,9 @@
     instr_create_1dst_1src((dc), OP_mov_reg, (d), (s), (c))
 #define INSTR_CREATE_movt(dc, d, s, c) \
     instr_create_1dst_1src((dc), OP_movt, (d), (s), (c))
-#define INSTR_CREATE_mrc(dc) \
-    instr_create_0dst_0src((dc), OP_mrc)
+/* d is Rt; s is the coprocessor register, e.g. DR_REG_TPIDRURW */
+#define INSTR_CREATE_mrc(dc, d, s, c) \
+    instr_create_1dst_1src((dc), OP_mrc, (d), (s), (c))
 #define INSTR_CREATE_mrc2(dc) \
     instr_create_0dst_0src((dc), OP_mrc2)
 #define INSTR_CREATE_mrrc(dc) \
@@ -562,8 +564,8 @@
     instr_create_0dst_0src((dc), OP_sadd8)
 #define INSTR_CREATE_sasx(dc) \
     instr_create_0dst_0src((dc), OP_sasx)
-#define INSTR_CREATE_sbc_imm(dc) \
-    instr_create_0dst_0src((dc), OP_sbc_imm)
+#define INSTR_CREATE_sbc_imm(dc, d, s, i, c) \
+    instr_create_1dst_2src((dc), OP_sbc_imm, (d), (s), (i), (c))
 #define INSTR_CREATE_sbc_reg(dc) \
     instr_create_0dst_0src((dc), OP_sbc_reg)
 #define INSTR_CREATE_sbc_rsr(dc) \
@@ -690,8 +692,8 @@
     instr_create_1dst_2src((dc), OP_strd_imm, (d), (s), (i), (c))
 #define INSTR_CREATE_strd_reg(dc, d, s, i, c) \
     instr_create_1dst_2src((dc), OP_strd_reg, d, s, i, c)
-#define INSTR_CREATE_strex(dc) \
-    instr_create_0dst_0src((dc), OP_strex)
+#define INSTR_CREATE_strex(dc, d, s1, s2, c) \
+    instr_create_1dst_2src((dc), OP_strex, (d), (s1), (s2), (c))
 #define INSTR_CREATE_strexb(dc) \
     instr_create_0dst_0src((dc), OP_strexb)
 #define INSTR_CREATE_strexd(dc) \
@@ -708,8 +710,8 @@
     instr_create_0dst_0src((dc), OP_strt)
 #define INSTR_CREATE_sub_imm(dc, d, s1, s2, c) \
     instr_create_1dst_2src((dc), OP_sub_imm, (d), (s1), (s2), (c))
-#define INSTR_CREATE_sub_reg(dc, d, s, c) \
-    instr_create_1dst_1src((dc), OP_sub_regi, (d), (s), (c))
+#define INSTR_CREATE_sub_reg(dc, d, s, i1, i2, c) \
+    instr_create_1dst_3src((dc), OP_sub_reg, (d), (s), (i1), (i2), (c))
 #define INSTR_CREATE_sub_rsr(dc, d, s, i, c) \
     instr_create_1dst_2src((dc), OP_sub_rsr, (d), (s), (i), (c))
 #define INSTR_CREATE_sub_sp_imm(dc, d, s, c) \
@@ -4370,6 +4370,8 @@ dr_insert_clean_call_ex_varg(void *drcontext, instrlist_t *ilist, instr_t *where
         ASSERT_NOT_REACHED();
 #endif /* CLIENT_INTERFACE */
     }
+    /* the callee analysis may have found that the fpstate save is unneeded */
+    save_fpstate = cci.save_fpstate;
     /* honor requests from caller */
     if (TEST(DR_CLEANCALL_NOSAVE_FLAGS, save_flags)) {
         /* even if we remove flag saves we want to keep mcontext shape */
@@ -4629,6 +4629,8 @@ recreate_fragment_ilist(dcontext_t *dcontext, byte *pc,
                     optimize_trace(dcontext, f->tag, ilist);
             }
 #endif
+            if (DYNAMO_OPTION(coalesce_trace_spills))
+                coalesce_trace_spills(dcontext, f->tag, ilist);
 
             /* FIXME: case 4718 append_trace_speculate_last_ibl(true)
              * should be called as well 
@@ -6205,6 +6207,453 @@ mangle_trace(dcontext_t *dcontext, instrlist_t *ilist, monitor_data_t *md)
 #endif
 }
 
+/****************************************************************************
+ * SCRATCH SPILL COALESCING
+ *
+ * Each mangled save to the dcontext wraps itself in push {r8,r9} ...
+ * pop {r8,r9} and rebuilds the dcontext address a byte at a time, and
+ * each client spill point reloads and respills its TLS slot, even when the
+ * next one is a few instrs away.  Once a trace is assembled we remove:
+ *   - a pop of our scratch registers followed by a push of the same ones;
+ *   - a TLS restore followed by a spill of the same register and slot;
+ *   - the rematerialization of a constant a scratch register already holds.
+ * The code between a removed pair must not look at the registers, sp or
+ * the slot, must not leave the trace, and, for app code, must not access
+ * memory, as a fault there would see our values in place of the app's.
+ * Spills are not hoisted out of self-loops: ours live on the app stack,
+ * so the loop body would see a moved sp.
+ *
+ * This must stay deterministic, as recreate_fragment_ilist() re-applies it.
+ */
+
+/* the intra-trace branch targets, which other paths can enter at */
+#define MAX_TRACE_BRANCH_TARGETS 32
+typedef struct _branch_targets_t {
+    instr_t *instr[MAX_TRACE_BRANCH_TARGETS];
+    int num;
+} branch_targets_t;
+
+/* returns false if the trace has too many branch targets to track */
+static bool
+collect_branch_targets(instrlist_t *trace, branch_targets_t *targets)
+{
+    instr_t *inst;
+    targets->num = 0;
+    for (inst = instrlist_first(trace); inst != NULL; inst = instr_get_next(inst)) {
+        if (instr_opcode_valid(inst) && instr_is_cti(inst) &&
+            opnd_is_instr(instr_get_target(inst))) {
+            if (targets->num == MAX_TRACE_BRANCH_TARGETS)
+                return false;
+            targets->instr[targets->num++] = opnd_get_instr(instr_get_target(inst));
+        }
+    }
+    return true;
+}
+
+static bool
+is_branch_target(branch_targets_t *targets, instr_t *inst)
+{
+    int i;
+    for (i = 0; i < targets->num; i++) {
+        if (targets->instr[i] == inst)
+            return true;
+    }
+    return false;
+}
+
+/* returns whether inst can sit between a removed restore/spill pair that
+ * holds the registers in list (and sp, if uses_sp) in our hands
+ */
+static bool
+can_span_scratch_pair(branch_targets_t *targets, instr_t *inst, reg_list_t list,
+                      bool uses_sp)
+{
+    int opc = instr_get_opcode(inst);
+    reg_id_t reg;
+
+    if (instr_is_label(inst) || !instr_opcode_valid(inst) || instr_is_cti(inst) ||
+        instr_is_syscall(inst) || is_branch_target(targets, inst))
+        return false;
+    for (reg = REG_RR0; reg <= REG_RR15; reg++) {
+        if (TEST(1 << (reg - REG_RR0), list) && instr_uses_reg(inst, reg))
+            return false;
+    }
+    if (uses_sp && (instr_uses_reg(inst, REG_RR13) || opc == OP_push || opc == OP_pop))
+        return false;
+    if (instr_ok_to_mangle(inst) &&
+        (instr_reads_memory(inst) || instr_writes_memory(inst) ||
+         opc == OP_push || opc == OP_pop))
+        return false;
+    return true;
+}
+
+/* returns whether inst is one of our pushes or pops of a register list */
+static bool
+is_scratch_push_pop(instr_t *inst, int opc, reg_list_t *list)
+{
+    if (instr_ok_to_mangle(inst) || instr_get_opcode(inst) != opc ||
+        instr_get_cond(inst) != COND_ALWAYS ||
+        !OPND_IS_REGLIST(instr_get_src(inst, 0)))
+        return false;
+    *list = opnd_get_reg_list(instr_get_src(inst, 0));
+    return true;
+}
+
+/* If inst starts our mrc + ldr restore of a register from its TLS slot,
+ * returns the register and slot offset.
+ */
+static bool
+is_tls_restore(instr_t *inst, reg_id_t *reg, int *offs)
+{
+    instr_t *ldr = instr_get_next(inst);
+    if (instr_ok_to_mangle(inst) || instr_get_opcode(inst) != OP_mrc ||
+        !opnd_is_reg(instr_get_src(inst, 0)) ||
+        opnd_get_reg(instr_get_src(inst, 0)) != DR_REG_TPIDRURW ||
+        ldr == NULL || instr_ok_to_mangle(ldr) || instr_get_opcode(ldr) != OP_ldr_imm ||
+        !opnd_is_reg(instr_get_dst(ldr, 0)) ||
+        !opnd_is_mem_reg(instr_get_src(ldr, 0)) ||
+        !instr_get_p_flag(ldr) || instr_get_w_flag(ldr) || !instr_get_u_flag(ldr))
+        return false;
+    *reg = opnd_get_reg(instr_get_dst(ldr, 0));
+    if (opnd_get_reg(instr_get_dst(inst, 0)) != *reg ||
+        opnd_get_mem_reg(instr_get_src(ldr, 0)) != *reg)
+        return false;
+    *offs = (int) opnd_get_immed_int(instr_get_src(ldr, 1));
+    return true;
+}
+
+/* If inst starts our [push {base}] mrc + str [pop {base}] spill of reg
+ * to slot offs, returns the last instr of the sequence.
+ */
+static instr_t *
+is_tls_spill(instr_t *inst, reg_id_t reg, int offs)
+{
+    instr_t *mrc = inst, *str, *last;
+    reg_list_t list;
+    reg_id_t base;
+    bool pushed = is_scratch_push_pop(inst, OP_push, &list);
+
+    if (pushed)
+        mrc = instr_get_next(inst);
+    if (mrc == NULL || instr_ok_to_mangle(mrc) || instr_get_opcode(mrc) != OP_mrc ||
+        !opnd_is_reg(instr_get_src(mrc, 0)) ||
+        opnd_get_reg(instr_get_src(mrc, 0)) != DR_REG_TPIDRURW)
+        return NULL;
+    base = opnd_get_reg(instr_get_dst(mrc, 0));
+    if (pushed && list != (1 << (base - REG_RR0)))
+        return NULL;
+    str = instr_get_next(mrc);
+    if (str == NULL || instr_ok_to_mangle(str) || instr_get_opcode(str) != OP_str_imm ||
+        !opnd_is_reg(instr_get_dst(str, 0)) || opnd_get_reg(instr_get_dst(str, 0)) != reg ||
+        !opnd_is_mem_reg(instr_get_src(str, 0)) ||
+        opnd_get_mem_reg(instr_get_src(str, 0)) != base ||
+        !instr_get_p_flag(str) || instr_get_w_flag(str) || !instr_get_u_flag(str) ||
+        (int) opnd_get_immed_int(instr_get_src(str, 1)) != offs)
+        return NULL;
+    last = str;
+    if (pushed) {
+        last = instr_get_next(str);
+        if (last == NULL || !is_scratch_push_pop(last, OP_pop, &list) ||
+            list != (1 << (base - REG_RR0)))
+            return NULL;
+    }
+    return last;
+}
+
+/* returns whether inst might write TLS slot offs: any store of ours
+ * through a TLS base we can't rule out
+ */
+static bool
+may_write_tls_slot(instr_t *inst, int offs)
+{
+    int opc = instr_get_opcode(inst);
+    if (instr_ok_to_mangle(inst) || (opc != OP_str_imm && opc != OP_str_reg &&
+                                     opc != OP_strd_imm && opc != OP_stm &&
+                                     opc != OP_stmia && opc != OP_stmdb))
+        return false;
+    return !(opc == OP_str_imm && (int) opnd_get_immed_int(instr_get_src(inst, 1)) != offs);
+}
+
+static void
+remove_instr_range(dcontext_t *dcontext, instrlist_t *ilist, instr_t *first,
+                   instr_t *last)
+{
+    instr_t *inst, *next;
+    for (inst = first; ; inst = next) {
+        next = instr_get_next(inst);
+        instrlist_remove(ilist, inst);
+        instr_destroy(dcontext, inst);
+        if (inst == last)
+            break;
+    }
+}
+
+/* removes pop {L} ... push {L} pairs of ours */
+static int
+coalesce_push_pop_pairs(dcontext_t *dcontext, instrlist_t *trace,
+                        branch_targets_t *targets)
+{
+    instr_t *inst, *next, *in;
+    reg_list_t list, list2;
+    int removed = 0;
+
+    for (inst = instrlist_first(trace); inst != NULL; inst = next) {
+        next = instr_get_next(inst);
+        if (!is_scratch_push_pop(inst, OP_pop, &list) || is_branch_target(targets, inst))
+            continue;
+        for (in = next; in != NULL; in = instr_get_next(in)) {
+            if (is_scratch_push_pop(in, OP_push, &list2) && list2 == list &&
+                !is_branch_target(targets, in))
+                break;
+            if (!can_span_scratch_pair(targets, in, list, true)) {
+                in = NULL;
+                break;
+            }
+        }
+        if (in == NULL)
+            continue;
+        DOLOG(3, LOG_INTERP, {
+            loginst(dcontext, 3, inst, "coalescing scratch spill: removing");
+            loginst(dcontext, 3, in, "\tand");
+        });
+        if (next == in)
+            next = instr_get_next(in);
+        remove_instr_range(dcontext, trace, inst, inst);
+        remove_instr_range(dcontext, trace, in, in);
+        removed += 2;
+    }
+    return removed;
+}
+
+/* removes TLS restores whose register goes straight back into its slot */
+static int
+coalesce_tls_pairs(dcontext_t *dcontext, instrlist_t *trace, branch_targets_t *targets)
+{
+    instr_t *inst, *next, *in, *last, *spill;
+    reg_id_t reg;
+    int offs, removed = 0;
+
+    for (inst = instrlist_first(trace); inst != NULL; inst = next) {
+        next = instr_get_next(inst);
+        if (!is_tls_restore(inst, &reg, &offs) || is_branch_target(targets, inst) ||
+            is_branch_target(targets, next))
+            continue;
+        /* next is the restore's ldr */
+        last = NULL;
+        for (in = instr_get_next(next); in != NULL; in = instr_get_next(in)) {
+            last = is_tls_spill(in, reg, offs);
+            if (last != NULL) {
+                for (spill = in; spill != last && !is_branch_target(targets, spill);
+                     spill = instr_get_next(spill))
+                    ; /* nothing */
+                if (is_branch_target(targets, spill))
+                    last = NULL;
+                break;
+            }
+            if (!can_span_scratch_pair(targets, in, 1 << (reg - REG_RR0), false) ||
+                may_write_tls_slot(in, offs))
+                break;
+        }
+        if (last == NULL)
+            continue;
+        DOLOG(3, LOG_INTERP, {
+            loginst(dcontext, 3, next, "coalescing tls spill: removing");
+            loginst(dcontext, 3, last, "\tand");
+        });
+        next = instr_get_next(next);
+        if (next == in)
+            next = instr_get_next(last);
+        remove_instr_range(dcontext, trace, inst, instr_get_next(inst));
+        removed += 2;
+        for (spill = in; ; spill = instr_get_next(spill)) {
+            removed++;
+            if (spill == last)
+                break;
+        }
+        remove_instr_range(dcontext, trace, in, last);
+    }
+    return removed;
+}
+
+/* returns the value of a data-processing I12 operand, a rotated
+ * modified immediate
+ */
+static uint
+expand_imm12(opnd_t opnd)
+{
+    return opnd_decode_modified_imm((uint) opnd_get_immed_int(opnd));
+}
+
+/* If inst is one of our unconditional mov_imm or orr_reg instrs whose
+ * inputs we know, applies it to known/val and returns its dst.
+ */
+static reg_id_t
+eval_const_instr(instr_t *inst, bool *known, uint *val)
+{
+    int opc = instr_get_opcode(inst);
+    reg_id_t dst, src1, src2;
+    uint amt, v;
+
+    if (instr_ok_to_mangle(inst) || instr_get_cond(inst) != COND_ALWAYS ||
+        instr_get_s_flag(inst) || (opc != OP_mov_imm && opc != OP_orr_reg) ||
+        !opnd_is_reg(instr_get_dst(inst, 0)))
+        return REG_NULL;
+    dst = opnd_get_reg(instr_get_dst(inst, 0));
+    if (dst < REG_RR0 || dst > REG_RR12)
+        return REG_NULL;
+    if (opc == OP_mov_imm) {
+        if (!opnd_is_immed_int(instr_get_src(inst, 0)))
+            return REG_NULL;
+        v = expand_imm12(instr_get_src(inst, 0));
+    } else {
+        if (!opnd_is_reg(instr_get_src(inst, 0)) || !opnd_is_reg(instr_get_src(inst, 1)) ||
+            !opnd_is_immed_int(instr_get_src(inst, 2)))
+            return REG_NULL;
+        src1 = opnd_get_reg(instr_get_src(inst, 0));
+        src2 = opnd_get_reg(instr_get_src(inst, 1));
+        if (src1 < REG_RR0 || src1 > REG_RR12 || src2 < REG_RR0 || src2 > REG_RR12 ||
+            !known[src1 - REG_RR0] || !known[src2 - REG_RR0])
+            return REG_NULL;
+        v = val[src2 - REG_RR0];
+        amt = (uint) opnd_get_immed_int(instr_get_src(inst, 2));
+        if (amt != 0) {
+            switch (instr_get_shift_type(inst)) {
+            case LOGICAL_LEFT:  v <<= amt; break;
+            case LOGICAL_RIGHT: v >>= amt; break;
+            case ARITH_RIGHT:   v = (uint) ((int) v >> amt); break;
+            case ROTATE_RIGHT:  v = v >> amt | v << (32 - amt); break;
+            default: return REG_NULL;
+            }
+        } else if (instr_get_shift_type(inst) != LOGICAL_LEFT) {
+            /* lsr/asr #32 and rrx */
+            return REG_NULL;
+        }
+        v |= val[src1 - REG_RR0];
+    }
+    known[dst - REG_RR0] = true;
+    val[dst - REG_RR0] = v;
+    return dst;
+}
+
+static void
+forget_const_reg(bool *known, reg_id_t reg)
+{
+    if (reg >= REG_RR0 && reg <= REG_RR12)
+        known[reg - REG_RR0] = false;
+}
+
+/* removes runs of our mov_imm/orr_reg that rebuild constants the
+ * registers they write already hold
+ */
+static int
+remove_redundant_constants(dcontext_t *dcontext, instrlist_t *trace,
+                           branch_targets_t *targets)
+{
+    bool known[16], run_known[16];
+    uint val[16], run_val[16];
+    reg_list_t written;
+    instr_t *inst, *next, *end, *last;
+    reg_id_t reg;
+    int i, len, removed = 0;
+
+    memset(known, 0, sizeof(known));
+    for (inst = instrlist_first(trace); inst != NULL; inst = next) {
+        next = instr_get_next(inst);
+        if (inst == instrlist_first(trace) || instr_is_label(inst) ||
+            !instr_opcode_valid(inst) || instr_is_syscall(inst) ||
+            is_branch_target(targets, inst)) {
+            /* a join point, or something we can't see into */
+            memset(known, 0, sizeof(known));
+            if (instr_is_label(inst) || !instr_opcode_valid(inst) || instr_is_syscall(inst))
+                continue;
+        }
+        memcpy(run_known, known, sizeof(known));
+        memcpy(run_val, val, sizeof(val));
+        written = 0;
+        len = 0;
+        last = NULL;
+        for (end = inst; end != NULL; end = instr_get_next(end)) {
+            if (end != inst && is_branch_target(targets, end))
+                break;
+            reg = eval_const_instr(end, run_known, run_val);
+            if (reg == REG_NULL)
+                break;
+            written |= 1 << (reg - REG_RR0);
+            last = end;
+            len++;
+        }
+        if (len > 0) {
+            for (i = 0; i < 16; i++) {
+                if (TEST(1 << i, written) && (!known[i] || val[i] != run_val[i]))
+                    break;
+            }
+            if (i == 16) {
+                DOLOG(3, LOG_INTERP, {
+                    loginst(dcontext, 3, inst, "removing rebuilt constant starting at");
+                });
+                remove_instr_range(dcontext, trace, inst, last);
+                removed += len;
+            }
+            memcpy(known, run_known, sizeof(known));
+            memcpy(val, run_val, sizeof(val));
+            next = end;
+            continue;
+        }
+        /* anything else that writes a register makes it unknown */
+        for (reg = REG_RR0; reg <= REG_RR12; reg++) {
+            if (instr_writes_to_reg(inst, reg))
+                known[reg - REG_RR0] = false;
+        }
+        /* our IR lists a writeback base as a source */
+        if (instr_get_w_flag(inst) || !instr_get_p_flag(inst)) {
+            for (i = 0; i < instr_num_srcs(inst); i++) {
+                if (opnd_is_mem_reg(instr_get_src(inst, i)))
+                    forget_const_reg(known, opnd_get_mem_reg(instr_get_src(inst, i)));
+            }
+            for (i = 0; i < instr_num_dsts(inst); i++) {
+                if (opnd_is_mem_reg(instr_get_dst(inst, i)))
+                    forget_const_reg(known, opnd_get_mem_reg(instr_get_dst(inst, i)));
+            }
+        }
+        if ((instr_get_opcode(inst) == OP_pop ||
+             (instr_get_opcode(inst) >= OP_ldm && instr_get_opcode(inst) <= OP_ldmed)) &&
+            OPND_IS_REGLIST(instr_get_src(inst, 0))) {
+            for (i = 0; i < 13; i++) {
+                if (TEST(1 << i, opnd_get_reg_list(instr_get_src(inst, 0))))
+                    known[i] = false;
+            }
+        }
+        /* mrs lists its destination as its only source, and an instr we
+         * decode without operands (mrc, mrrc, ...) may write anything
+         */
+        if (instr_get_opcode(inst) == OP_mrs && instr_num_srcs(inst) > 0 &&
+            opnd_is_reg(instr_get_src(inst, 0)))
+            forget_const_reg(known, opnd_get_reg(instr_get_src(inst, 0)));
+        else if (instr_num_dsts(inst) == 0 && instr_num_srcs(inst) == 0)
+            memset(known, 0, sizeof(known));
+    }
+    return removed;
+}
+
+/* Removes redundant scratch spills, restores and constants from a
+ * finished trace, returning the number of instrs removed.
+ */
+int
+coalesce_trace_spills(dcontext_t *dcontext, app_pc tag, instrlist_t *trace)
+{
+    branch_targets_t targets;
+    int removed;
+
+    if (!collect_branch_targets(trace, &targets))
+        return 0;
+    removed = coalesce_push_pop_pairs(dcontext, trace, &targets);
+    removed += coalesce_tls_pairs(dcontext, trace, &targets);
+    removed += remove_redundant_constants(dcontext, trace, &targets);
+    LOG(THREAD, LOG_INTERP, 3, "coalesce_trace_spills: removed %d instrs from "PFX"\n",
+        removed, tag);
+    return removed;
+}
+
 /****************************************************************************
  * UTILITIES
  */
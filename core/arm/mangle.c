@@ -108,13 +108,11 @@ typedef struct _callee_info_t {
     app_pc start;             /* entry point of a function  */
     app_pc bwd_tgt;           /* earliest backward branch target */
     app_pc fwd_tgt;           /* last forward branch target */
-    int num_xmms_used;        /* number of xmms used by callee */
-    bool qr_used[NUM_QR_REGS];  /* xmm/ymm registers usage */
+    bool vfp_used;            /* touches any VFP/NEON register or FPSCR */
     bool reg_used[NUM_GP_REGS];   /* general purpose registers usage */
     int num_callee_save_regs; /* number of regs callee saved */
     bool callee_save_regs[NUM_GP_REGS]; /* callee-save registers */
     bool has_locals;          /* if reference local via stack */
-    bool xbp_is_fp;           /* if xbp is used as frame pointer */
     bool opt_inline;          /* can be inlined or not */
     bool write_aflags;        /* if the function changes aflags */
     bool read_aflags;         /* if the function reads aflags from caller */
@@ -145,6 +143,7 @@ callee_info_init(callee_info_t *ci)
     ci->write_aflags = true;
     ci->read_aflags  = true;
     ci->tls_used   = true;
+    ci->vfp_used   = true;
     /* We use loop here and memset in analyze_callee_regs_usage later.
      * We could reverse the logic and use memset to set the value below,
      * but then later in analyze_callee_regs_usage, we have to use the loop.
@@ -196,8 +195,11 @@ callee_info_reserve_slot(callee_info_t *ci, slot_kind_t kind, byte value)
     ci->slots_used++;
 }
 
-static opnd_t
-callee_info_slot_opnd(callee_info_t *ci, slot_kind_t kind, byte value)
+/* Returns the offset of the scratch slot reserved for kind and value from
+ * the unprotected_context_t that spill_reg points at.
+ */
+static int
+callee_info_slot_disp(callee_info_t *ci, slot_kind_t kind, byte value)
 {
     uint i;
     if (kind == SLOT_REG)
@@ -205,15 +207,12 @@ callee_info_slot_opnd(callee_info_t *ci, slot_kind_t kind, byte value)
     for (i = 0; i < BUFFER_SIZE_ELEMENTS(ci->scratch_slots); i++) {
         if (ci->scratch_slots[i].kind  == kind &&
             ci->scratch_slots[i].value == value) {
-            int disp = (int)offsetof(unprotected_context_t,
-                                     inline_spill_slots[i]);
-            return opnd_create_base_disp(ci->spill_reg, DR_REG_NULL, 0, disp,
-                                         OPSZ_PTR);
+            return (int)offsetof(unprotected_context_t, inline_spill_slots[i]);
         }
     }
     ASSERT_MESSAGE(CHKLVL_ASSERTS, "Tried to find scratch slot for value "
                    "without calling callee_info_reserve_slot for it", false);
-    return opnd_create_null();
+    return 0;
 }
 
 static void
@@ -453,124 +452,188 @@ convert_to_near_rel(dcontext_t *dcontext, instr_t *instr)
 /***************************************************************************/
 #if !defined(STANDALONE_DECODER)
 
-/* Pushes not only the GPRs but also xmm/ymm, xip, and xflags, in
- * priv_mcontext_t order.
- * The current stack pointer alignment should be passed.  Use 1 if
- * unknown (NOT 0).
- * Returns the amount of data pushed.  Does NOT fix up the xsp value pushed
- * to be the value prior to any pushes for x64 as no caller needs that
- * currently (they all build a priv_mcontext_t and have to do further xsp
- * fixups anyway).
- * Includes xmm0-5 for PR 264138.
- * If stack_align16 is true, assumes the stack pointer is currently aligned
- * on a 16-byte boundary.
+/* Raw A1 encodings of movw and movt, which have no create macros */
+#define MOVW(cond, rd, imm16) \
+    ((cond) << 28 | 0x03000000 | ((imm16) >> 12) << 16 | (rd) << 12 | ((imm16) & 0xfff))
+#define MOVT(cond, rd, imm16) \
+    ((cond) << 28 | 0x03400000 | ((imm16) >> 12) << 16 | (rd) << 12 | ((imm16) & 0xfff))
+#define HW_REG(reg) ((reg) - DR_REG_R0)
+
+/* Bytes of priv_mcontext_t from the padding on: the Q register slots */
+#define QR_AREA_SIZE (sizeof(priv_mcontext_t) - offsetof(priv_mcontext_t, padding))
+
+static instr_t *
+create_raw_word(dcontext_t *dcontext, uint word)
+{
+    return instr_create_raw_4bytes(dcontext, (byte) word, (byte) (word >> 8),
+                                   (byte) (word >> 16), (byte) (word >> 24));
+}
+
+/* Inserts instrs setting reg to val before where.  Leaves the flags alone. */
+static void
+insert_mov_imm32(dcontext_t *dcontext, instrlist_t *ilist, instr_t *where,
+                 reg_id_t reg, uint val)
+{
+    uint imm12;
+    if (opnd_encode_modified_imm(val, &imm12)) {
+        PRE(ilist, where, INSTR_CREATE_mov_imm(dcontext, opnd_create_reg(reg),
+                                               OPND_CREATE_IMM12(imm12), COND_ALWAYS));
+        return;
+    }
+    PRE(ilist, where, create_raw_word(dcontext, MOVW(COND_ALWAYS, HW_REG(reg),
+                                                     val & 0xffff)));
+    if ((val >> 16) != 0) {
+        PRE(ilist, where, create_raw_word(dcontext, MOVT(COND_ALWAYS, HW_REG(reg),
+                                                         val >> 16)));
+    }
+}
+
+/* Inserts instrs setting dst to src + delta before where, splitting delta
+ * into as many modified immediates as it takes.  Leaves the flags alone.
+ */
+static void
+insert_add_imm32(dcontext_t *dcontext, instrlist_t *ilist, instr_t *where,
+                 reg_id_t dst, reg_id_t src, int delta)
+{
+    uint left = (delta < 0) ? -delta : delta;
+    if (left == 0 && dst != src) {
+        PRE(ilist, where, INSTR_CREATE_mov_reg(dcontext, opnd_create_reg(dst),
+                                               opnd_create_reg(src), COND_ALWAYS));
+    }
+    while (left != 0) {
+        uint shift = 0, chunk, imm12;
+        while (!TESTANY(3u << shift, left))
+            shift += 2;
+        chunk = left & (0xffu << shift);
+        if (!opnd_encode_modified_imm(chunk, &imm12))
+            ASSERT_NOT_REACHED();
+        if (delta < 0) {
+            PRE(ilist, where, INSTR_CREATE_sub_imm(dcontext, opnd_create_reg(dst),
+                                                   opnd_create_reg(src),
+                                                   OPND_CREATE_IMM12(imm12),
+                                                   COND_ALWAYS));
+        } else {
+            PRE(ilist, where, INSTR_CREATE_add_imm(dcontext, opnd_create_reg(dst),
+                                                   opnd_create_reg(src),
+                                                   OPND_CREATE_IMM12(imm12),
+                                                   COND_ALWAYS));
+        }
+        src = dst;
+        left -= chunk;
+    }
+}
+
+/* ldr/str reg, [base, #offs] with offset addressing and no writeback */
+static instr_t *
+create_ldst_imm(dcontext_t *dcontext, bool store, reg_id_t reg, reg_id_t base,
+                int offs)
+{
+    instr_t *in;
+    uint abs_offs = (offs < 0) ? -offs : offs;
+    ASSERT(abs_offs < 4096);
+    if (store) {
+        in = INSTR_CREATE_str_imm(dcontext, opnd_create_reg(reg), opnd_create_mem_reg(base),
+                                  OPND_CREATE_IMM12(abs_offs), COND_ALWAYS);
+    } else {
+        in = INSTR_CREATE_ldr_imm(dcontext, opnd_create_reg(reg), opnd_create_mem_reg(base),
+                                  OPND_CREATE_IMM12(abs_offs), COND_ALWAYS);
+    }
+    instr_set_p_flag(dcontext, in, true);
+    instr_set_u_flag(dcontext, in, offs >= 0);
+    instr_set_w_flag(dcontext, in, false);
+    return in;
+}
+
+/* Returns how many bytes insert_push_all_registers() pushes for cci. */
+static uint
+push_all_registers_size(clean_call_info_t *cci)
+{
+    uint size = (NUM_GP_REGS - cci->num_regs_skip) * R13_SZ;
+    if (cci->preserve_mcontext || cci->num_qr_skip != NUM_QR_REGS) {
+        size += QR_AREA_SIZE;
+        if (cci->preserve_mcontext && cci->skip_save_aflags)
+            size += 2*R13_SZ; /* pc and cpsr */
+    }
+    if (!cci->skip_save_aflags)
+        size += 2*R13_SZ;
+    return size;
+}
+
+/* Pushes the GPRs, cpsr, and a pc slot in priv_mcontext_t order.  The Q
+ * registers are saved with the fpstate, if at all (see
+ * analyze_callee_vfp_usage()), so their slots are only reserved, to keep
+ * the priv_mcontext_t shape.
+ * Registers marked in cci->reg_skip get no slot.  We do NOT store the app
+ * sp in its slot: see prepare_for_clean_call().  Saving the cpsr clobbers
+ * r0, after its app value has been pushed.
+ * push_pc, if non-NULL, must push one word, for the pc slot.
+ * The alignment is ignored: we use no instrs that care.
+ * Returns the amount of data pushed.
  */
 uint
 insert_push_all_registers(dcontext_t *dcontext, clean_call_info_t *cci, 
                           instrlist_t *ilist, instr_t *instr,
                           uint alignment, instr_t *push_pc)
 {
-#ifdef NO
-//TODO SJF Push all ARM gprs
     uint dstack_offs = 0;
-    int  offs_beyond_xmm = 0;
+    uint gpr_offs = 0;
+    uint list = 0;
+    int i;
     if (cci == NULL)
         cci = &default_clean_call_info;
-    if (cci->preserve_mcontext || cci->num_xmms_skip != NUM_XMM_REGS) {
-        int offs = XMM_SLOTS_SIZE + PRE_XMM_PADDING;
-        if (cci->preserve_mcontext && cci->skip_save_aflags) {
-            offs_beyond_xmm = 2*XSP_SZ; /* pc and flags */
-            offs += offs_beyond_xmm;
-        }
-        PRE(ilist, instr, INSTR_CREATE_lea
-            (dcontext, opnd_create_reg(REG_RR13),
-             OPND_CREATE_MEM_lea(REG_RR13, REG_NULL, 0, -offs)));
+    if (cci->preserve_mcontext || cci->num_qr_skip != NUM_QR_REGS) {
+        int offs = QR_AREA_SIZE;
+        if (cci->preserve_mcontext && cci->skip_save_aflags)
+            offs += 2*R13_SZ; /* pc and cpsr */
+        insert_add_imm32(dcontext, ilist, instr, DR_REG_R13, DR_REG_R13, -offs);
         dstack_offs += offs;
     }
-    if (preserve_xmm_caller_saved()) {
-        /* PR 264138: we must preserve xmm0-5 if on a 64-bit kernel */
-        int i;
-        /* PR 266305: see discussion in emit_fcache_enter_shared on
-         * which opcode is better.  Note that the AMD optimization
-         * guide says to use movlps+movhps for unaligned stores, but
-         * for simplicity and smaller code I'm using movups anyway.
-         */
-        /* FIXME i#438: once have SandyBridge processor need to measure
-         * cost of vmovdqu and whether worth arranging 32-byte alignment
-         * for all callers.  B/c we put ymm at end of priv_mcontext_t, we do
-         * currently have 32-byte alignment for clean calls.
-         */
-        uint opcode = move_mm_reg_opcode(ALIGNED(alignment, 32), ALIGNED(alignment, 16));
-        ASSERT(proc_has_feature(FEATURE_SSE));
-        for (i=0; i<NUM_XMM_SAVED; i++) {
-            if (!cci->xmm_skip[i]) {
-                PRE(ilist, instr, instr_create_1dst_1src
-                    (dcontext, opcode,
-                     opnd_create_base_disp(REG_RR13, REG_NULL, 0,
-                                           PRE_XMM_PADDING + i*XMM_SAVED_REG_SIZE +
-                                           offs_beyond_xmm,
-                                           OPSZ_SAVED_XMM),
-                     opnd_create_reg(REG_SAVED_XMM0 + (reg_id_t)i)));
-            }
-        }
-        ASSERT(i*XMM_SAVED_REG_SIZE == XMM_SAVED_SIZE);
-        ASSERT(XMM_SAVED_SIZE <= XMM_SLOTS_SIZE);
-    }
-    /* pc and aflags */
+    /* pc and cpsr: the cpsr slot is filled in once r0 is saved */
     if (!cci->skip_save_aflags) {
-        ASSERT(offs_beyond_xmm == 0);
-        PRE(ilist, instr, push_pc);
-        dstack_offs += XSP_SZ;
-        PRE(ilist, instr, INSTR_CREATE_pushf(dcontext));
-        dstack_offs += XSP_SZ;
-    } else {
-        ASSERT(offs_beyond_xmm == 2*XSP_SZ || !cci->preserve_mcontext);
-        /* for cci->preserve_mcontext we added to the lea above */
+        if (push_pc != NULL) {
+            PRE(ilist, instr, push_pc);
+            insert_add_imm32(dcontext, ilist, instr, DR_REG_R13, DR_REG_R13,
+                             -(int)R13_SZ);
+        } else {
+            insert_add_imm32(dcontext, ilist, instr, DR_REG_R13, DR_REG_R13,
+                             -2*(int)R13_SZ);
+        }
+        dstack_offs += 2*R13_SZ;
+    } else if (push_pc != NULL) {
+        /* for cci->preserve_mcontext we reserved the slot above */
         instr_destroy(dcontext, push_pc);
     }
 
-#ifdef X64
-    /* keep priv_mcontext_t order */
-    if (!cci->reg_skip[REG_RR15 - REG_RR0])
-        PRE(ilist, instr, INSTR_CREATE_push(dcontext, opnd_create_reg(REG_RR15)));
-    if (!cci->reg_skip[REG_RR14 - REG_RR0])
-        PRE(ilist, instr, INSTR_CREATE_push(dcontext, opnd_create_reg(REG_RR14)));
-    if (!cci->reg_skip[REG_RR13 - REG_RR0])
-        PRE(ilist, instr, INSTR_CREATE_push(dcontext, opnd_create_reg(REG_RR13)));
-    if (!cci->reg_skip[REG_RR12 - REG_RR0])
-        PRE(ilist, instr, INSTR_CREATE_push(dcontext, opnd_create_reg(REG_RR12)));
-    if (!cci->reg_skip[REG_RR11 - REG_RR0])
-        PRE(ilist, instr, INSTR_CREATE_push(dcontext, opnd_create_reg(REG_RR11)));
-    if (!cci->reg_skip[REG_RR10 - REG_RR0])
-        PRE(ilist, instr, INSTR_CREATE_push(dcontext, opnd_create_reg(REG_RR10)));
-    if (!cci->reg_skip[REG_RR9 - REG_RR0])
-        PRE(ilist, instr, INSTR_CREATE_push(dcontext, opnd_create_reg(REG_RR9)));
-    if (!cci->reg_skip[REG_RR8 - REG_RR0])
-        PRE(ilist, instr, INSTR_CREATE_push(dcontext, opnd_create_reg(REG_RR8)));
-    if (!cci->reg_skip[REG_RRAX - REG_RR0])
-        PRE(ilist, instr, INSTR_CREATE_push(dcontext, opnd_create_reg(REG_RRAX)));
-    if (!cci->reg_skip[REG_RRCX - REG_RR0])
-        PRE(ilist, instr, INSTR_CREATE_push(dcontext, opnd_create_reg(REG_RRCX)));
-    if (!cci->reg_skip[REG_RRDX - REG_RR0])
-        PRE(ilist, instr, INSTR_CREATE_push(dcontext, opnd_create_reg(REG_RRDX)));
-    if (!cci->reg_skip[REG_RRBX - REG_RR0])
-        PRE(ilist, instr, INSTR_CREATE_push(dcontext, opnd_create_reg(REG_RRBX)));
-    /* we do NOT match pusha xsp value */
-    if (!cci->reg_skip[REG_RRSP - REG_RR0])
-        PRE(ilist, instr, INSTR_CREATE_push(dcontext, opnd_create_reg(REG_RRSP)));
-    if (!cci->reg_skip[REG_RRBP - REG_RR0])
-        PRE(ilist, instr, INSTR_CREATE_push(dcontext, opnd_create_reg(REG_RRBP)));
-    if (!cci->reg_skip[REG_RRSI - REG_RR0])
-        PRE(ilist, instr, INSTR_CREATE_push(dcontext, opnd_create_reg(REG_RRSI)));
-    if (!cci->reg_skip[REG_RRDI - REG_RR0])
-        PRE(ilist, instr, INSTR_CREATE_push(dcontext, opnd_create_reg(REG_RRDI)));
-    dstack_offs += (NUM_GP_REGS - cci->num_regs_skip) * XSP_SZ;
-#else
-    PRE(ilist, instr, INSTR_CREATE_pusha(dcontext));
-    dstack_offs += 8 * XSP_SZ;
-#endif
+    if (!cci->reg_skip[DR_REG_R14 - DR_REG_R0]) {
+        PRE(ilist, instr, INSTR_CREATE_push(dcontext, opnd_create_reg_list(REGLIST_R14),
+                                            COND_ALWAYS));
+        gpr_offs += R13_SZ;
+    }
+    if (!cci->reg_skip[DR_REG_R13 - DR_REG_R0]) {
+        insert_add_imm32(dcontext, ilist, instr, DR_REG_R13, DR_REG_R13,
+                         -(int)R13_SZ);
+        gpr_offs += R13_SZ;
+    }
+    for (i = 0; i <= DR_REG_R12 - DR_REG_R0; i++) {
+        if (!cci->reg_skip[i]) {
+            list |= 1 << i;
+            gpr_offs += R13_SZ;
+        }
+    }
+    if (list != 0) {
+        PRE(ilist, instr, INSTR_CREATE_push(dcontext, opnd_create_reg_list(list),
+                                            COND_ALWAYS));
+    }
+    dstack_offs += gpr_offs;
+
+    if (!cci->skip_save_aflags) {
+        ASSERT(!cci->reg_skip[0]);
+        PRE(ilist, instr, INSTR_CREATE_mrs_cpsr(dcontext, DR_REG_R0));
+        PRE(ilist, instr, create_ldst_imm(dcontext, true, DR_REG_R0, DR_REG_R13,
+                                          gpr_offs));
+    }
+    ASSERT(dstack_offs == push_all_registers_size(cci));
     return dstack_offs;
-#endif //NO
 }
 
 /* User should pass the alignment from insert_push_all_registers: i.e., the
@@ -582,306 +645,252 @@ insert_pop_all_registers(dcontext_t *dcontext, clean_call_info_t *cci,
                          instrlist_t *ilist, instr_t *instr,
                          uint alignment)
 {
-#ifdef NO
-//TODO SJF
-    int offs_beyond_xmm = 0;
+    uint gpr_offs = 0;
+    uint list = 0;
+    int offs = 0;
+    int i;
     if (cci == NULL)
         cci = &default_clean_call_info;
 
-#ifdef X64
-    /* in priv_mcontext_t order */
-    if (!cci->reg_skip[REG_RRDI - REG_RR0])
-        PRE(ilist, instr, INSTR_CREATE_pop(dcontext, opnd_create_reg(REG_RRDI)));
-    if (!cci->reg_skip[REG_RRSI - REG_RR0])
-        PRE(ilist, instr, INSTR_CREATE_pop(dcontext, opnd_create_reg(REG_RRSI)));
-    if (!cci->reg_skip[REG_RRBP - REG_RR0])
-        PRE(ilist, instr, INSTR_CREATE_pop(dcontext, opnd_create_reg(REG_RRBP)));
-    /* skip xsp by popping into dead rbx */
-    if (!cci->reg_skip[REG_RRSP - REG_RR0]) {
-        ASSERT(!cci->reg_skip[REG_RRBX - REG_RR0]);
-        PRE(ilist, instr, INSTR_CREATE_pop(dcontext, opnd_create_reg(REG_RRBX)));
-    }
-    if (!cci->reg_skip[REG_RRBX - REG_RR0])
-        PRE(ilist, instr, INSTR_CREATE_pop(dcontext, opnd_create_reg(REG_RRBX)));
-    if (!cci->reg_skip[REG_RRDX - REG_RR0])
-        PRE(ilist, instr, INSTR_CREATE_pop(dcontext, opnd_create_reg(REG_RRDX)));
-    if (!cci->reg_skip[REG_RRCX - REG_RR0])
-        PRE(ilist, instr, INSTR_CREATE_pop(dcontext, opnd_create_reg(REG_RRCX)));
-    if (!cci->reg_skip[REG_RRAX - REG_RR0])
-        PRE(ilist, instr, INSTR_CREATE_pop(dcontext, opnd_create_reg(REG_RRAX)));
-    if (!cci->reg_skip[REG_RR8 - REG_RR0])
-        PRE(ilist, instr, INSTR_CREATE_pop(dcontext, opnd_create_reg(REG_RR8)));
-    if (!cci->reg_skip[REG_RR9 - REG_RR0])
-        PRE(ilist, instr, INSTR_CREATE_pop(dcontext, opnd_create_reg(REG_RR9)));
-    if (!cci->reg_skip[REG_RR10 - REG_RR0])
-        PRE(ilist, instr, INSTR_CREATE_pop(dcontext, opnd_create_reg(REG_RR10)));
-    if (!cci->reg_skip[REG_RR11 - REG_RR0])
-        PRE(ilist, instr, INSTR_CREATE_pop(dcontext, opnd_create_reg(REG_RR11)));
-    if (!cci->reg_skip[REG_RR12 - REG_RR0])
-        PRE(ilist, instr, INSTR_CREATE_pop(dcontext, opnd_create_reg(REG_RR12)));
-    if (!cci->reg_skip[REG_RR13 - REG_RR0])
-        PRE(ilist, instr, INSTR_CREATE_pop(dcontext, opnd_create_reg(REG_RR13)));
-    if (!cci->reg_skip[REG_RR14 - REG_RR0])
-        PRE(ilist, instr, INSTR_CREATE_pop(dcontext, opnd_create_reg(REG_RR14)));
-    if (!cci->reg_skip[REG_RR15 - REG_RR0])
-        PRE(ilist, instr, INSTR_CREATE_pop(dcontext, opnd_create_reg(REG_RR15)));
-#else
-    PRE(ilist, instr, INSTR_CREATE_popa(dcontext));
-#endif
-    if (!cci->skip_save_aflags) {
-        PRE(ilist, instr, INSTR_CREATE_popf(dcontext));
-        offs_beyond_xmm = XSP_SZ; /* pc */;
-    } else if (cci->preserve_mcontext) {
-        offs_beyond_xmm = 2*XSP_SZ; /* aflags + pc */
-    }
-
-    if (preserve_xmm_caller_saved()) {
-        /* PR 264138: we must preserve xmm0-5 if on a 64-bit kernel */
-        int i;
-        /* See discussion in emit_fcache_enter_shared on which opcode
-         * is better. */
-        uint opcode = move_mm_reg_opcode(ALIGNED(alignment, 32), ALIGNED(alignment, 16));
-        ASSERT(proc_has_feature(FEATURE_SSE));
-        for (i=0; i<NUM_XMM_SAVED; i++) {
-            if (!cci->xmm_skip[i]) {
-                PRE(ilist, instr, instr_create_1dst_1src
-                    (dcontext, opcode, opnd_create_reg(REG_SAVED_XMM0 + (reg_id_t)i),
-                     opnd_create_base_disp(REG_RR13, REG_NULL, 0, 
-                                           PRE_XMM_PADDING + i*XMM_SAVED_REG_SIZE +
-                                           offs_beyond_xmm,
-                                           OPSZ_SAVED_XMM)));
-            }
+    for (i = 0; i <= DR_REG_R12 - DR_REG_R0; i++) {
+        if (!cci->reg_skip[i]) {
+            list |= 1 << i;
+            gpr_offs += R13_SZ;
         }
-        ASSERT(i*XMM_SAVED_REG_SIZE == XMM_SAVED_SIZE);
-        ASSERT(XMM_SAVED_SIZE <= XMM_SLOTS_SIZE);
     }
+    if (!cci->reg_skip[DR_REG_R13 - DR_REG_R0])
+        gpr_offs += R13_SZ;
+    if (!cci->reg_skip[DR_REG_R14 - DR_REG_R0])
+        gpr_offs += R13_SZ;
 
-    PRE(ilist, instr, INSTR_CREATE_lea
-        (dcontext, opnd_create_reg(REG_RR13),
-         OPND_CREATE_MEM_lea(REG_RR13, REG_NULL, 0,
-                             PRE_XMM_PADDING + XMM_SLOTS_SIZE +
-                             offs_beyond_xmm)));
-#endif
+    /* cpsr first, as it goes through r0, which the pop then restores */
+    if (!cci->skip_save_aflags) {
+        ASSERT(!cci->reg_skip[0]);
+        PRE(ilist, instr, create_ldst_imm(dcontext, false, DR_REG_R0, DR_REG_R13,
+                                          gpr_offs));
+        PRE(ilist, instr, INSTR_CREATE_msr_cpsr(dcontext, DR_REG_R0));
+    }
+    if (list != 0) {
+        PRE(ilist, instr, INSTR_CREATE_pop(dcontext, opnd_create_reg_list(list),
+                                           COND_ALWAYS));
+    }
+    /* skip the r13 slot: sp is restored with the stack swap */
+    if (!cci->reg_skip[DR_REG_R13 - DR_REG_R0])
+        insert_add_imm32(dcontext, ilist, instr, DR_REG_R13, DR_REG_R13, R13_SZ);
+    if (!cci->reg_skip[DR_REG_R14 - DR_REG_R0]) {
+        PRE(ilist, instr, INSTR_CREATE_pop(dcontext, opnd_create_reg_list(REGLIST_R14),
+                                           COND_ALWAYS));
+    }
+
+    if (!cci->skip_save_aflags || cci->preserve_mcontext)
+        offs += 2*R13_SZ; /* pc and cpsr */
+    if (cci->preserve_mcontext || cci->num_qr_skip != NUM_QR_REGS)
+        offs += QR_AREA_SIZE;
+    insert_add_imm32(dcontext, ilist, instr, DR_REG_R13, DR_REG_R13, offs);
 }
 
 /* utility routines for inserting clean calls to an instrumentation routine 
  * strategy is very similar to fcache_enter/return
  * FIXME: try to share code with fcache_enter/return?
  *
- * first swap stacks to DynamoRIO stack:
- *      SAVE_TO_UPCONTEXT %xsp,xsp_OFFSET
- *      RESTORE_FROM_DCONTEXT dstack_OFFSET,%xsp
- * swap peb/teb fields
- * now save app eflags and registers, being sure to lay them out on
+ * first swap stacks to DynamoRIO stack (see insert_swap_stacks()),
+ * saving the app sp in the r13 mcontext slot
+ * now save app cpsr and registers, being sure to lay them out on
  * the stack in priv_mcontext_t order:
- *      push $0 # for priv_mcontext_t.pc; wasted, for now
- *      pushf
- *      pusha # xsp is dstack-XSP_SZ*2; rest are app values
- * clear the eflags for our usage
- * ASSUMPTION (also made in x86.asm): 0 ok, reserved bits are not set by popf,
- *                                    and clearing, not preserving, is good enough
- *      push   $0
- *      popf
+ *      sub   sp, sp, #<qr slots and padding>
+ *      sub   sp, sp, #8        # priv_mcontext_t.pc and cpsr
+ *      push  {lr}
+ *      sub   sp, sp, #4        # priv_mcontext_t.r13; not filled in
+ *      push  {r0-r12}
+ *      mrs   r0, cpsr
+ *      str   r0, [sp, #60]
+ *      sub   sp, sp, #4        # AAPCS 8-byte alignment
+ * there is no direction flag or the like to clear for our usage
  * make the call
- *      call routine
- * restore app regs and eflags
- *      popa
- *      popf
- *      lea XSP_SZ(xsp),xsp # clear priv_mcontext_t.pc slot
- * swap peb/teb fields
- * restore app stack
- *      RESTORE_FROM_UPCONTEXT xsp_OFFSET,%xsp
+ *      bl    routine
+ * restore app regs and cpsr
+ *      add   sp, sp, #4
+ *      ldr   r0, [sp, #60]
+ *      msr   cpsr, r0
+ *      pop   {r0-r12}
+ *      add   sp, sp, #4
+ *      pop   {lr}
+ *      add   sp, sp, #<pc, cpsr, qr slots and padding>
+ * restore app stack, reloading sp from the r13 mcontext slot
  */
 
+/* Loads the address of the unprotected_context_t into reg. */
 void
 insert_get_mcontext_base(dcontext_t *dcontext, instrlist_t *ilist, 
                          instr_t *where, reg_id_t reg)
 {
-#ifdef NO
-//TODO SJF
-    PRE(ilist, where, instr_create_restore_from_tls
-        (dcontext, reg, TLS_DCONTEXT_SLOT));
+    if (SCRATCH_ALWAYS_TLS()) {
+        PRE(ilist, where, instr_create_load_tls_base(dcontext, reg));
+        PRE(ilist, where, instr_create_restore_from_tls_base
+            (dcontext, reg, reg, TLS_DCONTEXT_SLOT));
+
+        /* An extra level of indirection with SELFPROT_DCONTEXT */
+        if (TEST(SELFPROT_DCONTEXT, dynamo_options.protect_mask)) {
+            ASSERT_NOT_TESTED();
+            PRE(ilist, where, create_ldst_imm
+                (dcontext, false, reg, reg, offsetof(dcontext_t, upcontext)));
+        }
+    } else {
+        /* thread-private: the address is a constant */
+        insert_mov_imm32(dcontext, ilist, where, reg,
+                         (uint)(ptr_uint_t) dcontext->upcontext_ptr);
+    }
+}
 
-    /* An extra level of indirection with SELFPROT_DCONTEXT */
-    if (TEST(SELFPROT_DCONTEXT, dynamo_options.protect_mask)) {
-        ASSERT_NOT_TESTED();
-        PRE(ilist, where, INSTR_CREATE_mov_imm
-            (dcontext, opnd_create_reg(reg), 
-             OPND_CREATE_MEMPTR(reg, offsetof(dcontext_t, upcontext)), COND_ALWAYS));
+/* Points reg at the field offs bytes into the dcontext. */
+static void
+insert_get_dcontext_field_addr(dcontext_t *dcontext, instrlist_t *ilist,
+                               instr_t *where, reg_id_t reg, uint offs)
+{
+    /* DSTACK_OFFSET isn't within the upcontext so if it's separate this won't
+     * work right.  FIXME - the dcontext accessing routines are a mess of shared
+     * vs. no shared support, separate context vs. no separate context support etc. */
+    ASSERT_NOT_IMPLEMENTED(!TEST(SELFPROT_DCONTEXT, dynamo_options.protect_mask));
+    if (SCRATCH_ALWAYS_TLS()) {
+        insert_get_mcontext_base(dcontext, ilist, where, reg);
+        insert_add_imm32(dcontext, ilist, where, reg, reg, offs);
+    } else {
+        insert_mov_imm32(dcontext, ilist, where, reg,
+                         (uint)(ptr_uint_t) dcontext + offs);
     }
-#endif
 }
 
-/* What prepare_for_clean_call() adds to xsp beyond sizeof(priv_mcontext_t) */
+/* Switches sp from the app stack to the dstack, saving the app sp in the
+ * r13 mcontext slot, or back again.  ARM has no memory-to-memory moves, so
+ * r0 and r1 are parked on the stack we are leaving and copied over to the
+ * stack we are switching to, to be popped from there:
+ *      push  {r0, r1}
+ *      <r0 = &dcontext->r13>
+ *      add   r1, sp, #8        # to the dstack only: save the app sp,
+ *      str   r1, [r0]          # then <r0 = &dcontext->dstack>
+ *      ldr   r0, [r0]
+ *      sub   r0, r0, #8
+ *      ldr   r1, [sp]
+ *      str   r1, [r0]
+ *      ldr   r1, [sp, #4]
+ *      str   r1, [r0, #4]
+ *      mov   sp, r0
+ *      pop   {r0, r1}
+ */
+static void
+insert_swap_stacks(dcontext_t *dcontext, instrlist_t *ilist, instr_t *where,
+                   bool to_dstack)
+{
+    int i;
+    PRE(ilist, where, INSTR_CREATE_push(dcontext,
+                                        opnd_create_reg_list(REGLIST_R0|REGLIST_R1),
+                                        COND_ALWAYS));
+    insert_get_dcontext_field_addr(dcontext, ilist, where, DR_REG_R0, R13_OFFSET);
+    if (to_dstack) {
+        insert_add_imm32(dcontext, ilist, where, DR_REG_R1, DR_REG_R13, 2*R13_SZ);
+        PRE(ilist, where, create_ldst_imm(dcontext, true, DR_REG_R1, DR_REG_R0, 0));
+        insert_get_dcontext_field_addr(dcontext, ilist, where, DR_REG_R0, DSTACK_OFFSET);
+    }
+    PRE(ilist, where, create_ldst_imm(dcontext, false, DR_REG_R0, DR_REG_R0, 0));
+    insert_add_imm32(dcontext, ilist, where, DR_REG_R0, DR_REG_R0, -2*(int)R13_SZ);
+    for (i = 0; i < 2; i++) {
+        PRE(ilist, where, create_ldst_imm(dcontext, false, DR_REG_R1, DR_REG_R13,
+                                          i*R13_SZ));
+        PRE(ilist, where, create_ldst_imm(dcontext, true, DR_REG_R1, DR_REG_R0,
+                                          i*R13_SZ));
+    }
+    PRE(ilist, where, INSTR_CREATE_mov_reg(dcontext, opnd_create_reg(DR_REG_R13),
+                                           opnd_create_reg(DR_REG_R0), COND_ALWAYS));
+    PRE(ilist, where, INSTR_CREATE_pop(dcontext,
+                                       opnd_create_reg_list(REGLIST_R0|REGLIST_R1),
+                                       COND_ALWAYS));
+}
+
+/* What prepare_for_clean_call() adds to sp beyond sizeof(priv_mcontext_t):
+ * the padding that keeps sp 8-byte aligned for the AAPCS.
+ */
 static inline int
 clean_call_beyond_mcontext(void)
 {
-    return 0; /* no longer adding anything */
+    return ALIGN_FORWARD(sizeof(priv_mcontext_t), 8) - sizeof(priv_mcontext_t);
 }
 
 /* prepare_for and cleanup_after assume that the stack looks the same after
  * the call to the instrumentation routine, since it stores the app state
  * on the stack.
  * Returns the size of the data stored on the DR stack.
- * WARNING: this routine does NOT save the fp/mmx/sse state, to do that the
+ * WARNING: this routine does NOT save the VFP/NEON state, to do that the
  * instrumentation routine should call proc_save_fpstate() and then
  * proc_restore_fpstate()
- * (This is because of expense:
- *   fsave takes 118 cycles!  
- *   frstor (separated by 6 instrs from fsave) takes 89 cycles
- *   fxsave and fxrstor are not available on HP machine!
- *   supposedly they came out in PII
- *   on balrog: fxsave 91 cycles, fxrstor 173)
  *
- * For x64, changes the stack pointer by a multiple of 16.
+ * Changes the stack pointer by a multiple of 8, as the AAPCS requires at
+ * a public interface, if cci->should_align.
  * 
  * NOTE: The client interface's get/set mcontext functions and the
  * hotpatching gateway rely on the app's context being available
  * on the dstack in a particular format.  Do not corrupt this data
  * unless you update all users of this data!
  *
- * NOTE : this routine clobbers TLS_XAX_SLOT and the XSP mcontext slot.
- * We guarantee to clients that all other slots (except the XAX mcontext slot)
+ * NOTE : this routine clobbers the r13 mcontext slot.
+ * We guarantee to clients that all other slots (except the r0 mcontext slot)
  * will remain untouched.
  *
  * N.B.: insert_parameter_preparation (and our documentation for
- * dr_prepare_for_call) assumes that this routine only modifies xsp
- * and xax and no other registers.
+ * dr_prepare_for_call) assumes that this routine only modifies sp
+ * and r0 and no other registers.
  */
-/* number of extra slots in addition to register slots. */
-#define NUM_EXTRA_SLOTS 2 /* pc, aflags */
 uint
 prepare_for_clean_call(dcontext_t *dcontext, clean_call_info_t *cci,
                        instrlist_t *ilist, instr_t *instr)
 {
-#ifdef NO
-//TODO SJF
     uint dstack_offs = 0;
 
     if (cci == NULL)
         cci = &default_clean_call_info;
     /* Swap stacks.  For thread-shared, we need to get the dcontext
-     * dynamically rather than use the constant passed in here.  Save
-     * away xax in a TLS slot and then load the dcontext there.
+     * dynamically rather than use the constant passed in here.
      */
-    if (SCRATCH_ALWAYS_TLS()) {
-        PRE(ilist, instr, instr_create_save_to_tls
-            (dcontext, REG_RR0, TLS_XAX_SLOT));
-
-        insert_get_mcontext_base(dcontext, ilist, instr,
-                                 REG_RR0);
-
-        PRE(ilist, instr, instr_create_save_to_dc_via_reg
-            (dcontext, REG_RR0, REG_RR13, R13_OFFSET));
-
-        /* DSTACK_OFFSET isn't within the upcontext so if it's separate this won't
-         * work right.  FIXME - the dcontext accessing routines are a mess of shared
-         * vs. no shared support, separate context vs. no separate context support etc. */
-        ASSERT_NOT_IMPLEMENTED(!TEST(SELFPROT_DCONTEXT, dynamo_options.protect_mask));
-
-#if defined(WINDOWS) && defined(CLIENT_INTERFACE)
-        /* i#249: swap PEB pointers while we have dcxt in reg.  We risk "silent
-         * death" by using xsp as scratch but don't have simple alternative.
-         */
-        /* XXX: should use clean callee analysis to remove pieces of this
-         * such as errno preservation
-         */
-        if (INTERNAL_OPTION(private_peb) && should_swap_peb_pointer()) {
-            preinsert_swap_peb(dcontext, ilist, instr, !SCRATCH_ALWAYS_TLS(),
-                               REG_RR0/*dc*/, REG_RR13/*scratch*/, true/*to priv*/);
-        }
-#endif
-        PRE(ilist, instr, instr_create_restore_from_dc_via_reg
-            (dcontext, REG_RR0, REG_RR13, DSTACK_OFFSET));
-
-        /* restore xax before pushing the context on the dstack */
-        PRE(ilist, instr, instr_create_restore_from_tls
-            (dcontext, REG_RR0, TLS_XAX_SLOT));  
-    }
-    else {
-        instr_create_save_to_dcontext(ilist, dcontext, REG_RR13, R13_OFFSET, INSERT_PRE, inst);
-        instr_create_restore_dynamo_stack(ilist, dcontext, INSERT_PRE, inst, absolute);
-    }
+    insert_swap_stacks(dcontext, ilist, instr, true/*to dstack*/);
 
     /* Save flags and all registers, in priv_mcontext_t order.
      * We're at base of dstack so should be nicely aligned.
      */
     ASSERT(ALIGNED(dcontext->dstack, PAGE_SIZE));
     dstack_offs +=
-        insert_push_all_registers(dcontext, cci, ilist, instr, PAGE_SIZE,
-                                  INSTR_CREATE_push_imm(dcontext, OPND_CREATE_INT32(0)));
-    /* Note that we do NOT bother to put the correct pre-push app xsp value on the
+        insert_push_all_registers(dcontext, cci, ilist, instr, PAGE_SIZE, NULL);
+    /* Note that we do NOT bother to put the correct pre-push app sp value on the
      * stack here, as an optimization for callees who never ask for it: instead we
      * rely on dr_[gs]et_mcontext() to fix it up if asked for.  We can get away w/
      * this while hotpatching cannot (hotp_inject_gateway_call() fixes it up every
      * time) b/c the callee has to ask for the priv_mcontext_t.
      */
 
-    /* clear eflags for callee's usage */
-    if (!cci->skip_clear_eflags) {
-        PRE(ilist, instr,
-            INSTR_CREATE_push_imm(dcontext, OPND_CREATE_INT32(0)));
-        PRE(ilist, instr, INSTR_CREATE_popf(dcontext));
-    }
-
-    /* We no longer need to preserve the app's errno on Windows except
-     * when using private libraries, so its preservation is in
-     * preinsert_swap_peb().
-     * We do not need to preserve DR's Linux errno across app execution.
+    /* There is nothing like x86's direction flag to clear for the callee, so
+     * cci->skip_clear_eflags has no effect.
      */
 
-#ifdef X64
-    /* PR 218790: maintain 16-byte rsp alignment.
-     * insert_parameter_preparation() currently assumes we leave rsp aligned.
-     */
-    /* check if need adjust stack for alignment. */
-    if (cci->should_align) {
-        uint num_slots = NUM_GP_REGS + NUM_EXTRA_SLOTS;
-        if (cci->skip_save_aflags)
-            num_slots -= 2;
-        num_slots -= cci->num_regs_skip; /* regs that not saved */
-        if ((num_slots % 2) == 1) {
-            ASSERT((dstack_offs % 16) == 8);
-            PRE(ilist, instr, INSTR_CREATE_lea
-                (dcontext, opnd_create_reg(REG_RR13),
-                 OPND_CREATE_MEM_lea(REG_RR13, REG_NULL, 0, -(int)XSP_SZ)));
-            dstack_offs += XSP_SZ;
-        } else {
-            ASSERT((dstack_offs % 16) == 0);
-        }
+    if (cci->should_align && !ALIGNED(dstack_offs, 8)) {
+        insert_add_imm32(dcontext, ilist, instr, DR_REG_R13, DR_REG_R13,
+                         -(int)R13_SZ);
+        dstack_offs += R13_SZ;
     }
-#endif
     ASSERT(cci->skip_save_aflags   ||
-           cci->num_xmms_skip != 0 ||
+           cci->num_qr_skip != 0   ||
            cci->num_regs_skip != 0 ||
            dstack_offs == sizeof(priv_mcontext_t) + clean_call_beyond_mcontext());
     return dstack_offs;
-#endif
 }
 
 void
 cleanup_after_clean_call(dcontext_t *dcontext, clean_call_info_t *cci,
                          instrlist_t *ilist, instr_t *instr)
 {
-#ifdef NO
     if (cci == NULL)
         cci = &default_clean_call_info;
-    /* saved error code is currently on the top of the stack */
 
-#ifdef X64
-    /* PR 218790: remove the padding we added for 16-byte rsp alignment */
-    if (cci->should_align) {
-        uint num_slots = NUM_GP_REGS + NUM_EXTRA_SLOTS;
-        if (cci->skip_save_aflags)
-            num_slots += 2;
-        num_slots -= cci->num_regs_skip; /* regs that not saved */
-        if ((num_slots % 2) == 1) {
-            PRE(ilist, instr, INSTR_CREATE_lea
-                (dcontext, opnd_create_reg(REG_RR13),
-                 OPND_CREATE_MEM_lea(REG_RR13, REG_NULL, 0, XSP_SZ)));
-        }
-    }
-#endif
+    /* remove the padding we added for 8-byte sp alignment */
+    if (cci->should_align && !ALIGNED(push_all_registers_size(cci), 8))
+        insert_add_imm32(dcontext, ilist, instr, DR_REG_R13, DR_REG_R13, R13_SZ);
 
     /* now restore everything */
     insert_pop_all_registers(dcontext, cci, ilist, instr,
@@ -889,36 +898,9 @@ cleanup_after_clean_call(dcontext_t *dcontext, clean_call_info_t *cci,
                              PAGE_SIZE);
 
     /* Swap stacks back.  For thread-shared, we need to get the dcontext
-     * dynamically.  Save xax in TLS so we can use it as scratch.
+     * dynamically.
      */
-    if (SCRATCH_ALWAYS_TLS()) {
-        PRE(ilist, instr, instr_create_save_to_tls
-            (dcontext, REG_RR0, TLS_XAX_SLOT));
-
-        insert_get_mcontext_base(dcontext, ilist, instr,
-                                 REG_RR0);
-
-#if defined(WINDOWS) && defined(CLIENT_INTERFACE)
-        /* i#249: swap PEB pointers while we have dcxt in reg.  We risk "silent
-         * death" by using xsp as scratch but don't have simple alternative.
-         */
-        if (INTERNAL_OPTION(private_peb) && should_swap_peb_pointer()) {
-            preinsert_swap_peb(dcontext, ilist, instr, !SCRATCH_ALWAYS_TLS(),
-                               REG_RR0/*dc*/, REG_RR13/*scratch*/, false/*to app*/);
-        }
-#endif
-
-        PRE(ilist, instr, instr_create_restore_from_dc_via_reg
-            (dcontext, REG_RR0, REG_RR13, R13_OFFSET));
-
-        PRE(ilist, instr, instr_create_restore_from_tls
-            (dcontext, REG_RR0, TLS_XAX_SLOT));
-    }
-    else {
-        PRE(ilist, instr,
-            instr_create_restore_from_dcontext(dcontext, REG_RR13, R13_OFFSET));
-    }
-#endif
+    insert_swap_stacks(dcontext, ilist, instr, false/*to app stack*/);
 }
 
 bool
@@ -3918,6 +3900,66 @@ mangle_mov_seg(dcontext_t *dcontext, instrlist_t *ilist, instr_t *instr,
 #endif
 }
 
+#ifdef HAVE_TLS
+/* mangle app accesses to TPIDRURW, which holds DR's TLS base (see
+ * os_tls_init()) when built with HAVE_TLS, to use the app's virtualized
+ * value instead.
+ */
+static void
+mangle_thread_register(dcontext_t *dcontext, instrlist_t *ilist, instr_t *instr,
+                       instr_t *next_instr)
+{
+    uint word, cond;
+    reg_id_t rt;
+    ushort offs;
+
+    if (instr_get_opcode(instr) != OP_mrc && instr_get_opcode(instr) != OP_mcr)
+        return;
+    /* the decoder does not fill in mrc/mcr operands, so go by the raw bits */
+    if (!instr_raw_bits_valid(instr))
+        return;
+    word = *(uint *)instr_get_raw_bits(instr);
+    /* looking for mrc/mcr p15, 0, Rt, c13, c0, 2 */
+    if ((word & 0x0fef0fff) != 0x0e0d0f50)
+        return;
+    cond = word >> 28;
+    ASSERT(cond != 0xf); /* mrc2/mcr2 have no cp15 forms */
+    rt = REG_RR0 + ((word >> 12) & 0xf);
+    offs = os_get_app_tpidrurw_offset();
+
+    if (TEST(0x00100000, word)) {
+        /* mrc: Rt is written anyway, so it can hold the base:
+         *   mrc p15, 0, Rt, c13, c0, 2; ldr Rt, [Rt, #app_tpidrurw]
+         * Both take the app's condition so a failed one leaves Rt alone.
+         */
+        PRE(ilist, instr, INSTR_CREATE_mrc(dcontext, opnd_create_reg(rt),
+                                           opnd_create_reg(DR_REG_TPIDRURW), cond));
+        /* must use the original instr, which might be used by caller */
+        instr_reuse(dcontext, instr);
+        instr_set_opcode(instr, OP_ldr_imm);
+        instr_set_num_opnds(dcontext, instr, 1, 2);
+        instr_set_dst(instr, 0, opnd_create_reg(rt));
+        instr_set_src(instr, 0, opnd_create_mem_reg(rt));
+        instr_set_src(instr, 1, OPND_CREATE_IMM12(os_tls_offset(offs)));
+        instr_set_cond(instr, cond);
+        instr_set_p_flag(dcontext, instr, true);
+        instr_set_u_flag(dcontext, instr, true);
+        instr_set_w_flag(dcontext, instr, false);
+        return;
+    }
+
+    /* mcr: store Rt into the virtualized slot instead.  With no register
+     * known to be dead, the spill saves its base register on the stack.
+     */
+    ASSERT_NOT_IMPLEMENTED(cond == COND_ALWAYS);
+    instr_create_save_to_tls_seq(ilist, dcontext, rt, REG_NULL, offs,
+                                 INSERT_PRE, instr);
+    instr_reuse(dcontext, instr);
+    instr_set_opcode(instr, OP_nop);
+    instr_set_num_opnds(dcontext, instr, 0, 0);
+}
+#endif /* HAVE_TLS */
+
 /* mangle the instruction that reference memory via segment register */
 static void
 mangle_seg_ref(dcontext_t *dcontext, instrlist_t *ilist, instr_t *instr,
@@ -4229,6 +4271,29 @@ mangle(dcontext_t *dcontext, instrlist_t *ilist, uint flags,
     ASSERT(ilist->flags == 0);
     KSTOP(mangling);
 #endif
+#if defined(LINUX) && defined(HAVE_TLS)
+    {
+        /* The rest of mangling is not yet ported, but once DR's TLS base is
+         * in TPIDRURW the app must not see it.
+         */
+        instr_t *instr, *next_instr;
+        for (instr = instrlist_first(ilist); instr != NULL; instr = next_instr) {
+            next_instr = instr_get_next(instr);
+            if (!instr_opcode_valid(instr) || !instr_ok_to_mangle(instr))
+                continue;
+            if (record_translation) {
+                /* make sure inserted instrs translate to the original instr */
+                app_pc xl8 = instr_get_translation(instr);
+                if (xl8 == NULL)
+                    xl8 = instr_get_raw_bits(instr);
+                instrlist_set_translation_target(ilist, xl8);
+            }
+            mangle_thread_register(dcontext, ilist, instr, next_instr);
+        }
+        if (record_translation)
+            instrlist_set_translation_target(ilist, NULL);
+    }
+#endif
 }
 
 /* END OF CONTROL-FLOW MANGLING ROUTINES
@@ -5093,6 +5158,8 @@ finalize_selfmod_sandbox(dcontext_t *dcontext, fragment_t *f)
 #define MAX_NUM_FUNC_INSTRS 4096
 /* the max number of instructions the callee can have for inline. */
 #define MAX_NUM_INLINE_INSTRS 20
+/* The AAPCS passes the first four args in r0-r3. */
+#define NUM_AAPCS_REGPARM 4
 
 void
 mangle_init(void)
@@ -5153,12 +5220,32 @@ decode_callee_instr(dcontext_t *dcontext, callee_info_t *ci, app_pc instr_pc)
     return next_pc;
 }
 
+/* Returns whether instr returns from the callee: bx lr, mov pc, lr, or a
+ * pop that includes the pc.  A conditional return is not the end of the
+ * callee, so we treat it as any other indirect branch.
+ */
+static bool
+callee_instr_is_return(instr_t *instr)
+{
+    int opc = instr_get_opcode(instr);
+    opnd_t src;
+    if (instr_get_cond(instr) != COND_ALWAYS)
+        return false;
+    if (opc == OP_bx) {
+        src = instr_get_src(instr, 0);
+        return (opnd_is_reg(src) && opnd_get_reg(src) == DR_REG_R14);
+    }
+    if (opc == OP_pop) {
+        src = instr_get_src(instr, 0);
+        return (opnd_is_reglist(src) && TEST(REGLIST_R15, opnd_get_reg_list(src)));
+    }
+    return instr_is_return(instr);
+}
+
 /* check newly decoded instruction from callee */
 static app_pc
 check_callee_instr(dcontext_t *dcontext, callee_info_t *ci, app_pc next_pc)
 {
-#ifdef NO
-//TODO SJF
     instrlist_t *ilist = ci->ilist;
     instr_t *instr;
     app_pc   cur_pc, tgt_pc;
@@ -5170,103 +5257,39 @@ check_callee_instr(dcontext_t *dcontext, callee_info_t *ci, app_pc next_pc)
     ASSERT(next_pc == cur_pc + instr_length(dcontext, instr));
     if (!instr_is_cti(instr)) {
         /* special instructions, bail out. */
-        if (instr_is_syscall(instr) || instr_is_interrupt(instr)) {
+        if (instr_is_syscall(instr) || instr_get_opcode(instr) == OP_bkpt) {
             LOG(THREAD, LOG_CLEANCALL, 2,
-                "CLEANCALL: bail out on syscall or interrupt at: "PFX"\n",
+                "CLEANCALL: bail out on syscall or breakpoint at: "PFX"\n",
                 cur_pc);
             ci->bailout = true;
             return NULL;
         }
         return next_pc;
     } else { /* cti instruc */
-        if (instr_is_mbr(instr)) {
-            /* check if instr is return, and if return is the last instr. */
-            if (!instr_is_return(instr) || ci->fwd_tgt > cur_pc) {
+        if (callee_instr_is_return(instr)) {
+            /* check if return is the last instr. */
+            if (ci->fwd_tgt > cur_pc) {
                 LOG(THREAD, LOG_CLEANCALL, 2,
-                    "CLEANCALL: bail out on indirect branch at: "PFX"\n",
+                    "CLEANCALL: bail out on return before branch target at: "PFX"\n",
                     cur_pc);
                 ci->bailout = true;
             }
             return NULL;
         } else if (instr_is_call(instr)) {
-            tgt_pc = opnd_get_pc(instr_get_target(instr));
-            /* remove and destroy the call instruction */
+            /* There is no PIC thunk to special-case: ARM PIC code reaches its
+             * GOT with pc-relative literals instead of a call.
+             */
+            LOG(THREAD, LOG_CLEANCALL, 2,
+                "CLEANCALL: callee calls out at: "PFX"\n", cur_pc);
             ci->bailout = true;
-            instrlist_remove(ilist, instr);
-            instr_destroy(GLOBAL_DCONTEXT, instr);
-            instr = NULL;
-            ci->num_instrs--;
+            return NULL;
+        } else if (instr_is_mbr(instr)) {
             LOG(THREAD, LOG_CLEANCALL, 2,
-                "CLEANCALL: callee calls out at: "PFX" to "PFX"\n",
-                cur_pc, tgt_pc);
-            /* check special PIC code:
-             * 1. call next_pc; pop r1;
-             * or
-             * 2. call pic_func;
-             *    and in pic_func: mov [%xsp] %r1; ret;
-             */
-            if (INTERNAL_OPTION(opt_cleancall) >= 1) {
-                instr_t ins;
-                app_pc  tmp_pc;
-                opnd_t src = OPND_CREATE_INTPTR(next_pc);
-                instr_init(dcontext, &ins);
-                TRY_EXCEPT(dcontext, {
-                    tmp_pc = decode(dcontext, tgt_pc, &ins);
-                }, {
-                    ASSERT_CURIOSITY(false && 
-                                     "crashed while decoding clean call");
-                    instr_free(dcontext, &ins);
-                    return NULL;
-                });
-                DOLOG(3, LOG_CLEANCALL, {
-                    disassemble_with_bytes(dcontext, tgt_pc, THREAD);
-                });
-                /* "pop %r1" or "mov [%rsp] %r1" */
-                if (!(((instr_get_opcode(&ins) == OP_pop) ||
-                       (instr_get_opcode(&ins) == OP_mov_ld &&
-                        opnd_same(instr_get_src(&ins, 0),
-                                  OPND_CREATE_MEMPTR(REG_RR13, 0)))) &&
-                      opnd_is_reg(instr_get_dst(&ins, 0)))) {
-                    LOG(THREAD, LOG_CLEANCALL, 2,
-                        "CLEANCALL: callee calls out is not PIC code, "
-                        "bailout\n");
-                    instr_free(dcontext, &ins);
-                    return NULL;
-                }
-                /* replace with "mov next_pc r1" */
-                /* XXX: the memory on top of stack will not be next_pc. */
-                instr = INSTR_CREATE_mov_imm
-                    (GLOBAL_DCONTEXT, instr_get_dst(&ins, 0), src, COND_ALWAYS);
-                instr_set_translation(instr, cur_pc);
-                instrlist_append(ilist, instr);
-                ci->num_instrs++;
-                instr_reset(dcontext, &ins);
-                if (tgt_pc != next_pc) { /* a callout */
-                    TRY_EXCEPT(dcontext, {
-                        tmp_pc = decode(dcontext, tmp_pc, &ins);
-                    }, {
-                        ASSERT_CURIOSITY(false && 
-                                         "crashed while decoding clean call");
-                        instr_free(dcontext, &ins);
-                        return NULL;
-                    });
-                    if (!instr_is_return(&ins)) {
-                        instr_free(dcontext, &ins);
-                        return NULL;
-                    }
-                    instr_free(dcontext, &ins);
-                }
-                LOG(THREAD, LOG_CLEANCALL, 2,
-                    "CLEANCALL: special PIC code at: "PFX"\n", 
-                    cur_pc);
-                ci->bailout = false;
-                instr_free(dcontext, &ins);
-                if (tgt_pc == next_pc)
-                    return tmp_pc;
-                else
-                    return next_pc;
-            }
-        } else { /* ubr or cbr */
+                "CLEANCALL: bail out on indirect branch at: "PFX"\n",
+                cur_pc);
+            ci->bailout = true;
+            return NULL;
+        } else { /* b or b<cond> */
             tgt_pc = opnd_get_pc(instr_get_target(instr));
             if (tgt_pc < cur_pc) { /* backward branch */
                 if (tgt_pc < ci->start) {
@@ -5286,14 +5309,11 @@ check_callee_instr(dcontext_t *dcontext, callee_info_t *ci, app_pc next_pc)
         }
     }
     return next_pc;
-#endif
 }
 
 static void
 check_callee_ilist(dcontext_t *dcontext, callee_info_t *ci)
 {
-#ifdef NO
-//TODO SJF
     instrlist_t *ilist = ci->ilist;
     instr_t *cti, *tgt, *ret;
     app_pc   tgt_pc;
@@ -5303,7 +5323,7 @@ check_callee_ilist(dcontext_t *dcontext, callee_info_t *ci)
          */
         ret = instrlist_last(ilist);
         /* must be RETURN, otherwise, bugs in decode_callee_ilist */
-        ASSERT(instr_is_return(ret));
+        ASSERT(callee_instr_is_return(ret));
         for (cti  = instrlist_first(ilist);
              cti != ret;
              cti  = instr_get_next(cti)) {
@@ -5326,6 +5346,18 @@ check_callee_ilist(dcontext_t *dcontext, callee_info_t *ci)
                 break;
             }
         }
+        /* A pop into pc also restores callee-saved regs: keep that part, for
+         * analyze_callee_save_reg() to pair with the push.
+         */
+        if (instr_get_opcode(ret) == OP_pop &&
+            (opnd_get_reg_list(instr_get_src(ret, 0)) & ~REGLIST_R15) != 0) {
+            instr_t *pop = INSTR_CREATE_pop
+                (GLOBAL_DCONTEXT,
+                 opnd_create_reg_list(opnd_get_reg_list(instr_get_src(ret, 0)) &
+                                      ~REGLIST_R15), COND_ALWAYS);
+            instr_set_translation(pop, instr_get_app_pc(ret));
+            instrlist_preinsert(ilist, ret, pop);
+        }
         /* remove RETURN as we do not need it any more */
         instrlist_remove(ilist, ret);
         instr_destroy(GLOBAL_DCONTEXT, ret);
@@ -5334,7 +5366,6 @@ check_callee_ilist(dcontext_t *dcontext, callee_info_t *ci)
         instrlist_clear_and_destroy(GLOBAL_DCONTEXT, ilist);
         ci->ilist = NULL;
     }
-#endif //NO
 }
 
 static void
@@ -5355,17 +5386,115 @@ decode_callee_ilist(dcontext_t *dcontext, callee_info_t *ci)
     check_callee_ilist(dcontext, ci);
 }
 
+/* Returns whether instr reads or writes VFP/NEON state, including FPSCR.
+ * The ARM decoder does not yet fill in operands for every VFP/NEON
+ * instruction, so we check the opcode as well as the operands.  Generic
+ * coprocessor instructions may target cp10/cp11 so we count them too.
+ */
+static bool
+instr_uses_vfp(instr_t *instr)
+{
+    int opc = instr_get_opcode(instr);
+    if (opc >= OP_vaba && opc <= OP_vzip)
+        return true;
+    switch (opc) {
+    case OP_cdp: case OP_cdp2:
+    case OP_ldc_imm: case OP_ldc2_imm: case OP_ldc_lit: case OP_ldc2_lit:
+    case OP_stc: case OP_stc2:
+    case OP_mcr: case OP_mcr2: case OP_mcrr: case OP_mcrr2:
+    case OP_mrc: case OP_mrc2: case OP_mrrc: case OP_mrrc2:
+        return true;
+    }
+    return instr_uses_fp_reg(instr);
+}
+
+/* The 32 D registers plus FPSCR are the bulk of a full context save, so
+ * we record whether the callee touches them at all: if not, a clean call
+ * asking for DR_CLEANCALL_SAVE_FLOAT can skip the fpstate save.
+ */
+static void
+analyze_callee_vfp_usage(dcontext_t *dcontext, callee_info_t *ci)
+{
+    instr_t *instr;
+    ci->vfp_used = false;
+    for (instr  = instrlist_first(ci->ilist);
+         instr != NULL;
+         instr  = instr_get_next(instr)) {
+        if (instr_uses_vfp(instr)) {
+            LOG(THREAD, LOG_CLEANCALL, 2,
+                "CLEANCALL: callee "PFX" uses VFP/NEON at "PFX"\n",
+                ci->start, instr_get_app_pc(instr));
+            ci->vfp_used = true;
+            break;
+        }
+    }
+}
+
+/* Returns whether instr reads the caller's NZCV flags: through its
+ * condition, through mrs, or as the carry-in of adc, sbc, rsc and rrx.
+ */
+static bool
+instr_reads_nzcv(instr_t *instr)
+{
+    int opc = instr_get_opcode(instr);
+    if (!instr_is_unconditional(instr) && instr_get_cond(instr) < COND_ALWAYS)
+        return true;
+    return (opc == OP_mrs || opc == OP_it ||
+            opc == OP_adc_imm || opc == OP_adc_reg || opc == OP_adc_rsr ||
+            opc == OP_sbc_imm || opc == OP_sbc_reg || opc == OP_sbc_rsr ||
+            opc == OP_rsc_imm || opc == OP_rsc_reg || opc == OP_rsc_rsr ||
+            opc == OP_rrx);
+}
+
+/* Returns whether instr may write any of the NZCV flags, and sets *all to
+ * whether it always overwrites all four of them.  Only the arithmetic ops
+ * and compares write V; logical ops and moves change C just when the
+ * shifter carries out.
+ */
+static bool
+instr_writes_nzcv(instr_t *instr, bool *all)
+{
+    int opc = instr_get_opcode(instr);
+    *all = false;
+    if (opc == OP_msr_imm || opc == OP_msr_reg)
+        return true;
+    switch (opc) {
+    case OP_cmp_imm: case OP_cmp_reg: case OP_cmp_rsr:
+    case OP_cmn_imm: case OP_cmn_reg: case OP_cmn_rsr:
+        break;
+    case OP_tst_imm: case OP_tst_reg: case OP_tst_rsr:
+    case OP_teq_imm: case OP_teq_reg: case OP_teq_rsr:
+        return true;
+    default:
+        if (!instr_has_s_flag(instr) || !instr_get_s_flag(instr))
+            return false;
+    }
+    switch (opc) {
+    case OP_add_imm: case OP_add_reg: case OP_add_rsr:
+    case OP_adc_imm: case OP_adc_reg: case OP_adc_rsr:
+    case OP_sub_imm: case OP_sub_reg: case OP_sub_rsr:
+    case OP_sbc_imm: case OP_sbc_reg: case OP_sbc_rsr:
+    case OP_rsb_imm: case OP_rsb_reg: case OP_rsb_rsr:
+    case OP_rsc_imm: case OP_rsc_reg: case OP_rsc_rsr:
+    case OP_add_sp_imm: case OP_sub_sp_imm: case OP_sub_sp_reg:
+    case OP_cmp_imm: case OP_cmp_reg: case OP_cmp_rsr:
+    case OP_cmn_imm: case OP_cmn_reg: case OP_cmn_rsr:
+        /* a predicated write may not happen */
+        *all = (instr_is_unconditional(instr) ||
+                instr_get_cond(instr) == COND_ALWAYS);
+        break;
+    }
+    return true;
+}
+
 static void
 analyze_callee_regs_usage(dcontext_t *dcontext, callee_info_t *ci)
 {
-#ifdef NO
-//TODO SJF
     instrlist_t *ilist = ci->ilist;
     instr_t *instr;
     uint i, num_regparm;
+    bool all;
 
-    ci->num_xmms_used = 0;
-    memset(ci->xmm_used, 0, sizeof(bool) * NUM_XMM_REGS);
     memset(ci->reg_used, 0, sizeof(bool) * NUM_GP_REGS);
     ci->write_aflags = false;
     for (instr  = instrlist_first(ilist);
@@ -5373,31 +5502,21 @@ analyze_callee_regs_usage(dcontext_t *dcontext, callee_info_t *ci)
          instr  = instr_get_next(instr)) {
         /* XXX: this is not efficient as instr_uses_reg will iterate over
          * every operands, and the total would be (NUM_REGS * NUM_OPNDS)
-         * for each instruction. However, since this will be only called 
+         * for each instruction. However, since this will be only called
          * once for each clean call callee, it will have little performance
          * impact unless there are a lot of different clean call callees.
          */
-        /* XMM registers usage */
-        for (i = 0; i < NUM_XMM_REGS; i++) {
-            if (!ci->xmm_used[i] &&
-                instr_uses_reg(instr, (DR_REG_XMM0 + (reg_id_t)i))) {
-                LOG(THREAD, LOG_CLEANCALL, 2,
-                    "CLEANCALL: callee "PFX" uses XMM%d at "PFX"\n", 
-                    ci->start, i, instr_get_app_pc(instr));
-                ci->xmm_used[i] = true;
-                ci->num_xmms_used++;
-            }
-        }
-        /* General purpose registers */
+        /* General purpose registers, including those in register lists
+         * and used as memory bases.
+         */
         for (i = 0; i < NUM_GP_REGS; i++) {
             reg_id_t reg = DR_REG_R0 + (reg_id_t)i;
             if (!ci->reg_used[i] &&
-                /* Later we'll rewrite stack accesses to not use XSP or XBP. */
+                /* Later we'll rewrite stack accesses to not use sp. */
                 reg != DR_REG_R13 &&
-                (reg != DR_REG_R5 || !ci->xbp_is_fp) &&
                 instr_uses_reg(instr, reg)) {
                 LOG(THREAD, LOG_CLEANCALL, 2,
-                    "CLEANCALL: callee "PFX" uses REG %s at "PFX"\n", 
+                    "CLEANCALL: callee "PFX" uses REG %s at "PFX"\n",
                     ci->start, reg_names[reg],
                     instr_get_app_pc(instr));
                 ci->reg_used[i] = true;
@@ -5406,7 +5525,7 @@ analyze_callee_regs_usage(dcontext_t *dcontext, callee_info_t *ci)
         }
         /* callee update aflags */
         if (!ci->write_aflags) {
-            if (TESTANY(EFLAGS_WRITE_6, instr_get_arith_flags(instr))) {
+            if (instr_writes_nzcv(instr, &all)) {
                 LOG(THREAD, LOG_CLEANCALL, 2,
                     "CLEANCALL: callee "PFX" updates aflags\n", ci->start);
                 ci->write_aflags = true;
@@ -5420,14 +5539,11 @@ analyze_callee_regs_usage(dcontext_t *dcontext, callee_info_t *ci)
     for (instr  = instrlist_first(ilist);
          instr != NULL;
          instr  = instr_get_next(instr)) {
-        uint flags = instr_get_arith_flags(instr);
-        if (TESTANY(EFLAGS_READ_6, flags)) {
+        if (instr_reads_nzcv(instr)) {
             ci->read_aflags = true;
             break;
         }
-        if (TESTALL(EFLAGS_WRITE_6, flags))
-            break;
-        if (instr_is_return(instr))
+        if (instr_writes_nzcv(instr, &all) && all)
             break;
         if (instr_is_cti(instr)) {
             ci->read_aflags = true;
@@ -5444,12 +5560,10 @@ analyze_callee_regs_usage(dcontext_t *dcontext, callee_info_t *ci)
      * reserved just in case.
      */
     if (ci->read_aflags || ci->write_aflags) {
-        /* XXX: We can optimize away the flags spill to memory if the callee
-         * does not use xax.
-         */
         callee_info_reserve_slot(ci, SLOT_FLAGS, 0);
-        /* Spilling flags clobbers xax, so we need to spill the app xax first.
-         * If the callee used xax, then the slot will already be reserved.
+        /* Spilling flags clobbers r0 (mrs needs a GPR), so we need to spill
+         * the app r0 first.  If the callee used r0, then the slot will
+         * already be reserved.
          */
         if (!ci->reg_used[DR_REG_R0 - DR_REG_R0]) {
             callee_info_reserve_slot(ci, SLOT_REG, DR_REG_R0);
@@ -5457,31 +5571,33 @@ analyze_callee_regs_usage(dcontext_t *dcontext, callee_info_t *ci)
     }
 
     /* i#987, i#988: reg might be used for arg passing but not used in callee */
-    num_regparm = MIN(ci->num_args, NUM_REGPARM);
+    num_regparm = MIN(ci->num_args, NUM_AAPCS_REGPARM);
     for (i = 0; i < num_regparm; i++) {
-        reg_id_t reg = regparms[i];
+        reg_id_t reg = DR_REG_R0 + (reg_id_t)i;
         if (!ci->reg_used[reg - DR_REG_R0]) {
             LOG(THREAD, LOG_CLEANCALL, 2,
-                "CLEANCALL: callee "PFX" uses REG %s for arg passing\n", 
+                "CLEANCALL: callee "PFX" uses REG %s for arg passing\n",
                 ci->start, reg_names[reg]);
             ci->reg_used[reg - DR_REG_R0] = true;
             callee_info_reserve_slot(ci, SLOT_REG, reg);
         }
     }
-#endif //NO
 }
 
-/* We use push/pop pattern to detect callee saved registers,
- * and assume that the code later won't change those saved value
- * on the stack. 
+/* We use the push/pop pair around the whole callee to detect callee saved
+ * registers, and assume that the code in between won't change the saved
+ * values on the stack.  check_callee_ilist() has already turned a final
+ * pop into pc into a pop of the rest of its list.
+ * An r11 frame pointer is just another callee saved register here: its
+ * setup writes r11 from sp, which analyze_callee_inline() rejects.
  */
 static void
 analyze_callee_save_reg(dcontext_t *dcontext, callee_info_t *ci)
 {
-#ifdef NO
-//TODO SJF
     instrlist_t *ilist = ci->ilist;
-    instr_t *top, *bot, *push_xbp, *pop_xbp, *instr, *enter, *leave;
+    instr_t *top, *bot;
+    uint push_list, pop_list;
+    int i;
 
     ASSERT(ilist != NULL);
     ci->num_callee_save_regs = 0;
@@ -5491,181 +5607,85 @@ analyze_callee_save_reg(dcontext_t *dcontext, callee_info_t *ci)
         /* zero or one instruction only, no callee save */
         return;
     }
-    /* 1. frame pointer usage analysis. */
-    /* i#392-c#4: frame pointer code might be in the middle
-     * 0xf771f390 <compiler_inscount>:      call   0xf7723a19 <get_pc_thunk>
-     * 0xf771f395 <compiler_inscount+5>:    add    $0x6c5f,%ecx
-     * 0xf771f39b <compiler_inscount+11>:   push   %ebp
-     * 0xf771f39c <compiler_inscount+12>:   mov    %esp,%ebp
-     * 0xf771f39e <compiler_inscount+14>:   mov    0x8(%ebp),%eax
-     * 0xf771f3a1 <compiler_inscount+17>:   pop    %ebp
-     * 0xf771f3a2 <compiler_inscount+18>:   add    %eax,0x494(%ecx)
-     * 0xf771f3a8 <compiler_inscount+24>:   ret
-     */
-    /* for easy of comparison, create push xbp, pop xbp */
-    push_xbp = INSTR_CREATE_push(dcontext, opnd_create_reg(DR_REG_R5));
-    pop_xbp  = INSTR_CREATE_pop(dcontext, opnd_create_reg(DR_REG_R5));
-    /* i#392-c#4: search for frame enter/leave pair */
-    enter = NULL;
-    leave = NULL;
-    for (instr = top; instr != bot; instr = instr_get_next(instr)) {
-        if (instr_get_opcode(instr) == OP_enter ||
-            instr_same(push_xbp, instr)) {
-            enter = instr;
-            break;
-        }
-    }
-    if (enter != NULL) {
-        for (instr = bot; instr != enter; instr = instr_get_prev(instr)) {
-            if (instr_get_opcode(instr) == OP_leave ||
-                instr_same(pop_xbp, instr)) {
-                leave = instr;
-                break;
-            }
-        }
-    }
-    /* Check enter/leave pair  */
-    if (enter != NULL && leave != NULL &&
-        (ci->bwd_tgt == NULL || instr_get_app_pc(enter) <  ci->bwd_tgt) &&
-        (ci->fwd_tgt == NULL || instr_get_app_pc(leave) >= ci->fwd_tgt)) {
-        /* check if xbp is fp */
-        if (instr_get_opcode(enter) == OP_enter) {
-            ci->xbp_is_fp = true;
-        } else {
-            /* i#392-c#2: mov xsp => xbp might not be right after push_xbp */
-            for (instr  = instr_get_next(enter);
-                 instr != leave;
-                 instr  = instr_get_next(instr)) {
-                if (instr != NULL &&
-                    /* we want to use instr_same to find "mov xsp => xbp",
-                     * but it could be OP_mov_ld or OP_mov_st, so use opnds
-                     * for comparison instead.
-                     */
-                    instr_num_srcs(instr) == 1 &&
-                    instr_num_dsts(instr) == 1 &&
-                    opnd_is_reg(instr_get_src(instr, 0)) &&
-                    opnd_get_reg(instr_get_src(instr, 0)) == DR_REG_R13 &&
-                    opnd_is_reg(instr_get_dst(instr, 0)) &&
-                    opnd_get_reg(instr_get_dst(instr, 0)) == DR_REG_R5) {
-                    /* found mov xsp => xbp */
-                    ci->xbp_is_fp = true;
-                    /* remove it */
-                    instrlist_remove(ilist, instr);
-                    instr_destroy(GLOBAL_DCONTEXT, instr);
-                    break;
-                }
-            }
-        }
-        if (ci->xbp_is_fp) {
-            LOG(THREAD, LOG_CLEANCALL, 2,
-                "CLEANCALL: callee "PFX" use XBP as frame pointer\n", ci->start);
-        } else {
-            LOG(THREAD, LOG_CLEANCALL, 2,
-                "CLEANCALL: callee "PFX" callee-saves reg xbp at "PFX" and "PFX"\n",
-                ci->start, instr_get_app_pc(enter), instr_get_app_pc(leave));
-            ci->callee_save_regs
-                [DR_REG_R5 - DR_REG_R0] = true;
-            ci->num_callee_save_regs++;
-        }
-        /* remove enter/leave or push/pop xbp pair */
-        instrlist_remove(ilist, enter);
-        instrlist_remove(ilist, leave);
-        instr_destroy(GLOBAL_DCONTEXT, enter);
-        instr_destroy(GLOBAL_DCONTEXT, leave);
-        top = instrlist_first(ilist);
-        bot = instrlist_last(ilist);
-    }
-    instr_destroy(dcontext, push_xbp);
-    instr_destroy(dcontext, pop_xbp);
-
-    /* get the rest callee save regs */
-    /* XXX: the callee save may be corrupted by memory update on the stack. */
-    /* XXX: the callee save may use mov instead of push/pop */
-    while (top != NULL && bot != NULL) {
-        /* if not in the first/last bb, break */
-        if ((ci->bwd_tgt != NULL && instr_get_app_pc(top) >= ci->bwd_tgt) ||
-            (ci->fwd_tgt != NULL && instr_get_app_pc(bot) <  ci->fwd_tgt) ||
-            instr_is_cti(top) || instr_is_cti(bot))
-            break;
-        /* XXX: I saw some compiler inserts nop, need to handle. */
-        /* push/pop pair check */
-        if (instr_get_opcode(top) != OP_push ||
-            instr_get_opcode(bot) != OP_pop  ||
-            !opnd_same(instr_get_src(top, 0), instr_get_dst(bot, 0)) ||
-            !opnd_is_reg(instr_get_src(top, 0)) ||
-            opnd_get_reg(instr_get_src(top, 0)) == REG_RR13)
-            break;
+    /* if not in the first/last bb, no pair */
+    if ((ci->bwd_tgt != NULL && instr_get_app_pc(top) >= ci->bwd_tgt) ||
+        (ci->fwd_tgt != NULL && instr_get_app_pc(bot) <  ci->fwd_tgt))
+        return;
+    /* XXX: the callee save may use str/ldr or stmdb/ldmia instead */
+    if (instr_get_opcode(top) != OP_push ||
+        instr_get_opcode(bot) != OP_pop  ||
+        instr_get_cond(top) != COND_ALWAYS ||
+        instr_get_cond(bot) != COND_ALWAYS ||
+        !opnd_is_reglist(instr_get_src(top, 0)) ||
+        !opnd_is_reglist(instr_get_src(bot, 0)))
+        return;
+    push_list = opnd_get_reg_list(instr_get_src(top, 0));
+    pop_list  = opnd_get_reg_list(instr_get_src(bot, 0));
+    /* lr is usually pushed only to be popped into pc */
+    if (TESTANY(REGLIST_R13 | REGLIST_R15, push_list) ||
+        (pop_list != push_list && pop_list != (push_list & ~REGLIST_R14)))
+        return;
+    for (i = 0; i <= DR_REG_R14 - DR_REG_R0; i++) {
+        if (!TEST(1 << i, pop_list))
+            continue;
         /* It is a callee saved reg, we will do our own save for it. */
         LOG(THREAD, LOG_CLEANCALL, 2,
             "CLEANCALL: callee "PFX" callee-saves reg %s at "PFX" and "PFX"\n",
-            ci->start, reg_names[opnd_get_reg(instr_get_src(top, 0))],
+            ci->start, reg_names[DR_REG_R0 + i],
             instr_get_app_pc(top), instr_get_app_pc(bot));
-        ci->callee_save_regs
-            [opnd_get_reg(instr_get_src(top, 0)) - DR_REG_R0] = true;
+        ci->callee_save_regs[i] = true;
         ci->num_callee_save_regs++;
-        /* remove & destroy the push/pop pairs */
-        instrlist_remove(ilist, top);
-        instr_destroy(GLOBAL_DCONTEXT, top);
-        instrlist_remove(ilist, bot);
-        instr_destroy(GLOBAL_DCONTEXT, bot);
-        /* get next pair */
-        top = instrlist_first(ilist);
-        bot = instrlist_last(ilist);
     }
-#endif
+    /* remove & destroy the push/pop pair */
+    instrlist_remove(ilist, top);
+    instr_destroy(GLOBAL_DCONTEXT, top);
+    instrlist_remove(ilist, bot);
+    instr_destroy(GLOBAL_DCONTEXT, bot);
 }
 
+/* Access to the user read/write or read-only thread ID register means the
+ * callee touches the app's TLS (errno, etc.).  With HAVE_TLS, DR also keeps
+ * its own base in the read/write one: see mangle_thread_register().
+ */
 static void
 analyze_callee_tls(dcontext_t *dcontext, callee_info_t *ci)
 {
-#ifdef NO
-    /* access to TLS means we do need to swap/preserve TEB/PEB fields
-     * for library isolation (errno, etc.)
-     */
     instr_t *instr;
-    int i;
     ci->tls_used = false;
     for (instr  = instrlist_first(ci->ilist);
          instr != NULL;
          instr  = instr_get_next(instr)) {
-        /* we assume any access via app's tls is to app errno. */
-        for (i = 0; i < instr_num_srcs(instr); i++) {
-            opnd_t opnd = instr_get_src(instr, i);
-            if (opnd_is_far_base_disp(opnd) &&
-                opnd_get_segment(opnd) == LIB_SEG_TLS)
-                ci->tls_used = true;
-        }
-        for (i = 0; i < instr_num_dsts(instr); i++) {
-            opnd_t opnd = instr_get_dst(instr, i);
-            if (opnd_is_far_base_disp(opnd) &&
-                opnd_get_segment(opnd) == LIB_SEG_TLS)
-                ci->tls_used = true;
+        int opc = instr_get_opcode(instr);
+        if (opc != OP_mrc && opc != OP_mcr)
+            continue;
+        /* The decoder does not fill in mrc/mcr operands, so we match
+         * p15, 0, <Rt>, c13, c0, {2,3} on the raw bits.
+         */
+        if (!instr_raw_bits_valid(instr) ||
+            (*(uint *)instr_get_raw_bits(instr) & 0x0fef0fdf) == 0x0e0d0f50) {
+            ci->tls_used = true;
+            break;
         }
     }
     if (ci->tls_used) {
         LOG(THREAD, LOG_CLEANCALL, 2,
-            "CLEANCALL: callee "PFX" accesses far memory\n", ci->start);
+            "CLEANCALL: callee "PFX" accesses thread registers\n", ci->start);
     }
-#endif
 }
 
 /* Pick a register to use as a base register pointing to our spill slots.
  * We can't use a register that is:
- * - DR_XSP (need a valid stack in case of fault)
- * - DR_XAX (could be used for args or aflags)
- * - REGPARM_0 on X64 (RDI on Lin and RCX on Win; for N>1 args, avoid REGPARM_<=N)
+ * - sp (need a valid stack in case of fault)
+ * - r0 (could be used for args or the cpsr)
+ * - lr or pc
  * - used by the callee
  */
 static void
 analyze_callee_pick_spill_reg(dcontext_t *dcontext, callee_info_t *ci)
 {
-#ifdef NO
     uint i;
-    for (i = 0; i < NUM_GP_REGS; i++) {
+    for (i = DR_REG_R1 - DR_REG_R0; i <= DR_REG_R12 - DR_REG_R0; i++) {
         reg_id_t reg = DR_REG_R0 + (reg_id_t)i;
-        if (reg == DR_REG_R13 ||
-            reg == DR_REG_R0 IF_X64(|| reg == REGPARM_0))
-            continue;
         if (!ci->reg_used[i]) {
             LOG(THREAD, LOG_CLEANCALL, 2,
                 "CLEANCALL: picking spill reg %s for callee "PFX"\n",
@@ -5675,50 +5695,96 @@ analyze_callee_pick_spill_reg(dcontext_t *dcontext, callee_info_t *ci)
         }
     }
 
-    /* This won't happen unless someone increases CLEANCALL_NUM_INLINE_SLOTS or
-     * handles calls with more arguments.  There are at least 8 GPRs, 4 spills,
-     * and 3 other regs we can't touch, so one will be available.
+    /* This won't happen unless the callee is close to the inline limit and
+     * touches every register.
      */
     LOG(THREAD, LOG_CLEANCALL, 2,
         "CLEANCALL: failed to pick spill reg for callee "PFX"\n", ci->start);
     /* Fail to inline by setting ci->spill_reg == DR_REG_INVALID. */
     ci->spill_reg = DR_REG_INVALID;
-#endif
+}
+
+/* Returns whether instr is add/sub sp, sp, #imm: frame setup or teardown */
+static bool
+callee_instr_is_sp_adjust(instr_t *instr)
+{
+    int opc = instr_get_opcode(instr);
+    opnd_t dst;
+    if (instr_get_cond(instr) != COND_ALWAYS || instr_num_dsts(instr) != 1)
+        return false;
+    dst = instr_get_dst(instr, 0);
+    if (!opnd_is_reg(dst) || opnd_get_reg(dst) != DR_REG_R13)
+        return false;
+    if (opc == OP_add_sp_imm || opc == OP_sub_sp_imm)
+        return true;
+    return ((opc == OP_add_imm || opc == OP_sub_imm) &&
+            opnd_is_reg(instr_get_src(instr, 0)) &&
+            opnd_get_reg(instr_get_src(instr, 0)) == DR_REG_R13);
+}
+
+/* Replaces the literal load instr, which would read a different literal
+ * once inlined, with the constant it loads.  The callee is in a loaded
+ * image so we assume its literal pool is not written to.
+ * Returns false if the literal cannot be read.
+ */
+static bool
+callee_replace_literal_load(dcontext_t *dcontext, callee_info_t *ci, instr_t *instr)
+{
+    app_pc pc = instr_get_app_pc(instr);
+    int disp = (int) opnd_get_immed_int(instr_get_src(instr, 0));
+    app_pc lit = pc + 8 + (instr_get_u_flag(instr) ? disp : -disp);
+    reg_id_t dst = opnd_get_reg(instr_get_dst(instr, 0));
+    uint val;
+    instr_t *prev, *in;
+
+    if (instr_get_cond(instr) != COND_ALWAYS ||
+        !safe_read(lit, sizeof(val), &val))
+        return false;
+    LOG(THREAD, LOG_CLEANCALL, 3,
+        "CLEANCALL: replacing literal load of "PFX" at "PFX" by its value 0x%x.\n",
+        lit, pc, val);
+    prev = instr_get_prev(instr);
+    insert_mov_imm32(GLOBAL_DCONTEXT, ci->ilist, instr, dst, val);
+    for (in  = (prev == NULL) ? instrlist_first(ci->ilist) : instr_get_next(prev);
+         in != instr;
+         in  = instr_get_next(in))
+        instr_set_translation(in, pc);
+    instrlist_remove(ci->ilist, instr);
+    instr_destroy(GLOBAL_DCONTEXT, instr);
+    return true;
 }
 
 static void
 analyze_callee_inline(dcontext_t *dcontext, callee_info_t *ci)
 {
-#ifdef NO
-//TODO SJF
     instr_t *instr, *next_instr;
-    opnd_t opnd, mem_ref, slot;
+    opnd_t opnd;
     bool opt_inline = true;
-    int i;
+    int i, j;
+    int local_disp = 0;
 
-    mem_ref = opnd_create_null();
     /* a set of condition checks */
     if (INTERNAL_OPTION(opt_cleancall) < 2) {
         LOG(THREAD, LOG_CLEANCALL, 1,
-            "CLEANCALL: callee "PFX" cannot be inlined: opt_cleancall: %d.\n", 
+            "CLEANCALL: callee "PFX" cannot be inlined: opt_cleancall: %d.\n",
             ci->start, INTERNAL_OPTION(opt_cleancall));
         opt_inline = false;
     }
     if (ci->num_instrs > MAX_NUM_INLINE_INSTRS) {
         LOG(THREAD, LOG_CLEANCALL, 1,
-            "CLEANCALL: callee "PFX" cannot be inlined: num of instrs: %d.\n", 
+            "CLEANCALL: callee "PFX" cannot be inlined: num of instrs: %d.\n",
             ci->start, ci->num_instrs);
         opt_inline = false;
     }
     if (ci->bwd_tgt != NULL || ci->fwd_tgt != NULL) {
         LOG(THREAD, LOG_CLEANCALL, 1,
-            "CLEANCALL: callee "PFX" cannot be inlined: has control flow.\n", 
+            "CLEANCALL: callee "PFX" cannot be inlined: has control flow.\n",
             ci->start);
         opt_inline = false;
     }
-    if (ci->num_xmms_used != 0) {
+    if (ci->vfp_used) {
         LOG(THREAD, LOG_CLEANCALL, 1,
-            "CLEANCALL: callee "PFX" cannot be inlined: uses XMM.\n", 
+            "CLEANCALL: callee "PFX" cannot be inlined: uses VFP/NEON.\n",
             ci->start);
         opt_inline = false;
     }
@@ -5734,7 +5800,7 @@ analyze_callee_inline(dcontext_t *dcontext, callee_info_t *ci)
             " unable to pick spill reg.\n", ci->start);
         opt_inline = false;
     }
-    if (!SCRATCH_ALWAYS_TLS() || ci->slots_used > CLEANCALL_NUM_INLINE_SLOTS) {
+    if (ci->slots_used > CLEANCALL_NUM_INLINE_SLOTS) {
         LOG(THREAD, LOG_CLEANCALL, 1,
             "CLEANCALL: callee "PFX" cannot be inlined:"
             " not enough scratch slots.\n", ci->start);
@@ -5753,38 +5819,20 @@ analyze_callee_inline(dcontext_t *dcontext, callee_info_t *ci)
     for (instr  = instrlist_first(ci->ilist);
          instr != NULL;
          instr  = next_instr) {
-        uint opc = instr_get_opcode(instr);
+        int opc = instr_get_opcode(instr);
         next_instr = instr_get_next(instr);
         /* sanity checks on stack usage */
-        if (instr_writes_to_reg(instr, DR_REG_R5) && ci->xbp_is_fp) {
-            /* xbp must not be changed if xbp is used for frame pointer */
-            LOG(THREAD, LOG_CLEANCALL, 1,
-                "CLEANCALL: callee "PFX" cannot be inlined: XBP is updated.\n",
-                ci->start);
-            opt_inline = false;
-            break;
-        } else if (instr_writes_to_reg(instr, DR_REG_R13)) {
+        if (instr_writes_to_reg(instr, DR_REG_R13) ||
+            opc == OP_push || opc == OP_pop) {
             /* stack pointer update, we only allow:
-             * lea [xsp, disp] => xsp
-             * xsp + imm_int => xsp
-             * xsp - imm_int => xsp
+             * add sp, sp, #imm
+             * sub sp, sp, #imm
              */
             if (ci->has_locals) {
                 /* we do not allow stack adjustment after accessing the stack */
                 opt_inline = false;
             }
-            if (opc == OP_lea) {
-                /* lea [xsp, disp] => xsp */
-                opnd = instr_get_src(instr, 0);
-                if (!opnd_is_base_disp(opnd)           ||
-                    opnd_get_base(opnd)  != DR_REG_R13 ||
-                    opnd_get_index(opnd) != DR_REG_NULL)
-                    opt_inline = false;
-            } else if (opc == OP_sub || opc == OP_add) {
-                /* xsp +/- int => xsp */
-                if (!opnd_is_immed_int(instr_get_src(instr, 0)))
-                    opt_inline = false;
-            } else {
+            if (!callee_instr_is_sp_adjust(instr)) {
                 /* other cases like push/pop are not allowed */
                 opt_inline = false;
             }
@@ -5802,83 +5850,61 @@ analyze_callee_inline(dcontext_t *dcontext, callee_info_t *ci)
                     ci->start, instr_get_app_pc(instr));
                 break;
             }
-        } else if (instr_reg_in_src(instr, DR_REG_R13) ||
-                   (instr_reg_in_src(instr, DR_REG_R5) && ci->xbp_is_fp)) {
-            /* Detect stack address leakage */
-            /* lea [xsp/xbp] */
-            if (opc == OP_lea)
-                opt_inline = false;
-            /* any direct use reg xsp or xbp */
-            for (i = 0; i < instr_num_srcs(instr); i++) {
-                opnd_t src = instr_get_src(instr, i);
-                if (opnd_is_reg(src) &&
-                    (reg_overlap(REG_RR13, opnd_get_reg(src))  ||
-                     (reg_overlap(REG_RR5, opnd_get_reg(src)) && ci->xbp_is_fp)))
-                    break;
-            }
-            if (i != instr_num_srcs(instr))
-                opt_inline = false;
-            if (!opt_inline) {
+        }
+        /* The pc reads differently once inlined.  Literal loads become
+         * constants; any other use of the pc stops us.
+         */
+        if (opc == OP_ldr_lit) {
+            if (!callee_replace_literal_load(dcontext, ci, instr)) {
                 LOG(THREAD, LOG_CLEANCALL, 1,
                     "CLEANCALL: callee "PFX" cannot be inlined: "
-                    "stack pointer leaked "PFX".\n",
+                    "unreadable literal at "PFX".\n",
                     ci->start, instr_get_app_pc(instr));
+                opt_inline = false;
                 break;
             }
+            continue;
         }
-        /* Check how many stack variables the callee has.
-         * We will not inline the callee if it has more than one stack variable.
+        if (instr_reg_in_src(instr, DR_REG_R15) || opc == OP_adr ||
+            opc == OP_ldrb_lit || opc == OP_ldrh_lit || opc == OP_ldrd_lit ||
+            opc == OP_ldrsb_lit || opc == OP_ldrsh_lit ||
+            opc == OP_ldc_lit || opc == OP_ldc2_lit ||
+            opc == OP_pld_lit || opc == OP_pldw_lit || opc == OP_pli_lit) {
+            LOG(THREAD, LOG_CLEANCALL, 1,
+                "CLEANCALL: callee "PFX" cannot be inlined: "
+                "pc-relative access at "PFX".\n",
+                ci->start, instr_get_app_pc(instr));
+            opt_inline = false;
+            break;
+        }
+        /* Check how many stack variables the callee has.  We will not
+         * inline the callee if it has more than one, or reaches it other
+         * than with a plain [sp, #imm] ldr or str.
          */
-        if (instr_reads_memory(instr)) {
-            for (i = 0; i < instr_num_srcs(instr); i++) {
-                opnd = instr_get_src(instr, i);
-                if (!opnd_is_base_disp(opnd))
-                    continue;
-                if (opnd_get_base(opnd) != DR_REG_R13 &&
-                    (opnd_get_base(opnd) != DR_REG_R5 || !ci->xbp_is_fp))
-                    continue;
-                if (!ci->has_locals) {
-                    /* We see the first one, remember it. */
-                    mem_ref = opnd;
-                    callee_info_reserve_slot(ci, SLOT_LOCAL, 0);
-                    if (ci->slots_used > CLEANCALL_NUM_INLINE_SLOTS) {
-                        LOG(THREAD, LOG_CLEANCALL, 1,
-                            "CLEANCALL: callee "PFX" cannot be inlined: "
-                            "not enough slots for local.\n",
-                            ci->start);
-                        break;
-                    }
-                    ci->has_locals = true;
-                } else if (!opnd_same(opnd, mem_ref)) {
-                    /* Check if it is the same stack var as the one we saw.
-                     * If different, no inline. 
-                     */
-                    LOG(THREAD, LOG_CLEANCALL, 1,
-                        "CLEANCALL: callee "PFX" cannot be inlined: "
-                        "more than one stack location is accessed "PFX".\n",
-                        ci->start, instr_get_app_pc(instr));
-                    break;
-                }
-                /* replace the stack location with the scratch slot. */
-                slot = callee_info_slot_opnd(ci, SLOT_LOCAL, 0);
-                opnd_set_size(&slot, opnd_get_size(mem_ref));
-                instr_set_src(instr, i, slot);
-            }
-            if (i != instr_num_srcs(instr)) {
-                opt_inline = false;
+        for (i = 0; i < instr_num_srcs(instr); i++) {
+            opnd = instr_get_src(instr, i);
+            if (opnd_is_mem_reg(opnd) && opnd_get_mem_reg(opnd) == DR_REG_R13)
                 break;
-            }
         }
-        if (instr_writes_memory(instr)) {
-            for (i = 0; i < instr_num_dsts(instr); i++) {
-                opnd = instr_get_dst(instr, i);
-                if (!opnd_is_base_disp(opnd))
-                    continue;
-                if (opnd_get_base(opnd) != DR_REG_R13 &&
-                    (opnd_get_base(opnd) != DR_REG_R5 || !ci->xbp_is_fp))
-                    continue;
+        for (j = 0; j < instr_num_dsts(instr); j++) {
+            opnd = instr_get_dst(instr, j);
+            if (opnd_is_mem_reg(opnd) && opnd_get_mem_reg(opnd) == DR_REG_R13)
+                break;
+        }
+        if (i < instr_num_srcs(instr) || j < instr_num_dsts(instr)) {
+            int disp;
+            if (j < instr_num_dsts(instr) ||
+                (opc != OP_ldr_imm && opc != OP_str_imm) || i != 0 ||
+                instr_get_cond(instr) != COND_ALWAYS ||
+                !instr_get_p_flag(instr) || instr_get_w_flag(instr)) {
+                opt_inline = false;
+            } else {
+                disp = (int) opnd_get_immed_int(instr_get_src(instr, 1));
+                if (!instr_get_u_flag(instr))
+                    disp = -disp;
                 if (!ci->has_locals) {
-                    mem_ref = opnd;
+                    /* We see the first one, remember it. */
+                    local_disp = disp;
                     callee_info_reserve_slot(ci, SLOT_LOCAL, 0);
                     if (ci->slots_used > CLEANCALL_NUM_INLINE_SLOTS) {
                         LOG(THREAD, LOG_CLEANCALL, 1,
@@ -5888,23 +5914,37 @@ analyze_callee_inline(dcontext_t *dcontext, callee_info_t *ci)
                         break;
                     }
                     ci->has_locals = true;
-                } else if (!opnd_same(opnd, mem_ref)) {
+                } else if (disp != local_disp) {
                     /* currently we only allows one stack refs */
-                    LOG(THREAD, LOG_CLEANCALL, 1,
-                        "CLEANCALL: callee "PFX" cannot be inlined: "
-                        "more than one stack location is accessed "PFX".\n",
-                        ci->start, instr_get_app_pc(instr));
-                    break;
+                    opt_inline = false;
                 }
-                /* replace the stack location with the scratch slot. */
-                slot = callee_info_slot_opnd(ci, SLOT_LOCAL, 0);
-                opnd_set_size(&slot, opnd_get_size(mem_ref));
-                instr_set_dst(instr, i, slot);
             }
-            if (i != instr_num_dsts(instr)) {
-                opt_inline = false;
+            if (!opt_inline) {
+                LOG(THREAD, LOG_CLEANCALL, 1,
+                    "CLEANCALL: callee "PFX" cannot be inlined: "
+                    "complicated or more than one stack location accessed "PFX".\n",
+                    ci->start, instr_get_app_pc(instr));
                 break;
             }
+            /* replace the stack location with the scratch slot. */
+            instr_set_src(instr, 0, opnd_create_mem_reg(ci->spill_reg));
+            instr_set_src(instr, 1, OPND_CREATE_IMM12
+                          (callee_info_slot_disp(ci, SLOT_LOCAL, 0)));
+            instr_set_u_flag(GLOBAL_DCONTEXT, instr, true);
+            continue;
+        }
+        /* Detect stack address leakage: any other use of sp, including
+         * the sp-relative add/sub forms writing other registers.
+         */
+        if (instr_reg_in_src(instr, DR_REG_R13) ||
+            opc == OP_add_sp_imm || opc == OP_sub_sp_imm ||
+            opc == OP_add_sp_reg || opc == OP_sub_sp_reg) {
+            LOG(THREAD, LOG_CLEANCALL, 1,
+                "CLEANCALL: callee "PFX" cannot be inlined: "
+                "stack pointer leaked "PFX".\n",
+                ci->start, instr_get_app_pc(instr));
+            opt_inline = false;
+            break;
         }
     }
     if (instr == NULL && opt_inline) {
@@ -5918,7 +5958,6 @@ analyze_callee_inline(dcontext_t *dcontext, callee_info_t *ci)
         instrlist_clear_and_destroy(GLOBAL_DCONTEXT, ci->ilist);
         ci->ilist = NULL;
     }
-#endif
 }
 
 static void
@@ -5929,6 +5968,7 @@ analyze_callee_ilist(dcontext_t *dcontext, callee_info_t *ci)
     if (INTERNAL_OPTION(opt_cleancall) >= 1) {
         analyze_callee_save_reg(dcontext, ci);
     }
+    analyze_callee_vfp_usage(dcontext, ci);
     analyze_callee_regs_usage(dcontext, ci);
     if (INTERNAL_OPTION(opt_cleancall) < 1) {
         instrlist_clear_and_destroy(GLOBAL_DCONTEXT, ci->ilist);
@@ -5941,31 +5981,31 @@ analyze_callee_ilist(dcontext_t *dcontext, callee_info_t *ci)
 }
 
 static void
-analyze_clean_call_aflags(dcontext_t *dcontext, 
+analyze_clean_call_aflags(dcontext_t *dcontext,
                           clean_call_info_t *cci, instr_t *where)
 {
-#ifdef NO
-//TODO SJF
     callee_info_t *ci = cci->callee_info;
     instr_t *instr;
+    bool all;
 
-    /* If there's a flags read, we clear the flags.  If there's a write or read,
-     * we save them, because a read creates a clear which is a write. */
-    cci->skip_clear_eflags = !ci->read_aflags;
-    cci->skip_save_aflags  = !(ci->write_aflags || ci->read_aflags);
+    /* There is no flag we have to clear for the callee, like x86's DF, so
+     * we only save the cpsr if the callee writes it: a read just sees the
+     * app's flags.
+     */
+    cci->skip_clear_eflags = true;
+    cci->skip_save_aflags  = !ci->write_aflags;
     /* XXX: this is a more aggressive optimization by analyzing the ilist
      * to be instrumented. The client may change the ilist, which violate
-     * the analysis result. For example, 
+     * the analysis result. For example,
      * I do not need save the aflags now if an instruction
      * after "where" updating all aflags, but later the client can
      * insert an instruction reads the aflags before that instruction.
      */
     if (INTERNAL_OPTION(opt_cleancall) > 1 && !cci->skip_save_aflags) {
         for (instr = where; instr != NULL; instr = instr_get_next(instr)) {
-            uint flags = instr_get_arith_flags(instr);
-            if (TESTANY(EFLAGS_READ_6, flags) || instr_is_cti(instr))
+            if (instr_reads_nzcv(instr) || instr_is_cti(instr))
                 break;
-            if (TESTALL(EFLAGS_WRITE_6, flags)) {
+            if (instr_writes_nzcv(instr, &all) && all) {
                 LOG(THREAD, LOG_CLEANCALL, 2,
                     "CLEANCALL: inserting clean call "PFX
                     ", skip saving aflags.\n", ci->start);
@@ -5974,69 +6014,62 @@ analyze_clean_call_aflags(dcontext_t *dcontext,
             }
         }
     }
-#endif
 }
 
 static void
 analyze_clean_call_regs(dcontext_t *dcontext, clean_call_info_t *cci)
 {
-#ifdef NO
-//TODO SJF
     uint i, num_regparm;
     callee_info_t *info = cci->callee_info;
 
-    /* 1. xmm registers */
-    for (i = 0; i < NUM_XMM_REGS; i++) {
-        if (info->xmm_used[i]) {
-            cci->xmm_skip[i] = false;
-        } else {
-            LOG(THREAD, LOG_CLEANCALL, 3,
-                "CLEANCALL: if inserting clean call "PFX
-                ", skip saving XMM%d.\n", info->start, i);
-            cci->xmm_skip[i] = true;
-            cci->num_xmms_skip++;
-        }
+    /* 1. Q registers: we only reserve their slots, all or nothing */
+    if (!info->vfp_used) {
+        LOG(THREAD, LOG_CLEANCALL, 3,
+            "CLEANCALL: if inserting clean call "PFX
+            ", skip saving Q registers.\n", info->start);
+        for (i = 0; i < NUM_QR_REGS; i++)
+            cci->qr_skip[i] = true;
+        cci->num_qr_skip = NUM_QR_REGS;
     }
-    if (INTERNAL_OPTION(opt_cleancall) > 2 && cci->num_xmms_skip != NUM_XMM_REGS)
-        cci->should_align = false;
     /* 2. general purpose registers */
-    /* set regs not to be saved for clean call */
+    /* set regs not to be saved for clean call.  The decoder leaves out the
+     * operands of some VFP/NEON and coprocessor instrs, which may write a
+     * GPR, so we can't trust reg_used if the callee has any.
+     */
     for (i = 0; i < NUM_GP_REGS; i++) {
-        if (info->reg_used[i]) {
+        if (info->reg_used[i] || info->vfp_used) {
             cci->reg_skip[i] = false;
         } else {
             LOG(THREAD, LOG_CLEANCALL, 3,
                 "CLEANCALL: if inserting clean call "PFX
-                ", skip saving reg %s.\n", 
+                ", skip saving reg %s.\n",
                 info->start, reg_names[DR_REG_R0 + (reg_id_t)i]);
             cci->reg_skip[i] = true;
             cci->num_regs_skip++;
         }
     }
-    /* we need save/restore rax if save aflags because rax is used */
+    /* we need save/restore r0 if save aflags because r0 is used */
     if (!cci->skip_save_aflags && cci->reg_skip[0]) {
         LOG(THREAD, LOG_CLEANCALL, 3,
             "CLEANCALL: if inserting clean call "PFX
-            ", cannot skip saving reg xax.\n", info->start);
+            ", cannot skip saving reg r0.\n", info->start);
         cci->reg_skip[0] = false;
-        cci->num_regs_skip++;
+        cci->num_regs_skip--;
     }
-    /* i#987: args are passed via regs in 64-bit, which will clober those regs,
+    /* i#987: args are passed via regs, which will clober those regs,
      * so we should not skip any regs that are used for arg passing.
-     * XXX: we do not support args passing via XMMs, 
-     * see docs for dr_insert_clean_call
      * XXX: we can elminate the arg passing instead since it is not used
      * if marked for skip. However, we have to handle cases like some args
      * are used and some are not.
      */
-    num_regparm = cci->num_args < NUM_REGPARM ? cci->num_args : NUM_REGPARM;
+    num_regparm = MIN(cci->num_args, NUM_AAPCS_REGPARM);
     for (i = 0; i < num_regparm; i++) {
-        if (cci->reg_skip[regparms[i] - DR_REG_R0]) {
+        if (cci->reg_skip[i]) {
             LOG(THREAD, LOG_CLEANCALL, 3,
                 "CLEANCALL: if inserting clean call "PFX
                 ", cannot skip saving reg %s due to param passing.\n",
-                info->start, reg_names[regparms[i]]);
-            cci->reg_skip[regparms[i] - DR_REG_R0] = false;
+                info->start, reg_names[DR_REG_R0 + (reg_id_t)i]);
+            cci->reg_skip[i] = false;
             cci->num_regs_skip--;
             /* We cannot call callee_info_reserve_slot for reserving slot
              * on inlining the callee here, because we are in clean call
@@ -6049,7 +6082,6 @@ analyze_clean_call_regs(dcontext_t *dcontext, clean_call_info_t *cci)
              */
         }
     }
-#endif
 }
 
 static void
@@ -6057,11 +6089,9 @@ analyze_clean_call_args(dcontext_t *dcontext,
                         clean_call_info_t *cci,
                         opnd_t *args)
 {
-#ifdef NO
-//TODO SJF
     uint i, j, num_regparm;
 
-    num_regparm = cci->num_args < NUM_REGPARM ? cci->num_args : NUM_REGPARM;
+    num_regparm = MIN(cci->num_args, NUM_AAPCS_REGPARM);
     /* If a param uses a reg, DR need restore register value, which assumes
      * the full context switch with priv_mcontext_t layout,
      * in which case we need keep priv_mcontext_t layout.
@@ -6071,18 +6101,18 @@ analyze_clean_call_args(dcontext_t *dcontext,
         if (opnd_is_reg(args[i]))
             cci->save_all_regs = true;
         for (j = 0; j < num_regparm; j++) {
-            if (opnd_uses_reg(args[i], regparms[j]))
+            if (opnd_uses_reg(args[i], DR_REG_R0 + (reg_id_t)j))
                 cci->save_all_regs = true;
         }
     }
     /* We only set cci->reg_skip all to false later if we fail to inline.  We
      * only need to preserve the layout if we're not inlining.
      */
-#endif
 }
 
 static bool
-analyze_clean_call_inline(dcontext_t *dcontext, clean_call_info_t *cci)
+analyze_clean_call_inline(dcontext_t *dcontext, clean_call_info_t *cci,
+                          opnd_t *args)
 {
     callee_info_t *info = cci->callee_info;
     bool opt_inline = true;
@@ -6106,6 +6136,16 @@ analyze_clean_call_inline(dcontext_t *dcontext, clean_call_info_t *cci)
             info->start);
         opt_inline = false;
     }
+    if (cci->num_args > 0 &&
+        ((!opnd_is_immed_int(args[0]) && !opnd_is_reg(args[0]) &&
+          !opnd_is_pc(args[0])) ||
+         opnd_uses_reg(args[0], DR_REG_R13) ||
+         opnd_uses_reg(args[0], DR_REG_R15))) {
+        LOG(THREAD, LOG_CLEANCALL, 2,
+            "CLEANCALL: fail inlining clean call "PFX", complex arg.\n",
+            info->start);
+        opt_inline = false;
+    }
     if (cci->save_fpstate) {
         LOG(THREAD, LOG_CLEANCALL, 2,
             "CLEANCALL: fail inlining clean call "PFX", saving fpstate.\n",
@@ -6137,11 +6177,32 @@ analyze_clean_call_inline(dcontext_t *dcontext, clean_call_info_t *cci)
         } else {
             uint i;
             for (i = 0; i < NUM_GP_REGS; i++) {
-                if (!cci->reg_skip[i] && info->callee_save_regs[i]) {
+                reg_id_t reg = DR_REG_R0 + (reg_id_t)i;
+                /* The bl we emit clobbers lr, and r8-r10 are scratch for
+                 * materializing args and reaching a far callee.
+                 */
+                if (reg == DR_REG_R14 ||
+                    (reg >= DR_REG_R8 && reg <= DR_REG_R10)) {
+                    if (cci->reg_skip[i]) {
+                        cci->reg_skip[i] = false;
+                        cci->num_regs_skip--;
+                    }
+                    continue;
+                }
+                /* A register the callee uses is skipped only if we saw the
+                 * callee save and restore it itself: the AAPCS alone is no
+                 * proof for hand-written code.  Decoding got this far, so the
+                 * callee makes no calls and cannot reach the mcontext slots
+                 * we leave unfilled.
+                 */
+                if (!cci->reg_skip[i] && reg >= DR_REG_R4 && reg <= DR_REG_R12 &&
+                    info->callee_save_regs[i]) {
                     cci->reg_skip[i] = true;
                     cci->num_regs_skip++;
                 }
             }
+            if (cci->num_regs_skip > 0)
+                STATS_INC(cleancall_gpr_save_skipped);
         }
         if (cci->skip_save_aflags) {
             STATS_INC(cleancall_aflags_save_skipped);
@@ -6189,14 +6250,22 @@ analyze_clean_call(dcontext_t *dcontext, clean_call_info_t *cci, instr_t *where,
         ci->start = (app_pc)callee;
         return false;
     }
-    /* 5. aflags optimization analysis */
+    /* 5. fpstate: no need to save what the callee never touches */
+    if (cci->save_fpstate && !ci->vfp_used) {
+        LOG(THREAD, LOG_CLEANCALL, 2,
+            "CLEANCALL: inserting clean call "PFX", skip saving fpstate.\n",
+            ci->start);
+        cci->save_fpstate = false;
+        STATS_INC(cleancall_fpstate_save_skipped);
+    }
+    /* 6. aflags optimization analysis */
     analyze_clean_call_aflags(dcontext, cci, where);
-    /* 6. register optimization analysis */
+    /* 7. register optimization analysis */
     analyze_clean_call_regs(dcontext, cci);
-    /* 7. check arguments */
+    /* 8. check arguments */
     analyze_clean_call_args(dcontext, cci, args);
-    /* 8. inline optimization analysis */
-    if (analyze_clean_call_inline(dcontext, cci))
+    /* 9. inline optimization analysis */
+    if (analyze_clean_call_inline(dcontext, cci, args))
         return true;
     /* by default, no inline optimization */
     return false;
@@ -6215,9 +6284,12 @@ insert_inline_reg_save(dcontext_t *dcontext, clean_call_info_t *cci,
         return;
     }
 
-    /* Spill a register to TLS and point it at our unprotected_context_t. */
-    PRE(ilist, where, instr_create_save_to_tls
-        (dcontext, ci->spill_reg, TLS_R0_SLOT));
+    /* Spill a register to the app stack and point it at our
+     * unprotected_context_t.  We can't reach a TLS slot without a free
+     * register, so the stack is the only place to put it.
+     */
+    PRE(ilist, where, INSTR_CREATE_push
+        (dcontext, opnd_create_reg_list(1 << HW_REG(ci->spill_reg)), COND_ALWAYS));
     insert_get_mcontext_base(dcontext, ilist, where, ci->spill_reg);
 
     /* Save used registers. */
@@ -6227,24 +6299,24 @@ insert_inline_reg_save(dcontext_t *dcontext, clean_call_info_t *cci,
             LOG(THREAD, LOG_CLEANCALL, 2,
                 "CLEANCALL: inlining clean call "PFX", saving reg %s.\n",
                 ci->start, reg_names[reg_id]);
-            PRE(ilist, where, INSTR_CREATE_mov_reg
-                (dcontext, callee_info_slot_opnd(ci, SLOT_REG, reg_id),
-                 opnd_create_reg(reg_id), COND_ALWAYS));
+            PRE(ilist, where, create_ldst_imm
+                (dcontext, true, reg_id, ci->spill_reg,
+                 callee_info_slot_disp(ci, SLOT_REG, reg_id)));
         }
     }
 
-    /* Save aflags if necessary via XAX, which was just saved if needed. */
+    /* Save aflags if necessary via r0, which was just saved if needed. */
     if (!cci->skip_save_aflags) {
         ASSERT(!cci->reg_skip[DR_REG_R0 - DR_REG_R0]);
-        dr_save_arith_flags_to_xax(dcontext, ilist, where);
-        PRE(ilist, where, INSTR_CREATE_mov_reg
-            (dcontext, callee_info_slot_opnd(ci, SLOT_FLAGS, 0),
-             opnd_create_reg(DR_REG_R0), COND_ALWAYS));
-        /* Restore app XAX here if it's needed to materialize the argument. */
+        PRE(ilist, where, INSTR_CREATE_mrs_cpsr(dcontext, DR_REG_R0));
+        PRE(ilist, where, create_ldst_imm
+            (dcontext, true, DR_REG_R0, ci->spill_reg,
+             callee_info_slot_disp(ci, SLOT_FLAGS, 0)));
+        /* Restore app r0 here if it's needed to materialize the argument. */
         if (cci->num_args > 0 && opnd_uses_reg(args[0], DR_REG_R0)) {
-            PRE(ilist, where, INSTR_CREATE_mov_imm
-                (dcontext, opnd_create_reg(DR_REG_R0),
-                 callee_info_slot_opnd(ci, SLOT_REG, DR_REG_R0), COND_ALWAYS));
+            PRE(ilist, where, create_ldst_imm
+                (dcontext, false, DR_REG_R0, ci->spill_reg,
+                 callee_info_slot_disp(ci, SLOT_REG, DR_REG_R0)));
         }
     }
 }
@@ -6262,12 +6334,12 @@ insert_inline_reg_restore(dcontext_t *dcontext, clean_call_info_t *cci,
         return;
     }
 
-    /* Restore aflags before regs because it uses xax. */
+    /* Restore aflags before regs because it uses r0. */
     if (!cci->skip_save_aflags) {
-        PRE(ilist, where, INSTR_CREATE_mov_imm
-            (dcontext, opnd_create_reg(DR_REG_R0),
-             callee_info_slot_opnd(ci, SLOT_FLAGS, 0), COND_ALWAYS));
-        dr_restore_arith_flags_from_xax(dcontext, ilist, where);
+        PRE(ilist, where, create_ldst_imm
+            (dcontext, false, DR_REG_R0, ci->spill_reg,
+             callee_info_slot_disp(ci, SLOT_FLAGS, 0)));
+        PRE(ilist, where, INSTR_CREATE_msr_cpsr(dcontext, DR_REG_R0));
     }
 
     /* Now restore all registers. */
@@ -6277,36 +6349,31 @@ insert_inline_reg_restore(dcontext_t *dcontext, clean_call_info_t *cci,
             LOG(THREAD, LOG_CLEANCALL, 2,
                 "CLEANCALL: inlining clean call "PFX", restoring reg %s.\n",
                 ci->start, reg_names[reg_id]);
-            PRE(ilist, where, INSTR_CREATE_mov_imm
-                (dcontext, opnd_create_reg(reg_id),
-                 callee_info_slot_opnd(ci, SLOT_REG, reg_id), COND_ALWAYS));
+            PRE(ilist, where, create_ldst_imm
+                (dcontext, false, reg_id, ci->spill_reg,
+                 callee_info_slot_disp(ci, SLOT_REG, reg_id)));
         }
     }
 
     /* Restore reg used for unprotected_context_t pointer. */
-    PRE(ilist, where, instr_create_restore_from_tls
-        (dcontext, ci->spill_reg, TLS_R0_SLOT));
+    PRE(ilist, where, INSTR_CREATE_pop
+        (dcontext, opnd_create_reg_list(1 << HW_REG(ci->spill_reg)), COND_ALWAYS));
 }
 
 static void
 insert_inline_arg_setup(dcontext_t *dcontext, clean_call_info_t *cci,
                         instrlist_t *ilist, instr_t *where, opnd_t *args)
 {
-#ifdef NO
-    reg_id_t regparm;
     callee_info_t *ci = cci->callee_info;
     opnd_t arg;
-    bool restored_spill_reg = false;
 
     if (cci->num_args == 0)
         return;
 
     /* If the arg is un-referenced, don't set it up.  This is actually necessary
-     * for correctness because we will not have spilled regparm[0] on x64 or
-     * reserved SLOT_LOCAL for x86_32.
+     * for correctness because we will not have spilled r0.
      */
-    if (IF_X64_ELSE(!ci->reg_used[regparms[0] - DR_REG_R0],
-                    !ci->has_locals)) {
+    if (!ci->reg_used[DR_REG_R0 - DR_REG_R0]) {
         LOG(THREAD, LOG_CLEANCALL, 2,
             "CLEANCALL: callee "PFX" doesn't read arg, skipping arg setup.\n",
             ci->start);
@@ -6315,73 +6382,28 @@ insert_inline_arg_setup(dcontext_t *dcontext, clean_call_info_t *cci,
 
     ASSERT(cci->num_args == 1);
     arg = args[0];
-    regparm = shrink_reg_for_param(IF_X64_ELSE(regparms[0], DR_REG_R0), arg);
-
-    if (opnd_uses_reg(arg, ci->spill_reg)) {
-        if (opnd_is_reg(arg)) {
-            /* Trying to pass the spill reg (or a subreg) as the arg. */
-            reg_id_t arg_reg = opnd_get_reg(arg);
-            arg = opnd_create_tls_slot(os_tls_offset(TLS_R0_SLOT));
-            opnd_set_size(&arg, reg_get_size(arg_reg));
-            if (arg_reg == DR_REG_AH ||  /* Don't rely on ordering. */
-                arg_reg == DR_REG_BH ||
-                arg_reg == DR_REG_CH ||
-                arg_reg == DR_REG_DH) {
-                /* If it's one of the high sub-registers, add 1 to offset. */
-                opnd_set_disp(&arg, opnd_get_disp(arg) + 1);
-            }
-        } else {
-            /* Too complicated to rewrite if it's embedded in the operand.  Just
-             * restore spill_reg during the arg materialization.  Hopefully this
-             * doesn't happen very often.
-             */
-            PRE(ilist, where, instr_create_restore_from_tls
-                (dcontext, ci->spill_reg, TLS_XAX_SLOT));
-            DOLOG(2, LOG_CLEANCALL, {
-                char disas_arg[MAX_OPND_DIS_SZ];
-                opnd_disassemble_to_buffer(dcontext, arg, disas_arg,
-                                           BUFFER_SIZE_ELEMENTS(disas_arg));
-                LOG(THREAD, LOG_CLEANCALL, 2,
-                    "CLEANCALL: passing arg %s using spill reg %s to callee "PFX" "
-                    "requires extra spills, consider using a different register.\n",
-                    disas_arg, reg_names[ci->spill_reg], ci->start);
-            });
-            restored_spill_reg = true;
-        }
-    }
-
     LOG(THREAD, LOG_CLEANCALL, 2,
         "CLEANCALL: inlining clean call "PFX", passing arg via reg %s.\n",
-        ci->start, reg_names[regparm]);
+        ci->start, reg_names[DR_REG_R0]);
+    /* analyze_clean_call_inline() only lets through these three kinds */
     if (opnd_is_immed_int(arg)) {
-        PRE(ilist, where, INSTR_CREATE_mov_imm
-            (dcontext, opnd_create_reg(regparm), arg, COND_ALWAYS));
+        insert_mov_imm32(dcontext, ilist, where, DR_REG_R0,
+                         (uint) opnd_get_immed_int(arg));
+    } else if (opnd_is_pc(arg)) {
+        insert_mov_imm32(dcontext, ilist, where, DR_REG_R0,
+                         (uint)(ptr_uint_t) opnd_get_pc(arg));
     } else {
-        PRE(ilist, where, INSTR_CREATE_mov_imm
-            (dcontext, opnd_create_reg(regparm), arg, COND_ALWAYS));
-    }
-
-    /* Put the unprotected_context_t pointer back in spill_reg if we needed to
-     * restore the app value.
-     */
-    if (restored_spill_reg) {
-        insert_get_mcontext_base(dcontext, ilist, where, ci->spill_reg);
+        reg_id_t reg = opnd_get_reg(arg);
+        ASSERT(opnd_is_reg(arg));
+        if (reg == ci->spill_reg) {
+            /* Passing the spill reg: its app value is on top of the app stack. */
+            PRE(ilist, where, create_ldst_imm(dcontext, false, DR_REG_R0,
+                                              DR_REG_R13, 0));
+        } else if (reg != DR_REG_R0) {
+            PRE(ilist, where, INSTR_CREATE_mov_reg(dcontext, opnd_create_reg(DR_REG_R0),
+                                                   opnd_create_reg(reg), COND_ALWAYS));
+        }
     }
-
-#ifndef X64
-    ASSERT(!cci->reg_skip[0]);
-    /* Move xax to the scratch slot of the local.  We only allow at most one
-     * local stack access, so the callee either does not use the argument, or
-     * the local stack access is the arg.
-     */
-    LOG(THREAD, LOG_CLEANCALL, 2,
-        "CLEANCALL: inlining clean call "PFX", passing arg via slot.\n",
-        ci->start);
-    PRE(ilist, where, INSTR_CREATE_mov_reg
-        (dcontext, callee_info_slot_opnd(ci, SLOT_LOCAL, 0),
-         opnd_create_reg(DR_REG_R0), COND_ALWAYS));
-#endif
-#endif//NO
 }
 
 void
@@ -6392,7 +6414,6 @@ insert_inline_clean_call(dcontext_t *dcontext, clean_call_info_t *cci,
     instr_t *instr;
 
     ASSERT(cci->ilist != NULL);
-    ASSERT(SCRATCH_ALWAYS_TLS());
     /* 0. update stats */
     STATS_INC(cleancall_inlined);
     /* 1. save registers */
@@ -6417,16 +6438,24 @@ insert_inline_clean_call(dcontext_t *dcontext, clean_call_info_t *cci,
     cci->ilist = NULL;
     /* 4. restore registers */
     insert_inline_reg_restore(dcontext, cci, ilist, where);
-    /* XXX: the inlined code looks like this 
-     *   mov    %rax -> %gs:0x00 
-     *   mov    %rdi -> %gs:0x01 
-     *   mov    $0x00000003 -> %edi 
-     *   mov    <rel> 0x0000000072200c00 -> %rax 
-     *   movsxd %edi -> %rdi 
-     *   add    %rdi (%rax) -> (%rax) 
-     *   mov    %gs:0x00 -> %rax 
-     *   mov    %gs:0x01 -> %rdi 
-     *   ...
+    /* XXX: the inlined code for a callee adding its arg to a global
+     * counter looks like this
+     *   push   {r1}
+     *   mrc    p15, 0, r1, c13, c0, 2
+     *   ldr    r1, [r1, #<dcontext slot>]
+     *   str    r0, [r1, #<slot 0>]
+     *   str    r2, [r1, #<slot 1>]
+     *   str    r3, [r1, #<slot 2>]
+     *   mov    r0, #3
+     *   movw   r3, #<counter low>
+     *   movt   r3, #<counter high>
+     *   ldr    r2, [r3]
+     *   add    r2, r2, r0
+     *   str    r2, [r3]
+     *   ldr    r3, [r1, #<slot 2>]
+     *   ldr    r2, [r1, #<slot 1>]
+     *   ldr    r0, [r1, #<slot 0>]
+     *   pop    {r1}
      * we can do some constant propagation optimization here,
      * leave it for higher optimization level.
      */
@@ -53,6 +53,8 @@
 #include "../fragment.h"
 #include "disassemble.h"
 #include "proc.h"
+#include "instrument.h" /* for instrlist_meta_append() */
+#include "loadtoconst.h"
 #include <string.h> /* for memset */
 
 /* IMPORTANT INSTRUCTIONS FOR WRITING OPTIMIZATIONS:
@@ -86,6 +88,11 @@ static void peephole_optimize(dcontext_t *dcontext, app_pc tag, instrlist_t *tra
 static void identify_for_loop(dcontext_t *dcontext,
                               app_pc tag, instrlist_t *trace);
 static void unroll_loops(dcontext_t *dcontext, app_pc tag, instrlist_t *trace);
+
+static void if_convert_branches(dcontext_t *dcontext, app_pc tag, instrlist_t *trace);
+static void pair_loads_stores(dcontext_t *dcontext, app_pc tag, instrlist_t *trace);
+static void remove_dead_flag_writes(dcontext_t *dcontext, app_pc tag,
+                                    instrlist_t *trace);
 #ifdef IA32_ON_IA64
 static void test_i64(dcontext_t *dcontext, app_pc tag, instrlist_t *trace);
 #endif
@@ -98,6 +105,9 @@ static bool is_zeroing_instr(instr_t *inst);
 static bool replace_inc_with_add(dcontext_t *dcontext, instr_t *inst,
                                  instrlist_t *trace);
 static bool safe_write(instr_t *mem_writer);
+static bool get_ldst_imm(instr_t *inst, bool *is_load, reg_id_t *base, int *offs,
+                         int *bump);
+static uint get_dp_immed(opnd_t opnd);
 static bool instruction_affects_mem_access(instr_t *instr,opnd_t mem_access);
 static bool is_dead_register(reg_id_t reg,instr_t *where);
 static reg_id_t find_dead_register_across_instrs(instr_t *start,instr_t *end);
@@ -164,12 +174,9 @@ optimize_trace(dcontext_t *dcontext, app_pc tag, instrlist_t *trace)
         unroll_loops(dcontext, tag, trace);
     }
 
-    if (dynamo_options.vectorize) {
-        identify_for_loop(dcontext, tag, trace);
-    }
-
-    if (dynamo_options.prefetch) {
-        prefetch_optimize_trace(dcontext, tag, trace);
+    /* before rlr and constant propagation, which can use the constants */
+    if (dynamo_options.loads_to_const) {
+        ltc_optimize_trace(dcontext, tag, trace);
     }
 
     if (dynamo_options.rlr) {
@@ -196,6 +203,33 @@ optimize_trace(dcontext_t *dcontext, app_pc tag, instrlist_t *trace)
         peephole_optimize(dcontext, tag, trace);
     }
 
+    /* if-conversion adds predicated flag readers, so it must precede
+     * dead flag removal
+     */
+    if (dynamo_options.if_convert) {
+        if_convert_branches(dcontext, tag, trace);
+    }
+
+    if (dynamo_options.pair_ldst) {
+        pair_loads_stores(dcontext, tag, trace);
+    }
+
+    if (dynamo_options.remove_dead_flags) {
+        remove_dead_flag_writes(dcontext, tag, trace);
+    }
+
+    /* the vectorizer emits raw NEON bits the passes above can't inspect */
+    if (dynamo_options.vectorize) {
+        identify_for_loop(dcontext, tag, trace);
+    }
+
+    /* likewise prefetch hints; a vectorized loop no longer jumps to the
+     * top and is left alone
+     */
+    if (dynamo_options.prefetch) {
+        prefetch_optimize_trace(dcontext, tag, trace);
+    }
+
 #ifdef IA32_ON_IA64
     if (dynamo_options.test_i64) {
         test_i64(dcontext, tag, trace);
@@ -227,6 +261,10 @@ static struct {
     int incs_replaced;
     /* unrolling */
     int loops_unrolled;
+    /* vectorization */
+    int loops_vectorized;
+    /* prefetching */
+    int prefetches_inserted;
     // spill_xmm
     int vals_spilled_to_xmm;
     int loads_replaced_by_xmm;
@@ -258,6 +296,14 @@ static struct {
     /* call return matching */
     int num_returns_removed;
     int num_return_instrs_removed;
+    /* if-conversion */
+    int branches_if_converted;
+    int instrs_predicated;
+    /* load/store pairing */
+    int ldst_pairs_combined;
+    /* dead flag removal */
+    int s_flags_removed;
+    int compares_removed;
 #ifdef IA32_ON_IA64
     bool i64_test;
     int ia64_num_entries;
@@ -302,6 +348,15 @@ print_optimization_stats()
     if (dynamo_options.unroll_loops) {
         LOG(GLOBAL, LOG_OPTS, 1, "%d loops unrolled\n", opt_stats_t.loops_unrolled);
     }
+    if (dynamo_options.vectorize) {
+        LOG(GLOBAL, LOG_OPTS, 1, "%d loops vectorized\n", opt_stats_t.loops_vectorized);
+    }
+    if (dynamo_options.prefetch) {
+        LOG(GLOBAL, LOG_OPTS, 1, "%d prefetches inserted\n", opt_stats_t.prefetches_inserted);
+    }
+    if (dynamo_options.loads_to_const) {
+        ltc_print_stats();
+    }
 
     if (dynamo_options.call_return_matching) {
         LOG(GLOBAL, LOG_OPTS, 1, "Call Return Matching - stats\n");
@@ -343,6 +398,23 @@ print_optimization_stats()
         LOG(GLOBAL, LOG_OPTS, 1, "     %d jmps (cbr) in traces\n", opt_stats_t.post_num_jmps_seen);
     }
 
+    if (dynamo_options.if_convert) {
+        LOG(GLOBAL, LOG_OPTS, 1, "If-Conversion - stats\n");
+        LOG(GLOBAL, LOG_OPTS, 1, "   %d branches removed\n", opt_stats_t.branches_if_converted);
+        LOG(GLOBAL, LOG_OPTS, 1, "   %d instrs predicated\n", opt_stats_t.instrs_predicated);
+    }
+
+    if (dynamo_options.pair_ldst) {
+        LOG(GLOBAL, LOG_OPTS, 1, "%d ldr/str pairs combined into ldrd/strd\n",
+            opt_stats_t.ldst_pairs_combined);
+    }
+
+    if (dynamo_options.remove_dead_flags) {
+        LOG(GLOBAL, LOG_OPTS, 1, "Dead Flag Removal - stats\n");
+        LOG(GLOBAL, LOG_OPTS, 1, "   %d S suffixes dropped\n", opt_stats_t.s_flags_removed);
+        LOG(GLOBAL, LOG_OPTS, 1, "   %d dead compares removed\n", opt_stats_t.compares_removed);
+    }
+
 #ifdef IA32_ON_IA64
     if (dynamo_options.test_i64) {
         if (opt_stats_t.i64_test)
@@ -358,468 +430,537 @@ print_optimization_stats()
 
 /****************************************************************************/
 
-/* op1 and op2 are both memory references */
-static bool
-generate_antialias_check(dcontext_t *dcontext, instrlist_t *pre_loop,
-                         opnd_t op1, opnd_t op2)
+/* NEON has no IR support in this tree, so the vectorizer emits its vector
+ * instrs as raw A1 encodings.  A q register is passed as its number and
+ * placed in the d register fields as 2*q; only q0-q7 are used, so the
+ * D/N/M high bits stay clear.  Core registers are hardware numbers.
+ */
+#define NEON_VLD1_32_WB(rn, q)      (0xf4200a8d | (rn) << 16 | (q) << 13)
+#define NEON_VST1_32_WB(rn, q)      (0xf4000a8d | (rn) << 16 | (q) << 13)
+#define NEON_VDUP_32(q, rt)         (0xeea00b10 | (q) << 17 | (rt) << 12)
+#define NEON_3REG(op, qd, qn, qm)   ((op) | (qn) << 17 | (qd) << 13 | (qm) << 1)
+#define NEON_VADD_I32               0xf2200840
+#define NEON_VSUB_I32               0xf3200840
+#define NEON_VMUL_I32               0xf2200950
+#define NEON_VAND                   0xf2000150
+#define NEON_VBIC                   0xf2100150
+#define NEON_VORR                   0xf2200150
+#define NEON_VEOR                   0xf3000150
+/* vpush/vpop {d0-d(nd-1)} */
+#define VFP_VPUSH_D0(nd)            (0xed2d0b00 | 2 * (nd))
+#define VFP_VPOP_D0(nd)             (0xecbd0b00 | 2 * (nd))
+
+/* AT_HWCAP bit for Advanced SIMD, from the kernel's asm/hwcap.h */
+#define HWCAP_NEON (1 << 12)
+
+/* iterations handled per vector pass: four 32-bit lanes */
+#define VECTOR_LANES 4
+#define MAX_VECTOR_QREGS 8
+#define MAX_VECTOR_OPS 16
+#define MAX_VECTOR_STREAMS 4
+
+#define HW_REG(reg) ((reg) - DR_REG_R0)
+
+static instr_t *
+create_raw_word(dcontext_t *dcontext, uint word)
 {
-#ifdef NO
-//TODO SJF
-    /* basic idea: "lea op1 !overlap lea op2" */
-    opnd_t lea1, lea2;
-    if (opnd_same(op1, op2))
-        return false; /* guaranteed alias */
-    if (!opnd_defines_use(op1, op2))
-        return true; /* guaranteed non-alias */
-    /* FIXME: get pre-loop values of registers */
-    /* FIXME: get unroll factor -- pass to opnd_defines_use too */
-    /* assumption: ebx and ecx are saved at start of pre_loop, restored at end 
-     * FIXME: op1/op2 may use ebx/ecx!
-     */
-    lea1 = op1;
-    opnd_set_size(&lea1, OPSZ_lea);
-    lea2 = op2;
-    opnd_set_size(&lea2, OPSZ_lea);
-    instrlist_append(pre_loop, INSTR_CREATE_lea(dcontext, opnd_create_reg(REG_EBX), lea1));
-    instrlist_append(pre_loop, INSTR_CREATE_lea(dcontext, opnd_create_reg(REG_ECX), lea2));
-    instrlist_append(pre_loop, INSTR_CREATE_cmp(dcontext,  opnd_create_reg(REG_EBX),
-                                                opnd_create_reg(REG_ECX)));
-    return true;
-#endif //NO
+    return instr_create_raw_4bytes(dcontext, (byte) word, (byte) (word >> 8),
+                                   (byte) (word >> 16), (byte) (word >> 24));
 }
 
-#define MAX_INDUCTION_VARS 8
-#define MAX_LCDS 32
-#define MAX_INVARIANTS 32
-
+/* Appends to pre_loop a check that jumps to skip unless a vector pass
+ * that loads VECTOR_LANES words at load_ptr and then stores as many at
+ * store_ptr reads what the scalar loop would: i.e., unless the store
+ * lands 1-15 bytes past the load, where a scalar iteration would read
+ * an earlier iteration's store.  Clobbers scratch and the flags.
+ */
 static void
-identify_for_loop(dcontext_t *dcontext, app_pc tag, instrlist_t *trace)
+generate_antialias_check(dcontext_t *dcontext, instrlist_t *pre_loop,
+                         reg_id_t store_ptr, reg_id_t load_ptr, reg_id_t scratch,
+                         instr_t *skip)
 {
-    instr_t *inst, *branch, *check;
-    opnd_t opnd;
-    int i, j, k;
-    instr_t *induction_var[MAX_INDUCTION_VARS];
-    int num_induction_vars = 0;
-    opnd_t lcd[MAX_LCDS];
-    int num_lcds = 0;
-    opnd_t invariant[MAX_INVARIANTS];
-    int num_invariants = 0;
-    instrlist_t pre_loop;
-    instrlist_init(&pre_loop);
-#ifdef NO
-//TODO SJF
-
-    /* FIXME: what about loops with cbr at top and ubr at bottom? */
-
-    /* FIXME: for now, we only look for single-basic-block traces */
+    /* (store_ptr - load_ptr - 1) <u 15 => overlap */
+    instrlist_meta_append(pre_loop,
+                          INSTR_CREATE_sub_reg(dcontext, opnd_create_reg(scratch),
+                                               opnd_create_reg(store_ptr),
+                                               opnd_create_reg(load_ptr),
+                                               OPND_CREATE_IMM5(0), COND_ALWAYS));
+    instrlist_meta_append(pre_loop,
+                          INSTR_CREATE_sub_imm(dcontext, opnd_create_reg(scratch),
+                                               opnd_create_reg(scratch),
+                                               OPND_CREATE_IMM12(1), COND_ALWAYS));
+    instrlist_meta_append(pre_loop,
+                          INSTR_CREATE_cmp_imm(dcontext, opnd_create_reg(scratch),
+                                               OPND_CREATE_IMM12(VECTOR_LANES * 4 - 1),
+                                               COND_ALWAYS));
+    instrlist_meta_append(pre_loop,
+                          INSTR_CREATE_b(dcontext, opnd_create_instr(skip),
+                                         COND_CARRY_CLEAR));
+}
 
-    LOG(THREAD, LOG_OPTS, 3, "identify_for_loop: examining trace with tag "PFX"\n", tag);
-    /* first, make sure we end with a conditional branch (followed by uncond.
-     * for fall-through)
+/* Appends to ilist a jump to done unless the VECTOR_LANES words at ptr
+ * lie on the page of the byte just below ptr, which the scalar loop or
+ * the previous vector pass has just accessed the same way.  A vector
+ * access then cannot fault where the scalar loop would not have, so it
+ * needs no translation.  Clobbers scratch and the flags.
+ */
+static void
+append_page_check(dcontext_t *dcontext, instrlist_t *ilist, reg_id_t ptr,
+                  reg_id_t scratch, instr_t *done)
+{
+    uint tail;
+    /* (ptr - 1) & tail == tail iff ptr - 1 is in the last VECTOR_LANES words
+     * of its page
      */
-    inst = instrlist_last(trace);
-    if (!instr_is_ubr(inst))
-        return;
-    branch = instr_get_prev(inst);
-    if (!instr_is_cbr(branch))
-        return;
-    /* now look for self-loop */
-    if (opnd_get_pc(instr_get_target(branch)) != tag)
-        return;
-
-#ifdef DEBUG
-    LOG(THREAD, LOG_OPTS, 1, "\nidentify_for_loop: found whole-trace self-loop: tag "PFX"\n", tag);
-    if ((stats->logmask & LOG_OPTS) != 0)
-        instrlist_disassemble(dcontext, tag, trace, THREAD);
-#endif
+    DEBUG_DECLARE(bool ok =) opnd_encode_modified_imm(PAGE_SIZE - VECTOR_LANES * 4,
+                                                      &tail);
+    ASSERT(ok);
+    instrlist_meta_append(ilist,
+                          INSTR_CREATE_sub_imm(dcontext, opnd_create_reg(scratch),
+                                               opnd_create_reg(ptr),
+                                               OPND_CREATE_IMM12(1), COND_ALWAYS));
+    instrlist_meta_append(ilist,
+                          INSTR_CREATE_and_imm(dcontext, opnd_create_reg(scratch),
+                                               opnd_create_reg(scratch),
+                                               OPND_CREATE_IMM12(tail), COND_ALWAYS));
+    instrlist_meta_append(ilist,
+                          INSTR_CREATE_cmp_imm(dcontext, opnd_create_reg(scratch),
+                                               OPND_CREATE_IMM12(tail), COND_ALWAYS));
+    instrlist_meta_append(ilist,
+                          INSTR_CREATE_b(dcontext, opnd_create_instr(done),
+                                         COND_EQUAL));
+}
 
-    /* FIXME: for each pair of read/write and write/write: insert pre-loop check to
-     * ensure no aliases
+typedef struct _vector_op_t {
+    uint word;          /* raw NEON encoding, or 0 for a dup */
+    int qd, qn, qm;
+    reg_id_t reg;       /* stream pointer, or dup source */
+    opnd_t immed;       /* dup of an immediate if reg is REG_NULL */
+} vector_op_t;
+
+typedef struct _vector_loop_t {
+    vector_op_t dup[MAX_VECTOR_QREGS];
+    int num_dups;
+    vector_op_t body[MAX_VECTOR_OPS];
+    int num_body;
+    reg_id_t load_ptr[MAX_VECTOR_STREAMS];
+    int num_loads;
+    reg_id_t store_ptr;
+    int num_qregs;
+    /* scalar reg -> q reg holding its lanes, -1 if none */
+    int qreg_of[DR_REG_R15 + 1];
+    /* pointers that still need their explicit +4 after the access */
+    bool needs_bump[DR_REG_R15 + 1];
+    bool is_pointer[DR_REG_R15 + 1];
+    /* writes of each induction register the loop shape accounts for */
+    int updates[DR_REG_R15 + 1];
+    /* loop counter: either "subs count, count, #1" or
+     * "add count, count, #1; cmp count, limit"
      */
+    reg_id_t count;
+    reg_id_t limit;
+    bool count_down;
+    bool count_cmp_seen;
+} vector_loop_t;
+
+/* returns how many instrs from start up to end write reg */
+static int
+num_writes_in(instr_t *start, instr_t *end, reg_id_t reg)
+{
+    instr_t *inst;
+    int writes = 0;
+    for (inst = start; inst != end; inst = instr_get_next(inst)) {
+        if (!instr_is_label(inst) && instr_writes_to_reg(inst, reg))
+            writes++;
+    }
+    return writes;
+}
+
+/* returns the q register holding the lanes of scalar source opnd, adding
+ * a dup of a loop-invariant register or immediate if needed, or -1
+ */
+static int
+vector_source(vector_loop_t *vl, instr_t *first, instr_t *branch, opnd_t opnd)
+{
+    int i;
+    reg_id_t reg;
 
-    /* make a pass looking for lcds and induction variables
-     *   only look at scalars -- ignore memory references, we deal with them
-     *   separately later
-     * also make sure there's only one exit
+    if (opnd_is_immed_int(opnd)) {
+        if (vl->num_qregs >= MAX_VECTOR_QREGS)
+            return -1;
+        vl->dup[vl->num_dups].reg = REG_NULL;
+        vl->dup[vl->num_dups].immed = opnd;
+        vl->dup[vl->num_dups].qd = vl->num_qregs;
+        vl->num_dups++;
+        return vl->num_qregs++;
+    }
+    if (!opnd_is_reg(opnd))
+        return -1;
+    reg = opnd_get_reg(opnd);
+    if (reg < DR_REG_R0 || reg > DR_REG_R12)
+        return -1;
+    if (vl->qreg_of[reg] >= 0)
+        return vl->qreg_of[reg];
+    /* read before written: must not be written at all, else it carries a
+     * value from the previous iteration
      */
-    for (inst = instrlist_first(trace); inst != branch; inst = instr_get_next(inst)) {
-        /* for now do not allow exits in middle */
-        if (instr_is_exit_cti(inst)) {
-            LOG(THREAD, LOG_OPTS, 1, "internal exit found, giving up\n");
-            return;
-        }
-        /* loop-carried dependence: a read with no writes prior in loop but
-         *   with a write following in loop
-         * loop invariant: a read with no writes anywhere in loop
-         * FIXME: better to store dependence info somehow, or to make passes
-         * through instrlist whenever need info?
-         */
-        loginst(dcontext, 1, inst, "considering");
-        for (i=0; i<instr_num_srcs(inst); i++) {
-            opnd = instr_get_src(inst, i);
-            /* ignore immeds and memory references */
-            if (opnd_is_immed(opnd) || opnd_is_memory_reference(opnd))
-                continue;
-            for (check = instrlist_first(trace); check != inst;
-                 check = instr_get_next(check)) {
-                for (j=0; j<instr_num_dsts(check); j++) {
-                    if (opnd_defines_use(instr_get_dst(check, j), opnd)) {
-                        /* write prior to read: no lcd */
-                        loginst(dcontext, 1, check,
-                                "\twrite prior to read -> no lcd");
-                        goto no_lcd;
-                    }
-                }
-            }
-            for (check = inst; check != branch; check = instr_get_next(check)) {
-                for (j=0; j<instr_num_dsts(check); j++) {
-                    if (opnd_defines_use(instr_get_dst(check, j), opnd)) {
-                        /* write following read: lcd */
-                        goto has_lcd;
-                    }
-                }
-            }
-            /* no writes: loop invariant! */
-            logopnd(dcontext, 1, opnd, "\tloop invariant");
-            invariant[num_invariants] = opnd;
-            num_invariants++;
-            if (num_invariants >= MAX_INVARIANTS) {
-                LOG(THREAD, LOG_OPTS, 1, "too many invariants, giving up\n");
-                return;
-            }
-        }
-        loginst(dcontext, 1, inst, "\tfell off end -> no lcd");
-    no_lcd:
-        continue;
-    has_lcd:
-        loginst(dcontext, 1, inst, "\tfound a loop-carried dependence");
-        /* find basic induction variables: i = i + constant
-         * FIXME: consider loop invariants as well as immeds as constants
-         * FIXME: only consider inc,dec,add,sub?
-         * FIXME: look for dependent induction vars too: j = i + constant
-         */
-        /* assumption: immediate operands are always 1st source */
-        if (instr_get_opcode(inst) == OP_inc || instr_get_opcode(inst) == OP_dec ||
-            (instr_num_srcs(inst) == 2 && instr_num_dsts(inst) == 1 &&
-             opnd_is_immed_int(instr_get_src(inst, 0)) &&
-             opnd_same(instr_get_src(inst, 1), instr_get_dst(inst, 0)))) {
-            loginst(dcontext, 1, inst, "\t\tfound induction variable");
-            induction_var[num_induction_vars] = inst;
-            num_induction_vars++;
-            if (num_induction_vars >= MAX_INDUCTION_VARS) {
-                LOG(THREAD, LOG_OPTS, 1, "too many induction vars, giving up\n");
-                return;
-            }
-        } else {
-            /* not an induction variable, but may be ok if lcd operand
-             * is based on induction var values
-             */
-            lcd[num_lcds] = opnd;
-            num_lcds++;
-            if (num_lcds >= MAX_LCDS) {
-                LOG(THREAD, LOG_OPTS, 1, "too many lcds, giving up\n");
-                return;
-            }
-        }
+    if (vl->is_pointer[reg] || reg == vl->count || reg == vl->limit ||
+        num_writes_in(first, branch, reg) > 0)
+        return -1;
+    for (i = 0; i < vl->num_dups; i++) {
+        if (vl->dup[i].reg == reg)
+            return vl->dup[i].qd;
     }
+    if (vl->num_qregs >= MAX_VECTOR_QREGS)
+        return -1;
+    vl->dup[vl->num_dups].reg = reg;
+    vl->dup[vl->num_dups].qd = vl->num_qregs;
+    vl->num_dups++;
+    return vl->num_qregs++;
+}
 
-    LOG(THREAD, LOG_OPTS, 1, "now looking through lcds for ones we can't handle\n");
-    /* it's ok for an lcd to read a value kept in an induction var
-     * or a loop invariant
-     */
-    for (i=0; i<num_lcds; i++) {
-        if (opnd_is_reg(lcd[i])) {
-            for (j=0; j<num_induction_vars; j++) {
-                if (opnd_same(lcd[i], instr_get_dst(induction_var[j], 0)))
-                    goto next_lcd;
-            }
-            for (j=0; j<num_invariants; j++) {
-                if (opnd_same(lcd[i], invariant[j]))
-                    goto next_lcd;
-            }
-        } else if (opnd_is_memory_reference(lcd[i])) {
-            for (j=0; j<opnd_num_regs_used(lcd[i]); j++) {
-                opnd = opnd_create_reg(opnd_get_reg_used(lcd[i], j));
-                for (k=0; k<num_induction_vars; k++) {
-                    if (opnd_same(opnd, instr_get_dst(induction_var[k], 0)))
-                        break;
-                }
-                if (k==num_induction_vars) {
-                    for (k=0; k<num_invariants; k++) {
-                        if (opnd_same(opnd, invariant[k]))
-                            break;
-                    }
-                    if (k==num_invariants)
-                        goto lcd_bad;
-                }
-            }
-        } else
-            ASSERT_NOT_REACHED();
-    next_lcd:
-        logopnd(dcontext, 1, lcd[i],
-                "\tlcd read is induction var value, so it's ok");
-        continue;
-    lcd_bad:
-        logopnd(dcontext, 1, lcd[i],
-                "\tlcd read is not induction var value, giving up");
-        return;
+/* maps a scalar data-processing opcode to its NEON 32-bit lane op;
+ * *swap is set for reverse subtract
+ */
+static uint
+vector_opcode(int opc, bool *swap)
+{
+    *swap = false;
+    switch (opc) {
+    case OP_add_imm: case OP_add_reg: return NEON_VADD_I32;
+    case OP_sub_imm: case OP_sub_reg: return NEON_VSUB_I32;
+    case OP_rsb_imm: case OP_rsb_reg: *swap = true; return NEON_VSUB_I32;
+    case OP_mul:                      return NEON_VMUL_I32;
+    case OP_and_imm: case OP_and_reg: return NEON_VAND;
+    case OP_bic_imm: case OP_bic_reg: return NEON_VBIC;
+    case OP_orr_imm: case OP_orr_reg: return NEON_VORR;
+    case OP_eor_imm: case OP_eor_reg: return NEON_VEOR;
+    default: return 0;
     }
+}
 
-    /* now look at loop termination test */
-    inst = get_decision_instr(branch);
-    loginst(dcontext, 1, inst, "looking at decision instr");
-    /* test must involve only induction vars and constants */
-    for (i=0; i<instr_num_srcs(inst); i++) {
-        opnd = instr_get_src(inst, i);
-        if (!opnd_is_immed(opnd)) {
-            for (j=0; j<num_induction_vars; j++) {
-                if (opnd_same(opnd, instr_get_dst(induction_var[j], 0)))
-                    break;
-            }
-            if (j==num_induction_vars) {
-                loginst(dcontext, 1, inst,
-                        "\tloop termination test not just consts & inductions!");
-                return;
-            }
+/* classifies one instr of the loop body, recording the vector code for it */
+static bool
+vectorize_instr(vector_loop_t *vl, instr_t *first, instr_t *branch, instr_t *inst)
+{
+    int opc = instr_get_opcode(inst);
+    reg_id_t dst, base;
+    opnd_t src1;
+    uint word;
+    bool swap;
+    int qn, qm;
+
+    if (!instr_ok_to_mangle(inst) || instr_get_cond(inst) != COND_ALWAYS ||
+        instr_num_dsts(inst) < 1 || !opnd_is_reg(instr_get_dst(inst, 0)))
+        return false;
+    dst = opnd_get_reg(instr_get_dst(inst, 0));
+    if (dst < DR_REG_R0 || dst > DR_REG_R12)
+        return false;
+
+    if (opc == OP_ldr_imm || opc == OP_str_imm) {
+        int offs;
+        if (vl->num_body >= MAX_VECTOR_OPS || !opnd_is_mem_reg(instr_get_src(inst, 0)))
+            return false;
+        base = opnd_get_mem_reg(instr_get_src(inst, 0));
+        offs = (int) opnd_get_immed_int(instr_get_src(inst, 1));
+        if (base < DR_REG_R0 || base > DR_REG_R12 || vl->is_pointer[base] ||
+            base == dst || instr_get_w_flag(inst))
+            return false;
+        /* unit stride: post-indexed by 4, or no offset and an add later */
+        if (!instr_get_p_flag(inst) && instr_get_u_flag(inst) && offs == 4)
+            vl->needs_bump[base] = false;
+        else if (instr_get_p_flag(inst) && offs == 0)
+            vl->needs_bump[base] = true;
+        else
+            return false;
+        vl->is_pointer[base] = true;
+        vl->body[vl->num_body].reg = base;
+        if (opc == OP_ldr_imm) {
+            if (vl->store_ptr != REG_NULL || vl->num_loads >= MAX_VECTOR_STREAMS ||
+                vl->num_qregs >= MAX_VECTOR_QREGS)
+                return false;
+            vl->load_ptr[vl->num_loads++] = base;
+            vl->qreg_of[dst] = vl->num_qregs;
+            vl->body[vl->num_body].word =
+                NEON_VLD1_32_WB(HW_REG(base), vl->num_qregs);
+            vl->num_qregs++;
+        } else {
+            /* a single store, after every load */
+            if (vl->store_ptr != REG_NULL || vl->qreg_of[dst] < 0)
+                return false;
+            vl->store_ptr = base;
+            vl->body[vl->num_body].word = NEON_VST1_32_WB(HW_REG(base), vl->qreg_of[dst]);
         }
+        vl->num_body++;
+        return true;
     }
 
-    LOG(THREAD, LOG_OPTS, 1, "now looking at memory references\n");
-    for (inst = instrlist_first(trace); inst != branch; inst = instr_get_next(inst)) {
-        /* for each store, generate pre-loop checks to ensure no overlap with
-         * any other store or read
-         */
-        loginst(dcontext, 1, inst, "considering");
-        for (i=0; i<instr_num_dsts(inst); i++) {
-            opnd = instr_get_dst(inst, i);
-            if (!opnd_is_memory_reference(opnd))
-                continue;
-            for (check = instrlist_first(trace); check != branch;
-                 check = instr_get_next(check)) {
-                for (j=0; j<instr_num_dsts(check); j++) {
-                    if (check==inst && j==i)
-                        continue;
-                    if (opnd_is_memory_reference(instr_get_dst(check, j))) {
-                        /* disambiguate these writes */
-                        logopnd(dcontext, 1, instr_get_dst(check, j),
-                                "\tgenerating checks");
-                        if (!generate_antialias_check(dcontext, &pre_loop, opnd,
-                                                      instr_get_dst(check, j))) {
-                            loginst(dcontext, 1, inst,
-                                    "unavoidable alias, giving up");
-                            return;
-                        }
-                    }
-                }
-            }
+    /* induction updates */
+    if (opc == OP_add_imm && opnd_is_reg(instr_get_src(inst, 0)) &&
+        opnd_get_reg(instr_get_src(inst, 0)) == dst && !instr_get_s_flag(inst)) {
+        int imm = (int) opnd_get_immed_int(instr_get_src(inst, 1));
+        if (vl->is_pointer[dst]) {
+            if (!vl->needs_bump[dst] || imm != 4)
+                return false;
+            vl->needs_bump[dst] = false;
+            vl->updates[dst]++;
+            return true;
         }
+        if (imm == 1 && vl->count == REG_NULL) {
+            vl->count = dst;
+            vl->count_down = false;
+            vl->updates[dst]++;
+            return true;
+        }
+        return false;
     }
-    if (instrlist_first(&pre_loop) != NULL) {
-        /* if we generated any tests, they assume we have two registers:
-         * save two registers at start, then restore at end, of pre_loop
-         * FIXME: what about eflags?
-         */
-        instrlist_prepend(&pre_loop,
-                          instr_create_save_to_dcontext(dcontext, REG_EBX, XBX_OFFSET));
-        instrlist_prepend(&pre_loop,
-                          instr_create_save_to_dcontext(dcontext, REG_ECX, XCX_OFFSET));
-        instrlist_append(&pre_loop,
-                         instr_create_restore_from_dcontext(dcontext, REG_ECX, XCX_OFFSET));
-        instrlist_append(&pre_loop,
-                         instr_create_restore_from_dcontext(dcontext, REG_EBX, XBX_OFFSET));
+    if (opc == OP_sub_imm && instr_get_s_flag(inst) &&
+        opnd_is_reg(instr_get_src(inst, 0)) && opnd_get_reg(instr_get_src(inst, 0)) == dst &&
+        opnd_get_immed_int(instr_get_src(inst, 1)) == 1 && vl->count == REG_NULL) {
+        vl->count = dst;
+        vl->count_down = true;
+        vl->count_cmp_seen = true;
+        vl->updates[dst]++;
+        return true;
+    }
+    if (opc == OP_cmp_reg) {
+        /* the compare must follow the increment */
+        if (vl->count != dst || vl->count_down || vl->count_cmp_seen ||
+            !opnd_is_reg(instr_get_src(inst, 0)) || instr_get_shift_type(inst) != 0 ||
+            opnd_get_immed_int(instr_get_src(inst, 1)) != 0)
+            return false;
+        vl->limit = opnd_get_reg(instr_get_src(inst, 0));
+        if (vl->limit < DR_REG_R0 || vl->limit > DR_REG_R12 || vl->is_pointer[vl->limit] ||
+            num_writes_in(first, branch, vl->limit) > 0)
+            return false;
+        vl->count_cmp_seen = true;
+        /* our IR lists the compared register as a dst */
+        vl->updates[dst]++;
+        return true;
     }
 
+    /* lane arithmetic: nothing of the sort after the store */
+    word = vector_opcode(opc, &swap);
+    if (word == 0 || instr_get_s_flag(inst) || vl->store_ptr != REG_NULL ||
+        vl->is_pointer[dst] || dst == vl->count || vl->num_body >= MAX_VECTOR_OPS)
+        return false;
+    if (opc != OP_mul && !opnd_is_immed_int(instr_get_src(inst, 1))) {
+        /* register operand: no shift */
+        if (instr_num_srcs(inst) < 3 || instr_get_shift_type(inst) != 0 ||
+            opnd_get_immed_int(instr_get_src(inst, 2)) != 0)
+            return false;
+    }
+    src1 = instr_get_src(inst, 1);
+    qn = vector_source(vl, first, branch, instr_get_src(inst, 0));
+    qm = vector_source(vl, first, branch, src1);
+    if (qn < 0 || qm < 0 || vl->num_qregs >= MAX_VECTOR_QREGS)
+        return false;
+    vl->qreg_of[dst] = vl->num_qregs;
+    vl->body[vl->num_body].word = swap ? NEON_3REG(word, vl->num_qregs, qm, qn) :
+        NEON_3REG(word, vl->num_qregs, qn, qm);
+    vl->num_body++;
+    vl->num_qregs++;
+    return true;
+}
 
-    LOG(THREAD, LOG_OPTS, 1, "loop has passed all tests so far!\n");
-#ifdef DEBUG
-    LOG(THREAD, LOG_OPTS, 1, "pre-loop checks are:\n");
-    if (stats->loglevel >= 1  && (stats->logmask & LOG_OPTS) != 0)
-        instrlist_disassemble(dcontext, tag, &pre_loop, THREAD);
-#endif
+/* appends "cmp remaining, #VECTOR_LANES" to ilist, computing remaining
+ * into scratch when counting up
+ */
+static void
+append_count_check(dcontext_t *dcontext, instrlist_t *ilist, vector_loop_t *vl,
+                   reg_id_t scratch)
+{
+    reg_id_t remaining = vl->count;
+    if (!vl->count_down) {
+        instrlist_meta_append(ilist,
+                              INSTR_CREATE_sub_reg(dcontext, opnd_create_reg(scratch),
+                                                   opnd_create_reg(vl->limit),
+                                                   opnd_create_reg(vl->count),
+                                                   OPND_CREATE_IMM5(0), COND_ALWAYS));
+        remaining = scratch;
+    }
+    instrlist_meta_append(ilist,
+                          INSTR_CREATE_cmp_imm(dcontext, opnd_create_reg(remaining),
+                                               OPND_CREATE_IMM12(VECTOR_LANES),
+                                               COND_ALWAYS));
+}
+
+/* Vectorizes a trace that is one self-looping block of unit-stride
+ * 32-bit integer loads, lane-wise arithmetic and a store, counted by
+ * "subs n, n, #1; bne/bgt" or "add i, i, #1; cmp i, m; bne/blt/blo".
+ * A pre-loop placed at the top of the trace runs the loop VECTOR_LANES
+ * iterations at a time in NEON while more than VECTOR_LANES remain and
+ * the store cannot feed a later load; the unchanged scalar body then
+ * finishes the remainder (and does everything when the checks fail),
+ * leaving the registers it writes as the original loop would.
+ *
+ * The vector loads and stores are meta instrs with no translation, so they
+ * must never fault: entry from outside the trace skips to the scalar body,
+ * only the back edge reaches the pre-loop, and each vector pass stays on
+ * the pages the previous iteration touched (see append_page_check()).
+ *
+ * The pre-loop borrows a core register and q0-q7 by pushing them on the
+ * app stack, and relies on the flags being dead at the loop top, which
+ * holds since the body may only set them for its termination test.
+ */
+static void
+identify_for_loop(dcontext_t *dcontext, app_pc tag, instrlist_t *trace)
+{
+    instr_t *inst, *first, *branch, *skip, *vloop, *vdone, *body;
+    vector_loop_t vl;
+    reg_id_t reg, scratch;
+    int i, branch_cond, more_cond;
+    instrlist_t *pre_loop;
 
-    /* now look for "load, arithop, store" pattern 
-     * THIS IS A HACK -- just want to identify loop in mmx.c
+    LOG(THREAD, LOG_OPTS, 3, "identify_for_loop: examining trace with tag "PFX"\n", tag);
+    if (!TEST(HWCAP_NEON, os_get_hwcap()))
+        return;
+    first = instrlist_first(trace);
+    branch = find_next_self_loop(dcontext, tag, first);
+    /* the self-loop must be the cbr ending the only block, and already
+     * branch within the trace so that only it enters the pre-loop
      */
-    inst = instrlist_first(trace);
-    if (instr_get_opcode(inst) != OP_mov_ld) {
-        LOG(THREAD, LOG_OPTS, 1, "1st instr not a load, aborting\n");
+    if (branch == NULL || !instr_is_cbr(branch) || instr_get_opcode(branch) != OP_b ||
+        !opnd_is_near_instr(instr_get_target(branch)))
         return;
-    }
-    inst = instr_get_next(inst);
-    if (instr_get_opcode(inst) != OP_add) {
-        LOG(THREAD, LOG_OPTS, 1, "2nd instr not an add, aborting\n");
+    inst = instr_get_next(branch);
+    if (inst == NULL || !instr_is_ubr(inst) || instr_get_next(inst) != NULL)
         return;
+
+    memset(&vl, 0, sizeof(vl));
+    vl.store_ptr = REG_NULL;
+    vl.count = REG_NULL;
+    vl.limit = REG_NULL;
+    for (i = 0; i <= DR_REG_R15; i++)
+        vl.qreg_of[i] = -1;
+    for (inst = first; inst != branch; inst = instr_get_next(inst)) {
+        if (instr_is_label(inst))
+            continue;
+        if (!vectorize_instr(&vl, first, branch, inst)) {
+            loginst(dcontext, 3, inst, "identify_for_loop: can't vectorize");
+            return;
+        }
     }
-    inst = instr_get_next(inst);
-    if (instr_get_opcode(inst) != OP_mov_st) {
-        LOG(THREAD, LOG_OPTS, 1, "3rd instr not a store, aborting\n");
+    if (vl.store_ptr == REG_NULL || vl.num_loads == 0 || vl.count == REG_NULL ||
+        !vl.count_cmp_seen)
         return;
+    /* induction registers may change only through their own updates */
+    for (reg = DR_REG_R0; reg <= DR_REG_R12; reg++) {
+        if (vl.is_pointer[reg] && vl.needs_bump[reg])
+            return;
+        if ((vl.is_pointer[reg] || reg == vl.count) &&
+            num_writes_in(first, branch, reg) != vl.updates[reg])
+            return;
     }
-    LOG(THREAD, LOG_OPTS, 1, "found 'load, arithop, store' pattern!\n");
-    for (check = instr_get_next(inst); check != branch;
-         check = instr_get_next(check)) {
-        for (j=0; j<num_induction_vars; j++) {
-            if (induction_var[j] == check)
+    /* bne counts unsigned, bgt/blt signed */
+    branch_cond = instr_get_cond(branch);
+    if (branch_cond == COND_NOT_EQUAL)
+        more_cond = COND_HIGHER;
+    else if (vl.count_down && branch_cond == COND_SIGNED_GREATER_THAN)
+        more_cond = COND_SIGNED_GREATER_THAN;
+    else if (!vl.count_down && branch_cond == COND_SIGNED_LESS_THAN)
+        more_cond = COND_SIGNED_GREATER_THAN;
+    else if (!vl.count_down && branch_cond == COND_CARRY_CLEAR)
+        more_cond = COND_HIGHER;
+    else
+        return;
+    /* a core register the loop doesn't touch */
+    for (scratch = DR_REG_R0; scratch <= DR_REG_R12; scratch++) {
+        for (inst = first; inst != branch; inst = instr_get_next(inst)) {
+            if (!instr_is_label(inst) && instr_uses_reg(inst, scratch))
                 break;
         }
-        if (j==num_induction_vars) {
-            loginst(dcontext, 1, check, "non-induction var is present");
-            return;
-        }
+        if (inst == branch)
+            break;
     }
-    LOG(THREAD, LOG_OPTS, 1, "vectorizing\n");
+    if (scratch > DR_REG_R12)
+        return;
 
-#ifdef NO
-//SJF No increment opcode for ARM so this seems unnecessary
-    for (i=0; i<num_induction_vars; i++) {
-        int opcode = instr_get_opcode(induction_var[i]);
-        if (opcode == OP_inc || opcode == OP_dec) {
-            inst = instr_get_prev(induction_var[i]);
-            if (replace_inc_with_add(dcontext, induction_var[i], trace)) {
-                /* orig induction var instr_t was destroyed, get new copy */
-                if (inst == NULL)
-                    induction_var[i] = instrlist_first(trace);
-                else
-                    induction_var[i] = instr_get_next(inst);
-            } else {
-                loginst(dcontext, 1, induction_var[i],
-                        "couldn't replace inc w/ add b/c of eflags\n");
-                /* FIXME: undo earlier inc->adds */
-                return;
-            }
-        }
-    }
+#ifdef DEBUG
+    LOG(THREAD, LOG_OPTS, 1, "\nidentify_for_loop: vectorizing trace "PFX"\n", tag);
+    if (stats->loglevel >= 3 && (stats->logmask & LOG_OPTS) != 0)
+        instrlist_disassemble(dcontext, tag, trace, THREAD);
 #endif
 
-    /********** unroll loop **********/
-#if 0
-    do {
-        body using i;
-        i += inc;
-    } while (i < max);
-
-becomes
-
-/*
-pre-loop to get alignment is tricky when replacing sideline...need to
-measure memory addresses, can't just go on induction var...for
-now do not have a pre-loop and do unaligned simd
-          offs = i % inc;
-          while (i % (inc * unrollfactor) != 0) {
-              body using i;
-              i += inc;
-          }
-*/
-        do {
-            body using i;
-            body using i+inc;
-            i += (inc * unrollfactor);
-        } while (i < max - (inc * unrollfactor) + 1);
-    while (i < max) {
-        body using i;
-        i += inc;
+    pre_loop = instrlist_create(dcontext);
+    skip = INSTR_CREATE_label(dcontext);
+    vloop = INSTR_CREATE_label(dcontext);
+    vdone = INSTR_CREATE_label(dcontext);
+    body = INSTR_CREATE_label(dcontext);
+    /* no access is known to be safe before the first scalar iteration */
+    instrlist_meta_append(pre_loop,
+                          INSTR_CREATE_b(dcontext, opnd_create_instr(body),
+                                         COND_ALWAYS));
+    instrlist_meta_append(pre_loop,
+                          INSTR_CREATE_push(dcontext,
+                                            opnd_create_reg_list(1 << HW_REG(scratch)),
+                                            COND_ALWAYS));
+    append_count_check(dcontext, pre_loop, &vl, scratch);
+    instrlist_meta_append(pre_loop,
+                          INSTR_CREATE_b(dcontext, opnd_create_instr(skip),
+                                         invert_cond_code(more_cond)));
+    for (i = 0; i < vl.num_loads; i++) {
+        generate_antialias_check(dcontext, pre_loop, vl.store_ptr, vl.load_ptr[i],
+                                 scratch, skip);
     }
-#endif
-#if 0
-    /* First do pre-alignment loop
-     * to do mod: idiv divides edx:eax by r/m32, puts quotient
-     *     in eax, remainder in edx
-     *   cdq sign-extends eax into edx:eax
-     *   so x mod y is:
-     *     mov x,%eax
-     *     cdq
-     *     idiv y
-     * answer is now in %edx!  */
-    inst = instrlist_first(trace);
-    instrlist_preinsert(trace, inst,
-                        instr_create_save_to_dcontext(dcontext, REG_EAX, XAX_OFFSET));
-    instrlist_preinsert(trace, inst,
-                        instr_create_save_to_dcontext(dcontext, REG_EDX, XDX_OFFSET));
-    /* FIXME: get termination index var & lower/upper bound 
-     * hardcoding to mmx.c loop for now
-     */
-    instrlist_preinsert(trace, inst,
-                        INSTR_CREATE_mov_imm(dcontext, opnd_create_reg(REG_EAX), opnd_create_reg(REG_ECX)));
-    instrlist_preinsert(trace, inst, INSTR_CREATE_cdq(dcontext));
-    /* can't pass immed to idiv so have to grab register */
-    instrlist_preinsert(trace, inst,
-                        instr_create_save_to_dcontext(dcontext, REG_EBX, XBX_OFFSET));
-    instrlist_preinsert(trace, inst,
-                        INSTR_CREATE_mov_imm(dcontext, opnd_create_reg(REG_EBX),
-                                             OPND_CREATE_INT32(unroll_factor)));
-    instrlist_preinsert(trace, inst,
-                        INSTR_CREATE_idiv_v(dcontext, opnd_create_reg(REG_EBX)));
-    instrlist_preinsert(trace, inst,
-                        instr_create_restore_from_dcontext(dcontext, REG_EBX, XBX_OFFSET));
-    /* mod is now in edx */
-    /* FIXME:
-     *   test edx, edx
-     *   restore eax and edx
-     *   jz unrolled_loop
-     *   <body of loop>
-     *   jmp top of pre loop
-     * unrolled_loop:
-     *   <body of loop> X unroll factor except:
-     *   test: "< bound" => "< bound - unrollfactor + 1"
-     *   ivar: "ivar += k" => "ivar += unrollfactor * k"
-     */
-    instrlist_preinsert(trace, inst,
-                        instr_create_restore_from_dcontext(dcontext, REG_EDX, XDX_OFFSET));
-    instrlist_preinsert(trace, inst,
-                        instr_create_restore_from_dcontext(dcontext, REG_EAX, XAX_OFFSET));
-#endif
-
-    /* HACK: focus on mmx.c sample loop */
-    inst = instrlist_first(trace);
-    opnd = instr_get_src(inst, 0);
-    ASSERT(opnd_is_memory_reference(opnd));
-    opnd_set_size(&opnd, OPSZ_8);
-    check = INSTR_CREATE_movq(dcontext, opnd_create_reg(REG_MM0), opnd);
-    loginst(dcontext, 1, inst, "replacing this");
-    loginst(dcontext, 1, check, "\twith this");
-    replace_inst(dcontext, trace, inst, check);
-
-    inst = instr_get_next(check);
-    opnd = instr_get_src(inst, 0);
-    ASSERT(opnd_is_memory_reference(opnd));
-    opnd_set_size(&opnd, OPSZ_8);
-    check = INSTR_CREATE_paddd(dcontext, opnd_create_reg(REG_MM0), opnd);
-    loginst(dcontext, 1, inst, "replacing this");
-    loginst(dcontext, 1, check, "\twith this");
-    replace_inst(dcontext, trace, inst, check);
-
-    inst = instr_get_next(check);
-    opnd = instr_get_dst(inst, 0);
-    ASSERT(opnd_is_memory_reference(opnd));
-    opnd_set_size(&opnd, OPSZ_8);
-    check = INSTR_CREATE_movq(dcontext, opnd, opnd_create_reg(REG_MM0));
-    loginst(dcontext, 1, inst, "replacing this");
-    loginst(dcontext, 1, check, "\twith this");
-    replace_inst(dcontext, trace, inst, check);
-
-    /* now make induction vars do X unroll duty */
-    for (i=0; i<num_induction_vars; i++) {
-        if (instr_get_opcode(induction_var[i]) == OP_inc ||
-            instr_get_opcode(induction_var[i]) == OP_dec) {
-            /* couldn't convert to add/sub, so duplicate */
-            instrlist_preinsert(trace, induction_var[i],
-                                instr_clone(dcontext, induction_var[i]));
-        } else {
-            opnd = instr_get_src(induction_var[i], 0);
-            ASSERT(opnd_is_immed_int(opnd));
-            opnd = opnd_create_immed_int(opnd_get_immed_int(opnd)*2, opnd_get_size(opnd));
-            instr_set_src(induction_var[i], 0, opnd);
+    instrlist_meta_append(pre_loop,
+                          create_raw_word(dcontext, VFP_VPUSH_D0(2 * vl.num_qregs)));
+    for (i = 0; i < vl.num_dups; i++) {
+        reg = vl.dup[i].reg;
+        if (reg == REG_NULL) {
+            instrlist_meta_append(pre_loop,
+                                  INSTR_CREATE_mov_imm(dcontext, opnd_create_reg(scratch),
+                                                       vl.dup[i].immed, COND_ALWAYS));
+            reg = scratch;
         }
+        instrlist_meta_append(pre_loop,
+                              create_raw_word(dcontext,
+                                              NEON_VDUP_32(vl.dup[i].qd, HW_REG(reg))));
+    }
+    instrlist_meta_append(pre_loop, vloop);
+    for (i = 0; i < vl.num_loads; i++)
+        append_page_check(dcontext, pre_loop, vl.load_ptr[i], scratch, vdone);
+    append_page_check(dcontext, pre_loop, vl.store_ptr, scratch, vdone);
+    for (i = 0; i < vl.num_body; i++)
+        instrlist_meta_append(pre_loop, create_raw_word(dcontext, vl.body[i].word));
+    if (vl.count_down) {
+        instrlist_meta_append(pre_loop,
+                              INSTR_CREATE_sub_imm(dcontext, opnd_create_reg(vl.count),
+                                                   opnd_create_reg(vl.count),
+                                                   OPND_CREATE_IMM12(VECTOR_LANES),
+                                                   COND_ALWAYS));
+    } else {
+        instrlist_meta_append(pre_loop,
+                              INSTR_CREATE_add_imm(dcontext, opnd_create_reg(vl.count),
+                                                   opnd_create_reg(vl.count),
+                                                   OPND_CREATE_IMM12(VECTOR_LANES),
+                                                   COND_ALWAYS));
     }
+    append_count_check(dcontext, pre_loop, &vl, scratch);
+    instrlist_meta_append(pre_loop,
+                          INSTR_CREATE_b(dcontext, opnd_create_instr(vloop), more_cond));
+    instrlist_meta_append(pre_loop, vdone);
+    instrlist_meta_append(pre_loop,
+                          create_raw_word(dcontext, VFP_VPOP_D0(2 * vl.num_qregs)));
+    instrlist_meta_append(pre_loop, skip);
+    instrlist_meta_append(pre_loop,
+                          INSTR_CREATE_pop(dcontext,
+                                           opnd_create_reg_list(1 << HW_REG(scratch)),
+                                           COND_ALWAYS));
+
+    instrlist_meta_append(pre_loop, body);
+
+    /* the back edge now enters at the pre-loop, past the entry jmp */
+    inst = instr_get_next(instrlist_first(pre_loop));
+    instr_set_target(branch, opnd_create_instr(inst));
+    instrlist_prepend_instrlist(dcontext, trace, pre_loop); /* destroys pre_loop */
 
 #ifdef DEBUG
-    LOG(THREAD, LOG_OPTS, 1, "\nfinal version of trace:\n");
-    if ((stats->logmask & LOG_OPTS) != 0)
+    opt_stats_t.loops_vectorized++;
+    LOG(THREAD, LOG_OPTS, 3, "\nidentify_for_loop: vectorized trace:\n");
+    if (stats->loglevel >= 3 && (stats->logmask & LOG_OPTS) != 0)
         instrlist_disassemble(dcontext, tag, trace, THREAD);
 #endif
-
-
-#endif
 }
 
 /****************************************************************************/
@@ -3500,274 +3641,408 @@ stack_adjust_combiner(dcontext_t *dcontext, app_pc tag, instrlist_t *trace)
 
 
 /****************************************************************************/
-/* call return matching, attempts to match calls with their corresponding
- * returns, may not always be safe
+/* call return matching: a bl inlined into a trace is followed by its
+ * callee, and when the callee's return is in the trace too and lr, or the
+ * stack slot the callee saved lr to, provably still holds the bl's return
+ * address, the return can only go to the code that follows it.  We then
+ * drop the indirect exit the return was mangled into and keep only the
+ * return's effect on sp.
  */
 
-/* removes the return code, pattern matches on our return macro */
-static instr_t *
-remove_return(dcontext_t *dcontext, instrlist_t *trace, instr_t *inst)
-{
-#ifdef NO //TODO SJF
-    if (!INTERNAL_OPTION(unsafe_ignore_eflags_trace)) {
-        instr_t *inst2;
-        int to_pop = 4;
-        opnd_t replacement;
-#ifdef DEBUG
-        opt_stats_t.num_returns_removed++;
-        opt_stats_t.num_return_instrs_removed += 6;
-#endif
-
-        inst2 = instr_get_next(inst);
-        ASSERT(instr_get_opcode(inst) == OP_mov_st);
-        loginst(dcontext, 3, inst, "removing");
-        remove_inst(dcontext, trace, inst);
-        inst = inst2;
+#define CALL_RETURN_STACK_SIZE 40
 
-        inst2 = instr_get_next(inst);
-        ASSERT(instr_get_opcode(inst) == OP_pop);
-        loginst(dcontext, 3, inst, "removing");
-        remove_inst(dcontext, trace, inst);
-        inst = inst2;
-
-        inst2 = instr_get_next(inst);
-        if (instr_get_opcode(inst2) == OP_lea) {
-            /* this popping of the stack, lea */
-            to_pop += opnd_get_disp(instr_get_src(inst, 0));
-            loginst(dcontext, 3, inst, "removing");
-            remove_inst(dcontext, trace, inst);
-            inst = inst2;
-#ifdef DEBUG
-            opt_stats_t.num_return_instrs_removed++;
-#endif
-        }
+/* frame slot value for "no saved copy" */
+#define NO_SLOT -1
+/* get_return_source() source for a return through lr */
+#define RET_FROM_LR -2
 
-        inst2 = instr_get_next(inst);
-        ASSERT(instr_get_opcode(inst) == OP_lea);
-        loginst(dcontext, 3, inst, "removing");
-        remove_inst(dcontext, trace, inst);
-        inst = inst2;
+typedef struct _call_frame_t {
+    app_pc retaddr;     /* where the bl returns to */
+    bool in_lr;         /* lr holds retaddr */
+    int slot;           /* offset from sp of a saved copy of retaddr, or NO_SLOT */
+} call_frame_t;
 
-        inst2 = instr_get_next(inst);
-        ASSERT(instr_get_opcode(inst) == OP_jecxz);
-        loginst(dcontext, 3, inst, "removing");
-        remove_inst(dcontext, trace, inst);
-        inst = inst2;
+/* returns the app address inst was decoded from, or NULL for our own code */
+static app_pc
+instr_app_pc(instr_t *inst)
+{
+    app_pc pc = instr_get_translation(inst);
+    if (pc == NULL && instr_raw_bits_valid(inst) && !is_dynamo_address(instr_get_raw_bits(inst)))
+        pc = instr_get_raw_bits(inst);
+    return pc;
+}
 
-        inst2 = instr_get_next(inst);
-        ASSERT(instr_get_opcode(inst) == OP_lea);
-        loginst(dcontext, 3, inst, "removing");
-        remove_inst(dcontext, trace, inst);
-        inst = inst2;
+/* returns the app address of the first app instr after inst, or NULL */
+static app_pc
+next_app_pc(instr_t *inst)
+{
+    app_pc pc;
+    for (inst = instr_get_next(inst); inst != NULL; inst = instr_get_next(inst)) {
+        pc = instr_app_pc(inst);
+        if (pc != NULL)
+            return pc;
+    }
+    return NULL;
+}
 
-        inst2 = instr_get_next(inst);
-        ASSERT(instr_get_opcode(inst) == OP_jmp);
-        loginst(dcontext, 3, inst, "removing");
-        remove_inst(dcontext, trace, inst);
-        inst = inst2;
+/* If inst is a push, a pop, or a full-descending stm/ldm on sp with
+ * writeback, returns its register list and how far it moves sp.
+ */
+static bool
+get_stack_multiple(instr_t *inst, bool *is_load, reg_list_t *list, int *delta)
+{
+    int opc = instr_get_opcode(inst);
+    int i, n = 0;
+
+    if (opc == OP_push || opc == OP_pop)
+        *is_load = (opc == OP_pop);
+    else if (opc == OP_ldm || opc == OP_ldmia || opc == OP_ldmfd ||
+             opc == OP_stmdb || opc == OP_stmfd) {
+        if (!instr_get_w_flag(inst) || instr_num_dsts(inst) != 1 ||
+            !opnd_is_mem_reg(instr_get_dst(inst, 0)) ||
+            opnd_get_mem_reg(instr_get_dst(inst, 0)) != DR_REG_R13)
+            return false;
+        *is_load = (opc == OP_ldm || opc == OP_ldmia || opc == OP_ldmfd);
+    } else
+        return false;
+    if (instr_num_srcs(inst) < 1 || !OPND_IS_REGLIST(instr_get_src(inst, 0)))
+        return false;
+    *list = opnd_get_reg_list(instr_get_src(inst, 0));
+    for (i = 0; i < 16; i++) {
+        if (TEST(1 << i, *list))
+            n++;
+    }
+    *delta = *is_load ? 4 * n : -4 * n;
+    return true;
+}
 
-        inst2 = instr_get_next(inst);
-        ASSERT(instr_get_opcode(inst) == OP_mov_ld);
-        loginst(dcontext, 3, inst, "removing");
-        remove_inst(dcontext, trace, inst);
-        inst = inst2;
-
-        /* check for add here, is not uncommon to pop off the args after a return,
-         * if so  can save an instruction */
-        if ((instr_get_opcode(inst) == OP_add) &&
-            opnd_is_reg(instr_get_dst(inst, 0)) &&
-            (opnd_get_reg(instr_get_dst(inst, 0)) == REG_ESP) &&
-            opnd_is_immed_int(instr_get_src(inst, 0))) {
-            to_pop += (int) opnd_get_immed_int(instr_get_src(inst, 0));
-#ifdef DEBUG
-            opt_stats_t.num_return_instrs_removed++;
-#endif
-            if (to_pop == 0) {
-#ifdef DEBUG
-                opt_stats_t.num_return_instrs_removed++;
-#endif
-                return inst;
-            }
-            if ((to_pop <= 127) && (to_pop >= -128)) {
-                replacement = OPND_CREATE_INT8(to_pop);
-            } else {
-                replacement = OPND_CREATE_INT32(to_pop);
-            }
-            loginst(dcontext, 3, inst, " updating stack adjustment :");
-            instr_set_src(inst, 0, replacement);
-            loginst(dcontext, 3, inst, " to :");
-            return inst;
-        }
-        if (check_eflags_cr(inst)) {
-            if ((to_pop <= 127) && (to_pop >= -128)) {
-                replacement = OPND_CREATE_INT8(to_pop);
-            } else {
-                replacement = OPND_CREATE_INT32(to_pop);
-            }
-            inst2 =
-                INSTR_CREATE_add_imm(dcontext, opnd_create_reg(REG_ESP), replacement);
-        }
-        else {
-            LOG(THREAD, LOG_OPTS, 3, "Forward eflags check failed using lea to adjust stack instead of add");
-            inst2 =
-                INSTR_CREATE_lea(dcontext, opnd_create_reg(REG_ESP),
-                                 opnd_create_base_disp(REG_ESP, REG_NULL, 0,
-                                                       to_pop, OPSZ_lea));
-        }
-        loginst(dcontext, 3, inst2, "adjusting stack");
-        instrlist_preinsert(trace, inst, inst2);
-        return inst2;
+/* returns the offset of reg's word in a block transfer of list */
+static int
+reg_list_offset(reg_list_t list, reg_id_t reg)
+{
+    int i, offs = 0;
+    for (i = 0; i < HW_REG(reg); i++) {
+        if (TEST(1 << i, list))
+            offs += 4;
     }
-    else
-        return remove_return_no_save_eflags(dcontext, trace, inst);
-#endif //NO
+    return offs;
 }
 
-/* for some reason can't get instr_same / opnd_same to work for the below so
- *  just write it out, returns true if the next instruction is likely the pop
- *  of a return */
-static bool 
-is_return(dcontext_t *dcontext, instr_t *inst)
+/* If inst is a return we can match -- bx lr, mov pc, lr, a pop of pc or
+ * ldr pc, [sp], #imm -- returns in *source where it reads the target
+ * from: RET_FROM_LR or an offset from sp.
+ */
+static bool
+get_return_source(instr_t *inst, int *source)
 {
-#ifdef NO //TODO SJF
-    instr_t *pop = instr_get_next(inst);
-    if (!INTERNAL_OPTION(unsafe_ignore_eflags_trace)) {
-        instr_t *lea, *jecxz;
-        if (pop == NULL)
-            return false;
-        lea = instr_get_next(pop);
-        if (lea == NULL)
-            return false;
-        jecxz = instr_get_next(lea);
-        if (jecxz == NULL)
-            return false;
-        if (instr_get_opcode(jecxz) == OP_lea)
-            jecxz = instr_get_next(jecxz); 
-        return (jecxz != NULL && 
-                instr_get_opcode(pop) == OP_pop &&
-                opnd_get_reg(instr_get_dst(pop, 0)) == REG_ECX &&
-                instr_get_opcode(jecxz) == OP_jecxz);
+    int opc = instr_get_opcode(inst);
+    bool is_load;
+    reg_list_t list;
+    reg_id_t base;
+    int delta, offs, bump;
+    uint imm;
+
+    if ((opc == OP_bx && opnd_is_reg(instr_get_src(inst, 0)) &&
+         opnd_get_reg(instr_get_src(inst, 0)) == DR_REG_R14) ||
+        instr_is_return(inst)) {
+        *source = RET_FROM_LR;
+        return true;
     }
-    else {
-        instr_t *lea, *cmp, *jne;
-        if (pop == NULL)
-            return false;
-        lea = instr_get_next(pop);
-        if (lea == NULL)
-            return false;
-        if (instr_get_opcode(lea) != OP_lea && instr_get_opcode(lea) != OP_cmp)
+    if (get_stack_multiple(inst, &is_load, &list, &delta)) {
+        if (!is_load || !TEST(REGLIST_R15, list))
             return false;
-        if (instr_get_opcode(lea) == OP_cmp)
-            cmp = lea;
-        else
-            cmp = instr_get_next(lea);
-        if (cmp == NULL)
-            return false;
-        jne = instr_get_next(cmp); 
-        return (jne != NULL && 
-                instr_get_opcode(pop) == OP_pop &&
-                opnd_get_reg(instr_get_dst(pop, 0)) == REG_ECX &&
-                instr_get_opcode(cmp) == OP_cmp && 
-                instr_get_opcode(jne) == OP_jne);
+        *source = reg_list_offset(list, DR_REG_R15);
+        return true;
     }
-#endif //NO
+    if (opc == OP_ldr_imm && get_ldst_imm(inst, &is_load, &base, &offs, &bump) &&
+        opnd_is_reg(instr_get_dst(inst, 0)) &&
+        opnd_get_reg(instr_get_dst(inst, 0)) == DR_REG_R15 &&
+        base == DR_REG_R13 && bump >= 0 && opnd_encode_modified_imm(bump, &imm)) {
+        /* remove_return() replaces the writeback with an add of bump */
+        *source = offs;
+        return true;
+    }
+    return false;
 }
 
-/* checks to see if the address pushed by the push instruction matches the
- * address in the cmp following the pop */
-static bool 
-check_return(dcontext_t *dcontext, instr_t *inst, instr_t *push)
+static bool
+writes_reg(instr_t *inst, reg_id_t reg)
 {
-#ifdef NO //TODO SJF
-    if (!INTERNAL_OPTION(unsafe_ignore_eflags_trace)) {
-        instr_t *lea = instr_get_next(inst);
-        opnd_t check;
-        if (instr_get_opcode(lea) != OP_lea)
-            lea = inst;
-        check = instr_get_src(lea, 0);
-        logopnd(dcontext, 3, check, "check opnd");
-        return (opnd_is_near_base_disp(check) &&
-                (opnd_get_disp(check) ==
-                 -(int) opnd_get_immed_int(instr_get_src(push, 0))));
+    int opc = instr_get_opcode(inst);
+    if (instr_writes_to_reg(inst, reg))
+        return true;
+    /* ldm and pop name the loaded registers in a source list */
+    if (((opc >= OP_ldm && opc <= OP_ldmed) || opc == OP_pop) &&
+        instr_num_srcs(inst) > 0 && OPND_IS_REGLIST(instr_get_src(inst, 0)))
+        return TEST(1 << HW_REG(reg), opnd_get_reg_list(instr_get_src(inst, 0)));
+    return false;
+}
+
+/* returns whether inst writes back to an sp base in a way we don't model */
+static bool
+writes_back_sp(instr_t *inst)
+{
+    int i;
+    if (!instr_get_w_flag(inst) && instr_get_p_flag(inst))
+        return false;
+    for (i = 0; i < instr_num_srcs(inst); i++) {
+        if (opnd_is_mem_reg(instr_get_src(inst, i)) &&
+            opnd_get_mem_reg(instr_get_src(inst, i)) == DR_REG_R13)
+            return true;
     }
-    else {
-        instr_t *cmp = instr_get_next(inst);
-        opnd_t check;
-        if (instr_get_opcode(cmp) != OP_cmp)
-            cmp = inst;
-        check = instr_get_src(cmp, 1);
-        logopnd(dcontext, 3, check, "check opnd");
-        return (opnd_is_immed_int(check) &&
-                opnd_get_immed_int(check) ==
-                opnd_get_immed_int(instr_get_src(push, 0)));
+    for (i = 0; i < instr_num_dsts(inst); i++) {
+        if (opnd_is_mem_reg(instr_get_dst(inst, i)) &&
+            opnd_get_mem_reg(instr_get_dst(inst, i)) == DR_REG_R13)
+            return true;
     }
-#endif //NO
+    return false;
 }
 
+/* accounts for sp moving by delta; copies that end up below sp are lost */
+static void
+adjust_slots(call_frame_t *frames, int top, int delta)
+{
+    int i;
+    for (i = 0; i < top; i++) {
+        if (frames[i].slot != NO_SLOT) {
+            frames[i].slot -= delta;
+            if (frames[i].slot < 0)
+                frames[i].slot = NO_SLOT;
+        }
+    }
+}
 
-#define CALL_RETURN_STACK_SIZE 40
+static void
+forget_slots(call_frame_t *frames, int top)
+{
+    int i;
+    for (i = 0; i < top; i++)
+        frames[i].slot = NO_SLOT;
+}
 
-/* attempts to match calls with returns for the purpose of removing the return check
- * instructions */
-static void 
+/* updates what we know about lr and the saved return addresses across
+ * inst, which is neither a call nor a return.  A store we can't place,
+ * other than one of our own, may hit the stack and so kills every saved
+ * copy: only returns through lr survive a callee that writes memory
+ * through pointers.
+ */
+static void
+update_call_frames(instr_t *inst, call_frame_t *frames, int top)
+{
+    call_frame_t *cur = &frames[top - 1];
+    int opc = instr_get_opcode(inst);
+    bool is_load;
+    reg_list_t list;
+    reg_id_t base, reg;
+    int i, delta, offs, bump, size;
+
+    if (instr_get_cond(inst) != COND_ALWAYS) {
+        /* may or may not execute: assume the worst */
+        if (writes_reg(inst, DR_REG_R14))
+            cur->in_lr = false;
+        if (instr_uses_reg(inst, DR_REG_R13) || opc == OP_push || opc == OP_pop ||
+            (instr_writes_memory(inst) && instr_ok_to_mangle(inst)))
+            forget_slots(frames, top);
+        return;
+    }
+    if (get_stack_multiple(inst, &is_load, &list, &delta)) {
+        if (TEST(REGLIST_R13, list)) {
+            forget_slots(frames, top);
+            return;
+        }
+        if (is_load) {
+            if (TEST(REGLIST_R14, list)) {
+                cur->in_lr = (cur->slot != NO_SLOT &&
+                              cur->slot == reg_list_offset(list, DR_REG_R14));
+            }
+        } else if (cur->in_lr && TEST(REGLIST_R14, list)) {
+            /* the callee's push {..., lr}: the words land below sp */
+            cur->slot = delta + reg_list_offset(list, DR_REG_R14);
+        }
+        adjust_slots(frames, top, delta);
+        return;
+    }
+    if (get_ldst_imm(inst, &is_load, &base, &offs, &bump) &&
+        opnd_is_reg(instr_get_dst(inst, 0))) {
+        reg = opnd_get_reg(instr_get_dst(inst, 0));
+        if (is_load) {
+            if (reg == DR_REG_R14 || (opc == OP_ldrd_imm && reg + 1 == DR_REG_R14)) {
+                cur->in_lr = (opc == OP_ldr_imm && base == DR_REG_R13 &&
+                              cur->slot != NO_SLOT && cur->slot == offs);
+            }
+            if (reg == DR_REG_R13 || (opc == OP_ldrd_imm && reg + 1 == DR_REG_R13)) {
+                forget_slots(frames, top);
+                return;
+            }
+        } else if (base == DR_REG_R13) {
+            /* overwrites any saved copy it overlaps */
+            size = (opc == OP_strd_imm) ? 8 : ((opc == OP_strb_imm) ? 1 : 4);
+            for (i = 0; i < top; i++) {
+                if (frames[i].slot != NO_SLOT &&
+                    frames[i].slot < offs + size && offs < frames[i].slot + 4)
+                    frames[i].slot = NO_SLOT;
+            }
+            if (opc == OP_str_imm && reg == DR_REG_R14 && cur->in_lr)
+                cur->slot = offs;
+        } else if (instr_ok_to_mangle(inst))
+            forget_slots(frames, top);
+        if (base == DR_REG_R13)
+            adjust_slots(frames, top, bump);
+        else if (base == DR_REG_R14 && bump != 0)
+            cur->in_lr = false;
+        return;
+    }
+    if ((opc == OP_add_imm || opc == OP_sub_imm) &&
+        opnd_is_reg(instr_get_dst(inst, 0)) &&
+        opnd_get_reg(instr_get_dst(inst, 0)) == DR_REG_R13 &&
+        opnd_is_reg(instr_get_src(inst, 0)) &&
+        opnd_get_reg(instr_get_src(inst, 0)) == DR_REG_R13) {
+        delta = (int) get_dp_immed(instr_get_src(inst, 1));
+        adjust_slots(frames, top, (opc == OP_add_imm) ? delta : -delta);
+        return;
+    }
+    if (writes_reg(inst, DR_REG_R14))
+        cur->in_lr = false;
+    if (writes_reg(inst, DR_REG_R13) || writes_back_sp(inst) ||
+        (instr_writes_memory(inst) && instr_ok_to_mangle(inst)))
+        forget_slots(frames, top);
+}
+
+/* Replaces a matched return with its effect on sp and removes the
+ * indirect exit our mangling put after it.  Returns the instr to resume
+ * matching at.
+ */
+static instr_t *
+remove_return(dcontext_t *dcontext, instrlist_t *trace, instr_t *inst)
+{
+    instr_t *in, *next, *resume;
+    bool is_load;
+    reg_list_t list;
+    reg_id_t base;
+    int delta, offs, bump = 0;
+    uint imm;
+
+#ifdef DEBUG
+    opt_stats_t.num_returns_removed++;
+#endif
+    for (in = instr_get_next(inst); in != NULL && instr_app_pc(in) == NULL; in = next) {
+        next = instr_get_next(in);
+        if (instr_is_exit_cti(in)) {
+            loginst(dcontext, 3, in, "removing return exit");
+            remove_inst(dcontext, trace, in);
+#ifdef DEBUG
+            opt_stats_t.num_return_instrs_removed++;
+#endif
+        }
+    }
+
+    if (get_stack_multiple(inst, &is_load, &list, &delta)) {
+        /* pc is the highest register, so the rest load from the same words */
+        list &= ~REGLIST_R15;
+        bump = 4;
+        if (list != 0) {
+            instr_set_src(inst, 0, opnd_create_reg_list(list));
+            instr_set_raw_bits_valid(inst, false);
+            loginst(dcontext, 3, inst, "return pop is now");
+            resume = inst;
+        } else
+            resume = NULL;
+    } else {
+        if (instr_get_opcode(inst) == OP_ldr_imm)
+            get_ldst_imm(inst, &is_load, &base, &offs, &bump);
+        resume = NULL;
+    }
+    if (bump != 0) {
+        /* get_return_source() only accepts an encodable bump */
+        DEBUG_DECLARE(bool ok =) opnd_encode_modified_imm(bump, &imm);
+        ASSERT(ok);
+        in = INSTR_CREATE_add_imm(dcontext, opnd_create_reg(DR_REG_R13),
+                                  opnd_create_reg(DR_REG_R13), OPND_CREATE_IMM12(imm),
+                                  COND_ALWAYS);
+        instrlist_postinsert(trace, inst, in);
+        if (resume == NULL)
+            resume = in;
+    }
+    if (resume != inst) {
+        if (resume == NULL)
+            resume = instr_get_next(inst);
+        loginst(dcontext, 3, inst, "removing return");
+        remove_inst(dcontext, trace, inst);
+#ifdef DEBUG
+        opt_stats_t.num_return_instrs_removed++;
+#endif
+    }
+    return resume;
+}
+
+/* attempts to match calls with returns for the purpose of removing the
+ * returns' indirect branch checks
+ */
+static void
 call_return_matching(dcontext_t *dcontext, app_pc tag, instrlist_t *trace)
 {
-#ifdef NO
-    instr_t *a[CALL_RETURN_STACK_SIZE];
+    call_frame_t frames[CALL_RETURN_STACK_SIZE];
     instr_t *inst, *next_inst;
-    int top, i, opcode;
-    top = 0;
+    app_pc pc;
+    int top = 0, i, source;
+    bool match;
+
 #ifdef DEBUG
     LOG(THREAD, LOG_OPTS, 3, "starting call return matching\n");
-    if (stats->loglevel >= 3 && (stats->logmask & LOG_OPTS) != 0)
-        instrlist_disassemble(dcontext, tag, trace, THREAD);
 #endif
     for (inst = instrlist_first(trace); inst != NULL; inst = next_inst) {
         next_inst = instr_get_next(inst);
-        loginst(dcontext, 3, inst, "checking");
-        // look for push_imm from call and add to state
-        if (next_inst != NULL) {
-            opcode = instr_get_opcode(next_inst);
-            if ((opcode == OP_push_imm) && (opnd_get_size(instr_get_src(next_inst, 0)) == OPSZ_4))  {
-                inst = next_inst;
-                loginst(dcontext, 3, inst, "found call push");
-                if (top < CALL_RETURN_STACK_SIZE) {
-                    a[top] = inst;
-                    top++;
-                } else {
-                    LOG(THREAD, LOG_OPTS, 1, "call return matching stack overflow\n");
-                    for (i = 1; i < CALL_RETURN_STACK_SIZE; i++) {
-                        a[i-1] = a[i];
-                    }
-                    a[top-1] = inst;
-                }
-            }
+        if (instr_is_label(inst) || !instr_opcode_valid(inst)) {
+            /* a join point, or bits we can't see into */
+            top = 0;
+            continue;
         }
-        // look for pop from return and remove instruction is possible
-        if (is_return(dcontext, inst)) {
-            loginst(dcontext, 3, inst, "found start of return");
-            while ((top > 0) && (!check_return(dcontext, instr_get_next(instr_get_next(inst)), a[top-1]))) {
+        if (instr_is_call_direct(inst)) {
+            pc = instr_app_pc(inst);
+            if (pc == NULL || instr_get_cond(inst) != COND_ALWAYS) {
+                top = 0;
+                continue;
+            }
+            loginst(dcontext, 3, inst, "found call");
+            if (top == CALL_RETURN_STACK_SIZE) {
+                LOG(THREAD, LOG_OPTS, 1, "call return matching stack overflow\n");
+                for (i = 1; i < CALL_RETURN_STACK_SIZE; i++)
+                    frames[i-1] = frames[i];
                 top--;
-                loginst(dcontext, 3, a[top], "ignoring probable non call push immed on call return stack");
             }
-            if (top > 0) {
-                loginst(dcontext, 3, a[top-1], "corresponding push was");
-                LOG(THREAD, LOG_OPTS, 3, "attempting to remove return code\n");
-                next_inst = remove_return(dcontext, trace, inst);
+            if (top > 0)
+                frames[top-1].in_lr = false;
+            frames[top].retaddr = pc + 4;
+            frames[top].in_lr = true;
+            frames[top].slot = NO_SLOT;
+            top++;
+            continue;
+        }
+        if (get_return_source(inst, &source)) {
+            match = (top > 0 && instr_get_cond(inst) == COND_ALWAYS &&
+                     (source == RET_FROM_LR ? frames[top-1].in_lr :
+                      (frames[top-1].slot != NO_SLOT && frames[top-1].slot == source)) &&
+                     next_app_pc(inst) == frames[top-1].retaddr);
+            if (match) {
+                loginst(dcontext, 3, inst, "found matching return");
                 top--;
+                next_inst = remove_return(dcontext, trace, inst);
             } else {
-                LOG(THREAD, LOG_OPTS, 3, "call return stack underflow\n");
+                loginst(dcontext, 3, inst, "return not matched");
+                top = 0;
             }
+            continue;
         }
+        if (top > 0)
+            update_call_frames(inst, frames, top);
     }
 #ifdef DEBUG
     LOG(THREAD, LOG_OPTS, 3, "done call return matching\n");
     if (stats->loglevel >= 3 && (stats->logmask & LOG_OPTS) != 0)
         instrlist_disassemble(dcontext, tag, trace, THREAD);
 #endif
-#endif //NO
 }
-    
+
 /****************************************************************************/
 
 /* peephole driver
@@ -4237,95 +4512,612 @@ find_dead_register_across_instrs_H(instr_t *start,instr_t *end)
 #endif /* #if 0 */
 
 /****************************************************************************/
-/* prefetching */
+/* ARM condition flag passes */
 
-#define MIN_PREFETCH_DISTANCE 3
+#define NZCV_FLAGS (CPSR_READ_N | CPSR_READ_Z | CPSR_READ_C | CPSR_READ_V)
 
-static void
-prefetch_optimize_trace(dcontext_t *dcontext, app_pc tag, instrlist_t *trace)
+/* max number of instrs a forward cbr may skip and still be if-converted */
+#define MAX_IF_CONVERT_INSTRS 4
+
+static bool
+is_compare(int opc)
 {
-#ifdef NO //TODO SJF
-    instr_t *instr,*loopinstr,*tracewalker,*prefetchinstr;
-    opnd_t src_mem_access;
-    int distance;
+    return (opc == OP_cmp_imm || opc == OP_cmp_reg || opc == OP_cmp_rsr ||
+            opc == OP_cmn_imm || opc == OP_cmn_reg || opc == OP_cmn_rsr ||
+            opc == OP_tst_imm || opc == OP_tst_reg || opc == OP_tst_rsr ||
+            opc == OP_teq_imm || opc == OP_teq_reg || opc == OP_teq_rsr);
+}
+
+/* returns the flags tested by condition code cond */
+static uint
+cond_flags_read(int cond)
+{
+    switch (cond) {
+    case COND_EQUAL:
+    case COND_NOT_EQUAL:
+        return CPSR_READ_Z;
+    case COND_CARRY_SET:
+    case COND_CARRY_CLEAR:
+        return CPSR_READ_C;
+    case COND_MINUS:
+    case COND_PLUS:
+        return CPSR_READ_N;
+    case COND_OVERFLOW:
+    case COND_NO_OVERFLOW:
+        return CPSR_READ_V;
+    case COND_HIGHER:
+    case COND_LOWER_OR_SAME:
+        return CPSR_READ_C | CPSR_READ_Z;
+    case COND_SIGNED_GREATER_THAN_OR_EQUAL:
+    case COND_SIGNED_LESS_THAN:
+        return CPSR_READ_N | CPSR_READ_V;
+    case COND_SIGNED_GREATER_THAN:
+    case COND_SIGNED_LESS_THAN_OR_EQUAL:
+        return CPSR_READ_N | CPSR_READ_Z | CPSR_READ_V;
+    default:
+        return 0;
+    }
+}
+
+/* returns the NZCV flags inst reads */
+static uint
+flags_read(instr_t *inst)
+{
+    int opc = instr_get_opcode(inst);
+    uint read = 0;
+
+    if (!instr_is_unconditional(inst))
+        read |= cond_flags_read(instr_get_cond(inst));
+    if (opc == OP_mrs || opc == OP_it)
+        read |= NZCV_FLAGS;
+    if (opc == OP_adc_imm || opc == OP_adc_reg || opc == OP_adc_rsr ||
+        opc == OP_sbc_imm || opc == OP_sbc_reg || opc == OP_sbc_rsr ||
+        opc == OP_rsc_imm || opc == OP_rsc_reg || opc == OP_rsc_rsr ||
+        opc == OP_rrx)
+        read |= CPSR_READ_C;
+    return read;
+}
 
-    bool insertprefetch;
+/* sets *must to the flags inst always overwrites and *may to those it
+ * might change.  arithmetic writes all of NZCV; logical ops, moves and
+ * shifts leave V alone and only change C when the shifter carries out;
+ * multiplies write just N and Z.
+ */
+static void
+flags_written(instr_t *inst, uint *must, uint *may)
+{
+    int opc = instr_get_opcode(inst);
 
-    loopinstr=find_next_self_loop(dcontext,tag,instrlist_first(trace));
-    if (loopinstr==NULL) {
+    *must = 0;
+    *may = 0;
+    if (opc == OP_msr_imm || opc == OP_msr_reg) {
+        *may = NZCV_FLAGS;
+        return;
+    }
+    if (!is_compare(opc) && (!instr_has_s_flag(inst) || !instr_get_s_flag(inst)))
         return;
+    switch (opc) {
+    case OP_add_imm: case OP_add_reg: case OP_add_rsr:
+    case OP_adc_imm: case OP_adc_reg: case OP_adc_rsr:
+    case OP_sub_imm: case OP_sub_reg: case OP_sub_rsr:
+    case OP_sbc_imm: case OP_sbc_reg: case OP_sbc_rsr:
+    case OP_rsb_imm: case OP_rsb_reg: case OP_rsb_rsr:
+    case OP_rsc_imm: case OP_rsc_reg: case OP_rsc_rsr:
+    case OP_add_sp_imm: case OP_sub_sp_imm: case OP_sub_sp_reg:
+    case OP_cmp_imm: case OP_cmp_reg: case OP_cmp_rsr:
+    case OP_cmn_imm: case OP_cmn_reg: case OP_cmn_rsr:
+        *may = NZCV_FLAGS;
+        break;
+    case OP_mul: case OP_mla:
+    case OP_smull: case OP_smlal: case OP_umull: case OP_umlal:
+        *may = CPSR_READ_N | CPSR_READ_Z;
+        break;
+    default:
+        *may = CPSR_READ_N | CPSR_READ_Z | CPSR_READ_C;
+        break;
     }
+    *must = *may & ~CPSR_READ_C;
+    if (*may == NZCV_FLAGS)
+        *must = NZCV_FLAGS;
+    /* a predicated write may not happen */
+    if (!instr_is_unconditional(inst) && instr_get_cond(inst) != COND_ALWAYS)
+        *must = 0;
+}
 
-    instr=instrlist_first(trace);
-    while (instr!=NULL) {
-        
-        if (instr_reads_memory(instr) &&
-            instr_get_opcode(instr)!=OP_prefetchnta) {
+/* returns true if all flags must be considered live at inst: anything
+ * that can leave the trace or whose flag use we do not model
+ */
+static bool
+flags_live_at(instr_t *inst)
+{
+    return (instr_is_cti(inst) || instr_is_syscall(inst) ||
+            instr_is_interrupt(inst) || instr_writes_to_reg(inst, DR_REG_R15));
+}
+
+/* returns true if inst can execute under a condition code in place of
+ * being skipped by a forward branch
+ */
+static bool
+is_predicable(instr_t *inst)
+{
+    uint must, may;
+
+    if (!instr_ok_to_mangle(inst) || flags_live_at(inst) ||
+        instr_is_unconditional(inst) || instr_get_cond(inst) != COND_ALWAYS ||
+        instr_get_opcode(inst) == OP_it)
+        return false;
+    /* the skipped instrs all test the branch's flags */
+    flags_written(inst, &must, &may);
+    return (may == 0);
+}
+
+/* returns true if a cti in trace other than branch targets an instr
+ * after start and before end
+ */
+static bool
+is_entered_between(instrlist_t *trace, instr_t *branch, instr_t *start, instr_t *end)
+{
+    instr_t *inst, *in;
+    opnd_t target;
+
+    for (inst = instrlist_first(trace); inst != NULL; inst = instr_get_next(inst)) {
+        if (inst == branch || !instr_is_cti(inst))
+            continue;
+        target = instr_get_target(inst);
+        if (!opnd_is_instr(target))
+            continue;
+        for (in = instr_get_next(start); in != end; in = instr_get_next(in)) {
+            if (opnd_get_instr(target) == in)
+                return true;
+        }
+    }
+    return false;
+}
 
-            src_mem_access=instr_get_src_mem_access(instr);
+/* replaces a conditional branch that skips a few instrs further down the
+ * trace with those instrs predicated on the opposite condition, removing
+ * the branch and a possible misprediction
+ */
+static void
+if_convert_branches(dcontext_t *dcontext, app_pc tag, instrlist_t *trace)
+{
+    instr_t *inst, *next_inst, *target, *in;
+    opnd_t target_opnd;
+    int cond, count;
 
-            //only prefetch if the load is register-indirect
-            if (!(opnd_get_base(src_mem_access)||opnd_get_index(src_mem_access)))
+    for (inst = instrlist_first(trace); inst != NULL; inst = next_inst) {
+        next_inst = instr_get_next(inst);
+        if (instr_get_opcode(inst) != OP_b || !instr_ok_to_mangle(inst))
+            continue;
+        cond = instr_get_cond(inst);
+        if (cond < COND_EQUAL || cond >= COND_ALWAYS)
+            continue;
+        target_opnd = instr_get_target(inst);
+        if (!opnd_is_instr(target_opnd))
+            continue;
+        target = opnd_get_instr(target_opnd);
+        count = 0;
+        for (in = next_inst; in != NULL && in != target; in = instr_get_next(in)) {
+            if (instr_is_label(in))
+                continue;
+            if (!is_predicable(in) || ++count > MAX_IF_CONVERT_INSTRS)
                 break;
+        }
+        /* a backward branch, or a forward one over too much */
+        if (in != target)
+            continue;
+        if (is_entered_between(trace, inst, inst, target))
+            continue;
 
-            prefetchinstr=INSTR_CREATE_prefetchnta(dcontext,
-                                                   opnd_create_base_disp(opnd_get_base(src_mem_access),
-                                                                         opnd_get_index(src_mem_access),
-                                                                         opnd_get_scale(src_mem_access),
-                                                                         opnd_get_disp(src_mem_access), OPSZ_1));
-
-            insertprefetch=true;
-            tracewalker=instr->prev;  //start walk before instruction to prefetch for
-            distance=0;
-            while (1) {
-                distance++;
-                //if beginning of trace is reached, go back to loop spot
-                if (tracewalker==NULL)
-                    tracewalker=loopinstr->prev;
-
-                //reached conflicting instruction
-                if (instruction_affects_mem_access(tracewalker,src_mem_access))
-                    break;
+        loginst(dcontext, 3, inst, "if-converting");
+        for (in = next_inst; in != target; in = instr_get_next(in)) {
+            if (instr_is_label(in))
+                continue;
+            instr_set_cond(in, invert_cond_code(cond));
+#ifdef DEBUG
+            opt_stats_t.instrs_predicated++;
+#endif
+        }
+#ifdef DEBUG
+        opt_stats_t.branches_if_converted++;
+#endif
+        remove_inst(dcontext, trace, inst);
+    }
+}
 
-                //came across same prefetch instruction already
-                if (instr_same(prefetchinstr,tracewalker)) {
-                    insertprefetch=false;
-                    break;
-                }
+/* if inst is a word ldr or str with an immediate offset and no writeback,
+ * returns its transfer register, base and signed displacement
+ */
+static bool
+get_word_ldst(instr_t *inst, reg_id_t *rt, reg_id_t *base, int *disp)
+{
+    int opc = instr_get_opcode(inst);
+    opnd_t mem, offs;
 
-                //looped completely around or load is after the loop instr
-                if ((tracewalker==instr)||(tracewalker==loopinstr)) {
-                    insertprefetch=false;
-                    break;
-                }                   
-                tracewalker=tracewalker->prev;
-            }
+    if ((opc != OP_ldr_imm && opc != OP_str_imm) || !instr_ok_to_mangle(inst))
+        return false;
+    /* post-indexed forms always write back */
+    if (!instr_get_p_flag(inst) || instr_get_w_flag(inst))
+        return false;
+    mem = instr_get_src(inst, 0);
+    offs = instr_get_src(inst, 1);
+    if (!opnd_is_reg(instr_get_dst(inst, 0)) || !opnd_is_mem_reg(mem) ||
+        !opnd_is_immed_int(offs))
+        return false;
+    *rt = opnd_get_reg(instr_get_dst(inst, 0));
+    *base = opnd_get_mem_reg(mem);
+    *disp = (int) opnd_get_immed_int(offs);
+    if (!instr_get_u_flag(inst))
+        *disp = -*disp;
+    return true;
+}
+
+/* combines a ldr/str of an even register followed by the same access of
+ * the next register to the next word into one ldrd/strd.  Unlike ldr/str,
+ * ldrd/strd fault on an address that is not word-aligned even with
+ * alignment checking off, so only sp-relative accesses at a word offset
+ * are paired: the AAPCS keeps sp word-aligned at all times.
+ */
+static void
+pair_loads_stores(dcontext_t *dcontext, app_pc tag, instrlist_t *trace)
+{
+    instr_t *inst, *next_inst, *pair;
+    reg_id_t rt1, rt2, base1, base2;
+    int disp1, disp2, opc, cond;
+
+    for (inst = instrlist_first(trace); inst != NULL; inst = next_inst) {
+        next_inst = instr_get_next(inst);
+        if (next_inst == NULL)
+            break;
+        if (!get_word_ldst(inst, &rt1, &base1, &disp1) ||
+            !get_word_ldst(next_inst, &rt2, &base2, &disp2))
+            continue;
+        opc = instr_get_opcode(inst);
+        cond = instr_get_cond(inst);
+        if (instr_get_opcode(next_inst) != opc || instr_get_cond(next_inst) != cond)
+            continue;
+        if (base1 != base2 || base1 != DR_REG_R13)
+            continue;
+        /* ldrd/strd take an 8-bit offset */
+        if (disp2 != disp1 + 4 || disp1 < -255 || disp1 > 255 || (disp1 & 3) != 0)
+            continue;
+        /* the pair must be an even register and its successor, not lr/pc */
+        if ((rt1 - DR_REG_R0) % 2 != 0 || rt1 == DR_REG_R14 || rt2 != rt1 + 1)
+            continue;
+        /* the first load would change the second's address */
+        if (opc == OP_ldr_imm && rt1 == base1)
+            continue;
+
+        if (opc == OP_ldr_imm) {
+            pair = INSTR_CREATE_ldrd_imm(dcontext, opnd_create_reg(rt1),
+                                         opnd_create_mem_reg(base1),
+                                         OPND_CREATE_IMM8(disp1 < 0 ? -disp1 : disp1),
+                                         cond);
+        } else {
+            pair = INSTR_CREATE_strd_imm(dcontext, opnd_create_reg(rt1),
+                                         opnd_create_mem_reg(base1),
+                                         OPND_CREATE_IMM8(disp1 < 0 ? -disp1 : disp1),
+                                         cond);
+        }
+        instr_set_p_flag(dcontext, pair, true);
+        instr_set_u_flag(dcontext, pair, disp1 >= 0);
+        instr_set_w_flag(dcontext, pair, false);
+
+        loginst(dcontext, 3, inst, "pairing");
+        loginst(dcontext, 3, next_inst, "   with");
+        next_inst = instr_get_next(next_inst);
+        remove_inst(dcontext, trace, instr_get_next(inst));
+        replace_inst(dcontext, trace, inst, pair);
+#ifdef DEBUG
+        opt_stats_t.ldst_pairs_combined++;
+#endif
+    }
+}
 
-            if (insertprefetch&&(distance<MIN_PREFETCH_DISTANCE||
-                                 (tracewalker->next==instr)))
-                insertprefetch=false;
+/* walks the trace backward tracking which of NZCV are live and drops the
+ * S suffix from app instrs whose flag results are never read, removing
+ * compares that are dead altogether
+ */
+static void
+remove_dead_flag_writes(dcontext_t *dcontext, app_pc tag, instrlist_t *trace)
+{
+    instr_t *inst, *prev_inst;
+    uint live = NZCV_FLAGS; /* live on trace exit */
+    uint must, may;
 
-            if (insertprefetch) { 
+    for (inst = instrlist_last(trace); inst != NULL; inst = prev_inst) {
+        prev_inst = instr_get_prev(inst);
+        if (instr_is_label(inst))
+            continue;
+        if (flags_live_at(inst)) {
+            live = NZCV_FLAGS;
+            continue;
+        }
+        flags_written(inst, &must, &may);
+        if (may != 0 && (may & live) == 0 && instr_ok_to_mangle(inst)) {
+            if (is_compare(instr_get_opcode(inst))) {
+                loginst(dcontext, 3, inst, "removing dead compare");
+                remove_inst(dcontext, trace, inst);
 #ifdef DEBUG
-                LOG(THREAD, LOG_OPTS, 3,"in trace "PFX" inserting prefetch for:",tag);
-                if (stats->loglevel>=3)
-                    instr_disassemble(dcontext,instr,THREAD);
-                LOG(THREAD, LOG_OPTS, 3," after instruction: ");
-                if (stats->loglevel>=3)
-                    instr_disassemble(dcontext,tracewalker,THREAD);
-                LOG(THREAD, LOG_OPTS, 3,"\n");
+                opt_stats_t.compares_removed++;
 #endif
-                instrlist_postinsert(trace,tracewalker,prefetchinstr);
+                continue;
             }
-            else
-                instr_destroy(dcontext,prefetchinstr);
+            if (instr_has_s_flag(inst)) {
+                loginst(dcontext, 3, inst, "dropping dead S suffix");
+                instr_set_s_flag(dcontext, inst, false);
+#ifdef DEBUG
+                opt_stats_t.s_flags_removed++;
+#endif
+                must = 0;
+            }
+        }
+        live = (live & ~must) | flags_read(inst);
+    }
+}
+
+/****************************************************************************/
+/* prefetching */
+
+/* PLD has no IR support in this tree (INSTR_CREATE_pld_imm takes no
+ * operands and encodes to nothing), so hints are emitted as raw A1
+ * "pld [rn, #+/-imm12]" words.  A hint never faults and writes no
+ * register, so inserting one leaves the app's state untouched.
+ */
+#define ARM_PLD_IMM(rn, disp) ((disp) >= 0 ?                               \
+                               (0xf5d0f000 | (rn) << 16 | (disp)) :       \
+                               (0xf550f000 | (rn) << 16 | -(disp)))
+#define MAX_PLD_DISP 4095
+
+/* cycles a miss to memory costs, which the lookahead should cover, at
+ * roughly one cycle per instr of loop body
+ */
+#define PREFETCH_MISS_CYCLES 120
+#define MIN_PREFETCH_LOOKAHEAD 2
+#define MAX_PREFETCH_LOOKAHEAD 32
+/* loads of one stream this close together share a hint */
+#define PREFETCH_LINE_SIZE 32
+#define MAX_PREFETCH_STREAMS 4
+
+typedef struct _prefetch_stream_t {
+    reg_id_t base;
+    int addr;           /* offset from base at the loop top */
+} prefetch_stream_t;
+
+#ifdef SIDELINE
+/* Lookahead multipliers from the sideline sampler, by trace tag.  The
+ * sideline thread is the only writer and nothing locks the table: a
+ * stale or torn entry only changes pld displacements, never which
+ * instrs a trace holds, so re-running optimize_trace to translate
+ * state still reproduces the same layout.
+ */
+#define PREFETCH_HINT_BITS 6
+#define PREFETCH_HINT_INDEX(tag) \
+    (((ptr_uint_t)(tag) >> 2) & ((1 << PREFETCH_HINT_BITS) - 1))
+static struct {
+    app_pc tag;
+    int scale;
+} prefetch_hints[1 << PREFETCH_HINT_BITS];
+
+/* Called by the sideline thread before it optimizes the trace at tag,
+ * which took samples of its total.  A loop holding a large share of the
+ * samples is where a late prefetch costs the most, so it reaches further
+ * ahead than its body length alone suggests.
+ */
+void
+prefetch_note_samples(app_pc tag, int samples, int total)
+{
+    uint i = PREFETCH_HINT_INDEX(tag);
+    int scale = 1;
+
+    if (total > 0) {
+        if (samples * 2 >= total)
+            scale = 4;
+        else if (samples * 4 >= total)
+            scale = 2;
+    }
+    prefetch_hints[i].tag = tag;
+    prefetch_hints[i].scale = scale;
+}
+#endif
+
+/* returns how many iterations ahead of a loop of body_len instrs to
+ * prefetch
+ */
+static int
+prefetch_lookahead(app_pc tag, int body_len)
+{
+    int lookahead = (PREFETCH_MISS_CYCLES + body_len - 1) / body_len;
+#ifdef SIDELINE
+    uint i = PREFETCH_HINT_INDEX(tag);
+    if (prefetch_hints[i].tag == tag)
+        lookahead *= prefetch_hints[i].scale;
+#endif
+    if (lookahead < MIN_PREFETCH_LOOKAHEAD)
+        lookahead = MIN_PREFETCH_LOOKAHEAD;
+    if (lookahead > MAX_PREFETCH_LOOKAHEAD)
+        lookahead = MAX_PREFETCH_LOOKAHEAD;
+    return lookahead;
+}
+
+/* If inst is an immediate-offset load or store we can model, returns its
+ * base, the offset from base it accesses, and how far it moves base.
+ */
+static bool
+get_ldst_imm(instr_t *inst, bool *is_load, reg_id_t *base, int *offs, int *bump)
+{
+    int opc = instr_get_opcode(inst);
+    int imm;
+
+    if (opc == OP_ldr_imm || opc == OP_ldrb_imm || opc == OP_ldrd_imm)
+        *is_load = true;
+    else if (opc == OP_str_imm || opc == OP_strb_imm || opc == OP_strd_imm)
+        *is_load = false;
+    else
+        return false;
+    /* decoded ldrd/strd split their offset across two immeds */
+    if ((opc == OP_ldrd_imm || opc == OP_strd_imm) && instr_num_srcs(inst) != 2)
+        return false;
+    if (!opnd_is_mem_reg(instr_get_src(inst, 0)) ||
+        !opnd_is_immed_int(instr_get_src(inst, 1)))
+        return false;
+    *base = opnd_get_mem_reg(instr_get_src(inst, 0));
+    imm = (int) opnd_get_immed_int(instr_get_src(inst, 1));
+    if (!instr_get_u_flag(inst))
+        imm = -imm;
+    if (!instr_get_p_flag(inst)) {
+        /* post-indexed: access at base, then write back */
+        *offs = 0;
+        *bump = imm;
+    } else {
+        *offs = imm;
+        *bump = instr_get_w_flag(inst) ? imm : 0;
+    }
+    return true;
+}
 
+/* returns the value of a data-processing instr's I12 operand, which holds
+ * the rotated modified immediate field
+ */
+static uint
+get_dp_immed(opnd_t opnd)
+{
+    return opnd_decode_modified_imm((uint) opnd_get_immed_int(opnd));
+}
 
+/* returns how far inst moves reg, setting *known to false if inst
+ * changes reg in a way that is not a constant step
+ */
+static int
+reg_step(instr_t *inst, reg_id_t reg, bool *known)
+{
+    int opc = instr_get_opcode(inst);
+    int i, offs, bump;
+    uint imm;
+    reg_id_t base;
+    bool is_load;
+
+    if (get_ldst_imm(inst, &is_load, &base, &offs, &bump)) {
+        if (is_load && (opnd_uses_reg(instr_get_dst(inst, 0), reg) ||
+                        (opc == OP_ldrd_imm &&
+                         opnd_uses_reg(instr_get_dst(inst, 0), reg - 1))))
+            *known = false;
+        else if (base == reg && bump != 0) {
+            if (instr_get_cond(inst) != COND_ALWAYS)
+                *known = false;
+            return bump;
+        }
+        return 0;
+    }
+    if ((opc == OP_add_imm || opc == OP_sub_imm) &&
+        opnd_is_reg(instr_get_dst(inst, 0)) && opnd_get_reg(instr_get_dst(inst, 0)) == reg) {
+        if (instr_get_cond(inst) != COND_ALWAYS || !opnd_is_reg(instr_get_src(inst, 0)) ||
+            opnd_get_reg(instr_get_src(inst, 0)) != reg) {
+            *known = false;
+            return 0;
+        }
+        imm = get_dp_immed(instr_get_src(inst, 1));
+        return (opc == OP_add_imm) ? (int) imm : -(int) imm;
+    }
+    /* anything else naming reg as a base or in a register list may write
+     * it back, and our IR lists the base of ldm/stm as a dst
+     */
+    for (i = 0; i < instr_num_dsts(inst); i++) {
+        if (opnd_uses_reg(instr_get_dst(inst, i), reg))
+            *known = false;
+    }
+    for (i = 0; i < instr_num_srcs(inst); i++) {
+        opnd_t src = instr_get_src(inst, i);
+        if (!opnd_is_reg(src) && opnd_uses_reg(src, reg))
+            *known = false;
+    }
+    if (instr_writes_to_reg(inst, reg))
+        *known = false;
+    return 0;
+}
+
+/* Inserts a pld ahead of each load stream in a trace that loops back to
+ * its top: a load off a register that the loop body only moves by a
+ * constant stride.  The hint looks ahead a number of iterations sized so
+ * the line arrives about when the load gets there.  Which loads get a
+ * hint depends only on the trace; the lookahead only changes the hint's
+ * displacement.
+ */
+static void
+prefetch_optimize_trace(dcontext_t *dcontext, app_pc tag, instrlist_t *trace)
+{
+    instr_t *inst, *first, *branch;
+    prefetch_stream_t streams[MAX_PREFETCH_STREAMS];
+    int stride[DR_REG_R12 + 1], delta[DR_REG_R12 + 1];
+    bool known[DR_REG_R12 + 1];
+    int num_streams = 0, body_len = 0, lookahead, offs, bump, addr, limit, i;
+    reg_id_t reg, base;
+    bool is_load;
+
+    first = instrlist_first(trace);
+    branch = find_next_self_loop(dcontext, tag, first);
+    if (branch == NULL)
+        return;
+    /* the body must run straight through to the loop branch */
+    for (inst = first; inst != branch; inst = instr_get_next(inst)) {
+        if (instr_is_label(inst))
+            continue;
+        if (instr_is_cti(inst) && opnd_is_instr(instr_get_target(inst)))
+            return;
+        body_len++;
+    }
+    body_len++;
+
+    for (reg = DR_REG_R0; reg <= DR_REG_R12; reg++) {
+        stride[reg] = 0;
+        delta[reg] = 0;
+        known[reg] = true;
+        for (inst = first; inst != branch && known[reg]; inst = instr_get_next(inst)) {
+            if (!instr_is_label(inst))
+                stride[reg] += reg_step(inst, reg, &known[reg]);
+        }
+    }
+    lookahead = prefetch_lookahead(tag, body_len);
+    LOG(THREAD, LOG_OPTS, 3, "prefetch: trace "PFX" loops over %d instrs, "
+        "looking %d iterations ahead\n", tag, body_len, lookahead);
+
+    for (inst = first; inst != branch; inst = instr_get_next(inst)) {
+        if (instr_is_label(inst))
+            continue;
+        if (get_ldst_imm(inst, &is_load, &base, &offs, &bump) &&
+            is_load && instr_ok_to_mangle(inst) && instr_get_cond(inst) == COND_ALWAYS &&
+            base >= DR_REG_R0 && base <= DR_REG_R12 && known[base] && stride[base] != 0 &&
+            num_streams < MAX_PREFETCH_STREAMS) {
+            addr = delta[base] + offs;
+            for (i = 0; i < num_streams; i++) {
+                if (streams[i].base == base &&
+                    streams[i].addr - addr < PREFETCH_LINE_SIZE &&
+                    addr - streams[i].addr < PREFETCH_LINE_SIZE)
+                    break;
+            }
+            /* the furthest we can reach from here */
+            limit = (stride[base] > 0) ? (MAX_PLD_DISP - offs) / stride[base] :
+                (MAX_PLD_DISP + offs) / -stride[base];
+            if (i == num_streams && limit > 0) {
+                int disp = offs + MIN(lookahead, limit) * stride[base];
+                loginst(dcontext, 3, inst, "prefetch: inserting pld ahead of");
+                instrlist_meta_preinsert(trace, inst,
+                                         create_raw_word(dcontext,
+                                                         ARM_PLD_IMM(HW_REG(base), disp)));
+                streams[num_streams].base = base;
+                streams[num_streams].addr = addr;
+                num_streams++;
+#ifdef DEBUG
+                opt_stats_t.prefetches_inserted++;
+#endif
+            }
+        }
+        /* track where each stream base is relative to the loop top */
+        for (reg = DR_REG_R0; reg <= DR_REG_R12; reg++) {
+            if (known[reg] && stride[reg] != 0)
+                delta[reg] += reg_step(inst, reg, &known[reg]);
         }
-        instr=instr_get_next(instr);
-        
     }
-#endif //NO
 }
 
 /* Removed josh's attempt at using the SSE2 xmm registers to hold some local vars - 
@@ -4520,15 +5312,17 @@ instr_get_src_mem_access(instr_t *instr)
 instr_t *
 find_next_self_loop(dcontext_t *dcontext, app_pc tag, instr_t *instr)
 {
-    app_pc target;
+    opnd_t targetop;
 
     while (instr != NULL) {
         if (instr_is_cbr(instr)||instr_is_ubr(instr)) {
-            target=opnd_get_pc(instr_get_target(instr));
-            if (target==tag) {
+            targetop=instr_get_target(instr);
+            /* instrlist_decode_cti turns a branch to the top into an instr target */
+            if (opnd_is_near_pc(targetop)&&opnd_get_pc(targetop)==tag)
+                return instr;
+            if (opnd_is_near_instr(targetop)&&
+                instr_get_prev(opnd_get_instr(targetop))==NULL)
                 return instr;
-            }
-
         }
 
         instr=instr_get_next(instr);
@@ -526,6 +526,7 @@ sideline_examine_traces()
 {
     sample_entry_t *e;
     fragment_t *f;
+    int count;
 
     /* WARNING: we're using fragment_t* to make it easier to find target thread
      * and its trace at once, but the trace could have been deleted, so be
@@ -546,9 +547,10 @@ sideline_examine_traces()
     }
 
     f = (fragment_t *) e->tag;
+    count = e->counter;
     LOG(logfile, LOG_SIDELINE, VERB_3,
         "\tSIDELINE: hottest entry is "PFX" == F%d with count %d\n",
-        f, f->id, e->counter);
+        f, f->id, count);
     /* don't need entry anymore, no matter what happens */
     remove_sample_entry(e->tag);
 
@@ -563,7 +565,9 @@ sideline_examine_traces()
     } else {
         LOG(logfile, LOG_SIDELINE, VERB_2,
             "\tSIDELINE: optimizing hottest entry == F%d with count %d\n",
-            f->id, e->counter);
+            f->id, count);
+        if (dynamo_options.prefetch)
+            prefetch_note_samples(f->tag, count, num_samples);
         f = sideline_optimize(f, remove_sideline_profiling, optimize_trace_wrapper);
 #ifdef DEBUG
         if (f != NULL)
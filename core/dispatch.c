@@ -835,6 +835,12 @@ dispatch_enter_dynamorio(dcontext_t *dcontext)
         /* now fully process the last cache exit as couldbelinking */
         dispatch_exit_fcache(dcontext);
     }
+
+    /* bound the snapshots of executable_areas and dynamo_areas that wait
+     * for a flush to be freed; may go nolinking, so after the exit is
+     * processed and before we hold any fragment pointer
+     */
+    vm_area_check_retired_snapshots(dcontext);
 }
 
 /* Processing of the last exit from the cache.
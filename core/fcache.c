@@ -3726,6 +3726,28 @@ fcache_is_flush_pending(dcontext_t *dcontext)
     return tu->pending_flush;
 }
 
+/* Returns how close the trace cache this thread emits into is to evicting
+ * traces, as a percentage: the larger of how full a finite cache is and how
+ * many of its recent replacements were regenerations.  Read without the cache
+ * lock, so it is only a heuristic (used by -adaptive_traces).
+ */
+uint
+fcache_trace_pressure(dcontext_t *dcontext)
+{
+    fcache_thread_units_t *tu = (fcache_thread_units_t *) dcontext->fcache_field;
+    fcache_t *cache = DYNAMO_OPTION(shared_traces) ? shared_cache_trace : tu->trace;
+    uint pressure = 0;
+    if (cache == NULL)
+        return 0;
+    if (cache->finite_cache && cache->max_size > 0)
+        pressure = (uint) MIN(cache->size * 100 / cache->max_size, 100);
+    if (cache->num_replaced > 0) {
+        pressure = MAX(pressure, MIN(cache->num_regenerated * 100 /
+                                     cache->num_replaced, 100));
+    }
+    return pressure;
+}
+
 /* accepts a chain of units linked by next_local.
  * caller must set pending_free and flushtime fields.
  */
@@ -1324,6 +1324,9 @@ fragment_reset_init(void)
      * reset the global flushtime here
      */
     flushtime_global = 0;
+#ifdef INTERNAL
+    const_load_flushtime = 0;
+#endif
     mutex_unlock(&shared_cache_flush_lock);
 
     if (SHARED_FRAGMENTS_ENABLED()) {
@@ -2380,6 +2383,8 @@ fragment_init_heap(fragment_t *f, app_pc tag, int direct_exits, int indirect_exi
          * but we need a non-zero value for linkstub_fragment() 
          */
         t->num_bbs = 1;
+        t->exits_seen = 0;
+        t->early_exits_seen = 0;
 #ifdef PROFILE_RDTSC
         t->count = 0UL;
         t->total_time = (uint64) 0;
@@ -4101,6 +4106,8 @@ fragment_copy_data_fields(dcontext_t *dcontext, fragment_t *f_src, fragment_t *f
             memcpy(t_dst->bbs, t_src->bbs, t_src->num_bbs*sizeof(trace_bb_info_t));
             t_dst->num_bbs = t_src->num_bbs;
         }
+        t_dst->exits_seen = t_src->exits_seen;
+        t_dst->early_exits_seen = t_src->early_exits_seen;
 
 #ifdef PROFILE_RDTSC
         t_dst->count = t_src->count;
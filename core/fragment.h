@@ -304,6 +304,13 @@ typedef struct _trace_only_t {
     /* holds the tags (and other info) for all constituent basic blocks */
     trace_bb_info_t *bbs;
     uint    num_bbs;
+
+    /* -adaptive_traces: exits from this trace seen by DR, and how many of
+     * those left before the final constituent block.  Not synchronized for
+     * shared traces: they are only a heuristic.
+     */
+    uint    exits_seen;
+    uint    early_exits_seen;
 } trace_only_t;
 
 /* trace extension of fragment_t */
@@ -67,6 +67,9 @@ KSTAT_DEF("in trace monitor, thci ", monitor_enter_thci)
 KSTAT_DEF("cache flush unit walk ", cache_flush_unit_walk)
 KSTAT_DEF("flush_region", flush_region)
 KSTAT_DEF("synchall flush ", synchall_flush)
+KSTAT_DEF("synchall sending suspend signals", synchall_suspend_signal)
+KSTAT_DEF("synchall waiting for suspend acks", synchall_suspend_ack)
+KSTAT_DEF("synchall checking for safe spots", synchall_safe_spot)
 KSTAT_DEF("coarse pclookup", coarse_pclookup)
 KSTAT_DEF("coarse freeze all", coarse_freeze_all)
 KSTAT_DEF("persisted cache generation", persisted_generation)
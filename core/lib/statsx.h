@@ -395,6 +395,8 @@
     STATS_DEF("Trace fragments aborted for any reason", num_aborted_traces)
     STATS_DEF("Trace fragments aborted: shared race", num_aborted_traces_race)
     STATS_DEF("Trace fragments aborted: client bad mod", num_aborted_traces_client)
+    STATS_DEF("Trace fragments aborted: folded load flushed",
+              num_aborted_traces_const_load)
     STATS_DEF("Trace building aborted: shared race", num_trace_building_race)
     STATS_DEF("Trace building truncated: next bb deleted", num_trace_next_bb_deleted)
     STATS_DEF("Trace building reset: no trace head",
@@ -406,6 +408,10 @@
     STATS_DEF("Maximum number of bbs in a trace", max_bbs_in_a_trace)
     STATS_DEF("Traces truncated due to cache size limits", num_max_trace_size_enforced)
     STATS_DEF("Number of times max_trace_bbs was enforced", num_max_trace_bbs_enforced)
+    STATS_DEF("Adaptive trace limits recomputed", adaptive_trace_limits_updated)
+    STATS_DEF("Adaptive trace threshold raised", adaptive_trace_threshold_raised)
+    STATS_DEF("Adaptive trace threshold lowered", adaptive_trace_threshold_lowered)
+    STATS_DEF("Traces deleted for re-forming on early exits", num_traces_reformed)
     STATS_DEF("Trace wannabes prevented from being traces", num_wannabe_traces)
     STATS_DEF("Trace head too large to be a trace", num_huge_fragments)
     STATS_DEF("Shared trace links shifted back to trace head", links_shared_trace_to_head)
@@ -542,6 +548,7 @@
     STATS_DEF("Trace building private copies futures deleted", num_trace_private_fut_del)
     STATS_DEF("Trace building private copies futures avoided", num_trace_private_fut_avoid)
     STATS_DEF("Trace inline-ib comparisons", trace_ib_cmp)
+    STATS_DEF("Trace scratch spill instrs removed", trace_spill_instrs_removed)
 #ifdef X64
     STATS_DEF("Trace inline-ib no eflag restore needed", trace_ib_no_flag_restore)
 #endif
@@ -991,6 +998,16 @@
     STATS_DEF("Peak dynamo areas vector length", max_DRareas_length)
     STATS_DEF("Peak executable areas vector length", max_execareas_length)
     STATS_DEF("Peak module areas vector length", max_modareas_length)
+#ifdef LINUX
+    STATS_DEF("All-memory-areas holes trusted w/o maps read", num_allmem_holes_trusted)
+    STATS_DEF("All-memory-areas holes checked against maps", num_allmem_holes_checked)
+    STATS_DEF("All-memory-areas untracked changes", num_allmem_untracked)
+    STATS_DEF("All-memory-areas full maps resyncs", num_allmem_resyncs)
+#endif
+    STATS_DEF("Vmarea snapshots published", num_vmarea_snapshots)
+    STATS_DEF("Vmarea snapshots freed after retirement", num_vmarea_snapshots_freed)
+    STATS_DEF("Peak vmarea snapshots awaiting free", max_vmarea_snapshots_retired)
+    STATS_DEF("Vmarea snapshot pending entries added", num_vmarea_snapshot_reclaims)
 
      /* probably more -pad_jmps stats then needed, remove some of the less important ones
       * once we've better characterized the behavior */
@@ -1096,6 +1113,9 @@
     STATS_DEF("Num bytes nops removed for tracing", num_nop_bytes_removed)
     STATS_DEF("Num synch yields for exiting threads", synch_yields_for_exiting_thread)
     STATS_DEF("Num synch yields", synch_yields)
+#ifdef LINUX
+    STATS_DEF("Threads suspended in a synchall batch", synch_batch_suspends)
+#endif
     STATS_DEF("Num synch loops in wait_at_safe_spot", synch_loops_wait_safe)
     STATS_DEF("Multiple setcontexts while in wait_at_safe_spot", wait_multiple_setcxt)
 
@@ -1196,6 +1216,8 @@
     STATS_DEF("Clean Call inlined", cleancall_inlined)
     STATS_DEF("Clean Call xmm skipped", cleancall_xmm_skipped)
     STATS_DEF("Clean Call aflags save skipped", cleancall_aflags_save_skipped)
+    STATS_DEF("Clean Call fpstate save skipped", cleancall_fpstate_save_skipped)
+    STATS_DEF("Clean Call GPR saves skipped", cleancall_gpr_save_skipped)
     STATS_DEF("Clean Call aflags clear skipped", cleancall_aflags_clear_skipped)
     /* i#107 handle application using same segment register */
     STATS_DEF("App reference with FS/GS seg being mangled", app_seg_refs_mangled)
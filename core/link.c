@@ -1133,10 +1133,13 @@ link_branch(dcontext_t *dcontext, fragment_t *f, linkstub_t *l, fragment_t *targ
 #ifdef TRACE_HEAD_CACHE_INCR
         {
             common_direct_linkstub_t *cdl = (common_direct_linkstub_t *) l;
-            if (TEST(FRAG_IS_TRACE_HEAD, targetf->flags))
+            if (TEST(FRAG_IS_TRACE_HEAD, targetf->flags)) {
                 cdl->target_fragment = targetf;
-            else
+                cdl->th_counter = monitor_trace_head_cache_counter(dcontext, targetf);
+            } else {
                 cdl->target_fragment = NULL;
+                cdl->th_counter = NULL;
+            }
         }
 #endif
         if (LINKSTUB_COARSE_PROXY(l->flags)) {
@@ -205,6 +205,10 @@ typedef struct _common_direct_linkstub_t {
      * a stale fragment_t* pointer from sitting around
      */
     fragment_t       *target_fragment;
+    /* and the in-cache countdown for that trace head in this thread's
+     * counter table, which the trace_head_incr routine decrements
+     */
+    int              *th_counter;
 #endif
 } common_direct_linkstub_t;
 
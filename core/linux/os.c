@@ -293,6 +293,11 @@ static bool kernel_thread_groups;
  */
 bool kernel_futex_support = false;
 
+/* For thread_suspend_async(): threads signaled but not yet suspended.
+ * Only one synch_with_all_threads() runs at a time so a single global suffices.
+ */
+volatile int suspend_batch_pending;
+
 static bool kernel_64bit;
 
 pid_t pid_cached;
@@ -351,6 +356,23 @@ static void *allmem_info_merge(void *dst_data, void *src_data);
  */
 DECLARE_CXTSWPROT_VAR(uint all_memory_areas_recursion, 0);
 
+/* all_memory_areas is updated precisely from the memory syscalls we
+ * intercept, so it is authoritative and a lookup that lands in a hole does
+ * not need to read /proc/pid/maps.  When we see a change we cannot model
+ * (e.g., SYS_shmat, or a failed syscall whose partial effects we don't know)
+ * we bump allmem_untracked_gen.  Until the next full resync catches
+ * allmem_synced_gen up, holes are double-checked against the OS.
+ */
+DECLARE_FREQPROT_VAR(static uint allmem_untracked_gen, 0);
+DECLARE_FREQPROT_VAR(static uint allmem_synced_gen, 0);
+/* count of hole lookups, for -allmem_verify_interval */
+DECLARE_FREQPROT_VAR(static uint allmem_hole_queries, 0);
+
+static void
+all_memory_areas_untracked_change(app_pc start, app_pc end);
+static void
+all_memory_areas_resync(void);
+
 static bool
 is_readable_without_exception_internal(const byte *pc, size_t size, bool query_os);
 
@@ -758,6 +780,35 @@ get_uname(void)
         kernel_64bit = true;
 }
 
+#ifdef ARM
+/* AT_HWCAP from our auxiliary vector: ARM has no cpuid for proc features */
+static ptr_uint_t hwcap;
+
+static void
+read_hwcap(void)
+{
+    ELF_AUXV_TYPE auxv;
+    file_t f = os_open("/proc/self/auxv", OS_OPEN_READ);
+    /* This can happen in a chroot or if /proc is disabled: assume no features. */
+    if (f == INVALID_FILE)
+        return;
+    while (os_read(f, &auxv, sizeof(auxv)) == sizeof(auxv) && auxv.a_type != AT_NULL) {
+        if (auxv.a_type == AT_HWCAP) {
+            hwcap = (ptr_uint_t) auxv.a_un.a_val;
+            break;
+        }
+    }
+    os_close(f);
+    LOG(GLOBAL, LOG_TOP, 1, "AT_HWCAP is "PFX"\n", hwcap);
+}
+
+ptr_uint_t
+os_get_hwcap(void)
+{
+    return hwcap;
+}
+#endif
+
 /* os-specific initializations */
 void
 os_init(void)
@@ -773,6 +824,9 @@ os_init(void)
     ASSERT_CURIOSITY(kernel_futex_support);
 
     get_uname();
+#ifdef ARM
+    read_hwcap();
+#endif
 
     /* Populate global data caches. */
     get_application_name();
@@ -1145,9 +1199,15 @@ typedef enum {
 #ifdef X64
     TLS_TYPE_ARCH_PRCTL,
 #endif
+#ifdef ARM
+    TLS_TYPE_TPIDRURW,
+#endif
 } tls_type_t;
 
+#ifdef HAVE_TLS
+/* only HAVE_TLS installs a segment or register base */
 static tls_type_t tls_type;
+#endif
 #ifdef X64
 static bool tls_using_msr;
 #endif
@@ -1402,6 +1462,21 @@ read_selector(reg_id_t seg)
     return sel;
 }
 
+#ifdef ARM
+/* ARM has no segments.  DR's TLS base instead lives in the user read/write
+ * thread ID register, TPIDRURW (p15, 0, c13, c0, 2): user mode can write it
+ * without a syscall, the kernel preserves it across context switches, and
+ * glibc keeps its own thread pointer in the read-only TPIDRURO.  The app's
+ * value is virtualized in os_local_state_t.app_tpidrurw.
+ */
+# define READ_TPIDRURW(var)                                 \
+    ASSERT(sizeof(var) == sizeof(void*));                   \
+    asm volatile("mrc p15, 0, %0, c13, c0, 2" : "=r"(var))
+# define WRITE_TPIDRURW(var)                                \
+    ASSERT(sizeof(var) == sizeof(void*));                   \
+    asm volatile("mcr p15, 0, %0, c13, c0, 2" : : "r"(var))
+#endif
+
 /* i#107: handle segment reg usage conflicts */
 typedef struct _os_seg_info_t {
     int   tls_type;
@@ -1429,6 +1504,9 @@ typedef struct _os_local_state_t {
     ushort app_fs;      /* for mangling seg update/query */
     void  *app_gs_base; /* for mangling segmented memory ref */
     void  *app_fs_base; /* for mangling segmented memory ref */
+#ifdef ARM
+    void  *app_tpidrurw; /* for mangling app mrc/mcr of TPIDRURW */
+#endif
     union {
         /* i#107: We use space in os_tls to store thread area information
          * thread init. It will not conflict with the client_tls usage,
@@ -1453,6 +1531,9 @@ typedef struct _os_local_state_t {
 #define TLS_APP_FS_BASE_OFFSET (offsetof(os_local_state_t, app_fs_base))
 #define TLS_APP_GS_OFFSET (offsetof(os_local_state_t, app_gs))
 #define TLS_APP_FS_OFFSET (offsetof(os_local_state_t, app_fs))
+#ifdef ARM
+# define TLS_APP_TPIDRURW_OFFSET (offsetof(os_local_state_t, app_tpidrurw))
+#endif
 
 /* N.B.: imm and idx are ushorts!
  * We use %c[0-9] to get gcc to emit an integer constant without a leading $ for
@@ -1464,45 +1545,41 @@ typedef struct _os_local_state_t {
  * precise constraint, then the compiler would be able to optimize better.  See
  * glibc comments on THREAD_SELF.
  */
-# ifdef ARM 
-//TODO SJF ASM
+# ifdef ARM
+/* Every slot is one mrc (for the base in TPIDRURW) plus one ldr/str away.
+ * A load can reuse its destination for the base; a store needs a second
+ * register, for which we clobber ip (r12), the intra-procedure scratch.
+ * The ldr/str immediate is 12 bits, which os_local_state_t fits well within.
+ */
 #define WRITE_TLS_SLOT_IMM(imm, var)                                  \
     IF_NOT_HAVE_TLS(ASSERT_NOT_REACHED());                            \
     ASSERT(sizeof(var) == sizeof(void*));                             \
-    asm("nop"); 
-/*
-    asm volatile("str %0, [r13, %1]" : : "r"(var), "i"(imm));
-*/
+    asm volatile("mrc p15, 0, r12, c13, c0, 2\n\t"                    \
+                 "str %0, [r12, %1]"                                  \
+                 : : "r"(var), "i"(imm) : "r12", "memory");
 
 #define READ_TLS_SLOT_IMM(imm, var)                  \
     IF_NOT_HAVE_TLS(ASSERT_NOT_REACHED());           \
     ASSERT(sizeof(var) == sizeof(void*));            \
-    asm("nop"); 
-/*
-    asm volatile("ldr %0, [r13, %1]" : "=r"(var) : "i"(imm));
-*/
+    asm volatile("mrc p15, 0, %0, c13, c0, 2\n\t"    \
+                 "ldr %0, [%0, %1]"                  \
+                 : "=r"(var) : "i"(imm) : "memory");
 
 /* FIXME: need dedicated-storage var for _TLS_SLOT macros, can't use expr */
 #define WRITE_TLS_SLOT(idx, var)                            \
     IF_NOT_HAVE_TLS(ASSERT_NOT_REACHED());                  \
     ASSERT(sizeof(var) == sizeof(void*));                   \
     ASSERT(sizeof(idx) == 2);                               \
-    asm("nop"); 
-/*
-    asm("mov %0, %%"ASM_R0 : : "m"((var)) : ASM_R0);      \
-    asm("mov %0, %%"ASM_R2 : : "m"((idx)) : ASM_R2); \
-    asm("mov %%"ASM_R0", %(%%"ASM_R2")" : : : ASM_R0, ASM_R2);
-*/
+    asm volatile("mrc p15, 0, r12, c13, c0, 2\n\t"          \
+                 "str %0, [r12, %1]"                        \
+                 : : "r"(var), "r"((uint)(idx)) : "r12", "memory");
 
 #define READ_TLS_SLOT(idx, var)                                    \
     ASSERT(sizeof(var) == sizeof(void*));                          \
     ASSERT(sizeof(idx) == 2);                                      \
-    asm("nop"); 
-/*
-    asm("mov %0, %%"ASM_R0: : "m"((idx)) : ASM_R0); \
-    asm("mov %(%%"ASM_R0"), %%"ASM_R0 : : : ASM_R0);  \
-    asm("mov %%"ASM_R0", %0" : "=m"((var)) : : ASM_R0);
-*/
+    asm volatile("mrc p15, 0, %0, c13, c0, 2\n\t"                  \
+                 "ldr %0, [%0, %1]"                                \
+                 : "=&r"(var) : "r"((uint)(idx)) : "memory");
 
 # else
 
@@ -1539,9 +1616,19 @@ static bool
 is_segment_register_initialized(void)
 {
 #ifdef ARM
-    /* ARM Does not have segments but this needs to return true 
-           so just do it. */
+# ifdef HAVE_TLS
+    /* TPIDRURW is zero until os_tls_init() installs our base.  As with the
+     * x86 selector, a new thread inherits its parent's value, so the clone
+     * paths must zero it in the child before anything asks for a dcontext.
+     */
+    void *base;
+    READ_TPIDRURW(base);
+    if (tls_type == TLS_TYPE_TPIDRURW && base != NULL)
+        return true;
+# else
+    /* Without HAVE_TLS nothing installs a base: there is nothing to wait for */
     return true;
+# endif
 #else
     if (read_selector(SEG_TLS) != 0)
         return true;
@@ -1560,7 +1647,9 @@ is_segment_register_initialized(void)
         int res = dynamorio_syscall(SYS_arch_prctl, 2,
                                     (SEG_TLS == SEG_FS ? ARCH_GET_FS : ARCH_GET_GS),
                                     &base);
+# ifdef HAVE_TLS
         ASSERT(tls_type == TLS_TYPE_ARCH_PRCTL);
+# endif
         if (res >= 0 && base != NULL) {
             os_local_state_t *os_tls = (os_local_state_t *) base;
             return (os_tls->tid == get_sys_thread_id());
@@ -1681,6 +1770,17 @@ os_get_app_seg_offset(reg_id_t seg)
     return 0;
 }
 
+#ifdef ARM
+/* Returns the TLS offset of the app's virtualized TPIDRURW value */
+ushort
+os_get_app_tpidrurw_offset(void)
+{
+    IF_NOT_HAVE_TLS(ASSERT_NOT_REACHED());
+    ASSERT(TLS_LOCAL_STATE_OFFSET == 0);
+    return TLS_APP_TPIDRURW_OFFSET;
+}
+#endif
+
 void *
 get_tls(ushort tls_offs)
 {
@@ -1711,6 +1811,14 @@ get_segment_base(uint seg)
         return NULL;
     else {
 # ifdef HAVE_TLS
+#  ifdef ARM
+        /* no segments: our base lives in TPIDRURW (see os_tls_init()) */
+        if (seg == SEG_TLS) {
+            byte *base;
+            READ_TPIDRURW(base);
+            return base;
+        }
+#  else
         uint selector = read_selector(seg);
         uint index = SELECTOR_INDEX(selector);
         LOG(THREAD_GET, LOG_THREADS, 4, "%s selector %x index %d ldt %d\n",
@@ -1762,6 +1870,7 @@ get_segment_base(uint seg)
                 return (byte *)(ptr_uint_t) desc.base_addr;
             }
         }
+#  endif /* ARM */
 # endif /* HAVE_TLS */
     }
     return (byte *) POINTER_MAX;
@@ -2104,8 +2213,29 @@ os_tls_init(void)
      *    only be used to set the gdt entries that fs and gs select for.  Faster to
      *    use <4GB base (obtain with mmap MAP_32BIT) since can use gdt; else have to
      *    use wrmsr.  The man pages say "ARCH_SET_GS is disabled in some kernels".
+     *
+     * On ARM none of these apply: we simply write the base into TPIDRURW.
      */
 
+# ifdef ARM
+    {
+        /* A thread created under DR starts out with its parent's DR base, in
+         * which case the value the app would natively have inherited is the
+         * parent's virtualized one.
+         */
+        os_local_state_t *cur;
+        READ_TPIDRURW(cur);
+        if (cur != NULL && is_dynamo_address((byte *)cur))
+            os_tls->app_tpidrurw = cur->app_tpidrurw;
+        else
+            os_tls->app_tpidrurw = cur;
+        WRITE_TPIDRURW(os_tls);
+        os_tls->tls_type = TLS_TYPE_TPIDRURW;
+        LOG(GLOBAL, LOG_THREADS, 1, "os_tls_init: TPIDRURW base "PFX", app value "PFX"\n",
+            segment, os_tls->app_tpidrurw);
+    }
+# endif
+
 # ifdef X64
     /* First choice is gdt, which means arch_prctl.  Since this may fail
      * on some kernels, we require -heap_in_lower_4GB so we can fall back
@@ -2242,7 +2372,9 @@ os_tls_init(void)
     memset(tls_table, 0, MAX_THREADS*sizeof(tls_slot_t));
 #endif
     /* store type in global var for convenience: should be same for all threads */
-    tls_type = TLS_TYPE_NONE; //SJF Removed HAVE_TLS error 
+#ifdef HAVE_TLS
+    tls_type = os_tls->tls_type;
+#endif
     ASSERT(is_segment_register_initialized());
 }
 
@@ -2263,12 +2395,22 @@ os_tls_exit(local_state_t *local_state, bool other_thread)
     tls_type_t tls_type = os_tls->tls_type;
     int index = os_tls->ldt_index;
 
+# ifdef ARM
+    /* Zero rather than restore app_tpidrurw, as the app value could look
+     * like an initialized base to is_segment_register_initialized().
+     * XXX: detach (i#95) will need to hand the app its value back.
+     */
+    if (!other_thread && tls_type == TLS_TYPE_TPIDRURW) {
+        WRITE_TPIDRURW(zero);
+    }
+# else
     /* If the MSR is in use, writing to the reg faults.  We rely on it being 0
      * to indicate that.
      */
     if (!other_thread && read_selector(SEG_TLS) != 0) {
         WRITE_DR_SEG(zero); /* macro needs lvalue! */
     }
+# endif
     heap_munmap(os_tls->self, PAGE_SIZE);
 
     /* For another thread we can't really make these syscalls so we have to
@@ -3289,18 +3431,26 @@ bool
 thread_suspend(thread_record_t *tr)
 {
     os_thread_data_t *ostd = (os_thread_data_t *) tr->dcontext->os_field;
+    bool handoff;
     ASSERT(ostd != NULL);
     /* See synch comments in thread_resume: the mutex held there
      * prevents prematurely sending a re-suspend signal.
      */
     mutex_lock(&ostd->suspend_lock);
-    ostd->suspend_count++;
+    /* If thread_suspend_async() already took a reference and sent the
+     * signal, we take over that reference rather than adding another.
+     */
+    handoff = ostd->suspend_handoff;
+    if (handoff)
+        ostd->suspend_handoff = false;
+    else
+        ostd->suspend_count++;
     ASSERT(ostd->suspend_count > 0);
     /* If already suspended, do not send another signal.  However, we do
      * need to ensure the target is suspended in case of a race, so we can't
      * just return.
      */
-    if (ostd->suspend_count == 1) {
+    if (ostd->suspend_count == 1 && !handoff) {
         /* PR 212090: we use a custom signal handler to suspend.  We wait
          * here until the target reaches the suspend point, and leave it
          * up to the caller to check whether it is a safe suspend point,
@@ -3333,6 +3483,81 @@ thread_suspend(thread_record_t *tr)
     return true;
 }
 
+/* Sends the suspend signal to tr without waiting for it to arrive, so that
+ * synch_with_all_threads() can have all of its targets stopping in parallel.
+ * The suspend reference taken here is handed to the next thread_suspend() on
+ * tr, or dropped by thread_suspend_cancel().  Targets count themselves off in
+ * suspend_batch_pending; use thread_suspend_wait_batch() to wait for them.
+ */
+bool
+thread_suspend_async(thread_record_t *tr)
+{
+    os_thread_data_t *ostd = (os_thread_data_t *) tr->dcontext->os_field;
+    ASSERT(ostd != NULL);
+    mutex_lock(&ostd->suspend_lock);
+    if (ostd->suspend_handoff) {
+        /* already have an outstanding reference */
+        mutex_unlock(&ostd->suspend_lock);
+        return true;
+    }
+    ostd->suspend_count++;
+    ASSERT(ostd->suspend_count > 0);
+    if (ostd->suspend_count == 1) {
+        ASSERT(ostd->suspended == 0);
+        /* must be set before the signal can arrive */
+        ostd->suspend_batch_ack = true;
+        atomic_inc(&suspend_batch_pending);
+        if (!thread_signal(tr->pid, tr->id, SUSPEND_SIGNAL)) {
+            ostd->suspend_batch_ack = false;
+            atomic_dec(&suspend_batch_pending);
+            ostd->suspend_count--;
+            mutex_unlock(&ostd->suspend_lock);
+            return false;
+        }
+    }
+    ostd->suspend_handoff = true;
+    mutex_unlock(&ostd->suspend_lock);
+    return true;
+}
+
+/* Waits until every thread signaled by thread_suspend_async() has reached
+ * its suspend point.  Each target decrements suspend_batch_pending from
+ * handle_suspend_signal() and the last one wakes us up, so we sleep once
+ * rather than once per thread.
+ */
+void
+thread_suspend_wait_batch(void)
+{
+    int pending;
+    while ((pending = suspend_batch_pending) > 0) {
+        /* Waits only if no target has acknowledged since we read pending.
+         * Return value doesn't matter because the count will be re-checked.
+         */
+        futex_wait(&suspend_batch_pending, pending);
+        if (suspend_batch_pending == pending) {
+            /* If it still has to wait, give up the cpu. */
+            thread_yield();
+        }
+    }
+}
+
+/* Drops a reference taken by thread_suspend_async() that was never handed
+ * to thread_suspend().  A no-op if there is no such reference.
+ */
+void
+thread_suspend_cancel(thread_record_t *tr)
+{
+    os_thread_data_t *ostd = (os_thread_data_t *) tr->dcontext->os_field;
+    bool handoff;
+    ASSERT(ostd != NULL);
+    mutex_lock(&ostd->suspend_lock);
+    handoff = ostd->suspend_handoff;
+    ostd->suspend_handoff = false;
+    mutex_unlock(&ostd->suspend_lock);
+    if (handoff)
+        thread_resume(tr);
+}
+
 bool
 thread_resume(thread_record_t *tr)
 {
@@ -4600,6 +4825,19 @@ ignorable_system_call(int num)
     case SYS_munmap:
     case SYS_mremap:
     case SYS_mprotect:
+    /* we can't model these memory changes: post_system_call() must see them
+     * to call all_memory_areas_untracked_change()
+     */
+#ifdef SYS_shmat
+    case SYS_shmat:
+#endif
+#ifdef SYS_shmdt
+    case SYS_shmdt:
+#endif
+#ifdef SYS_ipc
+    case SYS_ipc:
+#endif
+    case SYS_remap_file_pages:
     case SYS_execve:
     case SYS_clone:
     case SYS_fork:
@@ -5933,7 +6171,7 @@ pre_system_call(dcontext_t *dcontext)
            unsigned long prot)
         */
         uint res;
-        DEBUG_DECLARE(app_pc end;)
+        app_pc end;
         app_pc addr  = (void *) sys_param(dcontext, 0);
         size_t len  = (size_t) sys_param(dcontext, 1);
         uint prot = (uint) sys_param(dcontext, 2);
@@ -5962,8 +6200,7 @@ pre_system_call(dcontext_t *dcontext)
          *      to let the system call fail and recover in post_system_call(). 
          *      See PR 410921.
          */
-        if (!vmvector_lookup_data(all_memory_areas, addr, NULL, 
-                                  IF_DEBUG_ELSE(&end, NULL), NULL)) {
+        if (!vmvector_lookup_data(all_memory_areas, addr, NULL, &end, NULL)) {
             LOG(THREAD, LOG_SYSCALLS, 2,
                 "\t"PFX" isn't mapped; aborting mprotect\n", addr);
             execute_syscall = false;
@@ -5975,7 +6212,7 @@ pre_system_call(dcontext_t *dcontext)
              * spans 2 or more vmareas with dissimilar protection (xref 
              * PR 410921) or has unallocated regions in between (PR 413109).
              */
-            DOCHECK(1, dcontext->mprot_multi_areas = (addr + len) > end ? true : false;);
+            dcontext->mprot_multi_areas = (addr + len) > end ? true : false;
         }
 
         res = app_memory_protection_change(dcontext, addr, len, 
@@ -6014,6 +6251,13 @@ pre_system_call(dcontext_t *dcontext)
         dcontext->sys_param1 = dynamorio_syscall(SYS_brk, 1, 0);
         break;
     }
+#ifdef SYS_ipc
+    case SYS_ipc: {
+        /* save the call number for all_memory_areas handling in post */
+        dcontext->sys_param0 = (reg_t) sys_param(dcontext, 0);
+        break;
+    }
+#endif
     case SYS_uselib: {
         /* Used to get the kernel to load a share library (legacy system call).
          * Was primarily used when statically linking to dynamically loaded shared
@@ -6619,6 +6863,107 @@ remove_from_all_memory_areas(app_pc start, app_pc end)
     return ok;
 }
 
+/* Called when the address space changed in a way we did not model precisely
+ * in all_memory_areas.  Marks the cache as stale so that hole queries consult
+ * the OS and the next safe point performs a full resync.
+ */
+static void
+all_memory_areas_untracked_change(app_pc start, app_pc end)
+{
+    LOG(GLOBAL, LOG_VMAREAS|LOG_SYSCALLS, 2,
+        "all_memory_areas: untracked change to "PFX"-"PFX"\n", start, end);
+    STATS_INC(num_allmem_untracked);
+    allmem_untracked_gen++;
+}
+
+/* Returns whether all_memory_areas already has [start,end) covered by
+ * contiguous entries whose prot matches prot.  Caller must hold the lock.
+ */
+static bool
+all_memory_areas_matches(app_pc start, app_pc end, uint prot)
+{
+    app_pc pc = start, sub_start, sub_end;
+    allmem_info_t *info;
+    while (pc < end) {
+        if (!vmvector_lookup_data(all_memory_areas, pc, &sub_start, &sub_end,
+                                  (void **) &info))
+            return false;
+        /* allow maps to have +x (PR 213256) */
+        if (info->prot != prot && info->prot != (prot & ~MEMPROT_EXEC))
+            return false;
+        pc = sub_end;
+    }
+    return true;
+}
+
+/* Re-reads the maps file and brings all_memory_areas back in line with it
+ * after an untracked change.  Must be called with no locks held.
+ */
+static void
+all_memory_areas_resync(void)
+{
+    uint gen = allmem_untracked_gen;
+#ifdef HAVE_PROC_MAPS
+    maps_iter_t iter;
+    app_pc prev_end = NULL;
+    LOG(GLOBAL, LOG_VMAREAS, 2, "all_memory_areas_resync: gen %d => %d\n",
+        allmem_synced_gen, gen);
+    STATS_INC(num_allmem_resyncs);
+    maps_iterator_start(&iter, true /* plan to alloc */);
+    while (maps_iterator_next(&iter)) {
+        if (prev_end != NULL && prev_end < iter.vm_start) {
+            /* Drop anything we still list in the gap.  We re-query the OS
+             * under the lock so a racing mmap is either visible to us or
+             * will add itself after we release the lock.
+             */
+            app_pc pc = prev_end;
+            dr_mem_info_t info;
+            all_memory_areas_lock();
+            while (pc < iter.vm_start &&
+                   query_memory_ex_from_os(pc, &info) &&
+                   info.base_pc + info.size > pc) {
+                app_pc free_end = MIN(info.base_pc + info.size, iter.vm_start);
+                if (info.type == DR_MEMTYPE_FREE &&
+                    vmvector_overlap(all_memory_areas, pc, free_end)) {
+                    LOG(GLOBAL, LOG_VMAREAS, 2, "\tremoving stale "PFX"-"PFX"\n",
+                        pc, free_end);
+                    vmvector_remove(all_memory_areas, pc, free_end);
+                }
+                pc = free_end;
+            }
+            all_memory_areas_unlock();
+        }
+        prev_end = iter.vm_end;
+        /* reserved-but-not-committed regions are holes in all_memory_areas */
+        if (iter.prot == MEMPROT_NONE)
+            continue;
+        if (vsyscall_page_start != NULL && iter.vm_start == vsyscall_page_start)
+            continue;
+        all_memory_areas_lock();
+        if (!all_memory_areas_matches(iter.vm_start, iter.vm_end, iter.prot)) {
+            bool image;
+            all_memory_areas_unlock();
+            os_get_module_info_lock();
+            image = module_overlaps(iter.vm_start, iter.vm_end - iter.vm_start);
+            os_get_module_info_unlock();
+            LOG(GLOBAL, LOG_VMAREAS, 2, "\tupdating "PFX"-"PFX" prot=%d%s\n",
+                iter.vm_start, iter.vm_end, iter.prot, image ? " image" : "");
+            all_memory_areas_lock();
+            /* -1 preserves existing types for pieces we already know */
+            update_all_memory_areas(iter.vm_start, iter.vm_end, iter.prot,
+                                    image ? DR_MEMTYPE_IMAGE : -1);
+        }
+        all_memory_areas_unlock();
+    }
+    maps_iterator_stop(&iter);
+    DOLOG(4, LOG_VMAREAS, print_all_memory_areas(GLOBAL););
+#endif
+    /* Changes that raced with us bumped the gen past what we read and will
+     * trigger another resync.
+     */
+    allmem_synced_gen = gen;
+}
+
 /* We consider a module load to happen at the first mmap, so we check on later
  * overmaps to ensure things look consistent. */
 static bool
@@ -7188,6 +7533,15 @@ post_system_call(dcontext_t *dcontext)
             ASSERT(ok);
             update_all_memory_areas(base, base + size, info.prot, info.type);
             all_memory_areas_unlock();
+        } else if (size > old_size) {
+            /* Grown in place: the tail is new memory that all_memory_areas
+             * would otherwise not know about.  We use the prot and type of
+             * the old region obtained in pre_system_call.
+             */
+            all_memory_areas_lock();
+            update_all_memory_areas(base + old_size, base + size,
+                                    dcontext->sys_param3, dcontext->sys_param4);
+            all_memory_areas_unlock();
         }
         break;
     }
@@ -7246,6 +7600,8 @@ post_system_call(dcontext_t *dcontext)
                  * each mprotect syscall to guard against a rare theoretical bug.
                  */
                 ASSERT_CURIOSITY(!dcontext->mprot_multi_areas);
+                if (dcontext->mprot_multi_areas)
+                    all_memory_areas_untracked_change(base, base + size);
                 all_memory_areas_lock();
                 ASSERT(vmvector_overlap(all_memory_areas, base, base + size) ||
                        /* we could synch up: instead we relax the assert if 
@@ -7303,6 +7659,31 @@ post_system_call(dcontext_t *dcontext)
         }
         break;
     }
+    /* We don't model these in all_memory_areas, so we have it resync.
+     * shmat can return a high address that looks negative, so we don't
+     * bother checking for success: a spurious resync is harmless.
+     */
+#ifdef SYS_shmat
+    case SYS_shmat:
+#endif
+#ifdef SYS_shmdt
+    case SYS_shmdt:
+#endif
+    case SYS_remap_file_pages: {
+        all_memory_areas_untracked_change(NULL, NULL);
+        break;
+    }
+#ifdef SYS_ipc
+    case SYS_ipc: {
+        /* SHMAT == 21, SHMDT == 22 in linux/ipc.h; the upper bits hold
+         * the ipc version
+         */
+        uint call = (uint) dcontext->sys_param0 & 0xffff;
+        if (call == 21 || call == 22)
+            all_memory_areas_untracked_change(NULL, NULL);
+        break;
+    }
+#endif
 
     /****************************************************************************/
     /* SPAWNING -- fork mostly handled above */
@@ -7491,6 +7872,12 @@ post_system_call(dcontext_t *dcontext)
 
  exit_post_system_call:
 
+    /* We hold no locks here, so this is a safe spot to re-read the maps file
+     * after an untracked change.
+     */
+    if (allmem_untracked_gen != allmem_synced_gen)
+        all_memory_areas_resync();
+
 #ifdef CLIENT_INTERFACE 
     /* The instrument_post_syscall should be called after DR finishes all
      * its operations, since DR needs to know the real syscall results, 
@@ -8787,16 +9174,43 @@ query_memory_ex(const byte *pc, OUT dr_mem_info_t *out_info)
         byte *from_os_base_pc;
         size_t from_os_size;
         uint from_os_prot;
-        if (get_memory_info_from_os(pc, &from_os_base_pc, &from_os_size,
+        /* all_memory_areas is authoritative unless we've seen an untracked
+         * change since the last resync, so we only pay for reading the maps
+         * file in that case or on a periodic verification.
+         */
+        bool stale = (allmem_untracked_gen != allmem_synced_gen);
+        bool check_os = stale;
+        allmem_hole_queries++;
+        if (DYNAMO_OPTION(allmem_verify_interval) > 0 &&
+            allmem_hole_queries % DYNAMO_OPTION(allmem_verify_interval) == 0)
+            check_os = true;
+        DOSTATS({
+            if (check_os)
+                STATS_INC(num_allmem_holes_checked);
+            else
+                STATS_INC(num_allmem_holes_trusted);
+        });
+        if (check_os &&
+            get_memory_info_from_os(pc, &from_os_base_pc, &from_os_size,
                                     &from_os_prot) && 
             /* maps file shows our reserved-but-not-committed regions, which
              * are holes in all_memory_areas
              */
             from_os_prot != MEMPROT_NONE) {
-            SYSLOG_INTERNAL_ERROR("all_memory_areas is missing region "PFX"-"PFX"!",
-                                  from_os_base_pc, from_os_base_pc + from_os_size);
-            DOLOG(4, LOG_VMAREAS, print_all_memory_areas(THREAD_GET););
-            ASSERT_NOT_REACHED();
+            if (!stale) {
+                SYSLOG_INTERNAL_ERROR("all_memory_areas is missing region "
+                                      PFX"-"PFX"!", from_os_base_pc,
+                                      from_os_base_pc + from_os_size);
+                DOLOG(4, LOG_VMAREAS, print_all_memory_areas(THREAD_GET););
+                ASSERT_NOT_REACHED();
+                all_memory_areas_untracked_change(from_os_base_pc,
+                                                  from_os_base_pc + from_os_size);
+            }
+            /* we already hold the lock, so fill in the hole now; the next
+             * resync will correct the type if this turns out to be an image
+             */
+            update_all_memory_areas(from_os_base_pc, from_os_base_pc + from_os_size,
+                                    from_os_prot, DR_MEMTYPE_DATA);
             /* be paranoid */
             out_info->base_pc = from_os_base_pc;
             out_info->size = from_os_size;
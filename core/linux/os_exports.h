@@ -99,6 +99,10 @@ thread_id_t get_tls_thread_id(void);
 thread_id_t get_sys_thread_id(void);
 bool is_thread_terminated(dcontext_t *dcontext);
 void os_wait_thread_terminated(dcontext_t *dcontext);
+/* batched suspension for synch_with_all_threads */
+bool thread_suspend_async(thread_record_t *tr);
+void thread_suspend_wait_batch(void);
+void thread_suspend_cancel(thread_record_t *tr);
 void os_tls_pre_init(int gdt_index);
 /* XXX: reg_id_t is not defined here, use unsigned char instead */
 /* TODO SJF Compiler complains as defs dont match so Im commented them out */
@@ -107,6 +111,11 @@ void os_tls_pre_init(int gdt_index);
 //void *os_get_dr_seg_base(dcontext_t *dcontext, unsigned char seg);
 //void *os_get_app_seg_base(dcontext_t *dcontext, unsigned char seg);
 //bool os_file_has_elf_so_header(const char *filename);
+#ifdef ARM
+ushort os_get_app_tpidrurw_offset(void);
+/* the kernel's AT_HWCAP processor feature bits */
+ptr_uint_t os_get_hwcap(void);
+#endif
 
 /* We do NOT want our libc routines wrapped by pthreads, so we use
  * our own syscall wrappers.
@@ -113,6 +113,13 @@ typedef struct _os_thread_data_t {
     volatile int wakeup;
     volatile int resumed;
     struct sigcontext *suspended_sigcxt;
+    /* For synch_with_all_threads' batched suspend: whether a suspend
+     * reference from thread_suspend_async() is waiting to be handed to the
+     * next thread_suspend(), and whether handle_suspend_signal() should
+     * count itself off in suspend_batch_pending.
+     */
+    bool suspend_handoff;
+    bool suspend_batch_ack;
 
     /* PR 297902: for thread termination */
     bool terminate;
@@ -255,6 +262,11 @@ futex_wake_all(volatile int *futex);
 
 extern bool kernel_futex_support;
 
+/* number of threads signaled by thread_suspend_async() that have not yet
+ * reached handle_suspend_signal().  in os.c
+ */
+extern volatile int suspend_batch_pending;
+
 #ifdef VMX86_SERVER
 #  include "vmkuw.h"
 #endif
@@ -5967,6 +5967,14 @@ handle_suspend_signal(dcontext_t *dcontext, kernel_ucontext_t *ucxt)
     ASSERT(ostd->suspended == 0);
     ostd->suspended = 1;
     futex_wake_all(&ostd->suspended);
+    if (ostd->suspend_batch_ack) {
+        /* synch_with_all_threads is waiting on the whole batch: the last one
+         * in wakes it up
+         */
+        ostd->suspend_batch_ack = false;
+        if (atomic_dec_becomes_zero(&suspend_batch_pending))
+            futex_wake_all(&suspend_batch_pending);
+    }
     /* i#96/PR 295561: use futex(2) if available */
     while (ostd->wakeup == 0) {
         /* Waits only if the wakeup flag is not set as 1. Return value
@@ -104,7 +104,31 @@ DECLARE_CXTSWPROT_VAR(mutex_t trace_building_lock, INIT_LOCK_FREE(trace_building
 /* For clearing counters on trace deletion we follow a lazy strategy
  * using a sentinel value to determine whether we've built a trace or not
  */
-#define TH_COUNTER_CREATED_TRACE_VALUE() (INTERNAL_OPTION(trace_threshold) + 1U)
+#define TH_COUNTER_CREATED_TRACE_VALUE() (TH_MAX_THRESHOLD() + 1U)
+
+#ifdef TRACE_HEAD_CACHE_INCR
+# define THCI_CAN_LINK_FROM(from_f) \
+    (!TESTANY(FRAG_SHARED|FRAG_COARSE_GRAIN, (from_f)->flags))
+#endif
+
+/* -adaptive_traces parameters.  A thread's threshold moves within
+ * [trace_threshold / ADAPTIVE_TRACE_SCALE, trace_threshold * ADAPTIVE_TRACE_SCALE]
+ * and is recomputed every ADAPTIVE_TRACE_WINDOW trace exits we see.
+ */
+#define ADAPTIVE_TRACE_SCALE 4
+#define ADAPTIVE_TRACE_WINDOW 256
+/* fewest exits seen from a trace before we consider re-forming it */
+#define ADAPTIVE_REFORM_MIN_EXITS 16
+/* max_trace_bbs is never adapted below this */
+#define ADAPTIVE_MIN_TRACE_BBS 4
+
+/* The highest threshold any thread's counters may be compared against:
+ * the lazy-clearing sentinel must stay above it.
+ */
+#define TH_MAX_THRESHOLD()                                                   \
+    (DYNAMO_OPTION(adaptive_traces) ?                                       \
+     MIN(INTERNAL_OPTION(trace_threshold) * ADAPTIVE_TRACE_SCALE, USHRT_MAX) : \
+     INTERNAL_OPTION(trace_threshold))
 
 static void
 delete_private_copy(dcontext_t *dcontext)
@@ -349,6 +373,8 @@ monitor_thread_init(dcontext_t *dcontext)
     dcontext->monitor_field = (void *) md;
     memset(md, 0, sizeof(monitor_data_t));
     reset_trace_state(dcontext, false /* link lock not needed */);
+    md->trace_threshold = INTERNAL_OPTION(trace_threshold);
+    md->max_trace_bbs = DYNAMO_OPTION(max_trace_bbs);
 
     /* case 7966: don't initialize un-needed things for hotp_only & thin_client
      * FIXME: could set initial sizes to 0 for all configurations, instead
@@ -448,6 +474,10 @@ thcounter_add(dcontext_t *dcontext, app_pc tag)
         COUNTER_ALLOC(dcontext, sizeof(trace_head_counter_t) HEAPACCT(ACCT_THCOUNTER));
     e->tag = tag;
     e->counter = 0;
+#ifdef TRACE_HEAD_CACHE_INCR
+    e->cache_left = 0;
+    e->cache_armed = 0;
+#endif
     hindex = HASH_FUNC((ptr_uint_t)e->tag, &md->thead_table);
     e->next = md->thead_table.counter_table[hindex];
     md->thead_table.counter_table[hindex] = e;
@@ -475,6 +505,49 @@ thcounter_remove(dcontext_t *dcontext, app_pc tag)
 }
 #endif
 
+#ifdef TRACE_HEAD_CACHE_INCR
+/* Credits ctr->counter with the executions the trace_head_incr routine let
+ * into the head since we last armed ctr.  The routine only ever lowers
+ * cache_left, and stops at 1 so that the execution that finds the head hot
+ * is the one we count here.
+ */
+static void
+thcounter_fold_cache_count(trace_head_counter_t *ctr)
+{
+    if (ctr->cache_armed > 0 && ctr->cache_left > 0 &&
+        ctr->cache_left <= ctr->cache_armed)
+        ctr->counter += ctr->cache_armed - ctr->cache_left;
+    ctr->cache_left = 0;
+    ctr->cache_armed = 0;
+}
+
+/* Lets linked exits run the head in the cache until it reaches this
+ * thread's threshold.  A head at or past it (including the trace-built
+ * sentinel) always comes back to us.
+ */
+static void
+thcounter_arm_cache_count(monitor_data_t *md, trace_head_counter_t *ctr)
+{
+    if (ctr->counter < md->trace_threshold)
+        ctr->cache_armed = (int) (md->trace_threshold - ctr->counter);
+    else
+        ctr->cache_armed = 0;
+    ctr->cache_left = ctr->cache_armed;
+}
+
+int *
+monitor_trace_head_cache_counter(dcontext_t *dcontext, fragment_t *f)
+{
+    monitor_data_t *md = (monitor_data_t *) dcontext->monitor_field;
+    trace_head_counter_t *ctr = thcounter_add(dcontext, f->tag);
+    ASSERT(TEST(FRAG_IS_TRACE_HEAD, f->flags));
+    /* other links may already be counting down: keep their progress */
+    thcounter_fold_cache_count(ctr);
+    thcounter_arm_cache_count(md, ctr);
+    return &ctr->cache_left;
+}
+#endif
+
 /* Deletes all trace head entries in [start,end) */
 void
 thcounter_range_remove(dcontext_t *dcontext, app_pc start, app_pc end)
@@ -1037,7 +1110,13 @@ monitor_is_linkable(dcontext_t *dcontext, fragment_t *from_f, linkstub_t *from_l
         return true;
     if (DYNAMO_OPTION(disable_traces))
         return true;
-#ifndef TRACE_HEAD_CACHE_INCR
+#ifdef TRACE_HEAD_CACHE_INCR
+    /* the trace_head_incr routine is thread-private and counts in this
+     * thread's table, so only our own private fragments can link through it
+     */
+    if (TEST(FRAG_IS_TRACE_HEAD, to_f->flags) && !THCI_CAN_LINK_FROM(from_f))
+        return false;
+#else
     /* no link case -- block is a trace head */
     if (TEST(FRAG_IS_TRACE_HEAD, to_f->flags) && !DYNAMO_OPTION(disable_traces))
         return false;
@@ -1053,7 +1132,7 @@ monitor_is_linkable(dcontext_t *dcontext, fragment_t *from_f, linkstub_t *from_l
             /* fine to link to trace head
              * link will end up pointing not to fcache_return but to trace_head_incr
              */
-            return true;
+            return THCI_CAN_LINK_FROM(from_f);
 #else
             return false;
 #endif
@@ -1406,6 +1485,7 @@ end_and_emit_trace(dcontext_t *dcontext, fragment_t *cur_f)
      */
     
 #ifdef INTERNAL
+    md->const_load_flushtime = flushtime_global;
     if (dynamo_options.optimize
 #  ifdef SIDELINE
         && !dynamo_options.sideline
@@ -1416,6 +1496,19 @@ end_and_emit_trace(dcontext_t *dcontext, fragment_t *cur_f)
     }
 #endif /* INTERNAL */
 
+#ifdef ARM
+    /* must come after any optimization, as recreate_fragment_ilist() applies
+     * it in the same order
+     */
+    if (DYNAMO_OPTION(coalesce_trace_spills)) {
+        int removed = coalesce_trace_spills(dcontext, tag, trace);
+        if (removed > 0) {
+            STATS_ADD(trace_spill_instrs_removed, removed);
+            externally_mangled = true;
+        }
+    }
+#endif
+
 #ifdef PROFILE_RDTSC
     if (dynamo_options.profile_times) {
         /* space was already reserved in buffer and in md->emitted_size */
@@ -1444,6 +1537,24 @@ end_and_emit_trace(dcontext_t *dcontext, fragment_t *cur_f)
         delete_private_copy(dcontext);
     }
 
+#ifdef INTERNAL
+    /* A flush of memory that -loads_to_const folded loads from may have
+     * passed its check of const_load_areas after we registered a page but
+     * before we read it, yet found no trace to flush: throw this one away.
+     * A flush that starts after this check waits for us to leave
+     * couldbelinking and then removes the emitted trace.
+     */
+    if (dynamo_options.loads_to_const &&
+        const_load_flushtime > md->const_load_flushtime) {
+        LOG(THREAD, LOG_MONITOR, 2,
+            "aborting trace "PFX": folded memory flushed during optimization\n", tag);
+        trace_abort(dcontext);
+        STATS_INC(num_aborted_traces_const_load);
+        trace_f = NULL;
+        goto end_and_emit_trace_return;
+    }
+#endif
+
     /* Shared trace synchronization model:
      * We can't hold locks across cache executions, and we wouldn't want to have a
      * massive trace building lock anyway, so we only grab a lock at the final emit
@@ -1975,6 +2086,124 @@ check_fine_to_coarse_trace_head(dcontext_t *dcontext, fragment_t *f)
     }
 }
 
+/* Returns whether exit l of trace f leaves before the trace's final
+ * constituent block, i.e., whether the path the trace was built along
+ * was not followed to its end.  The final block's exits are the trace's
+ * last exit plus, if that is a fall-through jmp, the cbr just before it:
+ * any earlier exit is followed by the inlined code of a later block.
+ */
+static bool
+trace_exit_is_early(dcontext_t *dcontext, fragment_t *f, linkstub_t *l)
+{
+    linkstub_t *stub, *prev = NULL, *last = NULL;
+    DEBUG_DECLARE(bool found = false;)
+    for (stub = FRAGMENT_EXIT_STUBS(f); stub != NULL; stub = LINKSTUB_NEXT_EXIT(stub)) {
+        DODEBUG({ if (stub == l) found = true; });
+        prev = last;
+        last = stub;
+    }
+    ASSERT(found);
+    if (l == last)
+        return false;
+    if (l == prev &&
+        cbr_fallthrough_exit_cti(EXIT_CTI_PC(f, prev)) == EXIT_CTI_PC(f, last))
+        return false;
+    return true;
+}
+
+/* -adaptive_traces: recomputes this thread's trace_threshold and max_trace_bbs
+ * from scratch at the end of each sampling window.  A trace cache that is
+ * full or regenerating means new traces evict hot ones, so we wait for hotter
+ * heads.  Traces that are mostly left early were built along a minority path,
+ * so we profile longer before committing to a path and build shorter traces;
+ * traces that are mostly run to the end in an uncrowded cache are worth
+ * building sooner.
+ */
+static void
+adapt_trace_limits(dcontext_t *dcontext, monitor_data_t *md)
+{
+    uint pressure = fcache_trace_pressure(dcontext);
+    uint early_pct = md->window_early_exits * 100 / md->window_exits;
+    uint exit_pct = DYNAMO_OPTION(adaptive_trace_exit_percent);
+    uint threshold = INTERNAL_OPTION(trace_threshold);
+    uint max_bbs = DYNAMO_OPTION(max_trace_bbs);
+
+    if (pressure >= 90)
+        threshold *= ADAPTIVE_TRACE_SCALE;
+    else if (pressure >= 60)
+        threshold *= 2;
+    if (early_pct >= exit_pct) {
+        threshold *= 2;
+        if (max_bbs > ADAPTIVE_MIN_TRACE_BBS)
+            max_bbs = MAX(max_bbs / ADAPTIVE_TRACE_SCALE, ADAPTIVE_MIN_TRACE_BBS);
+    } else if (pressure < 30 && early_pct < exit_pct / 4)
+        threshold = (threshold + ADAPTIVE_TRACE_SCALE - 1) / ADAPTIVE_TRACE_SCALE;
+    if (pressure >= 90 && max_bbs > ADAPTIVE_MIN_TRACE_BBS)
+        max_bbs = MAX(max_bbs / 2, ADAPTIVE_MIN_TRACE_BBS);
+    threshold = MIN(threshold, TH_MAX_THRESHOLD());
+
+    LOG(THREAD, LOG_MONITOR, 2,
+        "adaptive traces: %d%% cache pressure, %d/%d early exits => "
+        "threshold %d (was %d), max bbs %d (was %d)\n", pressure,
+        md->window_early_exits, md->window_exits, threshold, md->trace_threshold,
+        max_bbs, md->max_trace_bbs);
+    STATS_INC(adaptive_trace_limits_updated);
+    DOSTATS({
+        if (threshold > md->trace_threshold)
+            STATS_INC(adaptive_trace_threshold_raised);
+        else if (threshold < md->trace_threshold)
+            STATS_INC(adaptive_trace_threshold_lowered);
+    });
+    md->trace_threshold = threshold;
+    md->max_trace_bbs = max_bbs;
+    md->window_exits = 0;
+    md->window_early_exits = 0;
+}
+
+/* -adaptive_traces: accounts for the trace exit we came back to DR through,
+ * if any, on the way to next_f.  We only see exits that are unlinked or miss
+ * in the ibl, which includes every exit to a trace head; that is our sample.
+ * A private trace whose exits are mostly early is deleted, so that its head
+ * starts counting again and is re-formed along whatever path is hot now.
+ * Shared traces would need a flush to delete, so they only feed the
+ * thread's limits.
+ */
+static void
+adaptive_trace_exit(dcontext_t *dcontext, monitor_data_t *md, fragment_t *next_f)
+{
+    fragment_t *trace = dcontext->last_fragment;
+    linkstub_t *l = dcontext->last_exit;
+    trace_only_t *t;
+    bool early;
+
+    if (trace == NULL || l == NULL || LINKSTUB_FAKE(l) ||
+        !TEST(FRAG_IS_TRACE, trace->flags) || TEST(FRAG_WAS_DELETED, trace->flags))
+        return;
+    t = TRACE_FIELDS(trace);
+    early = trace_exit_is_early(dcontext, trace, l);
+    t->exits_seen++;
+    md->window_exits++;
+    if (early) {
+        t->early_exits_seen++;
+        md->window_early_exits++;
+    }
+    if (md->window_exits >= ADAPTIVE_TRACE_WINDOW)
+        adapt_trace_limits(dcontext, md);
+
+    if (early && trace != next_f && t->exits_seen >= ADAPTIVE_REFORM_MIN_EXITS &&
+        t->early_exits_seen * 100 >=
+        t->exits_seen * DYNAMO_OPTION(adaptive_trace_exit_percent) &&
+        !TESTANY(FRAG_SHARED|FRAG_COARSE_GRAIN|FRAG_CANNOT_DELETE, trace->flags)) {
+        LOG(THREAD, LOG_MONITOR, 2,
+            "adaptive traces: re-forming trace F%d ("PFX"): %d/%d early exits\n",
+            trace->id, trace->tag, t->early_exits_seen, t->exits_seen);
+        /* trace == dcontext->last_fragment */
+        last_exit_deleted(dcontext);
+        fragment_delete(dcontext, trace, FRAGDEL_ALL);
+        STATS_INC(num_traces_reformed);
+    }
+}
+
 /* This routine maintains the statistics that identify hot code
  * regions, and it controls the building and installation of trace
  * fragments.
@@ -2167,8 +2396,8 @@ monitor_cache_enter(dcontext_t *dcontext, fragment_t *f)
                 end_trace = true;
             }
         }
-        if (DYNAMO_OPTION(max_trace_bbs) > 0 &&
-            md->num_blks >= DYNAMO_OPTION(max_trace_bbs) && !end_trace) {
+        if (md->max_trace_bbs > 0 &&
+            md->num_blks >= md->max_trace_bbs && !end_trace) {
             end_trace = true;
             STATS_INC(num_max_trace_bbs_enforced);
         }
@@ -2206,6 +2435,9 @@ monitor_cache_enter(dcontext_t *dcontext, fragment_t *f)
 
     /* if got here, md->trace_tag == NULL */
 
+    if (DYNAMO_OPTION(adaptive_traces))
+        adaptive_trace_exit(dcontext, md, f);
+
     /* searching for a hot trace head */
 
     if (TEST(FRAG_IS_TRACE, f->flags)) {
@@ -2282,10 +2514,17 @@ monitor_cache_enter(dcontext_t *dcontext, fragment_t *f)
         ctr->counter = INTERNAL_OPTION(trace_counter_on_delete);
         STATS_INC(th_counter_reset);
     }
+#ifdef TRACE_HEAD_CACHE_INCR
+    thcounter_fold_cache_count(ctr);
+#endif
 
     ctr->counter++;
     /* Should never be > here (assert is down below) but we check just in case */
-    if (ctr->counter >= INTERNAL_OPTION(trace_threshold)) {
+    if (ctr->counter >= md->trace_threshold) {
+        /* -adaptive_traces may have lowered the threshold below a count
+         * accumulated earlier: pretend we just reached it.
+         */
+        ctr->counter = md->trace_threshold;
         /* if cannot delete fragment, do not start trace -- wait until
          * can delete it (w/ exceptions, deletion status changes). */
         if (!TEST(FRAG_CANNOT_DELETE, f->flags)) {
@@ -2320,9 +2559,13 @@ monitor_cache_enter(dcontext_t *dcontext, fragment_t *f)
              * that our one-up sentinel works for lazy clearing.
              */
             ctr->counter--;
-            ASSERT(ctr->counter < INTERNAL_OPTION(trace_threshold));
+            ASSERT(ctr->counter < md->trace_threshold);
         }
     }
+#ifdef TRACE_HEAD_CACHE_INCR
+    /* linked exits count f down in the cache from here until it is hot */
+    thcounter_arm_cache_count(md, ctr);
+#endif
 
 #ifdef CLIENT_INTERFACE
     if (start_trace) {
@@ -2362,7 +2605,7 @@ monitor_cache_enter(dcontext_t *dcontext, fragment_t *f)
     if (start_trace) {
         KSTART(trace_building);
         /* ensure our sentinel counter value for counter clearing will work */
-        ASSERT(ctr->counter == INTERNAL_OPTION(trace_threshold));
+        ASSERT(ctr->counter == md->trace_threshold);
         ctr->counter = TH_COUNTER_CREATED_TRACE_VALUE();
         /* Found a hot trace head.  Switch this thread into trace
            selection mode, and initialize the instrlist_t for the new
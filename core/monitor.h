@@ -104,6 +104,14 @@ void trace_abort_and_delete(dcontext_t *dcontext);
 void
 thcounter_range_remove(dcontext_t *dcontext, app_pc start, app_pc end);
 
+#ifdef TRACE_HEAD_CACHE_INCR
+/* Returns this thread's in-cache countdown for trace head f, for a linkstub
+ * about to be linked through the trace_head_incr routine.
+ */
+int *
+monitor_trace_head_cache_counter(dcontext_t *dcontext, fragment_t *f);
+#endif
+
 bool
 mangle_trace_at_end(void);
 
@@ -117,6 +125,14 @@ mangle_trace_at_end(void);
 typedef struct _trace_head_counter_t {
     app_pc tag;
     uint   counter;
+#ifdef TRACE_HEAD_CACHE_INCR
+    /* executions left before the trace_head_incr routine sends a linked
+     * exit to this head back to us, and what we armed it with, so we can
+     * credit the executions it let through to counter
+     */
+    int    cache_left;
+    int    cache_armed;
+#endif
     /* FIXME: use open-address to save memory, and share code
      * w/ fragment.c?
      */
@@ -177,6 +193,15 @@ typedef struct _monitor_data_t {
     /* FIXME: use new generic_table_t and generic_hash_* routines */
     trace_head_table_t thead_table;
 
+    /* -adaptive_traces: this thread's current trace formation limits, which
+     * equal the trace_threshold and max_trace_bbs options when not adapting,
+     * and the trace exits seen in the current sampling window.
+     */
+    uint           trace_threshold;
+    uint           max_trace_bbs;
+    uint           window_exits;
+    uint           window_early_exits;
+
 #ifdef CLIENT_INTERFACE
     /* PR 299808: we re-build each bb and pass to the client */
     instrlist_t    unmangled_ilist;
@@ -189,6 +214,13 @@ typedef struct _monitor_data_t {
      */
     uint           final_exit_flags;
 
+#ifdef INTERNAL
+    /* flushtime_global before -loads_to_const registered any page for this
+     * trace, rechecked against const_load_flushtime at emit
+     */
+    uint           const_load_flushtime;
+#endif
+
 #ifdef CUSTOM_TRACES
     fragment_t     wrapper; /* for creating new shadowed trace heads */
 #endif
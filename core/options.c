@@ -819,6 +819,11 @@ check_option_compatibility_helper(int recurse_count)
         SET_DEFAULT_VALUE(trace_counter_on_delete);
         changed_options = true;
     }
+    if (DYNAMO_OPTION(adaptive_trace_exit_percent) > 100) {
+        USAGE_ERROR("adaptive_trace_exit_percent must be <= 100");
+        SET_DEFAULT_VALUE(adaptive_trace_exit_percent);
+        changed_options = true;
+    }
     if (INTERNAL_OPTION(alt_hash_func) >= HASH_FUNCTION_ENUM_MAX) {
         USAGE_ERROR("Invalid selection (%d) for shared cache hash func, must be < %d", 
                     INTERNAL_OPTION(alt_hash_func), 
@@ -618,6 +618,12 @@
      */
     OPTION_DEFAULT(bool, use_all_memory_areas, true, "Use all_memory_areas "
                    "address space cache to query page protections.")
+    /* all_memory_areas is kept up to date from the memory syscalls we intercept,
+     * so a query that falls in a hole normally does not need to consult
+     * /proc/pid/maps.  We still check every Nth hole as a safety net.
+     */
+    OPTION_DEFAULT(uint, allmem_verify_interval, 64, "Check /proc/pid/maps on "
+                   "every Nth all_memory_areas query that finds no region (0=never).")
 #endif /* LINUX */
 
     /* Disable diagnostics by default. -security turns it on */
@@ -914,6 +920,14 @@
         "enable speculative linking of trace last IB exit")
 
     OPTION_DEFAULT(uint, max_trace_bbs, 128, "maximum number of basic blocks in a trace")
+    OPTION_DEFAULT(bool, coalesce_trace_spills, true,
+        "remove redundant scratch register spills and restores from traces (ARM only)")
+    OPTION_DEFAULT(bool, adaptive_traces, false,
+        "tune trace_threshold and max_trace_bbs per thread from trace cache pressure "
+        "and trace exits, and re-form private traces that are mostly exited early")
+    OPTION_DEFAULT(uint, adaptive_trace_exit_percent, 50,
+        "percentage of trace exits leaving before the final block above which "
+        "-adaptive_traces considers traces to be poorly formed")
 
     /* FIXME: case 8023 covers re-enabling on linux */
     OPTION_DEFAULT(uint, protect_mask,
@@ -1418,6 +1432,11 @@
         "true use sleep in synch_with_* wait loops instead of yield")
     OPTION_DEFAULT(uint_time, synch_with_sleep_time, 5, "time in ms to sleep for each "
         "wait loop in synch_with_* routines")
+#ifdef LINUX
+    /* off until SUSPEND_SIGNAL is intercepted: nothing acks the batch yet */
+    OPTION_DEFAULT_INTERNAL(bool, synch_all_threads_batch_suspend, false,
+        "synch_with_all_threads signals all threads at once and waits for them together")
+#endif
 #ifdef WINDOWS
     /* FIXME - only an option since late in the release cycle - should always be on */
     OPTION_DEFAULT(bool, suspend_on_synch_failure_for_app_suspend, true, "if we fail "
@@ -2575,6 +2594,11 @@ IF_RCT_IND_BRANCH(options->rct_ind_jump = OPTION_DISABLED;)
     /* FIXME: case 4471 should start smaller and double instead */
     OPTION_DEFAULT_INTERNAL(uint, vmarea_increment_size, 100, 
         "incremental vmarea vector size")
+    /* requires -shared_deletion to reclaim replaced snapshots */
+    OPTION_DEFAULT_INTERNAL(bool, vmarea_snapshots, true,
+        "lock-free lookups in executable and DR areas via published snapshots")
+    OPTION_DEFAULT_INTERNAL(uint, vmarea_max_retired_snapshots, 64,
+        "force a deletion check point once this many replaced snapshots are pending")
     OPTION_INTERNAL(uint_addr, stress_fake_userva, 
         "pretend system address space starts at this address (case 9022)")
 
@@ -2648,8 +2672,8 @@ IF_RCT_IND_BRANCH(options->rct_ind_jump = OPTION_DISABLED;)
 
     OPTIMIZE_OPTION(bool, instr_counts)
     OPTIMIZE_OPTION(bool, stack_adjust)
-# ifdef LOAD_TO_CONST
     OPTIMIZE_OPTION(bool, loads_to_const)
+# ifdef LOAD_TO_CONST
     OPTIMIZE_OPTION(bool, safe_loads_to_const)
 # endif
 
@@ -2664,6 +2688,9 @@ IF_RCT_IND_BRANCH(options->rct_ind_jump = OPTION_DISABLED;)
     OPTIMIZE_OPTION(bool, call_return_matching)
     OPTIMIZE_OPTION(bool, remove_unnecessary_zeroing) // FIXME: unnecessarily long option
     OPTIMIZE_OPTION(bool, peephole)
+    OPTIMIZE_OPTION(bool, if_convert)
+    OPTIMIZE_OPTION(bool, pair_ldst)
+    OPTIMIZE_OPTION(bool, remove_dead_flags)
 # undef OPTIMIZE_OPTION
 #endif /* EXPOSE_INTERNAL_OPTIONS */
 #ifdef HOT_PATCHING_INTERFACE
@@ -1284,6 +1284,43 @@ synch_with_all_threads(thread_synch_state_t desired_synch_state,
         num_threads_temp = num_threads;
         synch_array_temp = synch_array;
 
+#ifdef LINUX
+        /* Rather than paying a full signal round trip per thread inside
+         * synch_with_thread(), send every suspend signal up front and wait
+         * once for all the targets to acknowledge.  synch_with_thread() then
+         * picks up the suspend reference we took and only has to check for a
+         * safe spot.  We apply the same filters as the loop below so that
+         * every reference taken here is consumed there.
+         */
+        if (DYNAMO_OPTION(synch_all_threads_batch_suspend)) {
+            KSTART(synchall_suspend_signal);
+            for (i = 0; i < num_threads; i++) {
+                if (synch_array[i] == SYNCH_WITH_ALL_SYNCHED ||
+                    threads[i]->id == my_id || threads[i]->execve)
+                    continue;
+# ifdef CLIENT_INTERFACE
+                if (IS_CLIENT_THREAD(threads[i]->dcontext) &&
+                    (!finished_non_client_threads ||
+                     !should_suspend_client_thread(threads[i]->dcontext,
+                                                   desired_synch_state)))
+                    continue;
+# endif
+                if (synch_array[i] == SYNCH_WITH_ALL_NEW) {
+                    adjust_wait_at_safe_spot(threads[i]->dcontext, 1);
+                    synch_array[i] = SYNCH_WITH_ALL_NOTIFIED;
+                }
+                /* on failure synch_with_thread() will retry and report it */
+                if (thread_suspend_async(threads[i]))
+                    STATS_INC(synch_batch_suspends);
+            }
+            KSTOP(synchall_suspend_signal);
+            KSTART(synchall_suspend_ack);
+            thread_suspend_wait_batch();
+            KSTOP(synchall_suspend_ack);
+        }
+#endif
+
+        KSTART(synchall_safe_spot);
         for (i = 0; i < num_threads; i++) {
             /* do not de-ref threads[i] after synching if it was cleaned up! */
             if (synch_array[i] != SYNCH_WITH_ALL_SYNCHED && threads[i]->id != my_id) {
@@ -1334,8 +1371,18 @@ synch_with_all_threads(thread_synch_state_t desired_synch_state,
                     LOG(THREAD, LOG_SYNCH, 2, "Synch failed!\n");
                     all_synched = false;
                     if (synch_res == THREAD_SYNCH_RESULT_SUSPEND_FAILURE) {
-                        if (TEST(THREAD_SYNCH_SUSPEND_FAILURE_ABORT, flags))
+                        if (TEST(THREAD_SYNCH_SUSPEND_FAILURE_ABORT, flags)) {
+#ifdef LINUX
+                            /* drop the batch references we won't get to */
+                            for (j = i + 1; j < num_threads; j++) {
+                                if (synch_array[j] != SYNCH_WITH_ALL_SYNCHED &&
+                                    threads[j]->id != my_id)
+                                    thread_suspend_cancel(threads[j]);
+                            }
+#endif
+                            KSTOP(synchall_safe_spot);
                             goto synch_with_all_abort;
+                        }
                     } else
                         ASSERT(synch_res == THREAD_SYNCH_RESULT_NOT_SAFE);
                 }
@@ -1344,6 +1391,7 @@ synch_with_all_threads(thread_synch_state_t desired_synch_state,
                     "Skipping synch with thread "IDFMT"\n", thread_ids_temp[i]);
             }
         }
+        KSTOP(synchall_safe_spot);
         /* We test the exiting thread count to avoid races between exit
          * process (current thread, though we could be here for detach or other
          * reasons) and an exiting thread (who might no longer be on the all
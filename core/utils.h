@@ -438,6 +438,9 @@ enum {
     LOCK_RANK(patch_proof_areas), /* < dynamo_areas < global_alloc_lock */
     LOCK_RANK(emulate_write_areas), /* < dynamo_areas < global_alloc_lock */
     LOCK_RANK(IAT_areas), /* < dynamo_areas < global_alloc_lock */
+#ifdef INTERNAL
+    LOCK_RANK(const_load_areas), /* < dynamo_areas < global_alloc_lock */
+#endif
 #ifdef CLIENT_INTERFACE
     /* PR 198871: this same label is used for all client locks */
     LOCK_RANK(dr_client_mutex), /* > module_data_lock */
@@ -502,6 +505,8 @@ enum {
     IF_LINUX_(LOCK_RANK(set_thread_area_lock)) /* no constraints */
     LOCK_RANK(landing_pad_areas_lock),  /* < global_alloc_lock, < dynamo_areas */
     LOCK_RANK(dynamo_areas),    /* < global_alloc_lock */
+    LOCK_RANK(vmvector_retired_lock), /* > executable_areas, > dynamo_areas,
+                                       * > shared_delete_lock, < global_alloc_lock */
     LOCK_RANK(map_intercept_pc_lock), /* < global_alloc_lock */
     LOCK_RANK(global_alloc_lock),/* < heap_unit_lock */
     LOCK_RANK(heap_unit_lock),   /* recursive */
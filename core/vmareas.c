@@ -284,6 +284,19 @@ vm_area_vector_t *emulate_write_areas;
  */
 vm_area_vector_t *IAT_areas;
 
+#ifdef INTERNAL
+/* used for DYNAMO_OPTION(loads_to_const)
+ * read-only app memory whose contents optimized traces have folded into
+ * immediates, rounded out to pages
+ */
+vm_area_vector_t *const_load_areas;
+/* flushtime_global that the most recent flush_const_load_overlap() reaches:
+ * a trace that began optimizing at an earlier flushtime may have read the
+ * flushed memory after the flush's check and must not be emitted
+ */
+uint const_load_flushtime;
+#endif
+
 /* Keeps persistent written-to and execution counts for switching back and
  * forth from page prot to sandboxing.
  */
@@ -363,6 +376,16 @@ typedef struct _deletion_lists_t {
     uint lazy_delete_count;
     /* ensure only one thread tries to move to pending deletion list */
     bool move_pending;
+
+    /* VECTOR_SNAPSHOT copies that have been replaced but may still be in use
+     * by lock-free readers, chained via next_retired and kept in increasing
+     * order of flushtime.  Protected by vmvector_retired_lock.
+     */
+    struct vmvector_snapshot_t *retired_snapshots;
+    struct vmvector_snapshot_t *retired_snapshots_tail;
+    uint retired_snapshot_count;
+    /* ensure only one thread adds a pending entry to reclaim them */
+    bool snapshot_move_pending;
 } deletion_lists_t;
 
 static deletion_lists_t *todelete;
@@ -407,6 +430,9 @@ DECLARE_CXTSWPROT_VAR(static mutex_t last_deallocated_lock,
 DECLARE_CXTSWPROT_VAR(mutex_t shared_delete_lock, INIT_LOCK_FREE(shared_delete_lock));
 /* synchronization for the lazy deletion list */
 DECLARE_CXTSWPROT_VAR(static mutex_t lazy_delete_lock, INIT_LOCK_FREE(lazy_delete_lock));
+/* synchronization for the retired vm_area_vector_t snapshot list */
+DECLARE_CXTSWPROT_VAR(static mutex_t vmvector_retired_lock,
+                      INIT_LOCK_FREE(vmvector_retired_lock));
 
 /* multi_entry_t allocation is either global or local heap */
 #define MULTI_ALLOC_DC(dc, flags) FRAGMENT_ALLOC_DC(dc, flags)
@@ -459,6 +485,8 @@ static void
 vm_area_clean_fraglist(dcontext_t *dcontext, vm_area_t *area);
 static bool
 lookup_addr(vm_area_vector_t *v, app_pc addr, vm_area_t **area);
+static void
+vmvector_publish_snapshot(vm_area_vector_t *v);
 #if defined(DEBUG) && defined(INTERNAL)
 static void
 print_fraglist(dcontext_t *dcontext, vm_area_t *area, const char *prefix);
@@ -1222,6 +1250,8 @@ add_vm_area(vm_area_vector_t *v, app_pc start, app_pc end,
             vm_area_clean_fraglist(dcontext, &v->buf[i]);
         }
     }
+    if (TEST(VECTOR_SNAPSHOT, v->flags))
+        vmvector_publish_snapshot(v);
     DOLOG(5, LOG_VMAREAS, { print_vm_areas(v, GLOBAL); });
 }
 
@@ -1431,6 +1461,9 @@ remove_vm_area(vm_area_vector_t *v, app_pc start, app_pc end, bool restore_prot)
         add_vm_area(v, new_area.start, new_area.end, new_area.vm_flags,
                     new_area.frag_flags, new_area.custom.client
                     _IF_DEBUG(new_area.comment));
+    } else if (TEST(VECTOR_SNAPSHOT, v->flags)) {
+        /* add_vm_area() publishes for us in the split case */
+        vmvector_publish_snapshot(v);
     }
     DOLOG(5, LOG_VMAREAS, { print_vm_areas(v, GLOBAL); });
     return true;
@@ -1525,6 +1558,171 @@ vm_area_overlap(vm_area_vector_t *v, app_pc start, app_pc end)
     return binary_search(v, start, end, NULL, NULL, false);
 }
 
+/*************************** SNAPSHOTS ****************************
+ *
+ * executable_areas and dynamo_areas are queried far more often than they
+ * change (every bb build, every signal, every is_dynamo_address), so for
+ * VECTOR_SNAPSHOT vectors we keep an immutable sorted array of the area
+ * bounds.  Writers, who already hold the vector's write lock, build a new
+ * array after each change and publish it with a single pointer store.
+ * Readers load the pointer once and binary search without any lock.
+ *
+ * The replaced array may still be in use by a reader, so it is retired
+ * with a flushtime and freed by the shared deletion machinery: once every
+ * thread has passed a check point for a pending entry at or after that
+ * flushtime, no reader can still hold the old pointer.  We publish before
+ * reading flushtime_global, so any pending entry created at or after
+ * flushtime_global+1 is created after the publish, and any thread signing
+ * off on it has finished all lookups that could have seen the old array.
+ * Retired arrays are thus reclaimed at the next flushtime, or at reset/exit.
+ * If nothing is flushed for a while, vm_area_check_retired_snapshots() adds
+ * an empty pending entry once -vmarea_max_retired_snapshots pile up, so the
+ * retired list stays bounded.
+ */
+
+typedef struct _vmvector_bounds_t {
+    app_pc start;
+    app_pc end;
+} vmvector_bounds_t;
+
+struct vmvector_snapshot_t {
+    int length;
+    /* for retired snapshots: the flushtime at which it is safe to free */
+    uint flushtime;
+    struct vmvector_snapshot_t *next_retired;
+    /* variable-length: sized by length */
+    vmvector_bounds_t bounds[1];
+};
+
+#define VMVECTOR_SNAPSHOT_SIZE(length) \
+    (sizeof(struct vmvector_snapshot_t) + \
+     ((length) > 0 ? (length) - 1 : 0) * sizeof(vmvector_bounds_t))
+
+static void
+vmvector_snapshot_free(struct vmvector_snapshot_t *snap)
+{
+    global_heap_free(snap, VMVECTOR_SNAPSHOT_SIZE(snap->length)
+                     HEAPACCT(ACCT_VMAREAS));
+}
+
+/* Frees all retired snapshots whose flushtime is <= flushtime.
+ * Caller must ensure no thread can still be reading them.
+ */
+static void
+vmvector_free_retired_snapshots(uint flushtime)
+{
+    struct vmvector_snapshot_t *snap, *next;
+    if (todelete == NULL)
+        return;
+    mutex_lock(&vmvector_retired_lock);
+    /* kept in increasing order of flushtime so we can stop at the first miss */
+    for (snap = todelete->retired_snapshots;
+         snap != NULL && snap->flushtime <= flushtime; snap = next) {
+        next = snap->next_retired;
+        vmvector_snapshot_free(snap);
+        ASSERT(todelete->retired_snapshot_count > 0);
+        todelete->retired_snapshot_count--;
+        STATS_INC(num_vmarea_snapshots_freed);
+    }
+    todelete->retired_snapshots = snap;
+    if (snap == NULL)
+        todelete->retired_snapshots_tail = NULL;
+    mutex_unlock(&vmvector_retired_lock);
+}
+
+/* Replaces v's snapshot with a copy of its current bounds.
+ * Caller must hold v's write lock.
+ */
+static void
+vmvector_publish_snapshot(vm_area_vector_t *v)
+{
+    struct vmvector_snapshot_t *snap, *old;
+    int i, length;
+    ASSERT(TEST(VECTOR_SNAPSHOT, v->flags));
+    ASSERT_VMAREA_VECTOR_PROTECTED(v, WRITE);
+    while (true) {
+        length = v->length;
+        snap = (struct vmvector_snapshot_t *)
+            global_heap_alloc(VMVECTOR_SNAPSHOT_SIZE(length) HEAPACCT(ACCT_VMAREAS));
+        /* For dynamo_areas, allocating can recursively add a new heap unit
+         * to v (see dynamo_vm_areas_lock()), which publishes on its own.
+         */
+        if (length == v->length)
+            break;
+        global_heap_free(snap, VMVECTOR_SNAPSHOT_SIZE(length) HEAPACCT(ACCT_VMAREAS));
+    }
+    snap->length = length;
+    snap->flushtime = 0;
+    snap->next_retired = NULL;
+    for (i = 0; i < length; i++) {
+        snap->bounds[i].start = v->buf[i].start;
+        snap->bounds[i].end = v->buf[i].end;
+    }
+    old = v->snapshot;
+    /* the contents must be visible before the pointer, and the pointer
+     * must be visible before we read flushtime_global below
+     */
+    MEMORY_BARRIER();
+    v->snapshot = snap;
+    MEMORY_BARRIER();
+    STATS_INC(num_vmarea_snapshots);
+    if (old == NULL)
+        return;
+    if (todelete == NULL) {
+        /* still single-threaded init, or past the point of freeing the
+         * deletion lists at exit: no other reader can be active
+         */
+        vmvector_snapshot_free(old);
+        return;
+    }
+    mutex_lock(&vmvector_retired_lock);
+    old->flushtime = flushtime_global + 1;
+    /* flushtime_global never decreases, so appending keeps the list sorted */
+    if (todelete->retired_snapshots_tail == NULL) {
+        ASSERT(todelete->retired_snapshots == NULL);
+        todelete->retired_snapshots = old;
+    } else
+        todelete->retired_snapshots_tail->next_retired = old;
+    todelete->retired_snapshots_tail = old;
+    todelete->retired_snapshot_count++;
+    STATS_TRACK_MAX(max_vmarea_snapshots_retired, todelete->retired_snapshot_count);
+    mutex_unlock(&vmvector_retired_lock);
+}
+
+/* Searches v's published snapshot for an overlap with [start, end) without
+ * acquiring v's lock.  Returns false if v has no snapshot, in which case the
+ * caller must fall back to a locked lookup; else sets *overlap.
+ */
+static bool
+vmvector_snapshot_overlap(vm_area_vector_t *v, app_pc start, app_pc end,
+                          bool *overlap /*OUT*/)
+{
+    struct vmvector_snapshot_t *snap;
+    int min, max;
+    if (!TEST(VECTOR_SNAPSHOT, v->flags))
+        return false;
+    snap = v->snapshot;
+    if (snap == NULL)
+        return false;
+    ASSERT(start < end || end == NULL /* wraparound */);
+    /* same search as binary_search() */
+    min = 0;
+    max = snap->length - 1;
+    while (max >= min) {
+        int i = (min + max) / 2;
+        if (end != NULL && end <= snap->bounds[i].start)
+            max = i - 1;
+        else if (start >= snap->bounds[i].end)
+            min = i + 1;
+        else {
+            *overlap = true;
+            return true;
+        }
+    }
+    *overlap = false;
+    return true;
+}
+
 /*********************** EXPORTED ROUTINES **********************/
 
 /* thread-shared initialization that should be repeated after a reset */
@@ -1566,6 +1764,10 @@ vm_areas_init()
                           emulate_write_areas);
     VMVECTOR_ALLOC_VECTOR(IAT_areas, GLOBAL_DCONTEXT, VECTOR_SHARED,
                           IAT_areas);
+#ifdef INTERNAL
+    VMVECTOR_ALLOC_VECTOR(const_load_areas, GLOBAL_DCONTEXT, VECTOR_SHARED,
+                          const_load_areas);
+#endif
     VMVECTOR_ALLOC_VECTOR(written_areas, GLOBAL_DCONTEXT,
                           VECTOR_SHARED | VECTOR_NEVER_MERGE,
                           written_areas);
@@ -1584,6 +1786,18 @@ vm_areas_init()
     todelete = HEAP_TYPE_ALLOC(GLOBAL_DCONTEXT, deletion_lists_t, ACCT_VMAREAS, PROTECTED);
     memset(todelete, 0, sizeof(*todelete));
 
+    /* Retired snapshots are only reclaimed via the shared deletion check points */
+    if (DYNAMO_OPTION(vmarea_snapshots) && DYNAMO_OPTION(shared_deletion)) {
+        write_lock(&executable_areas->lock);
+        executable_areas->flags |= VECTOR_SNAPSHOT;
+        vmvector_publish_snapshot(executable_areas);
+        write_unlock(&executable_areas->lock);
+        dynamo_vm_areas_lock();
+        dynamo_areas->flags |= VECTOR_SNAPSHOT;
+        vmvector_publish_snapshot(dynamo_areas);
+        dynamo_vm_areas_unlock();
+    }
+
     coarse_to_delete = HEAP_TYPE_ALLOC(GLOBAL_DCONTEXT, coarse_info_t *,
                                        ACCT_VMAREAS, PROTECTED);
     *coarse_to_delete = NULL;
@@ -1694,6 +1908,10 @@ vm_areas_exit()
     DELETE_LOCK(lazy_delete_lock);
     ASSERT(todelete->lazy_delete_count == 0);
     ASSERT(!todelete->move_pending);
+    /* normally drained by vm_area_check_shared_pending(GLOBAL_DCONTEXT) */
+    vmvector_free_retired_snapshots(UINT_MAX);
+    ASSERT(todelete->retired_snapshot_count == 0);
+    DELETE_LOCK(vmvector_retired_lock);
 
     HEAP_TYPE_FREE(GLOBAL_DCONTEXT, shared_data, thread_data_t, ACCT_VMAREAS, PROTECTED);
     shared_data = NULL;
@@ -1764,6 +1982,10 @@ vm_areas_exit()
 #endif
     vmvector_delete_vector(GLOBAL_DCONTEXT, IAT_areas);
     IAT_areas = NULL;
+#ifdef INTERNAL
+    vmvector_delete_vector(GLOBAL_DCONTEXT, const_load_areas);
+    const_load_areas = NULL;
+#endif
     return 0;
 }
 
@@ -1922,6 +2144,8 @@ vmvector_overlap(vm_area_vector_t *v, app_pc start, app_pc end)
     bool release_lock; /* 'true' means this routine needs to unlock */
     if (vmvector_empty(v))
         return false;
+    if (vmvector_snapshot_overlap(v, start, end, &overlap))
+        return overlap;
     LOCK_VECTOR(v, release_lock, read);
     ASSERT_OWN_READWRITE_LOCK(SHOULD_LOCK_VECTOR(v), &v->lock);
     overlap = vm_area_overlap(v, start, end);
@@ -2082,6 +2306,11 @@ vmvector_reset_vector(dcontext_t *dcontext, vm_area_vector_t *v)
         v->buf = NULL;
     } else
         ASSERT(v->size == 0 && v->length == 0);
+    if (v->snapshot != NULL) {
+        /* only called when no lock-free readers can remain */
+        vmvector_snapshot_free(v->snapshot);
+        v->snapshot = NULL;
+    }
 }
 
 static void
@@ -2416,6 +2645,8 @@ add_executable_vm_area_check_IAT(app_pc *start /*IN/OUT*/, app_pc *end /*IN/OUT*
                 ASSERT(*start == IAT_end); /* set up above */
                 *end = area->end;
                 area->start = *start;
+                if (TEST(VECTOR_SNAPSHOT, executable_areas->flags))
+                    vmvector_publish_snapshot(executable_areas);
                 *existing_area = area;
                 STATS_INC(coarse_merge_IAT);
                 /* If info was loaded prior to rebinding just use it.
@@ -2908,6 +3139,8 @@ bool
 is_executable_address(app_pc addr)
 {
     bool found;
+    if (vmvector_snapshot_overlap(executable_areas, addr, addr+1, &found))
+        return found;
     read_lock(&executable_areas->lock);
     found = lookup_addr(executable_areas, addr, NULL);
     read_unlock(&executable_areas->lock);
@@ -3672,6 +3905,10 @@ is_dynamo_address(app_pc addr)
     /* case 3045: areas inside the vmheap reservation are not added to the list */
     if (is_vmm_reserved_address(addr, 1))
         return true;
+    /* if stale we must take the lock to bring the vector up to date */
+    if (dynamo_areas_uptodate &&
+        vmvector_snapshot_overlap(dynamo_areas, addr, addr+1, &found))
+        return found;
     dynamo_vm_areas_start_reading();
     found = lookup_addr(dynamo_areas, addr, NULL);
     dynamo_vm_areas_done_reading();
@@ -3739,6 +3976,12 @@ bool
 executable_vm_area_overlap(app_pc start, app_pc end, bool have_writelock)
 {
     bool overlap;
+    /* a writer must see its own in-progress changes, so only readers use
+     * the snapshot
+     */
+    if (!have_writelock &&
+        vmvector_snapshot_overlap(executable_areas, start, end, &overlap))
+        return overlap;
     if (!have_writelock)
         read_lock(&executable_areas->lock);
     overlap = vm_area_overlap(executable_areas, start, end);
@@ -6030,11 +6273,46 @@ app_memory_allocation(dcontext_t *dcontext, app_pc base, size_t size, uint prot,
 }
 
 /* de-allocated or un-mapped memory region */
+#ifdef INTERNAL
+/* Called when [base, base+size) is about to be freed or made writable.
+ * If an optimized trace folded a load from it we flush every fragment:
+ * we don't record which traces read which memory, and read-only data
+ * changing under a running app is rare.
+ */
+static void
+flush_const_load_overlap(dcontext_t *dcontext, app_pc base, size_t size,
+                         bool own_initexit_lock)
+{
+    if (const_load_areas == NULL || vmvector_empty(const_load_areas) ||
+        !vmvector_overlap(const_load_areas, base, base + size))
+        return;
+    LOG(THREAD, LOG_VMAREAS, 1,
+        "flushing all fragments: loads folded from "PFX"-"PFX" may be stale\n",
+        base, base + size);
+    /* before the flush synchs, so a trace being built is either caught by
+     * its recheck in end_and_emit_trace() or emitted before the synch and
+     * flushed along with everything else
+     */
+    const_load_flushtime = flushtime_global + 1;
+    vmvector_remove(const_load_areas, base, base + size);
+    flush_fragments_in_region_start(dcontext, UNIVERSAL_REGION_BASE,
+                                    UNIVERSAL_REGION_SIZE, own_initexit_lock,
+                                    false /* keep futures */,
+                                    false /* not invalidating exec areas */,
+                                    false /* don't force synchall */
+                                    _IF_DGCDIAG(NULL));
+    flush_fragments_in_region_finish(dcontext, own_initexit_lock);
+}
+#endif
+
 void
 app_memory_deallocation(dcontext_t *dcontext, app_pc base, size_t size,
                         bool own_initexit_lock, bool image)
 {
     ASSERT(!dynamo_vm_area_overlap(base, base + size));
+#ifdef INTERNAL
+    flush_const_load_overlap(dcontext, base, size, own_initexit_lock);
+#endif
     /* we check for overlap regardless of memory protections, to allow flexible
      * policies that are independent of rwx bits -- if any overlap we remove,
      * no shortcuts
@@ -6428,6 +6706,11 @@ app_memory_protection_change(dcontext_t *dcontext, app_pc base, size_t size,
     }
 #endif
 
+#ifdef INTERNAL
+    if (TEST(MEMPROT_WRITE, prot))
+        flush_const_load_overlap(dcontext, base, size, false/*no initexit lock*/);
+#endif
+
     /* look for calls making code writable! 
      * cache is_executable here w/o holding lock -- if decide to perform state
      * change via flushing, we'll re-check overlap there and all will be atomic
@@ -8854,6 +9137,63 @@ move_lazy_list_to_pending_delete(dcontext_t *dcontext)
     enter_couldbelinking(dcontext, NULL, false/*not a cache transition*/);
 }
 
+/* If the retired snapshot list has grown past -vmarea_max_retired_snapshots,
+ * adds an empty pending deletion entry at a new flushtime so that every
+ * retired snapshot is freed once all threads have passed a check point.
+ * Like move_lazy_list_to_pending_delete() this must become nolinking to
+ * pair the flushtime with a thread count, so the caller must hold no locks
+ * and accept the loss of its fragment pointers.
+ */
+void
+vm_area_check_retired_snapshots(dcontext_t *dcontext)
+{
+    bool perform_move = false;
+    if (todelete == NULL || !DYNAMO_OPTION(shared_deletion) ||
+        RUNNING_WITHOUT_CODE_CACHE() ||
+        /* racy read: an extra or a missed check is harmless */
+        todelete->retired_snapshot_count <=
+        INTERNAL_OPTION(vmarea_max_retired_snapshots))
+        return;
+    mutex_lock(&vmvector_retired_lock);
+    if (!todelete->snapshot_move_pending &&
+        todelete->retired_snapshot_count >
+        INTERNAL_OPTION(vmarea_max_retired_snapshots)) {
+        perform_move = true;
+        todelete->snapshot_move_pending = true;
+    }
+    mutex_unlock(&vmvector_retired_lock);
+    if (!perform_move)
+        return;
+
+    ASSERT_OWN_NO_LOCKS();
+    ASSERT(is_self_couldbelinking());
+    enter_nolinking(dcontext, NULL, false/*not a cache transition*/);
+    mutex_lock(&thread_initexit_lock);
+    mutex_lock(&shared_cache_flush_lock);
+    mutex_lock(&shared_delete_lock);
+    LOG(THREAD, LOG_VMAREAS, 3,
+        "adding a pending deletion entry to reclaim %d retired snapshots\n",
+        todelete->retired_snapshot_count);
+    STATS_INC(num_vmarea_snapshot_reclaims);
+    /* ensure all threads in ref count will actually check the queue; every
+     * snapshot retired so far has a flushtime at or below the new one
+     */
+    increment_global_flushtime();
+    add_to_pending_list(dcontext, NULL,
+                        /* we do count this thread, as we aren't checking the
+                         * pending list here or inc-ing our flushtime
+                         */
+                        get_num_threads(), flushtime_global
+                        _IF_DEBUG(NULL) _IF_DEBUG(NULL));
+    mutex_unlock(&shared_delete_lock);
+    mutex_unlock(&shared_cache_flush_lock);
+    mutex_unlock(&thread_initexit_lock);
+    mutex_lock(&vmvector_retired_lock);
+    todelete->snapshot_move_pending = false;
+    mutex_unlock(&vmvector_retired_lock);
+    enter_couldbelinking(dcontext, NULL, false/*not a cache transition*/);
+}
+
 /* adds the list of fragments beginning with f and chained by {next,prev}_vmarea
  * to a new pending-lazy-deletion entry.
  * This routine may become nolinking, meaning that fragments may be freed
@@ -9415,6 +9755,7 @@ vm_area_check_shared_pending(dcontext_t *dcontext, fragment_t *was_I_flushed)
          * (fcache unit flushing relies on this order).
          */
         check_lazy_deletion_list(dcontext, pend->flushtime_deleted);
+        vmvector_free_retired_snapshots(pend->flushtime_deleted);
         
         STATS_TRACK_MAX(num_shared_flush_maxdiff,
                         flushtime_global - pend->flushtime_deleted);
@@ -9426,7 +9767,7 @@ vm_area_check_shared_pending(dcontext_t *dcontext, fragment_t *was_I_flushed)
         LOG(THREAD, LOG_FRAGMENT|LOG_VMAREAS, 2,
             "\tdeleting all fragments in region "PFX".."PFX" flushtime %u\n",
             pend->start, pend->end, pend->flushtime_deleted);
-        ASSERT(pend->frags != NULL);
+        /* frags is NULL for an entry that only reclaims retired snapshots */
         for (entry = pend->frags; entry != NULL; entry = next) {
             next = FRAG_NEXT(entry);
             LOG(THREAD, LOG_FRAGMENT|LOG_VMAREAS, 5,
@@ -9473,6 +9814,7 @@ vm_area_check_shared_pending(dcontext_t *dcontext, fragment_t *was_I_flushed)
     
     if (dcontext == GLOBAL_DCONTEXT) { /* need to free everything */
         check_lazy_deletion_list(dcontext, flushtime_global+1);
+        vmvector_free_retired_snapshots(flushtime_global+1);
         fcache_free_pending_units(dcontext, flushtime_global+1);
         /* reset_every_nth_pending relies on this */
         ASSERT(todelete->shared_delete_count == 0);
@@ -11349,6 +11691,88 @@ vmvector_tests()
     vmvector_print(&v, STDERR);
 }
 
+/* Checks that lock-free snapshot lookups agree with locked lookups across
+ * adds, merges, and removes, and times both as a microbenchmark.
+ */
+# define SNAPSHOT_TEST_AREAS 512
+# define SNAPSHOT_TEST_STRIDE 0x2000
+# define SNAPSHOT_TEST_LOOKUPS 1000000
+
+static void
+check_snapshot_matches(vm_area_vector_t *v)
+{
+    ptr_uint_t addr;
+    bool locked, lockfree, ok;
+    for (addr = 0; addr < (SNAPSHOT_TEST_AREAS + 2) * SNAPSHOT_TEST_STRIDE;
+         addr += SNAPSHOT_TEST_STRIDE / 4) {
+        read_lock(&v->lock);
+        locked = vm_area_overlap(v, INT_TO_PC(addr), INT_TO_PC(addr + 1));
+        read_unlock(&v->lock);
+        ok = vmvector_snapshot_overlap(v, INT_TO_PC(addr), INT_TO_PC(addr + 1),
+                                       &lockfree);
+        EXPECT(ok, true);
+        EXPECT(lockfree, locked);
+    }
+}
+
+static void
+vmvector_snapshot_tests(void)
+{
+    vm_area_vector_t v = {0, 0, 0, VECTOR_SHARED | VECTOR_SNAPSHOT,
+                          INIT_READWRITE_LOCK(thread_vm_areas)};
+    uint64 start_time;
+    uint locked_ms, lockfree_ms;
+    bool found;
+    int i, hits = 0;
+    print_file(STDERR, "\nvm_area_vector_t snapshot tests\n");
+    for (i = 1; i <= SNAPSHOT_TEST_AREAS; i++) {
+        vmvector_add(&v, INT_TO_PC(i * SNAPSHOT_TEST_STRIDE),
+                     INT_TO_PC(i * SNAPSHOT_TEST_STRIDE + SNAPSHOT_TEST_STRIDE / 2),
+                     NULL);
+    }
+    EXPECT(v.snapshot != NULL, true);
+    EXPECT(v.snapshot->length, SNAPSHOT_TEST_AREAS);
+    check_snapshot_matches(&v);
+
+    /* merge a few and split a few */
+    vmvector_add(&v, INT_TO_PC(3 * SNAPSHOT_TEST_STRIDE),
+                 INT_TO_PC(6 * SNAPSHOT_TEST_STRIDE), NULL);
+    vmvector_remove(&v, INT_TO_PC(10 * SNAPSHOT_TEST_STRIDE + 0x100),
+                    INT_TO_PC(10 * SNAPSHOT_TEST_STRIDE + 0x200));
+    vmvector_remove(&v, INT_TO_PC(20 * SNAPSHOT_TEST_STRIDE),
+                    INT_TO_PC(30 * SNAPSHOT_TEST_STRIDE));
+    EXPECT(v.snapshot->length, v.length);
+    check_snapshot_matches(&v);
+
+    start_time = query_time_millis();
+    for (i = 0; i < SNAPSHOT_TEST_LOOKUPS; i++) {
+        read_lock(&v.lock);
+        if (vm_area_overlap(&v, INT_TO_PC((i * 0x1235) & 0x3fffff),
+                            INT_TO_PC(((i * 0x1235) & 0x3fffff) + 1)))
+            hits++;
+        read_unlock(&v.lock);
+    }
+    locked_ms = (uint) (query_time_millis() - start_time);
+    start_time = query_time_millis();
+    for (i = 0; i < SNAPSHOT_TEST_LOOKUPS; i++) {
+        vmvector_snapshot_overlap(&v, INT_TO_PC((i * 0x1235) & 0x3fffff),
+                                  INT_TO_PC(((i * 0x1235) & 0x3fffff) + 1), &found);
+        if (found)
+            hits--;
+    }
+    lockfree_ms = (uint) (query_time_millis() - start_time);
+    EXPECT(hits, 0);
+    print_file(STDERR, "%d lookups in %d areas: locked %d ms, snapshot %d ms\n",
+               SNAPSHOT_TEST_LOOKUPS, v.length, locked_ms, lockfree_ms);
+
+    vmvector_remove(&v, INT_TO_PC(0), UNIVERSAL_REGION_END);
+    EXPECT(v.snapshot->length, 0);
+    check_snapshot_matches(&v);
+    vmvector_reset_vector(GLOBAL_DCONTEXT, &v);
+    EXPECT(v.snapshot == NULL, true);
+    DELETE_READWRITE_LOCK(v.lock);
+}
+
 /* initial vector tests
  * FIXME: should add a lot more, esp. wrt other flags -- these only
  * test no flags or interactions w/ selfmod flag
@@ -11470,5 +11894,6 @@ unit_test_vmareas(void)
     check_vec(&v, 2, INT_TO_PC(3), INT_TO_PC(4), 0, 0, NULL);
 
     vmvector_tests();
+    vmvector_snapshot_tests();
 }
 #endif  /* STANDALONE_UNIT_TEST */
@@ -67,6 +67,10 @@ enum {
      * flag to avoid the redundant vector-level lock
      */
     VECTOR_NO_LOCK       = 0x0010,
+    /* maintain an immutable copy of the area bounds that hot readers can
+     * search without acquiring the vector lock
+     */
+    VECTOR_SNAPSHOT      = 0x0020,
 };
 
 #define VECTOR_NEVER_MERGE (VECTOR_NEVER_MERGE_ADJACENT | VECTOR_NEVER_OVERLAP)
@@ -111,6 +115,14 @@ struct vm_area_vector_t {
      * If non-NULL, the free_payload_func will NOT be called.
      */
     void *(*merge_payload_func)(void *dst, void *src);
+
+    /* For VECTOR_SNAPSHOT vectors: a read-only copy of the current bounds,
+     * replaced wholesale on every change while holding the write lock.
+     * Readers load this pointer once and binary search it with no lock;
+     * a replaced copy is only freed once every thread has passed a
+     * shared deletion check point (see vm_area_check_shared_pending()).
+     */
+    struct vmvector_snapshot_t *snapshot;
 }; /* typedef-ed in globals.h */
 
 /* vm_area_vectors should NOT be declared statically if their locks need to be
@@ -138,6 +150,13 @@ extern vm_area_vector_t *patch_proof_areas;
  * native_exec_areas - note the exact regions are added here */
 extern vm_area_vector_t *IAT_areas; 
 
+#ifdef INTERNAL
+/* read-only memory that optimized traces have folded loads from */
+extern vm_area_vector_t *const_load_areas;
+/* flushtime_global that the most recent flush of const_load_areas reaches */
+extern uint const_load_flushtime;
+#endif
+
 extern mutex_t shared_delete_lock;
 
 /* operations on the opaque vector struct */
@@ -720,6 +739,13 @@ vm_area_allsynch_flush_fragments(dcontext_t *dcontext, dcontext_t *del_dcontext,
                                  app_pc start, app_pc end, bool exec_invalid,
                                  bool all_synched);
 
+/* Adds an empty pending deletion entry if too many replaced vmarea snapshots
+ * are waiting to be freed.  May become nolinking, so the caller must hold no
+ * locks and invalidate its fragment pointers.
+ */
+void
+vm_area_check_retired_snapshots(dcontext_t *dcontext);
+
 /* adds the list of fragments beginning with f and chained by {next,prev}_vmarea
  * to a new pending-lazy-deletion entry
  */
@@ -305,6 +305,7 @@ emit_detach_callback_final_jmp(dcontext_t *dcontext,
 #  define ATOMIC_COMPARE_EXCHANGE_PTR ATOMIC_COMPARE_EXCHANGE_int
 # endif
 # define SPINLOCK_PAUSE() _mm_pause() /* PAUSE = 0xf3 0x90 = repz nop */
+# define MEMORY_BARRIER() _mm_mfence()
 # define RDTSC_LL(var) (var = __rdtsc())
 # define SERIALIZE_INSTRUCTIONS() do { \
         int cpuid_res_local[4];        \
@@ -420,6 +421,7 @@ static inline int64 atomic_add_exchange_int64(volatile int64 *var, int64 value)
                       : "0" (newval), "m" (var))
 
 # define SPINLOCK_PAUSE()   __asm__ __volatile__("pause")
+# define MEMORY_BARRIER() __asm__ __volatile__("mfence" : : : "memory")
 # define RDTSC_LL(llval)                        \
     __asm__ __volatile__                        \
     ("rdtsc" : "=A" (llval))
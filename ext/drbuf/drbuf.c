@@ -0,0 +1,653 @@
+/* **********************************************************
+ * Copyright (c) 2013 Google, Inc.   All rights reserved.
+ * **********************************************************/
+
+/* drbuf: DynamoRIO Trace Buffer Extension
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;
+ * version 2.1 of the License, and no later version.
+
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Library General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* DynamoRIO Trace Buffer Extension: per-thread record buffers filled by
+ * inline instrumentation, with an inline bounds check calling out to hand
+ * off a full buffer.
+ */
+
+#include "dr_api.h"
+#include "drmgr.h"
+#include "drbuf.h"
+#include <string.h> /* memset */
+
+/* currently using asserts on internal logic sanity checks (never on
+ * input from user)
+ */
+#ifdef DEBUG
+# define ASSERT(x, msg) DR_ASSERT_MSG(x, msg)
+#else
+# define ASSERT(x, msg) /* nothing */
+#endif
+
+#define ALIGN_FORWARD(x, alignment) \
+    ((((ptr_uint_t)x) + ((alignment)-1)) & (~((alignment)-1)))
+
+#define PRE instrlist_meta_preinsert
+
+/* Largest word-aligned record whose size is a modified immediate: an 8-bit
+ * value shifted left by 2, so the add advancing the pointer is one instr.
+ */
+#define MAX_RECORD_SIZE 1020
+
+/* The TLS slots of a buffer: the current thread's buffer pointer, and the
+ * end of its buffer for the bounds check.
+ */
+enum {
+    BUF_PTR_SLOT,
+    BUF_END_SLOT,
+    NUM_TLS_SLOTS,
+};
+
+/* How long the writer thread sleeps when it finds no full buffers */
+#define WRITER_POLL_MS 1
+
+/* How long drbuf_free() waits for the writer thread to finish its current
+ * buffer.  At process exit DR has already stopped client threads.
+ */
+#define WRITER_EXIT_WAIT_MS 500
+
+/* One buffer's worth of records */
+typedef struct _chunk_t {
+    byte *alloc;
+    size_t used; /* bytes filled, once handed to the writer */
+    struct _chunk_t *next;
+} chunk_t;
+
+struct _drbuf_t {
+    size_t record_size;
+    size_t size;       /* bytes of records in each chunk */
+    size_t alloc_size;
+    drbuf_full_cb_t full_cb;
+    int tls_idx;
+    reg_id_t tls_seg;
+    uint tls_offs;
+
+    /* writer thread state, all protected by lock */
+    bool use_writer;
+    void *lock;
+    chunk_t *full;       /* queue of buffers for the writer, oldest first */
+    chunk_t *full_tail;
+    chunk_t *spare;      /* buffers the writer has finished with */
+    volatile bool writer_exit;
+    volatile bool writer_done;
+    /* drbuf_free() gave up waiting: the writer frees buf when it finishes */
+    bool writer_frees;
+
+    struct _drbuf_t *next;
+};
+
+typedef struct _per_thread_t {
+    chunk_t *cur;
+    /* what buf->tls_offs is relative to: DR's TLS base, or else slots less
+     * tls_offs
+     */
+    byte *seg_base;
+    /* whether DR's TLS base is installed in TPIDRURW for this thread */
+    bool tls_in_tpidrurw;
+    /* our own slots, when DR has no TLS base to put them in */
+    byte *slots[NUM_TLS_SLOTS];
+} per_thread_t;
+
+static int drbuf_init_count;
+
+/* all buffers, for thread events */
+static drbuf_t *buf_list;
+static void *buf_list_lock;
+
+/***************************************************************************
+ * CHUNKS
+ */
+
+static byte *
+chunk_base(drbuf_t *buf, chunk_t *chunk)
+{
+    return chunk->alloc;
+}
+
+static byte *
+chunk_end(drbuf_t *buf, chunk_t *chunk)
+{
+    return chunk->alloc + buf->size;
+}
+
+static chunk_t *
+chunk_create(drbuf_t *buf)
+{
+    chunk_t *chunk = (chunk_t *) dr_global_alloc(sizeof(*chunk));
+    chunk->alloc = (byte *) dr_raw_mem_alloc(buf->alloc_size,
+                                             DR_MEMPROT_READ | DR_MEMPROT_WRITE,
+                                             NULL);
+    if (chunk->alloc == NULL) {
+        dr_global_free(chunk, sizeof(*chunk));
+        return NULL;
+    }
+    chunk->used = 0;
+    chunk->next = NULL;
+    return chunk;
+}
+
+static void
+chunk_destroy(drbuf_t *buf, chunk_t *chunk)
+{
+    dr_raw_mem_free(chunk->alloc, buf->alloc_size);
+    dr_global_free(chunk, sizeof(*chunk));
+}
+
+/* Returns a spare buffer from the writer, or a new one */
+static chunk_t *
+chunk_get(drbuf_t *buf)
+{
+    chunk_t *chunk = NULL;
+    if (buf->use_writer) {
+        dr_mutex_lock(buf->lock);
+        chunk = buf->spare;
+        if (chunk != NULL)
+            buf->spare = chunk->next;
+        dr_mutex_unlock(buf->lock);
+    }
+    if (chunk == NULL)
+        return chunk_create(buf);
+    chunk->used = 0;
+    chunk->next = NULL;
+    return chunk;
+}
+
+static byte **
+thread_buf_slot(drbuf_t *buf, per_thread_t *pt, uint slot)
+{
+    return (byte **) (pt->seg_base + buf->tls_offs + slot*sizeof(void *));
+}
+
+static byte **
+thread_buf_ptr(drbuf_t *buf, per_thread_t *pt)
+{
+    return thread_buf_slot(buf, pt, BUF_PTR_SLOT);
+}
+
+/* Points the thread's TLS at the start and end of its current buffer */
+static void
+thread_buf_reset(drbuf_t *buf, per_thread_t *pt)
+{
+    *thread_buf_ptr(buf, pt) = chunk_base(buf, pt->cur);
+    *thread_buf_slot(buf, pt, BUF_END_SLOT) = chunk_end(buf, pt->cur);
+}
+
+/* Hands off the first used bytes of the thread's current buffer, and leaves
+ * the thread with an empty buffer unless exiting.
+ */
+static void
+deliver(void *drcontext, drbuf_t *buf, per_thread_t *pt, size_t used, bool exiting)
+{
+    chunk_t *chunk = pt->cur;
+    if (!buf->use_writer) {
+        if (used > 0)
+            buf->full_cb(drcontext, chunk_base(buf, chunk), used);
+        if (exiting) {
+            chunk_destroy(buf, chunk);
+            pt->cur = NULL;
+        }
+    } else {
+        if (used > 0 || !exiting) {
+            chunk->used = used;
+            chunk->next = NULL;
+            dr_mutex_lock(buf->lock);
+            if (buf->full_tail == NULL)
+                buf->full = chunk;
+            else
+                buf->full_tail->next = chunk;
+            buf->full_tail = chunk;
+            dr_mutex_unlock(buf->lock);
+        } else
+            chunk_destroy(buf, chunk);
+        pt->cur = exiting ? NULL : chunk_get(buf);
+        /* XXX: if we cannot get a fresh buffer we have nowhere to write */
+        DR_ASSERT(exiting || pt->cur != NULL);
+    }
+    if (pt->cur != NULL)
+        thread_buf_reset(buf, pt);
+}
+
+/* Frees buf and every buffer it still holds.  Any data must already have
+ * been passed to the callback.
+ */
+static void
+buffer_destroy(drbuf_t *buf)
+{
+    chunk_t *chunk, *next;
+    for (chunk = buf->full; chunk != NULL; chunk = next) {
+        next = chunk->next;
+        chunk_destroy(buf, chunk);
+    }
+    for (chunk = buf->spare; chunk != NULL; chunk = next) {
+        next = chunk->next;
+        chunk_destroy(buf, chunk);
+    }
+    drmgr_unregister_tls_field(buf->tls_idx);
+    dr_raw_tls_cfree(buf->tls_offs, NUM_TLS_SLOTS);
+    dr_mutex_destroy(buf->lock);
+    dr_global_free(buf, sizeof(*buf));
+}
+
+/***************************************************************************
+ * WRITER THREAD
+ */
+
+static void
+writer_thread(void *arg)
+{
+    drbuf_t *buf = (drbuf_t *) arg;
+    void *drcontext = dr_get_current_drcontext();
+    chunk_t *chunk;
+    bool frees;
+    while (!buf->writer_exit) {
+        dr_mutex_lock(buf->lock);
+        chunk = buf->full;
+        if (chunk != NULL) {
+            buf->full = chunk->next;
+            if (buf->full == NULL)
+                buf->full_tail = NULL;
+        }
+        dr_mutex_unlock(buf->lock);
+        if (chunk == NULL) {
+            dr_sleep(WRITER_POLL_MS);
+            continue;
+        }
+        if (chunk->used > 0)
+            buf->full_cb(drcontext, chunk_base(buf, chunk), chunk->used);
+        dr_mutex_lock(buf->lock);
+        chunk->next = buf->spare;
+        buf->spare = chunk;
+        dr_mutex_unlock(buf->lock);
+    }
+    dr_mutex_lock(buf->lock);
+    buf->writer_done = true;
+    frees = buf->writer_frees;
+    dr_mutex_unlock(buf->lock);
+    if (frees)
+        buffer_destroy(buf);
+}
+
+/***************************************************************************
+ * FULL BUFFERS
+ */
+
+/* Clean call target of the bounds check in drbuf_insert_update_buf_ptr():
+ * the pointer just written back has reached the end of the buffer.
+ */
+static void
+buffer_full(drbuf_t *buf)
+{
+    void *drcontext = dr_get_current_drcontext();
+    per_thread_t *pt = (per_thread_t *) drmgr_get_tls_field(drcontext, buf->tls_idx);
+    deliver(drcontext, buf, pt, *thread_buf_ptr(buf, pt) - chunk_base(buf, pt->cur),
+            false);
+}
+
+/***************************************************************************
+ * THREADS
+ */
+
+static void
+drbuf_thread_init(void *drcontext)
+{
+    drbuf_t *buf;
+    dr_mutex_lock(buf_list_lock);
+    for (buf = buf_list; buf != NULL; buf = buf->next) {
+        per_thread_t *pt = (per_thread_t *) dr_thread_alloc(drcontext, sizeof(*pt));
+        pt->seg_base = (byte *) dr_get_dr_segment_base(buf->tls_seg);
+        pt->tls_in_tpidrurw = (pt->seg_base != (byte *)(ptr_int_t)-1);
+        if (!pt->tls_in_tpidrurw)
+            pt->seg_base = (byte *) pt->slots - buf->tls_offs;
+        pt->cur = chunk_get(buf);
+        DR_ASSERT(pt->cur != NULL);
+        thread_buf_reset(buf, pt);
+        drmgr_set_tls_field(drcontext, buf->tls_idx, (void *) pt);
+    }
+    dr_mutex_unlock(buf_list_lock);
+}
+
+static void
+drbuf_thread_exit(void *drcontext)
+{
+    drbuf_t *buf;
+    dr_mutex_lock(buf_list_lock);
+    for (buf = buf_list; buf != NULL; buf = buf->next) {
+        per_thread_t *pt = (per_thread_t *) drmgr_get_tls_field(drcontext, buf->tls_idx);
+        if (pt == NULL)
+            continue;
+        if (pt->cur != NULL) {
+            deliver(drcontext, buf, pt,
+                    *thread_buf_ptr(buf, pt) - chunk_base(buf, pt->cur), true);
+        }
+        dr_thread_free(drcontext, pt, sizeof(*pt));
+        drmgr_set_tls_field(drcontext, buf->tls_idx, NULL);
+    }
+    dr_mutex_unlock(buf_list_lock);
+}
+
+/***************************************************************************
+ * INIT
+ */
+
+DR_EXPORT
+bool
+drbuf_init(void)
+{
+    /* handle multiple sets of init/exit calls */
+    int count = dr_atomic_add32_return_sum(&drbuf_init_count, 1);
+    if (count > 1)
+        return true;
+
+    drmgr_init();
+    buf_list_lock = dr_mutex_create();
+    if (!drmgr_register_thread_init_event(drbuf_thread_init) ||
+        !drmgr_register_thread_exit_event(drbuf_thread_exit))
+        return false;
+    return true;
+}
+
+DR_EXPORT
+void
+drbuf_exit(void)
+{
+    /* handle multiple sets of init/exit calls */
+    int count = dr_atomic_add32_return_sum(&drbuf_init_count, -1);
+    if (count != 0)
+        return;
+
+    ASSERT(buf_list == NULL, "drbuf_free not called on all buffers");
+    drmgr_unregister_thread_init_event(drbuf_thread_init);
+    drmgr_unregister_thread_exit_event(drbuf_thread_exit);
+    dr_mutex_destroy(buf_list_lock);
+    drmgr_exit();
+}
+
+/***************************************************************************
+ * BUFFERS
+ */
+
+static drbuf_t *
+create_buffer(size_t record_size, size_t num_records, drbuf_full_cb_t full_cb,
+              bool use_writer)
+{
+    drbuf_t *buf;
+    size_t size = record_size * num_records;
+
+    if (record_size == 0 || record_size > MAX_RECORD_SIZE ||
+        (record_size & (sizeof(reg_t) - 1)) != 0 || num_records == 0 ||
+        full_cb == NULL)
+        return NULL;
+
+    buf = (drbuf_t *) dr_global_alloc(sizeof(*buf));
+    memset(buf, 0, sizeof(*buf));
+    buf->record_size = record_size;
+    buf->size = size;
+    buf->alloc_size = ALIGN_FORWARD(size, PAGE_SIZE);
+    buf->full_cb = full_cb;
+    buf->use_writer = use_writer;
+    buf->lock = dr_mutex_create();
+
+    buf->tls_idx = drmgr_register_tls_field();
+    if (buf->tls_idx == -1 ||
+        !dr_raw_tls_calloc(&buf->tls_seg, &buf->tls_offs, NUM_TLS_SLOTS, 0)) {
+        if (buf->tls_idx != -1)
+            drmgr_unregister_tls_field(buf->tls_idx);
+        dr_mutex_destroy(buf->lock);
+        dr_global_free(buf, sizeof(*buf));
+        return NULL;
+    }
+    /* without a TLS base our slots are named by per-thread constants */
+    if (dr_get_dr_segment_base(buf->tls_seg) == (byte *)(ptr_int_t)-1 &&
+        !dr_using_all_private_caches()) {
+        dr_raw_tls_cfree(buf->tls_offs, NUM_TLS_SLOTS);
+        drmgr_unregister_tls_field(buf->tls_idx);
+        dr_mutex_destroy(buf->lock);
+        dr_global_free(buf, sizeof(*buf));
+        return NULL;
+    }
+
+    if (use_writer && !dr_create_client_thread(writer_thread, buf)) {
+        dr_raw_tls_cfree(buf->tls_offs, NUM_TLS_SLOTS);
+        drmgr_unregister_tls_field(buf->tls_idx);
+        dr_mutex_destroy(buf->lock);
+        dr_global_free(buf, sizeof(*buf));
+        return NULL;
+    }
+
+    dr_mutex_lock(buf_list_lock);
+    buf->next = buf_list;
+    buf_list = buf;
+    dr_mutex_unlock(buf_list_lock);
+    return buf;
+}
+
+DR_EXPORT
+drbuf_t *
+drbuf_create_buffer(size_t record_size, size_t num_records, drbuf_full_cb_t full_cb)
+{
+    return create_buffer(record_size, num_records, full_cb, false);
+}
+
+DR_EXPORT
+drbuf_t *
+drbuf_create_writer_buffer(size_t record_size, size_t num_records,
+                           drbuf_full_cb_t writer_cb)
+{
+    return create_buffer(record_size, num_records, writer_cb, true);
+}
+
+DR_EXPORT
+bool
+drbuf_free(drbuf_t *buf)
+{
+    drbuf_t *prev;
+    chunk_t *chunk, *next, *full;
+    void *drcontext = dr_get_current_drcontext();
+    int waited;
+
+    if (buf == NULL)
+        return false;
+    dr_mutex_lock(buf_list_lock);
+    if (buf_list == buf)
+        buf_list = buf->next;
+    else {
+        for (prev = buf_list; prev != NULL && prev->next != buf; prev = prev->next)
+            ; /* nothing */
+        if (prev == NULL) {
+            dr_mutex_unlock(buf_list_lock);
+            return false;
+        }
+        prev->next = buf->next;
+    }
+    dr_mutex_unlock(buf_list_lock);
+
+    if (buf->use_writer) {
+        bool frees;
+        buf->writer_exit = true;
+        for (waited = 0; !buf->writer_done && waited < WRITER_EXIT_WAIT_MS;
+             waited += WRITER_POLL_MS)
+            dr_sleep(WRITER_POLL_MS);
+        /* Anything still queued, e.g. from threads exiting with the process,
+         * is ours to pass on.  A writer still in its callback owns buf from
+         * here and frees it when it returns.
+         */
+        dr_mutex_lock(buf->lock);
+        full = buf->full;
+        buf->full = NULL;
+        buf->full_tail = NULL;
+        buf->writer_frees = !buf->writer_done;
+        frees = buf->writer_frees;
+        dr_mutex_unlock(buf->lock);
+        for (chunk = full; chunk != NULL; chunk = next) {
+            next = chunk->next;
+            if (chunk->used > 0)
+                buf->full_cb(drcontext, chunk_base(buf, chunk), chunk->used);
+            chunk_destroy(buf, chunk);
+        }
+        if (frees)
+            return true;
+    }
+    buffer_destroy(buf);
+    return true;
+}
+
+DR_EXPORT
+void *
+drbuf_get_buffer_base(void *drcontext, drbuf_t *buf)
+{
+    per_thread_t *pt = (per_thread_t *) drmgr_get_tls_field(drcontext, buf->tls_idx);
+    return chunk_base(buf, pt->cur);
+}
+
+DR_EXPORT
+void *
+drbuf_get_buffer_ptr(void *drcontext, drbuf_t *buf)
+{
+    per_thread_t *pt = (per_thread_t *) drmgr_get_tls_field(drcontext, buf->tls_idx);
+    return *thread_buf_ptr(buf, pt);
+}
+
+/***************************************************************************
+ * INSTRUMENTATION
+ */
+
+/* Loads or stores reg at the given TLS slot of buf, whose base is in base */
+static instr_t *
+create_slot_access(void *drcontext, drbuf_t *buf, bool store, reg_id_t reg,
+                   reg_id_t base, uint slot)
+{
+    instr_t *access;
+    opnd_t mem = opnd_create_mem_reg(base);
+    opnd_t offs = OPND_CREATE_IMM12(buf->tls_offs + slot*sizeof(void *));
+    if (store)
+        access = INSTR_CREATE_str_imm(drcontext, opnd_create_reg(reg), mem, offs,
+                                      COND_ALWAYS);
+    else
+        access = INSTR_CREATE_ldr_imm(drcontext, opnd_create_reg(reg), mem, offs,
+                                      COND_ALWAYS);
+    /* pre-indexed, positive offset, no writeback */
+    instr_set_p_flag(drcontext, access, true);
+    instr_set_u_flag(drcontext, access, true);
+    instr_set_w_flag(drcontext, access, false);
+    return access;
+}
+
+/* DR's TLS base lives in TPIDRURW only if DR was built with HAVE_TLS.
+ * Otherwise the register holds whatever the app put there, and we name the
+ * thread's own slots by their address, which is safe because without a TLS
+ * base DR keeps every code cache thread-private (checked in create_buffer()).
+ */
+static void
+insert_load_tls_base(void *drcontext, drbuf_t *buf, instrlist_t *ilist,
+                     instr_t *where, reg_id_t base)
+{
+    per_thread_t *pt = (per_thread_t *) drmgr_get_tls_field(drcontext, buf->tls_idx);
+    uint addr = (uint)(ptr_uint_t) pt->seg_base;
+    uint imm12;
+    int shift;
+    if (pt->tls_in_tpidrurw) {
+        PRE(ilist, where, INSTR_CREATE_mrc(drcontext, opnd_create_reg(base),
+                                           opnd_create_reg(DR_REG_TPIDRURW),
+                                           COND_ALWAYS));
+        return;
+    }
+    opnd_encode_modified_imm(addr & 0xff000000, &imm12);
+    PRE(ilist, where, INSTR_CREATE_mov_imm(drcontext, opnd_create_reg(base),
+                                           OPND_CREATE_IMM12(imm12), COND_ALWAYS));
+    for (shift = 16; shift >= 0; shift -= 8) {
+        if ((addr & (0xffU << shift)) == 0)
+            continue;
+        opnd_encode_modified_imm(addr & (0xffU << shift), &imm12);
+        PRE(ilist, where, INSTR_CREATE_orr_imm(drcontext, opnd_create_reg(base),
+                                               opnd_create_reg(base),
+                                               OPND_CREATE_IMM12(imm12), COND_ALWAYS));
+    }
+}
+
+DR_EXPORT
+void
+drbuf_insert_load_buf_ptr(void *drcontext, drbuf_t *buf, instrlist_t *ilist,
+                          instr_t *where, reg_id_t buf_ptr)
+{
+    insert_load_tls_base(drcontext, buf, ilist, where, buf_ptr);
+    PRE(ilist, where, create_slot_access(drcontext, buf, false, buf_ptr, buf_ptr,
+                                         BUF_PTR_SLOT));
+}
+
+DR_EXPORT
+bool
+drbuf_insert_buf_store(void *drcontext, drbuf_t *buf, instrlist_t *ilist,
+                       instr_t *where, reg_id_t buf_ptr, reg_id_t src,
+                       opnd_size_t opsz, ushort offset)
+{
+    instr_t *store;
+    if (offset >= buf->record_size)
+        return false;
+    if (opsz == OPSZ_4) {
+        store = INSTR_CREATE_str_imm(drcontext, opnd_create_reg(src),
+                                     opnd_create_mem_reg(buf_ptr),
+                                     OPND_CREATE_IMM12(offset), COND_ALWAYS);
+    } else if (opsz == OPSZ_1) {
+        store = INSTR_CREATE_strb_imm(drcontext, opnd_create_reg(src),
+                                      opnd_create_mem_reg(buf_ptr),
+                                      OPND_CREATE_IMM12(offset), COND_ALWAYS);
+    } else
+        return false;
+    /* pre-indexed, positive offset, no writeback */
+    instr_set_p_flag(drcontext, store, true);
+    instr_set_u_flag(drcontext, store, true);
+    instr_set_w_flag(drcontext, store, false);
+    PRE(ilist, where, store);
+    return true;
+}
+
+DR_EXPORT
+bool
+drbuf_insert_update_buf_ptr(void *drcontext, drbuf_t *buf, instrlist_t *ilist,
+                            instr_t *where, reg_id_t buf_ptr, reg_id_t scratch)
+{
+    instr_t *check, *not_full;
+    uint imm12;
+    if (scratch == buf_ptr || !opnd_encode_modified_imm(buf->record_size, &imm12))
+        return false;
+    not_full = INSTR_CREATE_label(drcontext);
+    PRE(ilist, where, INSTR_CREATE_add_imm(drcontext, opnd_create_reg(buf_ptr),
+                                           opnd_create_reg(buf_ptr),
+                                           OPND_CREATE_IMM12(imm12), COND_ALWAYS));
+    insert_load_tls_base(drcontext, buf, ilist, where, scratch);
+    PRE(ilist, where, create_slot_access(drcontext, buf, true, buf_ptr, scratch,
+                                         BUF_PTR_SLOT));
+    PRE(ilist, where, create_slot_access(drcontext, buf, false, scratch, scratch,
+                                         BUF_END_SLOT));
+    /* the carry is set when buf_ptr has reached the end */
+    check = INSTR_CREATE_sub_reg(drcontext, opnd_create_reg(scratch),
+                                 opnd_create_reg(buf_ptr), opnd_create_reg(scratch),
+                                 OPND_CREATE_IMM5(0), COND_ALWAYS);
+    instr_set_s_flag(drcontext, check, true);
+    PRE(ilist, where, check);
+    PRE(ilist, where, INSTR_CREATE_b(drcontext, opnd_create_instr(not_full),
+                                     COND_CARRY_CLEAR));
+    dr_insert_clean_call(drcontext, ilist, where, (void *) buffer_full, false, 1,
+                         OPND_CREATE_INTPTR(buf));
+    PRE(ilist, where, not_full);
+    return true;
+}
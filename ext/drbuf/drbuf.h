@@ -0,0 +1,187 @@
+/* **********************************************************
+ * Copyright (c) 2013 Google, Inc.   All rights reserved.
+ * **********************************************************/
+
+/* drbuf: DynamoRIO Trace Buffer Extension
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;
+ * version 2.1 of the License, and no later version.
+
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Library General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* DynamoRIO Trace Buffer Extension */
+
+#ifndef _DRBUF_H_
+#define _DRBUF_H_ 1
+
+/**
+ * @file drbuf.h
+ * @brief Header for DynamoRIO Trace Buffer Extension
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * \addtogroup drbuf Trace Buffers
+ */
+/*@{*/ /* begin doxygen group */
+
+/** Opaque handle to a trace buffer. */
+typedef struct _drbuf_t drbuf_t;
+
+/**
+ * Callback that receives a filled buffer.  \p buf_base is the first record
+ * and \p size the number of bytes filled, which is the full capacity of the
+ * buffer except when flushing at thread exit.  The buffer is reused once the
+ * callback returns, so any data to be kept must be copied out.
+ */
+typedef void (*drbuf_full_cb_t)(void *drcontext, void *buf_base, size_t size);
+
+/***************************************************************************
+ * INIT
+ */
+
+DR_EXPORT
+/**
+ * Initializes the drbuf extension.  Must be called prior to any of the
+ * other routines, and prior to any thread being created.  Can be called
+ * multiple times (by separate components, normally) but each call must be
+ * paired with a corresponding call to drbuf_exit().
+ *
+ * drbuf initializes drmgr.
+ *
+ * \return whether successful.
+ */
+bool
+drbuf_init(void);
+
+DR_EXPORT
+/**
+ * Cleans up the drbuf extension.
+ */
+void
+drbuf_exit(void);
+
+/***************************************************************************
+ * BUFFERS
+ */
+
+DR_EXPORT
+/**
+ * Creates a per-thread buffer holding \p num_records records of \p
+ * record_size bytes each.  \p record_size must be a non-zero multiple of 4
+ * no larger than 1020 so that the buffer pointer can be advanced with a
+ * single add.  Must be called prior to any thread being created.
+ *
+ * When drbuf_insert_update_buf_ptr() advances the buffer pointer to the
+ * end of the buffer, drbuf calls \p full_cb in the filling thread and
+ * resets the buffer.  \p full_cb is also called with any partially filled
+ * buffer at thread exit.
+ *
+ * \return the new buffer, or NULL on failure.
+ */
+drbuf_t *
+drbuf_create_buffer(size_t record_size, size_t num_records, drbuf_full_cb_t full_cb);
+
+DR_EXPORT
+/**
+ * Identical to drbuf_create_buffer() except that full buffers are handed
+ * to a single writer thread shared by all application threads, which
+ * calls \p writer_cb with its own \p drcontext.  The filling thread
+ * continues immediately with a fresh buffer, so the cost of processing
+ * the data is taken off the application threads.  Buffers flushed at
+ * process exit are passed to \p writer_cb by drbuf_free().
+ *
+ * \return the new buffer, or NULL on failure.
+ */
+drbuf_t *
+drbuf_create_writer_buffer(size_t record_size, size_t num_records,
+                           drbuf_full_cb_t writer_cb);
+
+DR_EXPORT
+/**
+ * Destroys \p buf, passing any data not yet processed to its callback.
+ * Should be called from the client's exit event.
+ *
+ * \return whether successful.
+ */
+bool
+drbuf_free(drbuf_t *buf);
+
+DR_EXPORT
+/**
+ * Returns the first record of the current thread's buffer for \p buf.
+ */
+void *
+drbuf_get_buffer_base(void *drcontext, drbuf_t *buf);
+
+DR_EXPORT
+/**
+ * Returns the current thread's buffer pointer for \p buf: the address of
+ * the next record to be filled.  Intended for use from clean calls.
+ */
+void *
+drbuf_get_buffer_ptr(void *drcontext, drbuf_t *buf);
+
+/***************************************************************************
+ * INSTRUMENTATION
+ */
+
+DR_EXPORT
+/**
+ * Inserts a meta instruction prior to \p where that loads the current
+ * thread's buffer pointer for \p buf into \p buf_ptr.
+ */
+void
+drbuf_insert_load_buf_ptr(void *drcontext, drbuf_t *buf, instrlist_t *ilist,
+                          instr_t *where, reg_id_t buf_ptr);
+
+DR_EXPORT
+/**
+ * Inserts a meta instruction prior to \p where that stores \p src to
+ * offset \p offset of the record at \p buf_ptr, which must hold the value
+ * loaded by drbuf_insert_load_buf_ptr().  \p opsz must be OPSZ_1 or
+ * OPSZ_4 and \p offset must be less than the record size.
+ *
+ * \return whether successful.
+ */
+bool
+drbuf_insert_buf_store(void *drcontext, drbuf_t *buf, instrlist_t *ilist,
+                       instr_t *where, reg_id_t buf_ptr, reg_id_t src,
+                       opnd_size_t opsz, ushort offset);
+
+DR_EXPORT
+/**
+ * Inserts meta instructions prior to \p where that advance \p buf_ptr by
+ * one record, write it back as the current thread's buffer pointer, and
+ * compare it against the end of the buffer, calling out to hand off the
+ * buffer when it is full.  \p buf_ptr must be reloaded with
+ * drbuf_insert_load_buf_ptr() before the next record.  Clobbers \p
+ * scratch, which must differ from \p buf_ptr, and the arithmetic flags,
+ * which the caller must have reserved (e.g., with drreg_reserve_aflags()).
+ *
+ * \return whether successful.
+ */
+bool
+drbuf_insert_update_buf_ptr(void *drcontext, drbuf_t *buf, instrlist_t *ilist,
+                            instr_t *where, reg_id_t buf_ptr, reg_id_t scratch);
+
+/*@}*/ /* end doxygen group */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _DRBUF_H_ */
@@ -206,17 +206,15 @@ drtable_destroy(void *tab, void *user_data)
     dr_global_free(table, sizeof(*table));
 }
 
-void *
-drtable_alloc(void *tab, ptr_uint_t num_entries, ptr_uint_t *idx_ptr)
+/* caller must hold the lock */
+static void *
+drtable_alloc_internal(drtable_t *table, ptr_uint_t num_entries, ptr_uint_t *idx_ptr,
+                       drtable_chunk_t **chunk_out OUT)
 {
     void *entry;
-    drtable_t *table = (drtable_t *)tab;
     drtable_chunk_t *chunk;
     int i;
 
-    DR_ASSERT(table != NULL && table->magic == DRTABLE_MAGIC);
-    if (table->synch)
-        drtable_lock(table);
     /* 1. find a chunk for holding entries */
     /* check last chunk */
     chunk = table->last_chunk;
@@ -237,8 +235,6 @@ drtable_alloc(void *tab, ptr_uint_t num_entries, ptr_uint_t *idx_ptr)
         table->last_chunk = drtable_chunk_create(table, num_entries);
         chunk = table->last_chunk;
         if (chunk == NULL) {
-            if (table->synch)
-                drtable_unlock(table);
             if (idx_ptr != NULL)
                 *idx_ptr = DRTABLE_INVALID_INDEX;
             return NULL;
@@ -254,12 +250,127 @@ drtable_alloc(void *tab, ptr_uint_t num_entries, ptr_uint_t *idx_ptr)
     DR_ASSERT(chunk->entries <= chunk->capacity);
     table->entries += num_entries;
     DR_ASSERT(table->entries <= table->capacity);
+    if (chunk_out != NULL)
+        *chunk_out = chunk;
+    return entry;
+}
+
+void *
+drtable_alloc(void *tab, ptr_uint_t num_entries, ptr_uint_t *idx_ptr)
+{
+    void *entry;
+    drtable_t *table = (drtable_t *)tab;
 
+    DR_ASSERT(table != NULL && table->magic == DRTABLE_MAGIC);
+    if (table->synch)
+        drtable_lock(table);
+    entry = drtable_alloc_internal(table, num_entries, idx_ptr, NULL);
     if (table->synch)
         drtable_unlock(table);
     return entry;
 }
 
+/* Thread-cached allocation: each cache takes a block of entries from the
+ * table under the lock and then hands them out with no synchronization.
+ */
+typedef struct _drtable_cache_t {
+    drtable_t *table;
+    ptr_uint_t batch_entries;
+    drtable_chunk_t *chunk; /* the chunk the current block is in */
+    byte *cur_ptr;          /* next free entry of the current block */
+    byte *end_ptr;          /* end of the current block */
+    ptr_uint_t cur_index;   /* index of cur_ptr */
+} drtable_cache_t;
+
+/* Returns the unused tail of the cache's block to its chunk if nothing has
+ * been allocated after it, which is the common case as the block is at the
+ * end of the last chunk.  Otherwise the tail stays allocated and zeroed.
+ * Caller must hold the table lock.
+ */
+static void
+drtable_cache_release(drtable_cache_t *cache)
+{
+    drtable_t *table = cache->table;
+    drtable_chunk_t *chunk = cache->chunk;
+    if (chunk != NULL && chunk->cur_ptr == cache->end_ptr) {
+        ptr_uint_t unused = (ptr_uint_t)
+            ((cache->end_ptr - cache->cur_ptr) / table->entry_size);
+        chunk->cur_ptr = cache->cur_ptr;
+        chunk->entries -= unused;
+        table->entries -= unused;
+    }
+    cache->chunk = NULL;
+    cache->cur_ptr = NULL;
+    cache->end_ptr = NULL;
+}
+
+void *
+drtable_cache_create(void *tab, ptr_uint_t batch_entries)
+{
+    drtable_t *table = (drtable_t *)tab;
+    drtable_cache_t *cache;
+    DR_ASSERT(table != NULL && table->magic == DRTABLE_MAGIC);
+    DR_ASSERT(batch_entries > 0);
+    cache = dr_global_alloc(sizeof(*cache));
+    cache->table = table;
+    cache->batch_entries = batch_entries;
+    cache->chunk = NULL;
+    cache->cur_ptr = NULL;
+    cache->end_ptr = NULL;
+    cache->cur_index = DRTABLE_INVALID_INDEX;
+    return cache;
+}
+
+void *
+drtable_cache_alloc(void *tcache, ptr_uint_t num_entries, ptr_uint_t *idx_ptr)
+{
+    drtable_cache_t *cache = (drtable_cache_t *)tcache;
+    drtable_t *table;
+    void *entry;
+    DR_ASSERT(cache != NULL);
+    table = cache->table;
+    if ((ptr_uint_t)(cache->end_ptr - cache->cur_ptr) <
+        num_entries * table->entry_size) {
+        /* refill: large requests get a block of their own */
+        ptr_uint_t batch = MAX(cache->batch_entries, num_entries);
+        byte *block;
+        if (table->synch)
+            drtable_lock(table);
+        drtable_cache_release(cache);
+        block = drtable_alloc_internal(table, batch, &cache->cur_index, &cache->chunk);
+        if (table->synch)
+            drtable_unlock(table);
+        if (block == NULL) {
+            if (idx_ptr != NULL)
+                *idx_ptr = DRTABLE_INVALID_INDEX;
+            return NULL;
+        }
+        cache->cur_ptr = block;
+        cache->end_ptr = block + batch * table->entry_size;
+    }
+    entry = cache->cur_ptr;
+    if (idx_ptr != NULL)
+        *idx_ptr = cache->cur_index;
+    cache->cur_ptr += num_entries * table->entry_size;
+    cache->cur_index += num_entries;
+    return entry;
+}
+
+void
+drtable_cache_destroy(void *tcache)
+{
+    drtable_cache_t *cache = (drtable_cache_t *)tcache;
+    drtable_t *table;
+    DR_ASSERT(cache != NULL);
+    table = cache->table;
+    if (table->synch)
+        drtable_lock(table);
+    drtable_cache_release(cache);
+    if (table->synch)
+        drtable_unlock(table);
+    dr_global_free(cache, sizeof(*cache));
+}
+
 void
 drtable_iterate(void *tab,
                 void *iter_data,
@@ -354,7 +465,7 @@ drtable_get_entry(void *tab, ptr_uint_t index)
     chunk = drtable_chunk_lookup_index(table, index);
     if (chunk == NULL)
         return NULL;
-    return (chunk->base + index * table->entry_size);
+    return (chunk->base + (index - chunk->index) * table->entry_size);
 }
 
 ptr_uint_t
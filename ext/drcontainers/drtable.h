@@ -104,6 +104,33 @@ drtable_create(ptr_uint_t capacity, size_t entry_size, uint flags, bool synch,
 void *
 drtable_alloc(void *tab, ptr_uint_t num_entries, ptr_uint_t *idx_ptr);
 
+/**
+ * Creates a per-thread allocation cache for \p tab, which takes blocks
+ * of \p batch_entries entries from the table at a time and hands them out
+ * through drtable_cache_alloc() without synchronization, so that threads
+ * making many small allocations do not all serialize on the table lock.
+ * Entries that a cache has taken but not yet handed out are zero and are
+ * included in drtable_num_entries(), drtable_iterate(), and
+ * drtable_dump_entries().  Where possible they are given back to the
+ * table when the cache is refilled or destroyed.
+ *
+ * \return the cache, to be used by a single thread at a time.
+ */
+void *
+drtable_cache_create(void *tab, ptr_uint_t batch_entries);
+
+/**
+ * Identical to drtable_alloc() except that the entries are taken from \p
+ * cache, which only locks the table when it needs a new block.  An
+ * allocation of more than the cache's batch size gets a block of its own.
+ */
+void *
+drtable_cache_alloc(void *cache, ptr_uint_t num_entries, ptr_uint_t *idx_ptr);
+
+/** Gives back the unused entries of \p cache where possible, and frees it. */
+void
+drtable_cache_destroy(void *cache);
+
 /**
  * Destroys all storage for the table.
  * The \p user_data is passed to each \p free_entry_func if specified.
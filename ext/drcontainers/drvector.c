@@ -1,5 +1,5 @@
 /* **********************************************************
- * Copyright (c) 2011 Google, Inc.  All rights reserved.
+ * Copyright (c) 2011-2013 Google, Inc.  All rights reserved.
  * **********************************************************/
 
 /*
@@ -34,7 +34,7 @@
 
 #include "dr_api.h"
 #include "drvector.h"
-#include <string.h> /* memcpy */
+#include <string.h> /* memcpy, memset */
 
 bool
 drvector_init(drvector_t *vec, uint initial_capacity, bool synch,
@@ -66,6 +66,21 @@ drvector_get_entry(drvector_t *vec, uint idx)
     return res;
 }
 
+/* caller must hold the lock */
+static void
+drvector_increase_capacity(drvector_t *vec, uint min_capacity)
+{
+    uint newcap = vec->capacity * 2;
+    void **newarray;
+    if (newcap < min_capacity)
+        newcap = min_capacity;
+    newarray = dr_global_alloc(newcap * sizeof(void*));
+    memcpy(newarray, vec->array, vec->entries * sizeof(void*));
+    dr_global_free(vec->array, vec->capacity * sizeof(void*));
+    vec->array = newarray;
+    vec->capacity = newcap;
+}
+
 bool
 drvector_append(drvector_t *vec, void *data)
 {
@@ -73,21 +88,177 @@ drvector_append(drvector_t *vec, void *data)
         return false;
     if (vec->synch)
         dr_mutex_lock(vec->lock);
-    if (vec->entries >= vec->capacity) {
-        uint newcap = vec->capacity * 2;
-        void **newarray = dr_global_alloc(newcap * sizeof(void*));
+    if (vec->entries >= vec->capacity)
+        drvector_increase_capacity(vec, vec->entries + 1);
+    vec->array[vec->entries] = data;
+    vec->entries++;
+    if (vec->synch)
+        dr_mutex_unlock(vec->lock);
+    return true;
+}
+
+bool
+drvector_append_batch(drvector_t *vec, void **data, uint num)
+{
+    if (vec == NULL || (data == NULL && num > 0))
+        return false;
+    if (vec->synch)
+        dr_mutex_lock(vec->lock);
+    if (vec->entries + num > vec->capacity)
+        drvector_increase_capacity(vec, vec->entries + num);
+    memcpy(&vec->array[vec->entries], data, num * sizeof(void*));
+    vec->entries += num;
+    if (vec->synch)
+        dr_mutex_unlock(vec->lock);
+    return true;
+}
+
+bool
+drvector_reserve(drvector_t *vec, uint capacity)
+{
+    if (vec == NULL)
+        return false;
+    if (vec->synch)
+        dr_mutex_lock(vec->lock);
+    if (capacity > vec->capacity) {
+        /* exactly what was asked for: the caller knows the final size */
+        void **newarray = dr_global_alloc(capacity * sizeof(void*));
         memcpy(newarray, vec->array, vec->entries * sizeof(void*));
         dr_global_free(vec->array, vec->capacity * sizeof(void*));
         vec->array = newarray;
-        vec->capacity = newcap;
+        vec->capacity = capacity;
     }
-    vec->array[vec->entries] = data;
-    vec->entries++;
     if (vec->synch)
         dr_mutex_unlock(vec->lock);
     return true;
 }
 
+bool
+drvector_resize(drvector_t *vec, uint entries)
+{
+    uint i;
+    if (vec == NULL)
+        return false;
+    if (vec->synch)
+        dr_mutex_lock(vec->lock);
+    if (entries > vec->capacity)
+        drvector_increase_capacity(vec, entries);
+    for (i = entries; i < vec->entries; i++) {
+        if (vec->free_data_func != NULL)
+            (vec->free_data_func)(vec->array[i]);
+    }
+    if (entries > vec->entries)
+        memset(&vec->array[vec->entries], 0, (entries - vec->entries) * sizeof(void*));
+    vec->entries = entries;
+    if (vec->synch)
+        dr_mutex_unlock(vec->lock);
+    return true;
+}
+
+/***************************************************************************
+ * SORTING AND SEARCHING
+ */
+
+/* Ranges this short are finished with an insertion sort. */
+#define SORT_INSERTION_MAX 12
+
+static void
+swap_entries(void **array, uint i, uint j)
+{
+    void *tmp = array[i];
+    array[i] = array[j];
+    array[j] = tmp;
+}
+
+/* Quicksort of array[lo..hi] with a median-of-three pivot.  Recurses only
+ * into the smaller partition, bounding the stack depth by log2 of the size.
+ */
+static void
+sort_range(void **array, uint lo, uint hi, int (*cmp)(void *, void *))
+{
+    while (hi - lo >= SORT_INSERTION_MAX) {
+        uint mid = lo + (hi - lo) / 2;
+        uint i, j;
+        void *pivot;
+        if (cmp(array[mid], array[lo]) < 0)
+            swap_entries(array, mid, lo);
+        if (cmp(array[hi], array[lo]) < 0)
+            swap_entries(array, hi, lo);
+        if (cmp(array[hi], array[mid]) < 0)
+            swap_entries(array, hi, mid);
+        /* array[lo] <= pivot <= array[hi] now bound the scans below */
+        pivot = array[mid];
+        i = lo;
+        j = hi;
+        for (;;) {
+            do { i++; } while (cmp(array[i], pivot) < 0);
+            do { j--; } while (cmp(pivot, array[j]) < 0);
+            if (i >= j)
+                break;
+            swap_entries(array, i, j);
+        }
+        /* [lo..j] <= pivot <= [j+1..hi] */
+        if (j - lo < hi - j) {
+            sort_range(array, lo, j, cmp);
+            lo = j + 1;
+        } else {
+            sort_range(array, j + 1, hi, cmp);
+            hi = j;
+        }
+    }
+    if (hi > lo) {
+        uint i, j;
+        for (i = lo + 1; i <= hi; i++) {
+            void *cur = array[i];
+            for (j = i; j > lo && cmp(cur, array[j - 1]) < 0; j--)
+                array[j] = array[j - 1];
+            array[j] = cur;
+        }
+    }
+}
+
+bool
+drvector_sort(drvector_t *vec, int (*cmp)(void *entry1, void *entry2))
+{
+    if (vec == NULL || cmp == NULL)
+        return false;
+    if (vec->synch)
+        dr_mutex_lock(vec->lock);
+    if (vec->entries > 1)
+        sort_range(vec->array, 0, vec->entries - 1, cmp);
+    if (vec->synch)
+        dr_mutex_unlock(vec->lock);
+    return true;
+}
+
+bool
+drvector_search(drvector_t *vec, void *key, int (*cmp)(void *key, void *entry),
+                OUT uint *idx)
+{
+    uint lo = 0, hi;
+    bool found = false;
+    if (vec == NULL || cmp == NULL)
+        return false;
+    if (vec->synch)
+        dr_mutex_lock(vec->lock);
+    /* finds the first entry not less than key */
+    hi = vec->entries;
+    while (lo < hi) {
+        uint mid = lo + (hi - lo) / 2;
+        if (cmp(key, vec->array[mid]) > 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo < vec->entries && cmp(key, vec->array[lo]) == 0)
+        found = true;
+    if (vec->synch)
+        dr_mutex_unlock(vec->lock);
+    if (idx != NULL)
+        *idx = lo;
+    return found;
+}
+
 bool
 drvector_delete(drvector_t *vec)
 {
@@ -120,3 +291,73 @@ drvector_unlock(drvector_t *vec)
 {
     dr_mutex_unlock(vec->lock);
 }
+
+/***************************************************************************
+ * THREAD-LOCAL APPEND
+ *
+ * Each thread gathers its appends in a private chunk with no locking at
+ * all and hands a full chunk to the vector in one drvector_append_batch(),
+ * so a thread takes the vector lock once per chunk rather than once per
+ * entry.  The vector's array can be reallocated at any append, which is
+ * why the chunk cannot simply be a reserved range of the array itself.
+ */
+
+typedef struct _drvector_local_t {
+    drvector_t *vec;
+    uint entries;
+    uint capacity;
+    void **chunk;
+} drvector_local_t;
+
+void *
+drvector_local_create(drvector_t *vec, uint chunk_entries)
+{
+    drvector_local_t *local;
+    if (vec == NULL || chunk_entries == 0)
+        return NULL;
+    local = dr_global_alloc(sizeof(*local));
+    local->vec = vec;
+    local->entries = 0;
+    local->capacity = chunk_entries;
+    local->chunk = dr_global_alloc(chunk_entries * sizeof(void*));
+    return local;
+}
+
+bool
+drvector_local_flush(void *handle)
+{
+    drvector_local_t *local = (drvector_local_t *) handle;
+    if (local == NULL)
+        return false;
+    if (local->entries == 0)
+        return true;
+    if (!drvector_append_batch(local->vec, local->chunk, local->entries))
+        return false;
+    local->entries = 0;
+    return true;
+}
+
+bool
+drvector_local_append(void *handle, void *data)
+{
+    drvector_local_t *local = (drvector_local_t *) handle;
+    if (local == NULL)
+        return false;
+    if (local->entries >= local->capacity && !drvector_local_flush(local))
+        return false;
+    local->chunk[local->entries++] = data;
+    return true;
+}
+
+bool
+drvector_local_destroy(void *handle)
+{
+    drvector_local_t *local = (drvector_local_t *) handle;
+    bool res;
+    if (local == NULL)
+        return false;
+    res = drvector_local_flush(local);
+    dr_global_free(local->chunk, local->capacity * sizeof(void*));
+    dr_global_free(local, sizeof(*local));
+    return res;
+}
@@ -1,5 +1,5 @@
 /* **********************************************************
- * Copyright (c) 2011 Google, Inc.  All rights reserved.
+ * Copyright (c) 2011-2013 Google, Inc.  All rights reserved.
  * **********************************************************/
 
 /*
@@ -93,6 +93,78 @@ drvector_get_entry(drvector_t *vec, uint idx);
 bool
 drvector_append(drvector_t *vec, void *data);
 
+/**
+ * Adds the \p num entries in \p data to the end of the vector, in order,
+ * resizing it at most once.
+ */
+bool
+drvector_append_batch(drvector_t *vec, void **data, uint num);
+
+/**
+ * Ensures the vector has room for at least \p capacity entries without
+ * further reallocation.  Never shrinks the vector.
+ */
+bool
+drvector_reserve(drvector_t *vec, uint capacity);
+
+/**
+ * Sets the number of entries to \p entries.  New entries are NULL.  If
+ * the vector shrinks and free_data_func was specified, calls it for each
+ * entry removed.
+ */
+bool
+drvector_resize(drvector_t *vec, uint entries);
+
+/**
+ * Sorts the entries in place, in the order given by \p cmp, which
+ * returns a negative, zero, or positive value as \p entry1 is less than,
+ * equal to, or greater than \p entry2.  The sort is not stable.
+ */
+bool
+drvector_sort(drvector_t *vec, int (*cmp)(void *entry1, void *entry2));
+
+/**
+ * Performs a binary search for \p key in a vector sorted in the order of
+ * \p cmp, which compares \p key to an entry like the comparison routine
+ * of drvector_sort().  If \p idx is non-NULL, returns in it the index of
+ * the first matching entry, or if there is none, the index at which \p
+ * key would be inserted to keep the vector sorted.
+ *
+ * \return whether a matching entry was found.
+ */
+bool
+drvector_search(drvector_t *vec, void *key, int (*cmp)(void *key, void *entry),
+                OUT uint *idx);
+
+/**
+ * Creates a handle for appending to \p vec from a single thread without
+ * taking the vector lock for every entry.  Entries appended through the
+ * handle are gathered in a private chunk of \p chunk_entries entries and
+ * added to the vector in one batch when the chunk fills up, when
+ * drvector_local_flush() is called, or when the handle is destroyed.
+ * Entries from different threads therefore arrive in the vector in
+ * chunk-sized groups rather than interleaved one by one.
+ *
+ * \return the handle, or NULL on failure.
+ */
+void *
+drvector_local_create(drvector_t *vec, uint chunk_entries);
+
+/**
+ * Appends \p data through a handle created by drvector_local_create().
+ * The handle must only be used by one thread at a time.
+ */
+bool
+drvector_local_append(void *local, void *data);
+
+/** Adds all entries gathered by \p local so far to its vector. */
+bool
+drvector_local_flush(void *local);
+
+/** Flushes \p local and frees it. */
+bool
+drvector_local_destroy(void *local);
+
 /**
  * Destroys all storage for the vector.  If free_payload_func was specified
  * calls it for each payload. 
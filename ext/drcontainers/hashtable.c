@@ -153,20 +153,21 @@ hash_free(void *ptr, size_t size)
 #define HASH_FUNC(val, mask) ((val) & (mask))
 
 static uint
-hash_key(hashtable_t *table, void *key)
+hash_key_ex(hash_type_t hashtype, uint (*hash_key_func)(void*), uint num_bits,
+            void *key)
 {
     uint hash = 0;
-    if (table->hash_key_func != NULL) {
-        hash = table->hash_key_func(key);
-    } else if (table->hashtype == HASH_STRING || table->hashtype == HASH_STRING_NOCASE) {
+    if (hash_key_func != NULL) {
+        hash = hash_key_func(key);
+    } else if (hashtype == HASH_STRING || hashtype == HASH_STRING_NOCASE) {
         const char *s = (const char *) key;
         char c;
         uint i, shift;
-        uint max_shift = ALIGN_FORWARD(table->table_bits, 8);
+        uint max_shift = ALIGN_FORWARD(num_bits, 8);
         /* XXX: share w/ core's hash_value() function */
         for (i = 0; s[i] != '\0'; i++) {
             c = s[i];
-            if (table->hashtype == HASH_STRING_NOCASE)
+            if (hashtype == HASH_STRING_NOCASE)
                 c = (char) tolower(c);
             shift = (i % 4) * 8;
             if (shift > max_shift)
@@ -175,30 +176,43 @@ hash_key(hashtable_t *table, void *key)
         }
     } else {
         /* HASH_INTPTR, or fallback for HASH_CUSTOM in release build */
-        ASSERT(table->hashtype == HASH_INTPTR,
+        ASSERT(hashtype == HASH_INTPTR,
                "hashtable.c hash_key internal error: invalid hash type");
         hash = (uint)(ptr_uint_t) key;
     }
-    return HASH_FUNC_BITS(hash, table->table_bits);
+    return HASH_FUNC_BITS(hash, num_bits);
+}
+
+static uint
+hash_key(hashtable_t *table, void *key)
+{
+    return hash_key_ex(table->hashtype, table->hash_key_func, table->table_bits, key);
 }
 
 static bool
-keys_equal(hashtable_t *table, void *key1, void *key2)
+keys_equal_ex(hash_type_t hashtype, bool (*cmp_key_func)(void*, void*),
+              void *key1, void *key2)
 {
-    if (table->cmp_key_func != NULL)
-        return table->cmp_key_func(key1, key2);
-    else if (table->hashtype == HASH_STRING)
+    if (cmp_key_func != NULL)
+        return cmp_key_func(key1, key2);
+    else if (hashtype == HASH_STRING)
         return strcmp((const char *) key1, (const char *) key2) == 0;
-    else if (table->hashtype == HASH_STRING_NOCASE)
+    else if (hashtype == HASH_STRING_NOCASE)
         return stri_eq((const char *) key1, (const char *) key2);
     else {
         /* HASH_INTPTR, or fallback for HASH_CUSTOM in release build */
-        ASSERT(table->hashtype == HASH_INTPTR,
+        ASSERT(hashtype == HASH_INTPTR,
                "hashtable.c keys_equal internal error: invalid hash type");
         return key1 == key2;
     }
 }
 
+static bool
+keys_equal(hashtable_t *table, void *key1, void *key2)
+{
+    return keys_equal_ex(table->hashtype, table->cmp_key_func, key1, key2);
+}
+
 void
 hashtable_init_ex(hashtable_t *table, uint num_bits, hash_type_t hashtype, bool str_dup,
                   bool synch, void (*free_payload_func)(void*),
@@ -263,9 +277,11 @@ hashtable_lookup(hashtable_t *table, void *key)
 {
     void *res = NULL;
     hash_entry_t *e;
-    uint hindex = hash_key(table, key);
+    uint hindex;
     if (table->synch)
         dr_mutex_lock(table->lock);
+    /* a concurrent resize changes the index, so compute it under the lock */
+    hindex = hash_key(table, key);
     for (e = table->table[hindex]; e != NULL; e = e->next) {
         if (keys_equal(table, e->key, key)) {
             res = e->payload;
@@ -315,12 +331,13 @@ hashtable_check_for_resize(hashtable_t *table)
 bool
 hashtable_add(hashtable_t *table, void *key, void *payload)
 {
-    uint hindex = hash_key(table, key);
+    uint hindex;
     hash_entry_t *e;
     /* if payload is null can't tell from lookup miss */
     ASSERT(payload != NULL, "hashtable_add internal error");
     if (table->synch)
         dr_mutex_lock(table->lock);
+    hindex = hash_key(table, key);
     for (e = table->table[hindex]; e != NULL; e = e->next) {
         if (keys_equal(table, e->key, key)) {
             /* we have a use where payload != existing entry so we don't assert on that */
@@ -350,7 +367,7 @@ void *
 hashtable_add_replace(hashtable_t *table, void *key, void *payload)
 {
     void *old_payload = NULL;
-    uint hindex = hash_key(table, key);
+    uint hindex;
     hash_entry_t *e, *new_e, *prev_e;
     /* if payload is null can't tell from lookup miss */
     ASSERT(payload != NULL, "hashtable_add_replace internal error");
@@ -364,6 +381,7 @@ hashtable_add_replace(hashtable_t *table, void *key, void *payload)
     new_e->payload = payload;
     if (table->synch)
         dr_mutex_lock(table->lock);
+    hindex = hash_key(table, key);
     for (e = table->table[hindex], prev_e = NULL; e != NULL; prev_e = e, e = e->next) {
         if (keys_equal(table, e->key, key)) {
             if (prev_e == NULL)
@@ -395,9 +413,10 @@ hashtable_remove(hashtable_t *table, void *key)
 {
     bool res = false;
     hash_entry_t *e, *prev_e;
-    uint hindex = hash_key(table, key);
+    uint hindex;
     if (table->synch)
         dr_mutex_lock(table->lock);
+    hindex = hash_key(table, key);
     for (e = table->table[hindex], prev_e = NULL; e != NULL; prev_e = e, e = e->next) {
         if (keys_equal(table, e->key, key)) {
             if (prev_e == NULL)
@@ -496,6 +515,491 @@ hashtable_delete(hashtable_t *table)
     dr_mutex_destroy(table->lock);
 }
  
+/***************************************************************************
+ * STRIPED HASHTABLE
+ *
+ * An open-addressed variant for tables that many threads hit at once.
+ * Keys are spread over HASHTABLE_STRIPES independent sub-tables, each
+ * with its own read-write lock, so operations on different stripes never
+ * contend and lookups in the same stripe proceed in parallel.  Each stripe
+ * is an array of cache-line-sized buckets of key/payload slots that is
+ * probed linearly one bucket at a time: a lookup usually touches a single
+ * line, and no entry is allocated separately.
+ */
+
+#define HASH_CACHE_LINE 64
+#define HASH_BUCKET_SLOT_BITS IF_X64_ELSE(2, 3)
+#define HASH_BUCKET_SLOTS (1U << HASH_BUCKET_SLOT_BITS)
+
+typedef struct _hash_slot_t {
+    void *key;
+    void *payload;
+} hash_slot_t;
+
+typedef struct _hash_bucket_t {
+    hash_slot_t slot[HASH_BUCKET_SLOTS];
+} hash_bucket_t;
+
+typedef struct _hash_stripe_t {
+    hash_bucket_t *buckets; /* cache-line aligned inside buckets_alloc */
+    void *buckets_alloc;
+    uint bucket_bits;
+    uint entries;
+    uint removed;
+    void *lock;
+} hash_stripe_t;
+
+/* Stripes are padded to a cache line each so that one stripe's counters
+ * do not share a line with its neighbor's.
+ */
+#define HASH_STRIPE_SIZE ALIGN_FORWARD(sizeof(hash_stripe_t), HASH_CACHE_LINE)
+#define HASH_STRIPES_ALLOC_SIZE (HASHTABLE_STRIPES * HASH_STRIPE_SIZE + HASH_CACHE_LINE)
+#define STRIPE(table, i) \
+    ((hash_stripe_t *)((byte *)(table)->stripes + (i) * HASH_STRIPE_SIZE))
+
+/* An empty slot has a NULL payload, which is disallowed as a real payload.
+ * A removed slot holds this marker instead, keeping later slots reachable,
+ * until the stripe is next rehashed.
+ */
+static char hash_removed_marker;
+#define HASH_REMOVED ((void *)&hash_removed_marker)
+
+#define SLOT_IN_USE(slot) ((slot)->payload != NULL && (slot)->payload != HASH_REMOVED)
+/* buckets are cache-line sized and aligned */
+#define BUCKET_OF_SLOT(slot) \
+    ((hash_bucket_t *)((ptr_uint_t)(slot) & ~((ptr_uint_t)HASH_CACHE_LINE - 1)))
+
+static uint
+striped_hash(hashtable_striped_t *table, void *key)
+{
+    uint hash = hash_key_ex(table->hashtype, table->hash_key_func, 32, key);
+    /* Pointers have poor low bits for linear probing, so scramble with a
+     * multiplicative hash and fold the well-mixed high half back down.
+     * The stripe is picked from the top bits.
+     */
+    hash *= 0x9e3779b1;
+    return hash ^ (hash >> 16);
+}
+
+static hash_stripe_t *
+stripe_for_hash(hashtable_striped_t *table, uint hash)
+{
+    return STRIPE(table, hash >> (32 - HASHTABLE_STRIPE_BITS));
+}
+
+static void
+stripe_alloc_buckets(hash_stripe_t *stripe, uint bucket_bits)
+{
+    size_t sz = (size_t)HASHTABLE_SIZE(bucket_bits) * sizeof(hash_bucket_t);
+    stripe->buckets_alloc = hash_alloc(sz + HASH_CACHE_LINE);
+    stripe->buckets = (hash_bucket_t *)
+        ALIGN_FORWARD(stripe->buckets_alloc, HASH_CACHE_LINE);
+    memset(stripe->buckets, 0, sz);
+    stripe->bucket_bits = bucket_bits;
+}
+
+static void
+stripe_free_buckets(hash_stripe_t *stripe)
+{
+    hash_free(stripe->buckets_alloc,
+              (size_t)HASHTABLE_SIZE(stripe->bucket_bits) * sizeof(hash_bucket_t) +
+              HASH_CACHE_LINE);
+    stripe->buckets = NULL;
+    stripe->buckets_alloc = NULL;
+}
+
+/* Returns the slot holding key, or NULL if there is none.  If free_slot is
+ * non-NULL it is pointed at the first removed or empty slot in key's probe
+ * sequence, for an add.
+ *
+ * A bucket that still has an empty slot has never been full (see
+ * stripe_remove_slot()), so no key's probe went past it and the search
+ * can stop there.  The resize policy ensures such a bucket exists.
+ * Caller must hold the stripe lock.
+ */
+static hash_slot_t *
+stripe_find(hashtable_striped_t *table, hash_stripe_t *stripe, uint hash, void *key,
+            hash_slot_t **free_slot OUT)
+{
+    uint mask = HASH_MASK(stripe->bucket_bits);
+    uint b = HASH_FUNC(hash, mask);
+    uint i, n;
+    /* every slot of a bucket is checked, so compare plain keys inline */
+    bool simple_keys = (table->hashtype == HASH_INTPTR && table->cmp_key_func == NULL);
+    if (free_slot != NULL)
+        *free_slot = NULL;
+    for (n = 0; n <= mask; n++, b = HASH_FUNC(b + 1, mask)) {
+        hash_bucket_t *bucket = &stripe->buckets[b];
+        bool saw_empty = false;
+        for (i = 0; i < HASH_BUCKET_SLOTS; i++) {
+            hash_slot_t *slot = &bucket->slot[i];
+            if (SLOT_IN_USE(slot)) {
+                if (simple_keys ? slot->key == key :
+                    keys_equal_ex(table->hashtype, table->cmp_key_func, slot->key, key))
+                    return slot;
+            } else {
+                if (slot->payload == NULL)
+                    saw_empty = true;
+                if (free_slot != NULL && *free_slot == NULL)
+                    *free_slot = slot;
+            }
+        }
+        if (saw_empty)
+            return NULL;
+    }
+    ASSERT(false, "hashtable_striped: stripe has no empty slot");
+    return NULL;
+}
+
+/* Empties a slot.  A bucket that has never been full can simply have its
+ * slot cleared, but in one that has, a key may have been pushed into a
+ * later bucket, so the slot is marked removed to keep that key reachable.
+ * Caller must hold the stripe lock.
+ */
+static void
+stripe_remove_slot(hash_stripe_t *stripe, hash_bucket_t *bucket, hash_slot_t *slot)
+{
+    uint i;
+    slot->key = NULL;
+    slot->payload = HASH_REMOVED;
+    stripe->entries--;
+    for (i = 0; i < HASH_BUCKET_SLOTS; i++) {
+        if (bucket->slot[i].payload == NULL) {
+            slot->payload = NULL;
+            return;
+        }
+    }
+    stripe->removed++;
+}
+
+/* caller must hold the stripe lock */
+static void
+stripe_rehash(hashtable_striped_t *table, hash_stripe_t *stripe, uint new_bits)
+{
+    hash_stripe_t old = *stripe;
+    uint i, j;
+    stripe_alloc_buckets(stripe, new_bits);
+    for (i = 0; i < HASHTABLE_SIZE(old.bucket_bits); i++) {
+        for (j = 0; j < HASH_BUCKET_SLOTS; j++) {
+            hash_slot_t *slot = &old.buckets[i].slot[j];
+            uint mask = HASH_MASK(stripe->bucket_bits);
+            uint b, k;
+            if (!SLOT_IN_USE(slot))
+                continue;
+            /* keys are unique, so no compares are needed: take the first
+             * empty slot along the probe sequence
+             */
+            for (b = HASH_FUNC(striped_hash(table, slot->key), mask); ;
+                 b = HASH_FUNC(b + 1, mask)) {
+                hash_bucket_t *bucket = &stripe->buckets[b];
+                for (k = 0; k < HASH_BUCKET_SLOTS; k++) {
+                    if (bucket->slot[k].payload == NULL)
+                        break;
+                }
+                if (k < HASH_BUCKET_SLOTS) {
+                    bucket->slot[k] = *slot;
+                    break;
+                }
+            }
+        }
+    }
+    stripe->removed = 0;
+    stripe_free_buckets(&old);
+}
+
+/* Makes room for one more entry, returning whether the stripe was rehashed.
+ * Caller must hold the stripe lock.
+ */
+static bool
+stripe_check_for_resize(hashtable_striped_t *table, hash_stripe_t *stripe)
+{
+    uint capacity = HASHTABLE_SIZE(stripe->bucket_bits) * HASH_BUCKET_SLOTS;
+    uint used = stripe->entries + stripe->removed + 1;
+    /* Open addressing needs an empty slot to end each probe, so even a
+     * non-resizable stripe is rehashed rather than filled up.
+     */
+    if (used >= capacity ||
+        (table->config.resizable &&
+         /* avoid fp ops.  should check for overflow. */
+         used * 100 > table->config.resize_threshold * capacity)) {
+        /* Dropping the removed slots may be enough; otherwise double the size. */
+        bool grow = (stripe->removed == 0 ||
+                     (table->config.resizable &&
+                      (stripe->entries + 1) * 200 >
+                      table->config.resize_threshold * capacity));
+        stripe_rehash(table, stripe, stripe->bucket_bits + (grow ? 1 : 0));
+        return true;
+    }
+    return false;
+}
+
+static void
+stripe_free_slot(hashtable_striped_t *table, hash_slot_t *slot, bool free_payload)
+{
+    if (table->str_dup)
+        hash_free(slot->key, strlen((const char *)slot->key) + 1);
+    if (free_payload && table->free_payload_func != NULL)
+        (table->free_payload_func)(slot->payload);
+}
+
+static void
+stripe_set_key(hashtable_striped_t *table, hash_slot_t *slot, void *key)
+{
+    if (table->str_dup) {
+        const char *s = (const char *) key;
+        slot->key = hash_alloc(strlen(s)+1);
+        strncpy((char *)slot->key, s, strlen(s)+1);
+    } else
+        slot->key = key;
+}
+
+void
+hashtable_striped_init_ex(hashtable_striped_t *table, uint num_bits,
+                          hash_type_t hashtype, bool str_dup, bool synch,
+                          void (*free_payload_func)(void*),
+                          uint (*hash_key_func)(void*),
+                          bool (*cmp_key_func)(void*, void*))
+{
+    uint i, bucket_bits = 1;
+    ASSERT(sizeof(hash_bucket_t) == HASH_CACHE_LINE, "bucket is not a cache line");
+    /* num_bits is the total slot count across all stripes */
+    if (num_bits > HASHTABLE_STRIPE_BITS + HASH_BUCKET_SLOT_BITS + 1)
+        bucket_bits = num_bits - HASHTABLE_STRIPE_BITS - HASH_BUCKET_SLOT_BITS;
+    table->stripes_alloc = hash_alloc(HASH_STRIPES_ALLOC_SIZE);
+    table->stripes = (void *) ALIGN_FORWARD(table->stripes_alloc, HASH_CACHE_LINE);
+    for (i = 0; i < HASHTABLE_STRIPES; i++) {
+        hash_stripe_t *stripe = STRIPE(table, i);
+        memset(stripe, 0, sizeof(*stripe));
+        stripe_alloc_buckets(stripe, bucket_bits);
+        stripe->lock = dr_rwlock_create();
+    }
+    table->hashtype = hashtype;
+    table->str_dup = str_dup;
+    ASSERT(!str_dup || hashtype == HASH_STRING || hashtype == HASH_STRING_NOCASE,
+           "hashtable_striped_init_ex internal error: invalid hashtable type");
+    table->synch = synch;
+    table->free_payload_func = free_payload_func;
+    table->hash_key_func = hash_key_func;
+    table->cmp_key_func = cmp_key_func;
+    ASSERT(table->hashtype != HASH_CUSTOM ||
+           (table->hash_key_func != NULL && table->cmp_key_func != NULL),
+           "hashtable_striped_init_ex missing cmp/hash key func");
+    table->config.size = sizeof(table->config);
+    table->config.resizable = true;
+    table->config.resize_threshold = 75;
+    table->persist_count = 0;
+}
+
+void
+hashtable_striped_init(hashtable_striped_t *table, uint num_bits, hash_type_t hashtype,
+                       bool str_dup)
+{
+    hashtable_striped_init_ex(table, num_bits, hashtype, str_dup, true,
+                              NULL, NULL, NULL);
+}
+
+void
+hashtable_striped_configure(hashtable_striped_t *table, hashtable_config_t *config)
+{
+    ASSERT(table != NULL && config != NULL, "invalid params");
+    /* Ignoring size of field: shouldn't be in between */
+    if (config->size > offsetof(hashtable_config_t, resizable))
+        table->config.resizable = config->resizable;
+    if (config->size > offsetof(hashtable_config_t, resize_threshold))
+        table->config.resize_threshold = config->resize_threshold;
+}
+
+void
+hashtable_striped_lock(hashtable_striped_t *table, void *key)
+{
+    dr_rwlock_write_lock(stripe_for_hash(table, striped_hash(table, key))->lock);
+}
+
+void
+hashtable_striped_unlock(hashtable_striped_t *table, void *key)
+{
+    dr_rwlock_write_unlock(stripe_for_hash(table, striped_hash(table, key))->lock);
+}
+
+void *
+hashtable_striped_lookup(hashtable_striped_t *table, void *key)
+{
+    void *res = NULL;
+    hash_slot_t *slot;
+    uint hash = striped_hash(table, key);
+    hash_stripe_t *stripe = stripe_for_hash(table, hash);
+    if (table->synch)
+        dr_rwlock_read_lock(stripe->lock);
+    slot = stripe_find(table, stripe, hash, key, NULL);
+    if (slot != NULL)
+        res = slot->payload;
+    if (table->synch)
+        dr_rwlock_read_unlock(stripe->lock);
+    return res;
+}
+
+bool
+hashtable_striped_add(hashtable_striped_t *table, void *key, void *payload)
+{
+    hash_slot_t *slot;
+    uint hash = striped_hash(table, key);
+    hash_stripe_t *stripe = stripe_for_hash(table, hash);
+    /* if payload is null can't tell from lookup miss */
+    ASSERT(payload != NULL, "hashtable_striped_add internal error");
+    if (table->synch)
+        dr_rwlock_write_lock(stripe->lock);
+    if (stripe_find(table, stripe, hash, key, &slot) != NULL) {
+        /* we have a use where payload != existing entry so we don't assert on that */
+        if (table->synch)
+            dr_rwlock_write_unlock(stripe->lock);
+        return false;
+    }
+    if (stripe_check_for_resize(table, stripe))
+        stripe_find(table, stripe, hash, key, &slot);
+    if (slot->payload == HASH_REMOVED)
+        stripe->removed--;
+    stripe_set_key(table, slot, key);
+    slot->payload = payload;
+    stripe->entries++;
+    if (table->synch)
+        dr_rwlock_write_unlock(stripe->lock);
+    return true;
+}
+
+void *
+hashtable_striped_add_replace(hashtable_striped_t *table, void *key, void *payload)
+{
+    void *old_payload = NULL;
+    hash_slot_t *slot, *free_slot;
+    uint hash = striped_hash(table, key);
+    hash_stripe_t *stripe = stripe_for_hash(table, hash);
+    /* if payload is null can't tell from lookup miss */
+    ASSERT(payload != NULL, "hashtable_striped_add_replace internal error");
+    if (table->synch)
+        dr_rwlock_write_lock(stripe->lock);
+    slot = stripe_find(table, stripe, hash, key, &free_slot);
+    if (slot != NULL) {
+        /* up to caller to free payload */
+        old_payload = slot->payload;
+        stripe_free_slot(table, slot, false);
+    } else {
+        slot = free_slot;
+        if (stripe_check_for_resize(table, stripe))
+            stripe_find(table, stripe, hash, key, &slot);
+        if (slot->payload == HASH_REMOVED)
+            stripe->removed--;
+        stripe->entries++;
+    }
+    stripe_set_key(table, slot, key);
+    slot->payload = payload;
+    if (table->synch)
+        dr_rwlock_write_unlock(stripe->lock);
+    return old_payload;
+}
+
+bool
+hashtable_striped_remove(hashtable_striped_t *table, void *key)
+{
+    hash_slot_t *slot;
+    uint hash = striped_hash(table, key);
+    hash_stripe_t *stripe = stripe_for_hash(table, hash);
+    if (table->synch)
+        dr_rwlock_write_lock(stripe->lock);
+    slot = stripe_find(table, stripe, hash, key, NULL);
+    if (slot != NULL) {
+        stripe_free_slot(table, slot, true);
+        stripe_remove_slot(stripe, BUCKET_OF_SLOT(slot), slot);
+    }
+    if (table->synch)
+        dr_rwlock_write_unlock(stripe->lock);
+    return slot != NULL;
+}
+
+bool
+hashtable_striped_remove_range(hashtable_striped_t *table, void *start, void *end)
+{
+    bool res = false;
+    uint s, i, j;
+    for (s = 0; s < HASHTABLE_STRIPES; s++) {
+        hash_stripe_t *stripe = STRIPE(table, s);
+        if (table->synch)
+            dr_rwlock_write_lock(stripe->lock);
+        for (i = 0; i < HASHTABLE_SIZE(stripe->bucket_bits); i++) {
+            for (j = 0; j < HASH_BUCKET_SLOTS; j++) {
+                hash_slot_t *slot = &stripe->buckets[i].slot[j];
+                if (SLOT_IN_USE(slot) && slot->key >= start && slot->key < end) {
+                    stripe_free_slot(table, slot, true);
+                    stripe_remove_slot(stripe, &stripe->buckets[i], slot);
+                    res = true;
+                }
+            }
+        }
+        if (table->synch)
+            dr_rwlock_write_unlock(stripe->lock);
+    }
+    return res;
+}
+
+static void
+stripe_clear(hashtable_striped_t *table, hash_stripe_t *stripe)
+{
+    uint i, j;
+    for (i = 0; i < HASHTABLE_SIZE(stripe->bucket_bits); i++) {
+        for (j = 0; j < HASH_BUCKET_SLOTS; j++) {
+            hash_slot_t *slot = &stripe->buckets[i].slot[j];
+            if (SLOT_IN_USE(slot))
+                stripe_free_slot(table, slot, true);
+            slot->key = NULL;
+            slot->payload = NULL;
+        }
+    }
+    stripe->entries = 0;
+    stripe->removed = 0;
+}
+
+void
+hashtable_striped_clear(hashtable_striped_t *table)
+{
+    uint s;
+    for (s = 0; s < HASHTABLE_STRIPES; s++) {
+        hash_stripe_t *stripe = STRIPE(table, s);
+        if (table->synch)
+            dr_rwlock_write_lock(stripe->lock);
+        stripe_clear(table, stripe);
+        if (table->synch)
+            dr_rwlock_write_unlock(stripe->lock);
+    }
+}
+
+void
+hashtable_striped_delete(hashtable_striped_t *table)
+{
+    uint s;
+    for (s = 0; s < HASHTABLE_STRIPES; s++) {
+        hash_stripe_t *stripe = STRIPE(table, s);
+        if (table->synch)
+            dr_rwlock_write_lock(stripe->lock);
+        stripe_clear(table, stripe);
+        stripe_free_buckets(stripe);
+        if (table->synch)
+            dr_rwlock_write_unlock(stripe->lock);
+        dr_rwlock_destroy(stripe->lock);
+    }
+    hash_free(table->stripes_alloc, HASH_STRIPES_ALLOC_SIZE);
+    table->stripes_alloc = NULL;
+    table->stripes = NULL;
+}
+
+uint
+hashtable_striped_entries(hashtable_striped_t *table)
+{
+    uint s, count = 0;
+    /* unsynchronized: a snapshot is all a caller could use anyway */
+    for (s = 0; s < HASHTABLE_STRIPES; s++)
+        count += STRIPE(table, s)->entries;
+    return count;
+}
+
 /***************************************************************************
  * PERSISTENCE
  */
@@ -520,12 +1024,22 @@ hashtable_delete(hashtable_t *table)
  */
 
 static bool
-key_in_range(hashtable_t *table, hash_entry_t *he, ptr_uint_t start, size_t size)
+key_in_range(hash_type_t hashtype, void *key, ptr_uint_t start, size_t size)
 {
-    if (table->hashtype != HASH_INTPTR || size == 0)
+    if (hashtype != HASH_INTPTR || size == 0)
         return true;
     /* avoiding overflow by subtracting one */
-    return ((ptr_uint_t)he->key >= start && (ptr_uint_t)he->key <= (start + (size - 1)));
+    return ((ptr_uint_t)key >= start && (ptr_uint_t)key <= (start + (size - 1)));
+}
+
+static bool
+persist_key(void *drcontext, hash_type_t hashtype, void *key, void *perscxt,
+            ptr_uint_t start, size_t size, hasthable_persist_flags_t flags)
+{
+    return ((!TEST(DR_HASHPERS_ONLY_IN_RANGE, flags) ||
+             key_in_range(hashtype, key, start, size)) &&
+            (!TEST(DR_HASHPERS_ONLY_PERSISTED, flags) ||
+             dr_fragment_persistable(drcontext, perscxt, key)));
 }
 
 static bool
@@ -534,6 +1048,44 @@ hash_write_file(file_t fd, void *ptr, size_t sz)
     return (dr_write_file(fd, ptr, sz) == (ssize_t)sz);
 }
 
+static size_t
+persist_total_size(uint count, size_t entry_size, hasthable_persist_flags_t flags)
+{
+    return sizeof(count) +
+        (TEST(DR_HASHPERS_REBASE_KEY, flags) ? sizeof(ptr_uint_t) : 0) +
+        count * (entry_size + sizeof(void*));
+}
+
+static bool
+persist_write_header(file_t fd, uint count, ptr_uint_t start,
+                     hasthable_persist_flags_t flags)
+{
+    if (!hash_write_file(fd, &count, sizeof(count)))
+        return false;
+    if (TEST(DR_HASHPERS_REBASE_KEY, flags)) {
+        if (!hash_write_file(fd, &start, sizeof(start)))
+            return false;
+    }
+    return true;
+}
+
+static bool
+persist_write_entry(file_t fd, void *key, void *payload, size_t entry_size,
+                    hasthable_persist_flags_t flags)
+{
+    if (!hash_write_file(fd, &key, sizeof(key)))
+        return false;
+    if (TEST(DR_HASHPERS_PAYLOAD_IS_POINTER, flags)) {
+        if (!hash_write_file(fd, payload, entry_size))
+            return false;
+    } else {
+        ASSERT(entry_size <= sizeof(void*), "inlined data too large");
+        if (!hash_write_file(fd, &payload, entry_size))
+            return false;
+    }
+    return true;
+}
+
 size_t
 hashtable_persist_size(void *drcontext, hashtable_t *table, size_t entry_size,
                        void *perscxt, hasthable_persist_flags_t flags)
@@ -553,10 +1105,8 @@ hashtable_persist_size(void *drcontext, hashtable_t *table, size_t entry_size,
         for (i = 0; i < HASHTABLE_SIZE(table->table_bits); i++) {
             hash_entry_t *he;
             for (he = table->table[i]; he != NULL; he = he->next) {
-                if ((!TEST(DR_HASHPERS_ONLY_IN_RANGE, flags) ||
-                     key_in_range(table, he, start, size)) &&
-                    (!TEST(DR_HASHPERS_ONLY_PERSISTED, flags) ||
-                     dr_fragment_persistable(drcontext, perscxt, he->key)))
+                if (persist_key(drcontext, table->hashtype, he->key, perscxt,
+                                start, size, flags))
                     count++;
             }
         }
@@ -568,9 +1118,7 @@ hashtable_persist_size(void *drcontext, hashtable_t *table, size_t entry_size,
      * hashtable_persist_size().
      */
     table->persist_count = count;
-    return sizeof(count) +
-        (TEST(DR_HASHPERS_REBASE_KEY, flags) ? sizeof(ptr_uint_t) : 0) +
-        count * (entry_size + sizeof(void*));
+    return persist_total_size(count, entry_size, flags);
 }
 
 bool
@@ -587,31 +1135,17 @@ hashtable_persist(void *drcontext, hashtable_t *table, size_t entry_size,
         start = (ptr_uint_t) dr_persist_start(perscxt);
         size = dr_persist_size(perscxt);
     }
-    if (!hash_write_file(fd, &table->persist_count, sizeof(table->persist_count)))
+    if (!persist_write_header(fd, table->persist_count, start, flags))
         return false;
-    if (TEST(DR_HASHPERS_REBASE_KEY, flags)) {
-        if (!hash_write_file(fd, &start, sizeof(start)))
-            return false;
-    }
     /* synch is already provided */
     for (i = 0; i < HASHTABLE_SIZE(table->table_bits); i++) {
         hash_entry_t *he;
         for (he = table->table[i]; he != NULL; he = he->next) {
-            if ((!TEST(DR_HASHPERS_ONLY_IN_RANGE, flags) ||
-                 key_in_range(table, he, start, size)) &&
-                (!TEST(DR_HASHPERS_ONLY_PERSISTED, flags) ||
-                 dr_fragment_persistable(drcontext, perscxt, he->key))) {
+            if (persist_key(drcontext, table->hashtype, he->key, perscxt,
+                            start, size, flags)) {
                 IF_DEBUG(count_check++;)
-                if (!hash_write_file(fd, &he->key, sizeof(he->key)))
+                if (!persist_write_entry(fd, he->key, he->payload, entry_size, flags))
                     return false;
-                if (TEST(DR_HASHPERS_PAYLOAD_IS_POINTER, flags)) {
-                    if (!hash_write_file(fd, he->payload, entry_size))
-                        return false;
-                } else {
-                    ASSERT(entry_size <= sizeof(void*), "inlined data too large");
-                    if (!hash_write_file(fd, &he->payload, entry_size))
-                        return false;
-                }
             }
         }
     }
@@ -619,14 +1153,15 @@ hashtable_persist(void *drcontext, hashtable_t *table, size_t entry_size,
     return true;
 }
 
-/* Loads from disk and adds to table 
+/* Loads from disk and adds to table, or to stable if table is NULL.
  * Note that clone should only be false for tables that do their own payload
  * freeing and can avoid freeing a payload in the mmap.
  */
-bool
-hashtable_resurrect(void *drcontext, byte **map INOUT, hashtable_t *table,
-                    size_t entry_size, void *perscxt, hasthable_persist_flags_t flags,
-                    bool (*process_payload)(void *key, void *payload, ptr_int_t shift))
+static bool
+resurrect_common(void *drcontext, byte **map INOUT, hashtable_t *table,
+                 hashtable_striped_t *stable, size_t entry_size, void *perscxt,
+                 hasthable_persist_flags_t flags,
+                 bool (*process_payload)(void *key, void *payload, ptr_int_t shift))
 {
     uint i;
     ptr_uint_t stored_start = 0;
@@ -663,8 +1198,107 @@ hashtable_resurrect(void *drcontext, byte **map INOUT, hashtable_t *table,
         if (process_payload != NULL) {
             if (!process_payload(key, toadd, shift_amt))
                 return false;
-        } else if (!hashtable_add(table, key, toadd))
+        } else if (table != NULL) {
+            if (!hashtable_add(table, key, toadd))
+                return false;
+        } else if (!hashtable_striped_add(stable, key, toadd))
             return false;
     }
     return true;
 }
+
+bool
+hashtable_resurrect(void *drcontext, byte **map INOUT, hashtable_t *table,
+                    size_t entry_size, void *perscxt, hasthable_persist_flags_t flags,
+                    bool (*process_payload)(void *key, void *payload, ptr_int_t shift))
+{
+    return resurrect_common(drcontext, map, table, NULL, entry_size, perscxt, flags,
+                            process_payload);
+}
+
+/* The striped table uses the same file layout as hashtable_t, so a table
+ * persisted by either can be resurrected into either.
+ */
+
+size_t
+hashtable_striped_persist_size(void *drcontext, hashtable_striped_t *table,
+                               size_t entry_size, void *perscxt,
+                               hasthable_persist_flags_t flags)
+{
+    uint count = 0;
+    if (table->hashtype == HASH_INTPTR &&
+        TESTANY(DR_HASHPERS_ONLY_IN_RANGE | DR_HASHPERS_ONLY_PERSISTED, flags)) {
+        /* synch is already provided */
+        uint s, i, j;
+        ptr_uint_t start = 0;
+        size_t size = 0;
+        if (perscxt != NULL) {
+            start = (ptr_uint_t) dr_persist_start(perscxt);
+            size = dr_persist_size(perscxt);
+        }
+        for (s = 0; s < HASHTABLE_STRIPES; s++) {
+            hash_stripe_t *stripe = STRIPE(table, s);
+            for (i = 0; i < HASHTABLE_SIZE(stripe->bucket_bits); i++) {
+                for (j = 0; j < HASH_BUCKET_SLOTS; j++) {
+                    hash_slot_t *slot = &stripe->buckets[i].slot[j];
+                    if (SLOT_IN_USE(slot) &&
+                        persist_key(drcontext, table->hashtype, slot->key, perscxt,
+                                    start, size, flags))
+                        count++;
+                }
+            }
+        }
+    } else
+        count = hashtable_striped_entries(table);
+    table->persist_count = count;
+    return persist_total_size(count, entry_size, flags);
+}
+
+bool
+hashtable_striped_persist(void *drcontext, hashtable_striped_t *table,
+                          size_t entry_size, file_t fd, void *perscxt,
+                          hasthable_persist_flags_t flags)
+{
+    uint s, i, j;
+    ptr_uint_t start = 0;
+    size_t size = 0;
+    IF_DEBUG(uint count_check = 0;)
+    if (TEST(DR_HASHPERS_REBASE_KEY, flags) && perscxt == NULL)
+        return false; /* invalid params */
+    if (perscxt != NULL) {
+        start = (ptr_uint_t) dr_persist_start(perscxt);
+        size = dr_persist_size(perscxt);
+    }
+    if (!persist_write_header(fd, table->persist_count, start, flags))
+        return false;
+    /* synch is already provided */
+    for (s = 0; s < HASHTABLE_STRIPES; s++) {
+        hash_stripe_t *stripe = STRIPE(table, s);
+        for (i = 0; i < HASHTABLE_SIZE(stripe->bucket_bits); i++) {
+            for (j = 0; j < HASH_BUCKET_SLOTS; j++) {
+                hash_slot_t *slot = &stripe->buckets[i].slot[j];
+                if (SLOT_IN_USE(slot) &&
+                    persist_key(drcontext, table->hashtype, slot->key, perscxt,
+                                start, size, flags)) {
+                    IF_DEBUG(count_check++;)
+                    if (!persist_write_entry(fd, slot->key, slot->payload,
+                                             entry_size, flags))
+                        return false;
+                }
+            }
+        }
+    }
+    ASSERT(table->persist_count == count_check, "invalid count");
+    return true;
+}
+
+bool
+hashtable_striped_resurrect(void *drcontext, byte **map INOUT,
+                            hashtable_striped_t *table, size_t entry_size,
+                            void *perscxt, hasthable_persist_flags_t flags,
+                            bool (*process_payload)(void *key, void *payload,
+                                                    ptr_int_t shift))
+{
+    return resurrect_common(drcontext, map, NULL, table, entry_size, perscxt, flags,
+                            process_payload);
+}
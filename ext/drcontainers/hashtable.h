@@ -1,5 +1,5 @@
 /* **********************************************************
- * Copyright (c) 2011-2012 Google, Inc.  All rights reserved.
+ * Copyright (c) 2011-2013 Google, Inc.  All rights reserved.
  * Copyright (c) 2007-2010 VMware, Inc.  All rights reserved.
  * **********************************************************/
 
@@ -323,6 +323,155 @@ hashtable_resurrect(void *drcontext, byte **map /*INOUT*/, hashtable_t *table,
                     size_t entry_size, void *perscxt, hasthable_persist_flags_t flags,
                     bool (*process_payload)(void *key, void *payload, ptr_int_t shift));
 
+/***************************************************************************
+ * STRIPED HASHTABLE
+ */
+
+/** The number of lock stripes of a hashtable_striped_t, as a power of two. */
+#define HASHTABLE_STRIPE_BITS 4
+/** The number of lock stripes of a hashtable_striped_t. */
+#define HASHTABLE_STRIPES (1U << HASHTABLE_STRIPE_BITS)
+
+/**
+ * An open-addressed hashtable for use from many threads at once.  Keys
+ * are spread over #HASHTABLE_STRIPES sub-tables, each guarded by its own
+ * read-write lock, so that operations on different sub-tables do not
+ * contend and lookups proceed in parallel.  Entries are stored inline in
+ * cache-line-sized buckets rather than allocated one by one.  The fields
+ * are internal.
+ */
+typedef struct _hashtable_striped_t {
+    void *stripes;
+    void *stripes_alloc;
+    hash_type_t hashtype;
+    bool str_dup;
+    bool synch;
+    void (*free_payload_func)(void*);
+    uint (*hash_key_func)(void*);
+    bool (*cmp_key_func)(void*, void*);
+    hashtable_config_t config;
+    uint persist_count;
+} hashtable_striped_t;
+
+/**
+ * Initializes a striped hashtable.  The parameters are as for
+ * hashtable_init_ex(), with \p num_bits giving the initial total number of
+ * entry slots, which are split evenly among the stripes.  Each stripe
+ * resizes on its own according to hashtable_striped_configure().  A stripe
+ * that is not resizable is still doubled rather than filled completely.
+ */
+void
+hashtable_striped_init_ex(hashtable_striped_t *table, uint num_bits,
+                          hash_type_t hashtype, bool str_dup, bool synch,
+                          void (*free_payload_func)(void*),
+                          uint (*hash_key_func)(void*),
+                          bool (*cmp_key_func)(void*, void*));
+
+/** Equivalent to hashtable_init() for a striped hashtable. */
+void
+hashtable_striped_init(hashtable_striped_t *table, uint num_bits, hash_type_t hashtype,
+                       bool str_dup);
+
+/**
+ * Configures optional parameters of striped hashtable operation.  The
+ * resize threshold applies to each stripe separately.
+ */
+void
+hashtable_striped_configure(hashtable_striped_t *table, hashtable_config_t *config);
+
+/** Returns the payload for the given key, or NULL if the key is not found */
+void *
+hashtable_striped_lookup(hashtable_striped_t *table, void *key);
+
+/**
+ * Adds a new entry.  Returns false if an entry for \p key already exists.
+ * \note Never use NULL as a payload as that is used for a lookup failure.
+ */
+bool
+hashtable_striped_add(hashtable_striped_t *table, void *key, void *payload);
+
+/**
+ * Adds a new entry, replacing an existing entry if any, and returns the
+ * replaced payload or NULL.
+ * \note Never use NULL as a payload as that is used for a lookup failure.
+ */
+void *
+hashtable_striped_add_replace(hashtable_striped_t *table, void *key, void *payload);
+
+/**
+ * Removes the entry for key.  If free_payload_func was specified calls it
+ * for the payload being removed.  Returns false if no such entry
+ * exists.
+ */
+bool
+hashtable_striped_remove(hashtable_striped_t *table, void *key);
+
+/**
+ * Removes all entries with key in [start..end).  If free_payload_func
+ * was specified calls it for each payload being removed.  Returns
+ * false if no such entry exists.
+ */
+bool
+hashtable_striped_remove_range(hashtable_striped_t *table, void *start, void *end);
+
+/**
+ * Removes all entries from the table.  If free_payload_func was specified
+ * calls it for each payload.
+ */
+void
+hashtable_striped_clear(hashtable_striped_t *table);
+
+/**
+ * Destroys all storage for the table.  If free_payload_func was specified
+ * calls it for each payload.
+ */
+void
+hashtable_striped_delete(hashtable_striped_t *table);
+
+/**
+ * Returns the number of entries in the table.  The count is not
+ * synchronized with concurrent updates.
+ */
+uint
+hashtable_striped_entries(hashtable_striped_t *table);
+
+/**
+ * Acquires the lock of the stripe holding \p key, for extending
+ * synchronization to the use of a looked-up payload.  Operations on the
+ * same stripe must not be made while holding it unless the table was
+ * initialized without \p synch.
+ */
+void
+hashtable_striped_lock(hashtable_striped_t *table, void *key);
+
+/** Releases the lock acquired by hashtable_striped_lock(). */
+void
+hashtable_striped_unlock(hashtable_striped_t *table, void *key);
+
+/**
+ * Equivalent to hashtable_persist_size() for a striped hashtable.  The
+ * persisted format is the same, so data persisted from either kind of
+ * table can be resurrected into either.
+ */
+size_t
+hashtable_striped_persist_size(void *drcontext, hashtable_striped_t *table,
+                               size_t entry_size, void *perscxt,
+                               hasthable_persist_flags_t flags);
+
+/** Equivalent to hashtable_persist() for a striped hashtable. */
+bool
+hashtable_striped_persist(void *drcontext, hashtable_striped_t *table,
+                          size_t entry_size, file_t fd, void *perscxt,
+                          hasthable_persist_flags_t flags);
+
+/** Equivalent to hashtable_resurrect() for a striped hashtable. */
+bool
+hashtable_striped_resurrect(void *drcontext, byte **map /*INOUT*/,
+                            hashtable_striped_t *table, size_t entry_size,
+                            void *perscxt, hasthable_persist_flags_t flags,
+                            bool (*process_payload)(void *key, void *payload,
+                                                    ptr_int_t shift));
+
 /*@}*/ /* end doxygen group */
 
 #ifdef __cplusplus
@@ -161,6 +161,19 @@ static const drmgr_priority_t default_priority = {
 /* We store the current bb phase in a TLS slot. */
 static int tls_idx_bb_phase;
 
+/* We store the per-thread bb analysis cache in a TLS slot. */
+static int tls_idx_bb_cache;
+
+/* Whether each per-instr field is reserved.  Protected by tls_lock. */
+#define MAX_NUM_INSTR_FIELDS 8
+static bool instr_field_taken[MAX_NUM_INSTR_FIELDS];
+
+static void
+drmgr_bb_cache_reset(void *drcontext, instrlist_t *bb);
+
+static void
+drmgr_bb_cache_free(void *drcontext);
+
 static dr_emit_flags_t
 drmgr_bb_event(void *drcontext, void *tag, instrlist_t *bb,
                bool for_trace, bool translating);
@@ -329,6 +342,7 @@ drmgr_init(void)
 #endif
 
     tls_idx_bb_phase = drmgr_register_tls_field();
+    tls_idx_bb_cache = drmgr_register_tls_field();
 
     return true;
 }
@@ -342,6 +356,7 @@ drmgr_exit(void)
     if (count != 0)
         return;
 
+    drmgr_unregister_tls_field(tls_idx_bb_cache);
     drmgr_unregister_tls_field(tls_idx_bb_phase);
 
     drmgr_bb_exit();
@@ -429,6 +444,10 @@ drmgr_bb_event(void *drcontext, void *tag, instrlist_t *bb,
     }
 
     /* Pass 2: analysis */
+    /* The app instrs are final from here on: the shared analysis of them is
+     * computed on the first query and reused by every later pass.
+     */
+    drmgr_bb_cache_reset(drcontext, bb);
     drmgr_set_tls_field(drcontext, tls_idx_bb_phase,
                         (void *)(ptr_int_t)DRMGR_PHASE_ANALYSIS);
     for (quartet_idx = 0, pair_idx = 0, e = cblist_instrumentation; e != NULL;
@@ -485,6 +504,7 @@ drmgr_bb_event(void *drcontext, void *tag, instrlist_t *bb,
 
     drmgr_set_tls_field(drcontext, tls_idx_bb_phase,
                         (void *)(ptr_int_t)DRMGR_PHASE_NONE);
+    drmgr_bb_cache_reset(drcontext, NULL);
 
     if (pair_count > 0)
         dr_thread_free(drcontext, pair_data, sizeof(void*)*pair_count);
@@ -1308,33 +1328,34 @@ drmgr_thread_exit_event(void *drcontext)
         (*e->cb.thread_cb)(drcontext);
     dr_rwlock_read_unlock(thread_event_lock);
 
+    drmgr_bb_cache_free(drcontext);
     drmgr_cls_stack_exit(drcontext);
 }
 
-/* shared by tls and cls */
+/* shared by tls, cls, and per-instr fields */
 static int
-drmgr_reserve_tls_cls_field(bool *taken)
+drmgr_reserve_tls_cls_field(bool *taken, int num)
 {
     int i;
     dr_mutex_lock(tls_lock);
-    for (i = 0; i < MAX_NUM_TLS; i++) {
+    for (i = 0; i < num; i++) {
         if (!taken[i]) {
             taken[i] = true;
             break;
         }
     }
     dr_mutex_unlock(tls_lock);
-    if (i < MAX_NUM_TLS)
+    if (i < num)
         return i;
     else
         return -1;
 }
 
 static bool
-drmgr_unreserve_tls_cls_field(bool *taken, int idx)
+drmgr_unreserve_tls_cls_field(bool *taken, int num, int idx)
 {
     bool res = false;
-    if (idx < 0 || idx > MAX_NUM_TLS)
+    if (idx < 0 || idx >= num)
         return false;
     dr_mutex_lock(tls_lock);
     if (taken[idx]) {
@@ -1350,14 +1371,14 @@ DR_EXPORT
 int
 drmgr_register_tls_field(void)
 {
-    return drmgr_reserve_tls_cls_field(tls_taken);
+    return drmgr_reserve_tls_cls_field(tls_taken, MAX_NUM_TLS);
 }
 
 DR_EXPORT
 bool
 drmgr_unregister_tls_field(int idx)
 {
-    return drmgr_unreserve_tls_cls_field(tls_taken, idx);
+    return drmgr_unreserve_tls_cls_field(tls_taken, MAX_NUM_TLS, idx);
 }
 
 DR_EXPORT
@@ -1698,7 +1719,7 @@ drmgr_register_cls_field(void (*cb_init_func)(void *drcontext, bool new_depth),
     if (!drmgr_generic_event_add(&cblist_cls_exit, cls_event_lock,
                                  (void (*)(void)) cb_exit_func, NULL))
         return -1;
-    return drmgr_reserve_tls_cls_field(cls_taken);
+    return drmgr_reserve_tls_cls_field(cls_taken, MAX_NUM_TLS);
 }
 
 DR_EXPORT
@@ -1711,7 +1732,7 @@ drmgr_unregister_cls_field(void (*cb_init_func)(void *drcontext, bool new_depth)
                                           (void (*)(void)) cb_init_func);
     res = drmgr_generic_event_remove(&cblist_cls_exit, cls_event_lock,
                                      (void (*)(void)) cb_exit_func) && res;
-    res = drmgr_unreserve_tls_cls_field(cls_taken, idx) && res;
+    res = drmgr_unreserve_tls_cls_field(cls_taken, MAX_NUM_TLS, idx) && res;
     return res;
 }
 
@@ -1835,3 +1856,364 @@ drmgr_reserve_note_range(size_t size)
     dr_mutex_unlock(note_lock);
     return res;
 }
+
+/***************************************************************************
+ * SHARED BB ANALYSIS
+ */
+
+#define NUM_LIVE_REGS 15 /* r0 through r14 */
+#define LIVE_ALL (((1U << NUM_LIVE_REGS) - 1) | DRMGR_LIVE_AFLAGS)
+
+#define CPSR_READ_ARITH (CPSR_READ_N|CPSR_READ_Z|CPSR_READ_C|CPSR_READ_V|CPSR_READ_Q)
+#define CPSR_WRITE_NZCV (CPSR_WRITE_N|CPSR_WRITE_Z|CPSR_WRITE_C|CPSR_WRITE_V)
+
+typedef struct _mem_ref_t {
+    opnd_t opnd;
+    bool is_write;
+} mem_ref_t;
+
+/* What we know about one app instr of the current bb */
+typedef struct _app_info_t {
+    instr_t *inst;
+    uint live;      /* before inst */
+    uint mem_start; /* index of its first entry in bb_cache_t.mem */
+    uint mem_count;
+    void *field[MAX_NUM_INSTR_FIELDS];
+} app_info_t;
+
+typedef struct _bb_cache_t {
+    instrlist_t *bb;   /* NULL outside of the analysis phase onward */
+    bool valid;        /* app[] and mem[] describe bb */
+    app_info_t *app;
+    uint app_count;
+    uint app_capacity;
+    mem_ref_t *mem;
+    uint mem_count;
+    uint mem_capacity;
+    uint cursor;       /* index of the last app instr looked up */
+} bb_cache_t;
+
+static bb_cache_t *
+drmgr_bb_cache_get(void *drcontext)
+{
+    bb_cache_t *cache = (bb_cache_t *) drmgr_get_tls_field(drcontext, tls_idx_bb_cache);
+    if (cache == NULL) {
+        cache = (bb_cache_t *) dr_thread_alloc(drcontext, sizeof(*cache));
+        memset(cache, 0, sizeof(*cache));
+        drmgr_set_tls_field(drcontext, tls_idx_bb_cache, (void *)cache);
+    }
+    return cache;
+}
+
+static void
+drmgr_bb_cache_reset(void *drcontext, instrlist_t *bb)
+{
+    bb_cache_t *cache = (bb_cache_t *) drmgr_get_tls_field(drcontext, tls_idx_bb_cache);
+    if (cache == NULL) {
+        if (bb == NULL)
+            return;
+        cache = drmgr_bb_cache_get(drcontext);
+    }
+    cache->bb = bb;
+    cache->valid = false;
+}
+
+static void
+drmgr_bb_cache_free(void *drcontext)
+{
+    bb_cache_t *cache = (bb_cache_t *) drmgr_get_tls_field(drcontext, tls_idx_bb_cache);
+    if (cache == NULL)
+        return;
+    if (cache->app != NULL)
+        dr_thread_free(drcontext, cache->app, cache->app_capacity*sizeof(*cache->app));
+    if (cache->mem != NULL)
+        dr_thread_free(drcontext, cache->mem, cache->mem_capacity*sizeof(*cache->mem));
+    dr_thread_free(drcontext, cache, sizeof(*cache));
+    drmgr_set_tls_field(drcontext, tls_idx_bb_cache, NULL);
+}
+
+static bool
+instr_is_exit(instr_t *inst)
+{
+    return (instr_is_cti(inst) || instr_is_syscall(inst) || instr_is_interrupt(inst));
+}
+
+/* Computes the registers among r0-r14 that inst reads and writes.  Our IR
+ * does not split operands that way: a store lists its Rt as a dst, while
+ * ldm and pop list the registers they load, and mrs its destination, as
+ * srcs.  We only count a register as written when we are sure it is: a
+ * missed kill merely keeps a value live.
+ */
+static void
+get_reg_usage(instr_t *inst, OUT uint *read, OUT uint *written)
+{
+    int opc = instr_get_opcode(inst);
+    bool store = instr_writes_memory(inst);
+    bool loads_list = ((opc >= OP_ldm && opc <= OP_ldmed) || opc == OP_pop);
+    int i, r;
+    *read = 0;
+    *written = 0;
+    for (i = 0; i < instr_num_dsts(inst); i++) {
+        opnd_t opnd = instr_get_dst(inst, i);
+        for (r = 0; r < NUM_LIVE_REGS; r++) {
+            if (!opnd_uses_reg(opnd, DR_REG_R0 + r))
+                continue;
+            /* a store's Rt, and a swap's, is only known to be read */
+            if (opnd_is_reg(opnd) && !store)
+                *written |= 1U << r;
+            else
+                *read |= 1U << r;
+        }
+    }
+    for (i = 0; i < instr_num_srcs(inst); i++) {
+        opnd_t opnd = instr_get_src(inst, i);
+        for (r = 0; r < NUM_LIVE_REGS; r++) {
+            if (!opnd_uses_reg(opnd, DR_REG_R0 + r))
+                continue;
+            if ((loads_list && opnd_is_reglist(opnd)) ||
+                (opc == OP_mrs && opnd_is_reg(opnd)))
+                *written |= 1U << r;
+            else
+                *read |= 1U << r;
+        }
+    }
+    /* strd's second register is implicit */
+    if ((opc == OP_strd_imm || opc == OP_strd_reg) && instr_num_dsts(inst) > 0 &&
+        opnd_is_reg(instr_get_dst(inst, 0))) {
+        r = opnd_get_reg(instr_get_dst(inst, 0)) - DR_REG_R0 + 1;
+        if (r >= 0 && r < NUM_LIVE_REGS)
+            *read |= 1U << r;
+    }
+    if (opc == OP_push || opc == OP_pop)
+        *read |= 1U << (DR_REG_R13 - DR_REG_R0);
+    /* a register that is both read and written stays live */
+    *written &= ~*read;
+}
+
+/* Given the liveness after inst, returns the liveness before it.  A
+ * predicated write may not happen, so it does not kill the prior value.
+ */
+static uint
+live_before(instr_t *inst, uint live_after)
+{
+    uint live = live_after;
+    bool predicated = (instr_get_cond(inst) != COND_ALWAYS);
+    uint cpsr = instr_get_cpsr(inst);
+    uint read, written;
+    if (instr_is_exit(inst))
+        live = LIVE_ALL;
+    get_reg_usage(inst, &read, &written);
+    if (!predicated)
+        live &= ~written;
+    live |= read;
+    if (predicated || (cpsr & CPSR_READ_ARITH) != 0)
+        live |= DRMGR_LIVE_AFLAGS;
+    else if ((cpsr & CPSR_WRITE_NZCV) == CPSR_WRITE_NZCV)
+        live &= ~DRMGR_LIVE_AFLAGS;
+    return live;
+}
+
+static void
+drmgr_bb_cache_add_mem(void *drcontext, bb_cache_t *cache, opnd_t opnd, bool is_write)
+{
+    if (cache->mem_count == cache->mem_capacity) {
+        uint capacity = (cache->mem_capacity == 0) ? 16 : cache->mem_capacity*2;
+        mem_ref_t *mem = (mem_ref_t *) dr_thread_alloc(drcontext, capacity*sizeof(*mem));
+        if (cache->mem != NULL) {
+            memcpy(mem, cache->mem, cache->mem_count*sizeof(*mem));
+            dr_thread_free(drcontext, cache->mem,
+                           cache->mem_capacity*sizeof(*cache->mem));
+        }
+        cache->mem = mem;
+        cache->mem_capacity = capacity;
+    }
+    cache->mem[cache->mem_count].opnd = opnd;
+    cache->mem[cache->mem_count].is_write = is_write;
+    cache->mem_count++;
+}
+
+/* ARM memory operands are usually a mem_reg naming the base, which
+ * opnd_is_memory_reference() does not accept.  Operand position does not
+ * give the direction either (a store's address is a src), so the caller
+ * passes what the opcode does.  A swap's operand is recorded twice: once
+ * read, then written.
+ */
+static void
+drmgr_bb_cache_add_mem_opnd(void *drcontext, bb_cache_t *cache, opnd_t opnd,
+                            bool reads, bool writes)
+{
+    if (!opnd_is_memory_reference(opnd) && !opnd_is_mem_reg(opnd))
+        return;
+    if (reads)
+        drmgr_bb_cache_add_mem(drcontext, cache, opnd, false);
+    if (writes)
+        drmgr_bb_cache_add_mem(drcontext, cache, opnd, true);
+}
+
+/* One forward walk records the app instrs and their memory operands, and
+ * one backward walk over the record computes liveness.  Anything live out
+ * of the block is considered live: we do not look across block boundaries.
+ */
+static void
+drmgr_bb_cache_build(void *drcontext, bb_cache_t *cache)
+{
+    instr_t *inst;
+    uint count = 0, idx, live = LIVE_ALL;
+    bool reads, writes;
+    int i;
+
+    for (inst = instrlist_first(cache->bb); inst != NULL; inst = instr_get_next(inst)) {
+        if (instr_ok_to_mangle(inst))
+            count++;
+    }
+    if (count > cache->app_capacity) {
+        if (cache->app != NULL) {
+            dr_thread_free(drcontext, cache->app,
+                           cache->app_capacity*sizeof(*cache->app));
+        }
+        cache->app_capacity = count*2;
+        cache->app = (app_info_t *)
+            dr_thread_alloc(drcontext, cache->app_capacity*sizeof(*cache->app));
+    }
+    cache->app_count = count;
+    cache->mem_count = 0;
+    cache->cursor = 0;
+
+    for (idx = 0, inst = instrlist_first(cache->bb); inst != NULL;
+         inst = instr_get_next(inst)) {
+        app_info_t *info;
+        if (!instr_ok_to_mangle(inst))
+            continue;
+        info = &cache->app[idx++];
+        memset(info, 0, sizeof(*info));
+        info->inst = inst;
+        info->mem_start = cache->mem_count;
+        reads = instr_reads_memory(inst);
+        writes = instr_writes_memory(inst);
+        if (reads || writes) {
+            for (i = 0; i < instr_num_srcs(inst); i++)
+                drmgr_bb_cache_add_mem_opnd(drcontext, cache, instr_get_src(inst, i),
+                                            reads, writes);
+            for (i = 0; i < instr_num_dsts(inst); i++)
+                drmgr_bb_cache_add_mem_opnd(drcontext, cache, instr_get_dst(inst, i),
+                                            reads, writes);
+        }
+        info->mem_count = cache->mem_count - info->mem_start;
+    }
+    ASSERT(idx == count, "app instr count mismatch");
+
+    while (idx > 0) {
+        idx--;
+        live = live_before(cache->app[idx].inst, live);
+        cache->app[idx].live = live;
+    }
+    cache->valid = true;
+}
+
+/* Returns the record for app instr inst of the bb being built, or NULL.
+ * Passes normally visit instrs in order, so we look next to the previous
+ * lookup before scanning.
+ */
+static app_info_t *
+drmgr_bb_cache_lookup(void *drcontext, instr_t *inst)
+{
+    bb_cache_t *cache;
+    uint i;
+    if (inst == NULL || !instr_ok_to_mangle(inst))
+        return NULL;
+    cache = (bb_cache_t *) drmgr_get_tls_field(drcontext, tls_idx_bb_cache);
+    if (cache == NULL || cache->bb == NULL)
+        return NULL;
+    if (!cache->valid)
+        drmgr_bb_cache_build(drcontext, cache);
+    if (cache->app_count == 0)
+        return NULL;
+    if (cache->app[cache->cursor].inst == inst)
+        return &cache->app[cache->cursor];
+    if (cache->cursor + 1 < cache->app_count &&
+        cache->app[cache->cursor + 1].inst == inst) {
+        cache->cursor++;
+        return &cache->app[cache->cursor];
+    }
+    for (i = 0; i < cache->app_count; i++) {
+        if (cache->app[i].inst == inst) {
+            cache->cursor = i;
+            return &cache->app[i];
+        }
+    }
+    return NULL;
+}
+
+DR_EXPORT
+bool
+drmgr_get_liveness(void *drcontext, instr_t *inst, OUT uint *live)
+{
+    app_info_t *info = drmgr_bb_cache_lookup(drcontext, inst);
+    if (info == NULL || live == NULL)
+        return false;
+    *live = info->live;
+    return true;
+}
+
+DR_EXPORT
+bool
+drmgr_get_mem_opnd(void *drcontext, instr_t *inst, uint index,
+                   OUT opnd_t *opnd, OUT bool *is_write)
+{
+    app_info_t *info = drmgr_bb_cache_lookup(drcontext, inst);
+    bb_cache_t *cache;
+    if (info == NULL || index >= info->mem_count)
+        return false;
+    cache = (bb_cache_t *) drmgr_get_tls_field(drcontext, tls_idx_bb_cache);
+    if (opnd != NULL)
+        *opnd = cache->mem[info->mem_start + index].opnd;
+    if (is_write != NULL)
+        *is_write = cache->mem[info->mem_start + index].is_write;
+    return true;
+}
+
+/***************************************************************************
+ * PER-INSTRUCTION FIELDS
+ */
+
+DR_EXPORT
+int
+drmgr_register_instr_field(void)
+{
+    return drmgr_reserve_tls_cls_field(instr_field_taken, MAX_NUM_INSTR_FIELDS);
+}
+
+DR_EXPORT
+bool
+drmgr_unregister_instr_field(int idx)
+{
+    return drmgr_unreserve_tls_cls_field(instr_field_taken, MAX_NUM_INSTR_FIELDS, idx);
+}
+
+DR_EXPORT
+void *
+drmgr_get_instr_field(void *drcontext, instr_t *inst, int idx)
+{
+    app_info_t *info;
+    if (idx < 0 || idx >= MAX_NUM_INSTR_FIELDS)
+        return NULL;
+    info = drmgr_bb_cache_lookup(drcontext, inst);
+    if (info == NULL)
+        return NULL;
+    return info->field[idx];
+}
+
+DR_EXPORT
+bool
+drmgr_set_instr_field(void *drcontext, instr_t *inst, int idx, void *value)
+{
+    app_info_t *info;
+    if (idx < 0 || idx >= MAX_NUM_INSTR_FIELDS)
+        return false;
+    ASSERT(instr_field_taken[idx], "usage error: setting instr field that is not reserved");
+    info = drmgr_bb_cache_lookup(drcontext, inst);
+    if (info == NULL)
+        return false;
+    info->field[idx] = value;
+    return true;
+}
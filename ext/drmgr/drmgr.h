@@ -668,6 +668,102 @@ DR_EXPORT
 ptr_uint_t
 drmgr_reserve_note_range(size_t size);
 
+/***************************************************************************
+ * SHARED BB ANALYSIS
+ */
+
+/**
+ * The bit for \p reg, one of DR_REG_R0 through DR_REG_R14, in the mask
+ * returned by drmgr_get_liveness().
+ */
+#define DRMGR_LIVE_REG(reg) (1U << ((reg) - DR_REG_R0))
+
+/** The bit for the arithmetic flags in the mask returned by drmgr_get_liveness(). */
+#define DRMGR_LIVE_AFLAGS (1U << 15)
+
+DR_EXPORT
+/**
+ * Returns in \p live which application values may be read at or after
+ * the application instruction \p inst, as a mask of DRMGR_LIVE_REG() bits
+ * and #DRMGR_LIVE_AFLAGS.  Values live out of the block are considered
+ * live.  A register or the flags whose bit is clear may be clobbered by
+ * instrumentation inserted prior to \p inst without being preserved.
+ *
+ * drmgr computes liveness for the whole block the first time any
+ * component asks for it after the app2app stage, and all components share
+ * the result, so it is much cheaper than each one walking the block
+ * itself.  \p inst must be an application instruction of the block being
+ * built, and this must be called from the analysis, insertion, or
+ * instru2instru stage.
+ *
+ * \return whether successful.
+ */
+bool
+drmgr_get_liveness(void *drcontext, instr_t *inst, OUT uint *live);
+
+DR_EXPORT
+/**
+ * Returns the \p index-th memory operand of the application instruction
+ * \p inst, in operand order, with \p is_write set if \p inst stores
+ * through it.  This is usually the mem_reg naming the base register.
+ * Whether an access is a read or a write depends on the opcode, as in
+ * instr_reads_memory() and instr_writes_memory().  A swap's operand is
+ * returned twice, first as a read and then as a write.  The implicit
+ * stack accesses of push and pop are not included.  Either OUT parameter
+ * may be NULL.  Like
+ * drmgr_get_liveness(), the operands of the whole block are gathered once
+ * and shared among components, under the same restrictions.
+ *
+ * \return false if \p inst has no \p index-th memory operand.
+ */
+bool
+drmgr_get_mem_opnd(void *drcontext, instr_t *inst, uint index,
+                   OUT opnd_t *opnd, OUT bool *is_write);
+
+/***************************************************************************
+ * PER-INSTRUCTION FIELDS
+ */
+
+DR_EXPORT
+/**
+ * Reserves a field that each application instruction of the block being
+ * built can hold, for passing data from a component's analysis stage to
+ * its later stages without a side table keyed by \p instr_t pointer.
+ * The field is NULL for every instruction at the start of the analysis
+ * stage of each block.  Up to 8 fields can be reserved.
+ *
+ * \return the index of the field, or -1 on failure.
+ */
+int
+drmgr_register_instr_field(void);
+
+DR_EXPORT
+/**
+ * Frees a field reserved by drmgr_register_instr_field().
+ */
+bool
+drmgr_unregister_instr_field(int idx);
+
+DR_EXPORT
+/**
+ * Returns the value of field \p idx for the application instruction \p
+ * inst of the block being built, or NULL if \p inst is not one.  Can be
+ * called from the analysis, insertion, or instru2instru stage.
+ */
+void *
+drmgr_get_instr_field(void *drcontext, instr_t *inst, int idx);
+
+DR_EXPORT
+/**
+ * Sets field \p idx of the application instruction \p inst of the block
+ * being built to \p value.  Can be called from the analysis, insertion,
+ * or instru2instru stage.
+ *
+ * \return false if \p inst is not an application instruction of the block.
+ */
+bool
+drmgr_set_instr_field(void *drcontext, instr_t *inst, int idx, void *value);
+
 /***************************************************************************
  * UTILITIES
  */
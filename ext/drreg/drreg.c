@@ -0,0 +1,927 @@
+/* **********************************************************
+ * Copyright (c) 2013 Google, Inc.   All rights reserved.
+ * **********************************************************/
+
+/* drreg: DynamoRIO Register Management Extension
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;
+ * version 2.1 of the License, and no later version.
+
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Library General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* DynamoRIO Register Management Extension: arbitrates scratch registers
+ * among instrumentation passes, spilling only what is live.
+ */
+
+#include "dr_api.h"
+#include "drmgr.h"
+#include "drreg.h"
+#include <string.h> /* memset */
+
+/* currently using asserts on internal logic sanity checks (never on
+ * input from user)
+ */
+#ifdef DEBUG
+# define ASSERT(x, msg) DR_ASSERT_MSG(x, msg)
+#else
+# define ASSERT(x, msg) /* nothing */
+#endif
+
+/* There are cases where notifying the user is the right thing, even for a library.
+ * Holding a reservation across an app instr that uses the register cannot be
+ * recovered from silently.
+ */
+#define USAGE_ERROR(msg) do { \
+    dr_fprintf(STDERR, "FATAL USAGE ERROR: %s\n", msg); \
+    dr_abort(); \
+} while (0);
+
+/* check if all bits in mask are set in var */
+#define TESTALL(mask, var) (((mask) & (var)) == (mask))
+/* check if any bit in mask is set in var */
+#define TESTANY(mask, var) (((mask) & (var)) != 0)
+/* check if a single bit is set in var */
+#define TEST TESTANY
+
+#define PRE instrlist_meta_preinsert
+
+/* Liveness is a bitmask per app instr: bit i for r<i>, plus one bit for
+ * the arithmetic flags.  A set bit means the app value may be read before
+ * it is next written.
+ */
+#define LIVE_AFLAGS (1U << DRREG_NUM_GPRS)
+#define LIVE_ALL    (DRREG_ALLOW_ALL | LIVE_AFLAGS)
+
+#define CPSR_READ_ARITH (CPSR_READ_N|CPSR_READ_Z|CPSR_READ_C|CPSR_READ_V|CPSR_READ_Q)
+#define CPSR_WRITE_NZCV (CPSR_WRITE_N|CPSR_WRITE_Z|CPSR_WRITE_C|CPSR_WRITE_V)
+
+/* The msr field mask selecting APSR.nzcvq */
+#define MSR_MASK_NZCVQ 0x2
+
+/* TLS slot layout: the flags, a slot for the register we borrow to move the
+ * flags, and then the gpr slots.
+ */
+enum {
+    AFLAGS_SLOT,
+    AFLAGS_TMP_SLOT,
+    GPR_SLOT_BASE,
+};
+#define MAX_SPILL_SLOTS 32
+#define NO_SLOT ((uint)-1)
+
+typedef struct _reg_info_t {
+    /* reserved by an instrumentation pass */
+    bool in_use;
+    /* the register holds the app value */
+    bool native;
+    /* when !native, the slot holding the app value, or NO_SLOT if the app
+     * value was dead when we took the register
+     */
+    uint slot;
+} reg_info_t;
+
+typedef struct _per_thread_t {
+    /* liveness before the app instr being instrumented */
+    uint cur_live;
+    instr_t *last_app;
+    reg_info_t reg[DRREG_NUM_GPRS];
+    reg_info_t aflags;
+    /* bitmask of occupied gpr slots */
+    uint slot_used;
+    /* whether DR's TLS base is installed in TPIDRURW for this thread */
+    bool tls_in_tpidrurw;
+    /* what slot_offs() is relative to: DR's TLS base, or else our own
+     * per-thread slots less tls_offs
+     */
+    byte *slot_base;
+    /* our own slots, when DR has no TLS base to put them in */
+    reg_t *private_slots;
+} per_thread_t;
+
+static int drreg_init_count;
+static int tls_idx = -1;
+static reg_id_t tls_seg;
+static uint tls_offs;
+static uint num_gpr_slots;
+
+static dr_emit_flags_t
+drreg_event_bb_analysis(void *drcontext, void *tag, instrlist_t *bb,
+                        bool for_trace, bool translating, OUT void **user_data);
+
+static dr_emit_flags_t
+drreg_event_bb_insert_early(void *drcontext, void *tag, instrlist_t *bb, instr_t *inst,
+                            bool for_trace, bool translating, void *user_data);
+
+static dr_emit_flags_t
+drreg_event_bb_insert_late_analysis(void *drcontext, void *tag, instrlist_t *bb,
+                                    bool for_trace, bool translating,
+                                    OUT void **user_data);
+
+static dr_emit_flags_t
+drreg_event_bb_insert_late(void *drcontext, void *tag, instrlist_t *bb, instr_t *inst,
+                           bool for_trace, bool translating, void *user_data);
+
+static bool
+drreg_event_restore_state(void *drcontext, bool restore_memory,
+                          dr_restore_state_info_t *info);
+
+static void
+drreg_thread_init(void *drcontext);
+
+static void
+drreg_thread_exit(void *drcontext);
+
+/***************************************************************************
+ * SPILLING AND RESTORING
+ */
+
+static uint
+cur_live(per_thread_t *pt)
+{
+    return pt->cur_live;
+}
+
+/* Instrs in the sequence that loads the slot base when it is not in TPIDRURW */
+#define ABS_BASE_LOAD_LEN 4
+
+/* The slots are reached through the base of DR's TLS, which lives in
+ * TPIDRURW: there is no segment addressing to name them directly.  DR only
+ * installs that base when built with HAVE_TLS, and otherwise TPIDRURW holds
+ * whatever the app put there.  Then we use our own per-thread slots and
+ * name their address as a constant, which is safe because without a TLS
+ * base DR keeps every code cache thread-private (checked in drreg_init()).
+ * The constant always takes ABS_BASE_LOAD_LEN instrs, one per byte, so
+ * drreg_event_restore_state() can recognize it.
+ */
+static void
+load_slot_base(void *drcontext, per_thread_t *pt, instrlist_t *ilist, instr_t *where,
+               reg_id_t base)
+{
+    uint addr = (uint)(ptr_uint_t) pt->slot_base;
+    uint imm12;
+    int shift;
+    if (pt->tls_in_tpidrurw) {
+        PRE(ilist, where, INSTR_CREATE_mrc(drcontext, opnd_create_reg(base),
+                                           opnd_create_reg(DR_REG_TPIDRURW),
+                                           COND_ALWAYS));
+        return;
+    }
+    opnd_encode_modified_imm(addr & 0xff000000, &imm12);
+    PRE(ilist, where, INSTR_CREATE_mov_imm(drcontext, opnd_create_reg(base),
+                                           OPND_CREATE_IMM12(imm12), COND_ALWAYS));
+    for (shift = 16; shift >= 0; shift -= 8) {
+        opnd_encode_modified_imm(addr & (0xffU << shift), &imm12);
+        PRE(ilist, where, INSTR_CREATE_orr_imm(drcontext, opnd_create_reg(base),
+                                               opnd_create_reg(base),
+                                               OPND_CREATE_IMM12(imm12), COND_ALWAYS));
+    }
+}
+
+static uint
+slot_offs(uint slot)
+{
+    return tls_offs + slot*sizeof(reg_t);
+}
+
+/* New ldr/str have post-indexed, subtracting addressing: we want [base, #+offs] */
+static instr_t *
+slot_access(void *drcontext, instr_t *inst)
+{
+    instr_set_p_flag(drcontext, inst, true);
+    instr_set_u_flag(drcontext, inst, true);
+    instr_set_w_flag(drcontext, inst, false);
+    return inst;
+}
+
+/* Single-register push (str [sp, #-4]!) or pop (ldr [sp], #4) */
+static instr_t *
+stack_access(void *drcontext, bool push, instr_t *inst)
+{
+    instr_set_p_flag(drcontext, inst, push);
+    instr_set_u_flag(drcontext, inst, !push);
+    instr_set_w_flag(drcontext, inst, push);
+    return inst;
+}
+
+/* Returns a register other than avoid whose value can be clobbered to hold
+ * the TLS base: not reserved, and its app value is dead or already displaced.
+ */
+static reg_id_t
+find_base_reg(per_thread_t *pt, reg_id_t avoid)
+{
+    uint live = cur_live(pt);
+    int i;
+    for (i = 0; i < DRREG_NUM_GPRS; i++) {
+        reg_info_t *ri = &pt->reg[i];
+        if (DR_REG_R0 + i != avoid && !ri->in_use &&
+            (!ri->native || !TEST(1U << i, live)))
+            return DR_REG_R0 + i;
+    }
+    return DR_REG_NULL;
+}
+
+static void
+spill_reg(void *drcontext, per_thread_t *pt, instrlist_t *ilist, instr_t *where,
+          reg_id_t reg, uint slot)
+{
+    reg_id_t base = find_base_reg(pt, reg);
+    bool borrowed = false;
+    if (base == DR_REG_NULL) {
+        /* Every other register is reserved or live: borrow one across the
+         * store, preserving it on the app stack with a push and pop.
+         */
+        int i;
+        for (i = 0; i < DRREG_NUM_GPRS; i++) {
+            if (DR_REG_R0 + i != reg && !pt->reg[i].in_use)
+                break;
+        }
+        ASSERT(i < DRREG_NUM_GPRS, "no register to hold the TLS base");
+        base = DR_REG_R0 + i;
+        borrowed = true;
+        PRE(ilist, where, stack_access(drcontext, true,
+                                       INSTR_CREATE_str_imm
+                                       (drcontext, opnd_create_reg(base),
+                                        opnd_create_mem_reg(DR_REG_R13),
+                                        OPND_CREATE_IMM12(sizeof(reg_t)),
+                                        COND_ALWAYS)));
+    }
+    load_slot_base(drcontext, pt, ilist, where, base);
+    PRE(ilist, where,
+        slot_access(drcontext,
+                    INSTR_CREATE_str_imm(drcontext, opnd_create_reg(reg),
+                                         opnd_create_mem_reg(base),
+                                         OPND_CREATE_IMM12(slot_offs(slot)),
+                                         COND_ALWAYS)));
+    if (borrowed) {
+        PRE(ilist, where, stack_access(drcontext, false,
+                                       INSTR_CREATE_ldr_imm
+                                       (drcontext, opnd_create_reg(base),
+                                        opnd_create_mem_reg(DR_REG_R13),
+                                        OPND_CREATE_IMM12(sizeof(reg_t)),
+                                        COND_ALWAYS)));
+    }
+}
+
+/* reg doubles as the base register, so no other register is needed */
+static void
+restore_reg(void *drcontext, per_thread_t *pt, instrlist_t *ilist, instr_t *where,
+            reg_id_t reg, uint slot)
+{
+    load_slot_base(drcontext, pt, ilist, where, reg);
+    PRE(ilist, where,
+        slot_access(drcontext,
+                    INSTR_CREATE_ldr_imm(drcontext, opnd_create_reg(reg),
+                                         opnd_create_mem_reg(reg),
+                                         OPND_CREATE_IMM12(slot_offs(slot)),
+                                         COND_ALWAYS)));
+}
+
+static uint
+find_free_slot(per_thread_t *pt)
+{
+    uint i;
+    for (i = 0; i < num_gpr_slots; i++) {
+        if (!TEST(1U << i, pt->slot_used)) {
+            pt->slot_used |= 1U << i;
+            return GPR_SLOT_BASE + i;
+        }
+    }
+    return NO_SLOT;
+}
+
+static void
+release_slot(per_thread_t *pt, uint slot)
+{
+    if (slot == NO_SLOT)
+        return;
+    ASSERT(slot >= GPR_SLOT_BASE && TEST(1U << (slot - GPR_SLOT_BASE), pt->slot_used),
+           "releasing unused slot");
+    pt->slot_used &= ~(1U << (slot - GPR_SLOT_BASE));
+}
+
+/* Returns a register that can hold the flags while they are moved to or from
+ * their slot.  A register that is not reserved and whose app value is dead or
+ * already displaced can be clobbered freely; otherwise we borrow one and
+ * preserve it in AFLAGS_TMP_SLOT, setting *borrowed.
+ */
+static reg_id_t
+get_flags_scratch(per_thread_t *pt, bool *borrowed)
+{
+    uint live = cur_live(pt);
+    int i;
+    for (i = 0; i < DRREG_NUM_GPRS; i++) {
+        reg_info_t *ri = &pt->reg[i];
+        if (!ri->in_use && (!ri->native || !TEST(1U << i, live))) {
+            *borrowed = false;
+            return DR_REG_R0 + i;
+        }
+    }
+    for (i = 0; i < DRREG_NUM_GPRS; i++) {
+        if (!pt->reg[i].in_use) {
+            *borrowed = true;
+            return DR_REG_R0 + i;
+        }
+    }
+    return DR_REG_NULL;
+}
+
+static bool
+save_aflags(void *drcontext, per_thread_t *pt, instrlist_t *ilist, instr_t *where)
+{
+    bool borrowed;
+    reg_id_t scratch = get_flags_scratch(pt, &borrowed);
+    if (scratch == DR_REG_NULL)
+        return false;
+    if (borrowed)
+        spill_reg(drcontext, pt, ilist, where, scratch, AFLAGS_TMP_SLOT);
+    PRE(ilist, where, INSTR_CREATE_mrs(drcontext, opnd_create_reg(scratch),
+                                       COND_ALWAYS));
+    spill_reg(drcontext, pt, ilist, where, scratch, AFLAGS_SLOT);
+    if (borrowed)
+        restore_reg(drcontext, pt, ilist, where, scratch, AFLAGS_TMP_SLOT);
+    return true;
+}
+
+static void
+restore_aflags(void *drcontext, per_thread_t *pt, instrlist_t *ilist, instr_t *where)
+{
+    bool borrowed;
+    reg_id_t scratch = get_flags_scratch(pt, &borrowed);
+    ASSERT(scratch != DR_REG_NULL, "all registers reserved");
+    if (borrowed)
+        spill_reg(drcontext, pt, ilist, where, scratch, AFLAGS_TMP_SLOT);
+    restore_reg(drcontext, pt, ilist, where, scratch, AFLAGS_SLOT);
+    PRE(ilist, where, INSTR_CREATE_msr_reg(drcontext, opnd_create_reg(scratch),
+                                           opnd_create_immed_int(MSR_MASK_NZCVQ,
+                                                                 OPSZ_4_2),
+                                           COND_ALWAYS));
+    if (borrowed)
+        restore_reg(drcontext, pt, ilist, where, scratch, AFLAGS_TMP_SLOT);
+}
+
+/***************************************************************************
+ * LIVENESS
+ */
+
+static bool
+instr_is_exit(instr_t *inst)
+{
+    return (instr_is_cti(inst) || instr_is_syscall(inst) || instr_is_interrupt(inst));
+}
+
+/* Liveness is computed once per block by drmgr and shared with other
+ * components: we just translate its mask into ours.
+ */
+static uint
+app_live(void *drcontext, instr_t *inst)
+{
+    uint live, res;
+    if (!drmgr_get_liveness(drcontext, inst, &live))
+        return LIVE_ALL;
+    res = live & DRREG_ALLOW_ALL;
+    if (TEST(DRMGR_LIVE_AFLAGS, live))
+        res |= LIVE_AFLAGS;
+    return res;
+}
+
+static dr_emit_flags_t
+drreg_event_bb_analysis(void *drcontext, void *tag, instrlist_t *bb,
+                        bool for_trace, bool translating, OUT void **user_data)
+{
+    per_thread_t *pt = (per_thread_t *) drmgr_get_tls_field(drcontext, tls_idx);
+    instr_t *inst;
+    int i;
+
+    pt->cur_live = LIVE_ALL;
+    pt->last_app = NULL;
+    for (inst = instrlist_last(bb); inst != NULL; inst = instr_get_prev(inst)) {
+        if (instr_ok_to_mangle(inst)) {
+            pt->last_app = inst;
+            break;
+        }
+    }
+
+    /* The previous block must have restored everything */
+    for (i = 0; i < DRREG_NUM_GPRS; i++) {
+        ASSERT(!pt->reg[i].in_use && pt->reg[i].native, "reg state leaked across bbs");
+        pt->reg[i].in_use = false;
+        pt->reg[i].native = true;
+        pt->reg[i].slot = NO_SLOT;
+    }
+    pt->aflags.in_use = false;
+    pt->aflags.native = true;
+    pt->aflags.slot = NO_SLOT;
+    pt->slot_used = 0;
+    return DR_EMIT_DEFAULT;
+}
+
+static dr_emit_flags_t
+drreg_event_bb_insert_early(void *drcontext, void *tag, instrlist_t *bb, instr_t *inst,
+                            bool for_trace, bool translating, void *user_data)
+{
+    per_thread_t *pt = (per_thread_t *) drmgr_get_tls_field(drcontext, tls_idx);
+    if (instr_ok_to_mangle(inst))
+        pt->cur_live = app_live(drcontext, inst);
+    return DR_EMIT_DEFAULT;
+}
+
+static dr_emit_flags_t
+drreg_event_bb_insert_late_analysis(void *drcontext, void *tag, instrlist_t *bb,
+                                    bool for_trace, bool translating,
+                                    OUT void **user_data)
+{
+    /* all the analysis is done in the early pass */
+    return DR_EMIT_DEFAULT;
+}
+
+/* Restores app values before inst if inst needs them or shows them to be
+ * dead.  A dead value is restored rather than forgotten: left in its slot,
+ * drreg_event_restore_state() would put it back over the app's next write.
+ */
+static dr_emit_flags_t
+drreg_event_bb_insert_late(void *drcontext, void *tag, instrlist_t *bb, instr_t *inst,
+                           bool for_trace, bool translating, void *user_data)
+{
+    per_thread_t *pt = (per_thread_t *) drmgr_get_tls_field(drcontext, tls_idx);
+    bool exiting;
+    uint live;
+    int i;
+
+    if (!instr_ok_to_mangle(inst))
+        return DR_EMIT_DEFAULT;
+    exiting = (inst == pt->last_app || instr_is_exit(inst));
+    live = cur_live(pt);
+
+    /* Flags first, as restoring them may use a gpr whose app value is about
+     * to be restored.
+     */
+    if (!pt->aflags.native) {
+        uint cpsr = instr_get_cpsr(inst);
+        bool reads = (instr_get_cond(inst) != COND_ALWAYS ||
+                      TESTANY(CPSR_READ_ARITH, cpsr));
+        if (pt->aflags.in_use &&
+            (exiting || reads || TESTANY(CPSR_WRITE_NZCV, cpsr)))
+            USAGE_ERROR("drreg: aflags reserved across an app instr that uses them");
+        if (!pt->aflags.in_use) {
+            if (!TEST(LIVE_AFLAGS, live) || exiting || reads) {
+                if (pt->aflags.slot != NO_SLOT)
+                    restore_aflags(drcontext, pt, bb, inst);
+                pt->aflags.native = true;
+                pt->aflags.slot = NO_SLOT;
+            }
+        }
+    }
+
+    for (i = 0; i < DRREG_NUM_GPRS; i++) {
+        reg_info_t *ri = &pt->reg[i];
+        reg_id_t reg = DR_REG_R0 + i;
+        bool uses;
+        if (ri->native)
+            continue;
+        uses = instr_uses_reg(inst, reg);
+        if (ri->in_use) {
+            if (exiting || uses)
+                USAGE_ERROR("drreg: register reserved across an app instr that uses it");
+            continue;
+        }
+        if (TEST(1U << i, live) && !exiting && !instr_reads_from_reg(inst, reg))
+            continue;
+        ASSERT(ri->slot != NO_SLOT || !TEST(1U << i, live),
+               "live app value was not spilled");
+        if (ri->slot != NO_SLOT)
+            restore_reg(drcontext, pt, bb, inst, reg, ri->slot);
+        release_slot(pt, ri->slot);
+        ri->slot = NO_SLOT;
+        ri->native = true;
+    }
+    return DR_EMIT_DEFAULT;
+}
+
+/***************************************************************************
+ * RESERVATION
+ */
+
+DR_EXPORT
+drreg_status_t
+drreg_reserve_register(void *drcontext, instrlist_t *ilist, instr_t *where,
+                       uint allowed, OUT reg_id_t *reg_out)
+{
+    per_thread_t *pt = (per_thread_t *) drmgr_get_tls_field(drcontext, tls_idx);
+    uint live = cur_live(pt);
+    int i, pick = -1;
+    if (reg_out == NULL || (allowed & DRREG_ALLOW_ALL) == 0)
+        return DRREG_ERROR_INVALID_PARAMETER;
+
+    /* Prefer a register already taken from the app and not yet restored,
+     * then one whose app value is dead, and only then spill.
+     */
+    for (i = 0; i < DRREG_NUM_GPRS; i++) {
+        if (TEST(1U << i, allowed) && !pt->reg[i].in_use && !pt->reg[i].native) {
+            pick = i;
+            break;
+        }
+    }
+    if (pick < 0) {
+        for (i = 0; i < DRREG_NUM_GPRS; i++) {
+            if (TEST(1U << i, allowed) && !pt->reg[i].in_use &&
+                !TEST(1U << i, live)) {
+                pick = i;
+                pt->reg[i].slot = NO_SLOT;
+                break;
+            }
+        }
+    }
+    if (pick < 0) {
+        for (i = 0; i < DRREG_NUM_GPRS; i++) {
+            if (TEST(1U << i, allowed) && !pt->reg[i].in_use)
+                break;
+        }
+        if (i == DRREG_NUM_GPRS)
+            return DRREG_ERROR_REG_CONFLICT;
+        pt->reg[i].slot = find_free_slot(pt);
+        if (pt->reg[i].slot == NO_SLOT)
+            return DRREG_ERROR_OUT_OF_SLOTS;
+        pick = i;
+        spill_reg(drcontext, pt, ilist, where, DR_REG_R0 + pick, pt->reg[pick].slot);
+    }
+    pt->reg[pick].in_use = true;
+    pt->reg[pick].native = false;
+    *reg_out = DR_REG_R0 + pick;
+    return DRREG_SUCCESS;
+}
+
+DR_EXPORT
+drreg_status_t
+drreg_unreserve_register(void *drcontext, instrlist_t *ilist, instr_t *where,
+                         reg_id_t reg)
+{
+    per_thread_t *pt = (per_thread_t *) drmgr_get_tls_field(drcontext, tls_idx);
+    if (reg < DR_REG_R0 || reg >= DR_REG_R0 + DRREG_NUM_GPRS ||
+        !pt->reg[reg - DR_REG_R0].in_use)
+        return DRREG_ERROR_INVALID_PARAMETER;
+    /* the restore, if any, is done lazily by drreg_event_bb_insert_late() */
+    pt->reg[reg - DR_REG_R0].in_use = false;
+    return DRREG_SUCCESS;
+}
+
+DR_EXPORT
+drreg_status_t
+drreg_reserve_aflags(void *drcontext, instrlist_t *ilist, instr_t *where)
+{
+    per_thread_t *pt = (per_thread_t *) drmgr_get_tls_field(drcontext, tls_idx);
+    if (pt->aflags.in_use)
+        return DRREG_ERROR_IN_USE;
+    if (pt->aflags.native) {
+        if (TEST(LIVE_AFLAGS, cur_live(pt))) {
+            if (!save_aflags(drcontext, pt, ilist, where))
+                return DRREG_ERROR_REG_CONFLICT;
+            pt->aflags.slot = AFLAGS_SLOT;
+        } else
+            pt->aflags.slot = NO_SLOT;
+        pt->aflags.native = false;
+    }
+    pt->aflags.in_use = true;
+    return DRREG_SUCCESS;
+}
+
+DR_EXPORT
+drreg_status_t
+drreg_unreserve_aflags(void *drcontext, instrlist_t *ilist, instr_t *where)
+{
+    per_thread_t *pt = (per_thread_t *) drmgr_get_tls_field(drcontext, tls_idx);
+    if (!pt->aflags.in_use)
+        return DRREG_ERROR_INVALID_PARAMETER;
+    pt->aflags.in_use = false;
+    return DRREG_SUCCESS;
+}
+
+/***************************************************************************
+ * QUERIES
+ */
+
+DR_EXPORT
+drreg_status_t
+drreg_get_app_value(void *drcontext, instrlist_t *ilist, instr_t *where,
+                    reg_id_t app_reg, reg_id_t dst_reg)
+{
+    per_thread_t *pt = (per_thread_t *) drmgr_get_tls_field(drcontext, tls_idx);
+    reg_info_t *ri;
+    if (app_reg < DR_REG_R0 || app_reg >= DR_REG_R0 + DRREG_NUM_GPRS ||
+        !reg_is_gpr(dst_reg))
+        return DRREG_ERROR_INVALID_PARAMETER;
+    ri = &pt->reg[app_reg - DR_REG_R0];
+    if (ri->native) {
+        if (dst_reg != app_reg) {
+            PRE(ilist, where, INSTR_CREATE_mov_reg(drcontext, opnd_create_reg(dst_reg),
+                                                   opnd_create_reg(app_reg),
+                                                   COND_ALWAYS));
+        }
+        return DRREG_SUCCESS;
+    }
+    if (ri->slot == NO_SLOT)
+        return DRREG_ERROR_NO_APP_VALUE;
+    restore_reg(drcontext, pt, ilist, where, dst_reg, ri->slot);
+    return DRREG_SUCCESS;
+}
+
+DR_EXPORT
+drreg_status_t
+drreg_is_register_dead(void *drcontext, reg_id_t reg, OUT bool *dead)
+{
+    per_thread_t *pt = (per_thread_t *) drmgr_get_tls_field(drcontext, tls_idx);
+    if (dead == NULL || reg < DR_REG_R0 || reg >= DR_REG_R0 + DRREG_NUM_GPRS)
+        return DRREG_ERROR_INVALID_PARAMETER;
+    *dead = !TEST(1U << (reg - DR_REG_R0), cur_live(pt));
+    return DRREG_SUCCESS;
+}
+
+DR_EXPORT
+drreg_status_t
+drreg_are_aflags_dead(void *drcontext, OUT bool *dead)
+{
+    per_thread_t *pt = (per_thread_t *) drmgr_get_tls_field(drcontext, tls_idx);
+    if (dead == NULL)
+        return DRREG_ERROR_INVALID_PARAMETER;
+    *dead = !TEST(LIVE_AFLAGS, cur_live(pt));
+    return DRREG_SUCCESS;
+}
+
+/***************************************************************************
+ * RESTORE STATE
+ */
+
+/* Raw encodings of the instructions we insert, all unconditional.  The
+ * decoder does not fill in mrc operands, so we match the bits ourselves.
+ */
+#define RAW_COND_MASK          0xf0000000
+#define RAW_MRC_TPIDRURW_MASK  0xffff0fff
+#define RAW_MRC_TPIDRURW       0xee1d0f50 /* mrc p15, 0, Rt, c13, c0, 2 */
+#define RAW_LDR_STR_IMM_MASK   0xfff00000
+#define RAW_STR_IMM            0xe5800000 /* str Rt, [Rn, #+imm12] */
+#define RAW_LDR_IMM            0xe5900000 /* ldr Rt, [Rn, #+imm12] */
+#define RAW_PUSH_POP_MASK      0xffff0fff
+#define RAW_PUSH               0xe52d0004 /* str Rt, [sp, #-4]! */
+#define RAW_POP                0xe49d0004 /* ldr Rt, [sp], #4 */
+#define RAW_MSR_REG_MASK       0xfff0fff0
+#define RAW_MSR_REG            0xe120f000 /* msr APSR_<mask>, Rn */
+#define RAW_MOV_IMM_MASK       0xffff0000
+#define RAW_MOV_IMM            0xe3a00000 /* mov Rd, #imm12 */
+#define RAW_ORR_IMM_MASK       0xfff00000
+#define RAW_ORR_IMM            0xe3800000 /* orr Rd, Rn, #imm12 */
+#define RAW_RT(word) (((word) >> 12) & 0xf)
+#define RAW_RN(word) (((word) >> 16) & 0xf)
+#define RAW_IMM12(word) ((word) & 0xfff)
+
+/* The APSR bits our msr writes back */
+#define CPSR_NZCVQ 0xf8000000
+
+/* Returns the register that the load_slot_base() sequence starting at pc
+ * loads the slot base into, or -1 if pc does not start one.
+ */
+static int
+raw_base_load(per_thread_t *pt, uint *pc)
+{
+    uint rd, val;
+    int i;
+    if (pt->tls_in_tpidrurw) {
+        if ((pc[0] & RAW_MRC_TPIDRURW_MASK) != RAW_MRC_TPIDRURW)
+            return -1;
+        return RAW_RT(pc[0]);
+    }
+    if ((pc[0] & RAW_MOV_IMM_MASK) != RAW_MOV_IMM)
+        return -1;
+    rd = RAW_RT(pc[0]);
+    val = opnd_decode_modified_imm(RAW_IMM12(pc[0]));
+    for (i = 1; i < ABS_BASE_LOAD_LEN; i++) {
+        if ((pc[i] & RAW_ORR_IMM_MASK) != RAW_ORR_IMM ||
+            RAW_RT(pc[i]) != rd || RAW_RN(pc[i]) != rd)
+            return -1;
+        val |= opnd_decode_modified_imm(RAW_IMM12(pc[i]));
+    }
+    if (val != (uint)(ptr_uint_t) pt->slot_base)
+        return -1;
+    return rd;
+}
+
+static int
+base_load_len(per_thread_t *pt)
+{
+    return pt->tls_in_tpidrurw ? 1 : ABS_BASE_LOAD_LEN;
+}
+
+/* Returns the slot word accesses if it is a load or store off base, or NO_SLOT */
+static uint
+raw_slot_access(uint word, uint base)
+{
+    uint offs;
+    if (((word & RAW_LDR_STR_IMM_MASK) != RAW_STR_IMM &&
+         (word & RAW_LDR_STR_IMM_MASK) != RAW_LDR_IMM) ||
+        RAW_RN(word) != base)
+        return NO_SLOT;
+    offs = RAW_IMM12(word);
+    if (offs < tls_offs || offs >= slot_offs(GPR_SLOT_BASE + num_gpr_slots) ||
+        (offs - tls_offs) % sizeof(reg_t) != 0)
+        return NO_SLOT;
+    return (offs - tls_offs) / sizeof(reg_t);
+}
+
+/* Walks our inserted code from the top of the fragment to the interruption
+ * point to find which app values sit in slots (or on the stack, for a base
+ * register borrowed by spill_reg()) and puts them back in the mcontext.
+ */
+static bool
+drreg_event_restore_state(void *drcontext, bool restore_memory,
+                          dr_restore_state_info_t *info)
+{
+    per_thread_t *pt = (per_thread_t *) drmgr_get_tls_field(drcontext, tls_idx);
+    uint spilled[DRREG_NUM_GPRS];
+    bool aflags_spilled = false;
+    int pushed = -1;
+    uint *pc, *end;
+    int i, base;
+
+    if (!info->raw_mcontext_valid || info->fragment_info.cache_start_pc == NULL ||
+        pt == NULL)
+        return true;
+    for (i = 0; i < DRREG_NUM_GPRS; i++)
+        spilled[i] = NO_SLOT;
+    end = (uint *) info->raw_mcontext->r15;
+    for (pc = (uint *) info->fragment_info.cache_start_pc; pc < end; pc++) {
+        uint word = *pc;
+        uint slot = NO_SLOT;
+        uint rt = RAW_RT(word);
+        base = raw_base_load(pt, pc);
+        if (base >= 0) {
+            /* the slot access follows the load of its base */
+            pc += base_load_len(pt);
+            if (pc >= end)
+                break;
+            word = *pc;
+            rt = RAW_RT(word);
+            slot = raw_slot_access(word, base);
+        }
+        if (slot != NO_SLOT) {
+            bool store = ((word & RAW_LDR_STR_IMM_MASK) == RAW_STR_IMM);
+            if (slot == AFLAGS_SLOT) {
+                /* the flags come back at the msr following the load */
+                if (store)
+                    aflags_spilled = true;
+            } else if (rt < DRREG_NUM_GPRS) {
+                if (store)
+                    spilled[rt] = slot;
+                else if (spilled[rt] == slot)
+                    spilled[rt] = NO_SLOT;
+            }
+        } else if ((word & RAW_MSR_REG_MASK) == RAW_MSR_REG) {
+            aflags_spilled = false;
+        } else if ((word & RAW_PUSH_POP_MASK) == RAW_PUSH &&
+                   raw_base_load(pt, pc + 1) == (int) rt) {
+            pushed = rt;
+        } else if ((word & RAW_PUSH_POP_MASK) == RAW_POP && pushed >= 0 &&
+                   rt == (uint) pushed) {
+            pushed = -1;
+        }
+    }
+
+    for (i = 0; i < DRREG_NUM_GPRS; i++) {
+        if (spilled[i] != NO_SLOT) {
+            reg_set_value(DR_REG_R0 + i, info->mcontext,
+                          *(reg_t *)(pt->slot_base + slot_offs(spilled[i])));
+        }
+    }
+    if (aflags_spilled) {
+        reg_t flags = *(reg_t *)(pt->slot_base + slot_offs(AFLAGS_SLOT));
+        info->mcontext->cpsr = (info->mcontext->cpsr & ~CPSR_NZCVQ) |
+            (flags & CPSR_NZCVQ);
+    }
+    if (pushed >= 0) {
+        reg_set_value(DR_REG_R0 + pushed, info->mcontext,
+                      *(reg_t *)info->raw_mcontext->r13);
+        info->mcontext->r13 = info->raw_mcontext->r13 + sizeof(reg_t);
+    }
+    return true;
+}
+
+/***************************************************************************
+ * INIT
+ */
+
+static void
+drreg_thread_init(void *drcontext)
+{
+    per_thread_t *pt = (per_thread_t *) dr_thread_alloc(drcontext, sizeof(*pt));
+    int i;
+    memset(pt, 0, sizeof(*pt));
+    pt->cur_live = LIVE_ALL;
+    for (i = 0; i < DRREG_NUM_GPRS; i++) {
+        pt->reg[i].native = true;
+        pt->reg[i].slot = NO_SLOT;
+    }
+    pt->aflags.native = true;
+    pt->aflags.slot = NO_SLOT;
+    pt->slot_base = (byte *) dr_get_dr_segment_base(tls_seg);
+    pt->tls_in_tpidrurw = (pt->slot_base != (byte *)(ptr_int_t)-1);
+    if (!pt->tls_in_tpidrurw) {
+        /* see load_slot_base() */
+        pt->private_slots = (reg_t *)
+            dr_thread_alloc(drcontext, (GPR_SLOT_BASE + num_gpr_slots) * sizeof(reg_t));
+        pt->slot_base = (byte *) pt->private_slots - tls_offs;
+    }
+    drmgr_set_tls_field(drcontext, tls_idx, (void *) pt);
+}
+
+static void
+drreg_thread_exit(void *drcontext)
+{
+    per_thread_t *pt = (per_thread_t *) drmgr_get_tls_field(drcontext, tls_idx);
+    if (pt->private_slots != NULL) {
+        dr_thread_free(drcontext, pt->private_slots,
+                       (GPR_SLOT_BASE + num_gpr_slots) * sizeof(reg_t));
+    }
+    dr_thread_free(drcontext, pt, sizeof(*pt));
+}
+
+DR_EXPORT
+drreg_status_t
+drreg_init(drreg_options_t *ops)
+{
+    drmgr_priority_t pri_high =
+        {sizeof(pri_high), DRMGR_PRIORITY_NAME_DRREG_HIGH, NULL, NULL,
+         DRMGR_PRIORITY_INSERT_DRREG_HIGH};
+    drmgr_priority_t pri_low =
+        {sizeof(pri_low), DRMGR_PRIORITY_NAME_DRREG_LOW, NULL, NULL,
+         DRMGR_PRIORITY_INSERT_DRREG_LOW};
+    int count;
+
+    if (ops == NULL || ops->struct_size < sizeof(*ops) ||
+        ops->num_spill_slots > MAX_SPILL_SLOTS)
+        return DRREG_ERROR_INVALID_PARAMETER;
+
+    /* handle multiple sets of init/exit calls */
+    count = dr_atomic_add32_return_sum(&drreg_init_count, 1);
+    if (count > 1) {
+        if (ops->num_spill_slots > num_gpr_slots)
+            return DRREG_ERROR_OUT_OF_SLOTS;
+        return DRREG_SUCCESS;
+    }
+
+    drmgr_init();
+    num_gpr_slots = ops->num_spill_slots;
+    if (!dr_raw_tls_calloc(&tls_seg, &tls_offs, GPR_SLOT_BASE + num_gpr_slots, 0))
+        return DRREG_ERROR_OUT_OF_SLOTS;
+    /* without a TLS base our slots are named by per-thread constants */
+    if (dr_get_dr_segment_base(tls_seg) == (byte *)(ptr_int_t)-1 &&
+        !dr_using_all_private_caches())
+        return DRREG_ERROR;
+
+    tls_idx = drmgr_register_tls_field();
+    if (tls_idx == -1)
+        return DRREG_ERROR;
+    if (!drmgr_register_thread_init_event(drreg_thread_init) ||
+        !drmgr_register_thread_exit_event(drreg_thread_exit) ||
+        !drmgr_register_restore_state_ex_event(drreg_event_restore_state))
+        return DRREG_ERROR;
+
+    /* The early pass computes liveness and tracks which app instr clients are
+     * instrumenting; the late pass restores what those clients displaced.
+     */
+    if (!drmgr_register_bb_instrumentation_event(drreg_event_bb_analysis,
+                                                 drreg_event_bb_insert_early,
+                                                 &pri_high) ||
+        !drmgr_register_bb_instrumentation_event(drreg_event_bb_insert_late_analysis,
+                                                 drreg_event_bb_insert_late,
+                                                 &pri_low))
+        return DRREG_ERROR;
+    return DRREG_SUCCESS;
+}
+
+DR_EXPORT
+drreg_status_t
+drreg_exit(void)
+{
+    /* handle multiple sets of init/exit calls */
+    int count = dr_atomic_add32_return_sum(&drreg_init_count, -1);
+    if (count != 0)
+        return DRREG_SUCCESS;
+
+    drmgr_unregister_bb_instrumentation_event(drreg_event_bb_analysis);
+    drmgr_unregister_bb_instrumentation_event(drreg_event_bb_insert_late_analysis);
+    drmgr_unregister_thread_init_event(drreg_thread_init);
+    drmgr_unregister_thread_exit_event(drreg_thread_exit);
+    drmgr_unregister_restore_state_ex_event(drreg_event_restore_state);
+    drmgr_unregister_tls_field(tls_idx);
+    if (!dr_raw_tls_cfree(tls_offs, GPR_SLOT_BASE + num_gpr_slots))
+        return DRREG_ERROR;
+    drmgr_exit();
+    return DRREG_SUCCESS;
+}
@@ -0,0 +1,210 @@
+/* **********************************************************
+ * Copyright (c) 2013 Google, Inc.   All rights reserved.
+ * **********************************************************/
+
+/* drreg: DynamoRIO Register Management Extension
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;
+ * version 2.1 of the License, and no later version.
+
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Library General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* DynamoRIO Register Management Extension */
+
+#ifndef _DRREG_H_
+#define _DRREG_H_ 1
+
+/**
+ * @file drreg.h
+ * @brief Header for DynamoRIO Register Management Extension
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * \addtogroup drreg Register Management
+ */
+/*@{*/ /* begin doxygen group */
+
+/** Success code for each drreg operation */
+typedef enum {
+    DRREG_SUCCESS,                 /**< Operation succeeded. */
+    DRREG_ERROR,                   /**< Operation failed. */
+    DRREG_ERROR_INVALID_PARAMETER, /**< Operation failed: invalid parameter */
+    DRREG_ERROR_OUT_OF_SLOTS,      /**< Operation failed: no more TLS spill slots */
+    DRREG_ERROR_REG_CONFLICT,      /**< Operation failed: no allowed register free */
+    DRREG_ERROR_IN_USE,            /**< Operation failed: resource already reserved */
+    DRREG_ERROR_NO_APP_VALUE,      /**< Operation failed: app value not available */
+} drreg_status_t;
+
+/** Specifies the options when initializing drreg. */
+typedef struct _drreg_options_t {
+    /** Set this to the size of this structure. */
+    size_t struct_size;
+    /**
+     * The number of thread-local spill slots to reserve for general-purpose
+     * registers.  Registers are only spilled when their application value is
+     * live at the point of reservation, so this bounds the number of
+     * simultaneously reserved live registers.
+     */
+    uint num_spill_slots;
+} drreg_options_t;
+
+/**
+ * Priorities of drmgr instrumentation passes used by drreg.  drreg
+ * picks up drmgr's shared register liveness in its early pass, and its
+ * late insertion pass restores application values that were spilled by earlier passes.
+ * Users of drreg must order their insertion passes between these two.
+ */
+enum {
+    DRMGR_PRIORITY_INSERT_DRREG_HIGH = -7500, /**< Priority of drreg analysis */
+    DRMGR_PRIORITY_INSERT_DRREG_LOW  =  7500, /**< Priority of drreg restores */
+};
+
+/** Name of drmgr instrumentation pass priority for drreg analysis */
+#define DRMGR_PRIORITY_NAME_DRREG_HIGH "drreg_high"
+/** Name of drmgr instrumentation pass priority for drreg restores */
+#define DRMGR_PRIORITY_NAME_DRREG_LOW  "drreg_low"
+
+/** The number of general-purpose registers drreg manages: r0 through r12. */
+#define DRREG_NUM_GPRS 13
+
+/**
+ * Returns the bit for \p reg to pass in the \p allowed mask of
+ * drreg_reserve_register().  \p reg must be one of DR_REG_R0 through DR_REG_R12.
+ */
+#define DRREG_ALLOW(reg) (1U << ((reg) - DR_REG_R0))
+
+/** Allows drreg_reserve_register() to pick any of r0 through r12. */
+#define DRREG_ALLOW_ALL ((1U << DRREG_NUM_GPRS) - 1)
+
+/***************************************************************************
+ * INIT
+ */
+
+DR_EXPORT
+/**
+ * Initializes the drreg extension.  Must be called prior to any of the
+ * other routines, and prior to any thread being created.  Can be called
+ * multiple times (by separate components, normally) but each call must be
+ * paired with a corresponding call to drreg_exit().  The number of spill
+ * slots requested by a later call may not exceed the number requested by
+ * the first call.
+ *
+ * drreg initializes drmgr and registers its own instrumentation passes
+ * using the priorities #DRMGR_PRIORITY_INSERT_DRREG_HIGH and
+ * #DRMGR_PRIORITY_INSERT_DRREG_LOW.
+ */
+drreg_status_t
+drreg_init(drreg_options_t *ops);
+
+DR_EXPORT
+/**
+ * Cleans up the drreg extension.
+ */
+drreg_status_t
+drreg_exit(void);
+
+/***************************************************************************
+ * RESERVATION
+ */
+
+DR_EXPORT
+/**
+ * Reserves a general-purpose register for use by instrumentation inserted
+ * prior to \p where, which must be the application instruction passed to
+ * the caller's drmgr insertion event (or a meta instruction preceding it).
+ * The register is chosen from those set in \p allowed (see DRREG_ALLOW())
+ * and returned in \p reg_out.
+ *
+ * drreg prefers a register whose application value is dead at \p where,
+ * or whose value was already spilled by an earlier reservation in the same
+ * block; only if neither is available does it insert a spill to a
+ * thread-local slot.  The application value is restored lazily: not at
+ * drreg_unreserve_register(), but just before the next application
+ * instruction that reads the register or at the end of the block.
+ *
+ * A reservation may be held across application instructions that do not
+ * access the register, but must be released before the last application
+ * instruction of the block.
+ */
+drreg_status_t
+drreg_reserve_register(void *drcontext, instrlist_t *ilist, instr_t *where,
+                       uint allowed, OUT reg_id_t *reg_out);
+
+DR_EXPORT
+/**
+ * Releases a register reserved by drreg_reserve_register().  No
+ * instructions are inserted: any restore of the application value is
+ * deferred to the point where the application needs it.
+ */
+drreg_status_t
+drreg_unreserve_register(void *drcontext, instrlist_t *ilist, instr_t *where,
+                         reg_id_t reg);
+
+DR_EXPORT
+/**
+ * Reserves the arithmetic flags (N, Z, C, V, and Q in the CPSR) for use by
+ * instrumentation inserted prior to \p where.  The flags are only saved if
+ * they are live at \p where; as with registers, they are restored lazily.
+ */
+drreg_status_t
+drreg_reserve_aflags(void *drcontext, instrlist_t *ilist, instr_t *where);
+
+DR_EXPORT
+/**
+ * Releases the arithmetic flags reserved by drreg_reserve_aflags().
+ */
+drreg_status_t
+drreg_unreserve_aflags(void *drcontext, instrlist_t *ilist, instr_t *where);
+
+/***************************************************************************
+ * QUERIES
+ */
+
+DR_EXPORT
+/**
+ * Inserts instructions prior to \p where that place the application value
+ * of \p app_reg into \p dst_reg, which may be a register currently reserved
+ * by the caller.  Returns DRREG_ERROR_NO_APP_VALUE if the application
+ * value of \p app_reg was dead and has been clobbered.
+ */
+drreg_status_t
+drreg_get_app_value(void *drcontext, instrlist_t *ilist, instr_t *where,
+                    reg_id_t app_reg, reg_id_t dst_reg);
+
+DR_EXPORT
+/**
+ * Sets \p dead to whether the application value of \p reg is dead just
+ * prior to the application instruction currently being instrumented.
+ */
+drreg_status_t
+drreg_is_register_dead(void *drcontext, reg_id_t reg, OUT bool *dead);
+
+DR_EXPORT
+/**
+ * Sets \p dead to whether the arithmetic flags are dead just prior to the
+ * application instruction currently being instrumented.
+ */
+drreg_status_t
+drreg_are_aflags_dead(void *drcontext, OUT bool *dead);
+
+/*@}*/ /* end doxygen group */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _DRREG_H_ */
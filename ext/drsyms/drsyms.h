@@ -180,6 +180,49 @@ drsym_error_t
 drsym_lookup_address(const char *modpath, size_t modoffs, drsym_info_t *info /*INOUT*/,
                      uint flags);
 
+/**
+ * Type for drsym_lookup_addresses() callback function.
+ * Returns whether to continue with the remaining offsets.
+ *
+ * @param[in]  index   The index into the offsets passed to drsym_lookup_addresses()
+ *                     of the offset that was looked up.
+ * @param[in]  info    Information about the symbol at that offset.  Must not be
+ *                     modified.
+ * @param[in]  status  What drsym_lookup_address() would have returned for the offset.
+ * @param[in]  data    User parameter passed to drsym_lookup_addresses().
+ */
+typedef bool (*drsym_lookup_addresses_cb)(size_t index, drsym_info_t *info,
+                                          drsym_error_t status, void *data);
+
+DR_EXPORT
+/**
+ * Retrieves symbol information for each of \p count module offsets, in
+ * order, passing the results for each offset to \p callback.  The results
+ * are those drsym_lookup_address() would return, but the module is looked
+ * up and locked once for the whole batch.  If the offsets are sorted,
+ * consecutive offsets within the same symbol or compilation unit reuse the
+ * previous offset's search and demangling work; unsorted offsets are
+ * supported but do not benefit.  If the callback returns false, no further
+ * offsets are looked up.
+ *
+ * @param[in] modpath  The full path to the module to be queried.
+ * @param[in] modoffs  The offsets from the base of the module to be queried.
+ * @param[in] count    The number of entries in \p modoffs.
+ * @param[in,out] info Storage for the results, passed to \p callback.  As with
+ *   drsym_lookup_address(), the caller must set its struct_size and
+ *   name_size fields.
+ * @param[in] callback Function to call with the results for each offset.
+ * @param[in] data     User parameter passed to callback.
+ * @param[in] flags    Options for the operation.  Ignored for Windows PDB (DRSYM_PDB).
+ *
+ * \return DRSYM_SUCCESS unless the parameters are invalid or the module
+ * could not be loaded.  The per-offset status is passed to \p callback.
+ */
+drsym_error_t
+drsym_lookup_addresses(const char *modpath, const size_t *modoffs, size_t count,
+                       drsym_info_t *info /*INOUT*/, drsym_lookup_addresses_cb callback,
+                       void *data, uint flags);
+
 enum {
     DRSYM_TYPE_OTHER,  /**< Unknown type, cannot downcast. */
     DRSYM_TYPE_INT,    /**< Integer, cast to drsym_int_type_t. */
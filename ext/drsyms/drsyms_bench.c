@@ -32,8 +32,9 @@
 
 /* DRSyms benchmarking standalone app. */
 
-/* This is a standalone app for benchmarking drsyms.  Currently we just time
- * symbol enumeration of an arbitrary object file.
+/* This is a standalone app for benchmarking drsyms.  We time symbol
+ * enumeration of an arbitrary object file, followed by repeated address and
+ * name lookups of a sample of its symbols.
  */
 
 #include <stdio.h>
@@ -45,6 +46,23 @@
 
 static char sym_buf[4096];
 
+/* Number of symbols sampled for the lookup benchmarks. */
+#define MAX_QUERIES 4096
+/* Number of passes over the sample for each lookup benchmark. */
+#define QUERY_ROUNDS 25
+
+typedef struct _query_t {
+    char *name;
+    size_t modoffs;
+} query_t;
+
+typedef struct _query_sample_t {
+    query_t queries[MAX_QUERIES];
+    uint num_queries;
+    uint64 stride;
+    uint64 count;
+} query_sample_t;
+
 static int
 usage(const char *msg)
 {
@@ -86,7 +104,7 @@ sym_callback(const char *name, size_t modoffs, void *data)
     return true;
 }
 
-static void
+static uint64
 enumerate_with_flags(const char *modpath, drsym_flags_t flags)
 {
     uint64 start, end, time;
@@ -102,12 +120,121 @@ enumerate_with_flags(const char *modpath, drsym_flags_t flags)
     time = end - start;
 
     dr_printf("Took %d.%03d seconds.\n", (int)(time / 1000), (int)(time % 1000));
+    return sym_count;
+}
+
+/* Samples every stride-th symbol with a non-zero offset. */
+static bool
+sample_callback(const char *name, size_t modoffs, void *data)
+{
+    query_sample_t *sample = (query_sample_t *)data;
+    if (modoffs != 0 && sample->count++ % sample->stride == 0) {
+        sample->queries[sample->num_queries].name = strdup(name);
+        sample->queries[sample->num_queries].modoffs = modoffs;
+        sample->num_queries++;
+    }
+    return sample->num_queries < MAX_QUERIES;
+}
+
+static void
+print_rate(const char *what, uint64 lookups, uint64 time)
+{
+    dr_printf("%s: %d lookups took %d.%03d seconds", what, (int)lookups,
+              (int)(time / 1000), (int)(time % 1000));
+    if (time > 0)
+        dr_printf(" (%d lookups/sec)", (int)(lookups * 1000 / time));
+    dr_printf(".\n");
+}
+
+static void
+lookup_addresses(const char *modpath, query_sample_t *sample)
+{
+    uint64 start, end, found = 0;
+    uint i, round;
+    drsym_info_t *info = (drsym_info_t *) malloc(sizeof(*info) + sizeof(sym_buf));
+
+    info->struct_size = sizeof(*info);
+    info->name_size = sizeof(sym_buf);
+    /* The first lookup builds the address index. */
+    start = dr_get_milliseconds();
+    drsym_lookup_address(modpath, sample->queries[0].modoffs, info,
+                         DRSYM_DEFAULT_FLAGS);
+    end = dr_get_milliseconds();
+    print_rate("First address lookup", 1, end - start);
+
+    start = dr_get_milliseconds();
+    for (round = 0; round < QUERY_ROUNDS; round++) {
+        for (i = 0; i < sample->num_queries; i++) {
+            if (drsym_lookup_address(modpath, sample->queries[i].modoffs, info,
+                                     DRSYM_DEFAULT_FLAGS) == DRSYM_SUCCESS)
+                found++;
+        }
+    }
+    end = dr_get_milliseconds();
+    print_rate("Address lookups", (uint64)QUERY_ROUNDS * sample->num_queries,
+               end - start);
+    if (found != (uint64)QUERY_ROUNDS * sample->num_queries)
+        dr_printf("%d address lookups failed.\n",
+                  (int)((uint64)QUERY_ROUNDS * sample->num_queries - found));
+    free(info);
+}
+
+static void
+lookup_names(const char *modpath, query_sample_t *sample)
+{
+    uint64 start, end, found = 0;
+    uint i, round;
+    size_t modoffs;
+
+    /* The first lookup builds the name index. */
+    start = dr_get_milliseconds();
+    drsym_lookup_symbol(modpath, sample->queries[0].name, &modoffs,
+                        DRSYM_DEFAULT_FLAGS);
+    end = dr_get_milliseconds();
+    print_rate("First name lookup", 1, end - start);
+
+    start = dr_get_milliseconds();
+    for (round = 0; round < QUERY_ROUNDS; round++) {
+        for (i = 0; i < sample->num_queries; i++) {
+            if (drsym_lookup_symbol(modpath, sample->queries[i].name, &modoffs,
+                                    DRSYM_DEFAULT_FLAGS) == DRSYM_SUCCESS)
+                found++;
+        }
+    }
+    end = dr_get_milliseconds();
+    print_rate("Name lookups", (uint64)QUERY_ROUNDS * sample->num_queries,
+               end - start);
+    if (found != (uint64)QUERY_ROUNDS * sample->num_queries)
+        dr_printf("%d name lookups failed.\n",
+                  (int)((uint64)QUERY_ROUNDS * sample->num_queries - found));
+}
+
+static void
+benchmark_lookups(const char *modpath, uint64 sym_count)
+{
+    query_sample_t *sample = (query_sample_t *) malloc(sizeof(*sample));
+    uint i;
+
+    memset(sample, 0, sizeof(*sample));
+    sample->stride = sym_count / MAX_QUERIES + 1;
+    drsym_enumerate_symbols(modpath, sample_callback, sample, DRSYM_DEFAULT_FLAGS);
+    if (sample->num_queries == 0) {
+        dr_printf("No symbols to look up.\n");
+    } else {
+        dr_printf("Sampled %d symbols for lookups.\n", sample->num_queries);
+        lookup_addresses(modpath, sample);
+        lookup_names(modpath, sample);
+    }
+    for (i = 0; i < sample->num_queries; i++)
+        free(sample->queries[i].name);
+    free(sample);
 }
 
 int
 main(int argc, char **argv)
 {
     const char *modpath;
+    uint64 sym_count;
 #ifdef WINDOWS
     char full_path[2048];
 #endif
@@ -134,7 +261,9 @@ main(int argc, char **argv)
      * about how long the second enumeration takes.
      */
     enumerate_with_flags(modpath, DRSYM_DEFAULT_FLAGS);
-    enumerate_with_flags(modpath, DRSYM_DEFAULT_FLAGS);
+    sym_count = enumerate_with_flags(modpath, DRSYM_DEFAULT_FLAGS);
+
+    benchmark_lookups(modpath, sym_count);
 
     drsym_exit();
 }
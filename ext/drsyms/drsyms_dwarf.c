@@ -42,6 +42,7 @@
 #include "libdwarf.h"
 
 #include <stdlib.h> /* qsort */
+#include <string.h>
 
 /* For debugging */
 static bool verbose = false;
@@ -52,17 +53,49 @@ static bool verbose = false;
     } \
 } while (0)
 
+/* A line table entry with its address pulled out for sorting and searching. */
+typedef struct _line_entry_t {
+    Dwarf_Addr addr;
+    Dwarf_Line line;
+} line_entry_t;
+
+typedef struct _cu_info_t {
+    Dwarf_Die die;
+    Dwarf_Off die_offs;
+    /* Whether .debug_aranges or the CU's lowpc+highpc gave us its range. */
+    bool has_range;
+    /* The line table, read and sorted on first use. */
+    bool lines_read;
+    Dwarf_Line *lines;
+    Dwarf_Signed num_lines; /* -1 if the CU has no line info */
+    line_entry_t *sorted_lines;
+} cu_info_t;
+
+typedef struct _cu_range_t {
+    Dwarf_Addr lo;
+    Dwarf_Addr hi;
+    uint cu;
+} cu_range_t;
+
 typedef struct _dwarf_module_t {
     byte *load_base;
     Dwarf_Debug dbg;
-    /* we cache the last CU we looked up */
-    Dwarf_Die lines_cu;
-    Dwarf_Line *lines;
-    Dwarf_Signed num_lines;
+    /* The CU index is built on first use.  cus is in .debug_info order (and
+     * thus die_offs order) and ranges is sorted by start address.
+     */
+    bool cus_indexed;
+    cu_info_t *cus;
+    uint num_cus;
+    uint cus_alloc;
+    cu_range_t *ranges;
+    uint num_ranges;
+    uint ranges_alloc;
+    /* Queries tend to cluster, so we check the last range hit first. */
+    uint last_range;
 } dwarf_module_t;
 
 static bool
-search_addr2line_in_cu(dwarf_module_t *mod, Dwarf_Addr pc, Dwarf_Die cu_die,
+search_addr2line_in_cu(dwarf_module_t *mod, Dwarf_Addr pc, cu_info_t *cu,
                        drsym_info_t *sym_info INOUT);
 
 /******************************************************************************
@@ -91,97 +124,220 @@ next_die_matching_tag(Dwarf_Debug dbg, Dwarf_Tag search_tag)
     return die;
 }
 
-/* Iterate over all the CUs in the module to find the CU containing the given
- * PC.
+/******************************************************************************
+ * CU index.
  */
-static Dwarf_Die
-find_cu_die_via_iter(Dwarf_Debug dbg, Dwarf_Addr pc)
+
+static void
+add_cu(dwarf_module_t *mod, Dwarf_Die die)
+{
+    cu_info_t *cu;
+    Dwarf_Error de = {0};
+    if (mod->num_cus == mod->cus_alloc) {
+        uint new_alloc = (mod->cus_alloc == 0) ? 16 : mod->cus_alloc * 2;
+        cu_info_t *new_cus = (cu_info_t *)
+            dr_global_alloc(new_alloc * sizeof(*new_cus));
+        if (mod->cus != NULL) {
+            memcpy(new_cus, mod->cus, mod->num_cus * sizeof(*new_cus));
+            dr_global_free(mod->cus, mod->cus_alloc * sizeof(*mod->cus));
+        }
+        mod->cus = new_cus;
+        mod->cus_alloc = new_alloc;
+    }
+    cu = &mod->cus[mod->num_cus++];
+    memset(cu, 0, sizeof(*cu));
+    cu->die = die;
+    if (dwarf_dieoffset(die, &cu->die_offs, &de) != DW_DLV_OK)
+        NOTIFY_DWARF(de);
+}
+
+static void
+add_cu_range(dwarf_module_t *mod, Dwarf_Addr lo, Dwarf_Addr hi, uint cu)
+{
+    if (lo >= hi)
+        return;
+    if (mod->num_ranges == mod->ranges_alloc) {
+        uint new_alloc = (mod->ranges_alloc == 0) ? 16 : mod->ranges_alloc * 2;
+        cu_range_t *new_ranges = (cu_range_t *)
+            dr_global_alloc(new_alloc * sizeof(*new_ranges));
+        if (mod->ranges != NULL) {
+            memcpy(new_ranges, mod->ranges, mod->num_ranges * sizeof(*new_ranges));
+            dr_global_free(mod->ranges, mod->ranges_alloc * sizeof(*mod->ranges));
+        }
+        mod->ranges = new_ranges;
+        mod->ranges_alloc = new_alloc;
+    }
+    mod->ranges[mod->num_ranges].lo = lo;
+    mod->ranges[mod->num_ranges].hi = hi;
+    mod->ranges[mod->num_ranges].cu = cu;
+    mod->num_ranges++;
+    mod->cus[cu].has_range = true;
+}
+
+/* Returns the index of the CU whose DIE is at die_offs, or -1. */
+static int
+find_cu_by_offset(dwarf_module_t *mod, Dwarf_Off die_offs)
+{
+    uint lo = 0, hi = mod->num_cus;
+    while (lo < hi) {
+        uint mid = lo + (hi - lo) / 2;
+        if (mod->cus[mid].die_offs == die_offs)
+            return (int) mid;
+        if (mod->cus[mid].die_offs < die_offs)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return -1;
+}
+
+static int
+compare_cu_ranges(const void *a_in, const void *b_in)
+{
+    const cu_range_t *a = (const cu_range_t *) a_in;
+    const cu_range_t *b = (const cu_range_t *) b_in;
+    if (a->lo > b->lo)
+        return 1;
+    if (a->lo < b->lo)
+        return -1;
+    return 0;
+}
+
+/* Collects every CU along with its address ranges, taken from .debug_aranges
+ * where present and otherwise from the CU's lowpc+highpc, which should work if
+ * it has a single contiguous range.  Note that Cygwin and MinGW gcc don't seem
+ * to include lowpc+highpc in their CU's, and clang sometimes omits both.
+ */
+static void
+index_cus(dwarf_module_t *mod)
 {
-    Dwarf_Die die = NULL;
-    Dwarf_Unsigned cu_offset = 0;
     Dwarf_Error de = {0};
-    Dwarf_Die cu_die = NULL;
+    Dwarf_Unsigned cu_offset = 0;
+    Dwarf_Arange *arlist;
+    Dwarf_Signed arcnt, i;
+    uint j;
 
-    while (dwarf_next_cu_header(dbg, NULL, NULL, NULL, NULL,
+    mod->cus_indexed = true;
+    while (dwarf_next_cu_header(mod->dbg, NULL, NULL, NULL, NULL,
                                 &cu_offset, &de) == DW_DLV_OK) {
         /* Scan forward in the tag soup for a CU DIE. */
-        die = next_die_matching_tag(dbg, DW_TAG_compile_unit);
+        Dwarf_Die die = next_die_matching_tag(mod->dbg, DW_TAG_compile_unit);
+        if (die != NULL)
+            add_cu(mod, die);
+    }
 
-        /* We found a CU die, now check if it's the one we wanted. */
-        if (die != NULL) {
-            Dwarf_Addr lo_pc, hi_pc;
-            if (dwarf_lowpc(die, &lo_pc, &de) != DW_DLV_OK ||
-                dwarf_highpc(die, &hi_pc, &de) != DW_DLV_OK) {
+    if (dwarf_get_aranges(mod->dbg, &arlist, &arcnt, &de) == DW_DLV_OK) {
+        for (i = 0; i < arcnt; i++) {
+            Dwarf_Addr start;
+            Dwarf_Unsigned length;
+            Dwarf_Off die_offs;
+            int cu;
+            if (dwarf_get_arange_info(arlist[i], &start, &length, &die_offs,
+                                      &de) != DW_DLV_OK) {
                 NOTIFY_DWARF(de);
-                break;
-            }
-
-            if (lo_pc <= pc && pc < hi_pc) {
-                cu_die = die;
-                break;
+                continue;
             }
+            cu = find_cu_by_offset(mod, die_offs);
+            if (cu >= 0)
+                add_cu_range(mod, start, start + length, (uint) cu);
         }
-    }
+    } else
+        NOTIFY_DWARF(de);
 
-    while (dwarf_next_cu_header(dbg, NULL, NULL, NULL, NULL,
-                                &cu_offset, &de) == DW_DLV_OK) {
-        /* Reset the internal CU header state. */
+    for (j = 0; j < mod->num_cus; j++) {
+        Dwarf_Addr lo_pc, hi_pc;
+        if (mod->cus[j].has_range)
+            continue;
+        if (dwarf_lowpc(mod->cus[j].die, &lo_pc, &de) == DW_DLV_OK &&
+            dwarf_highpc(mod->cus[j].die, &hi_pc, &de) == DW_DLV_OK)
+            add_cu_range(mod, lo_pc, hi_pc, j);
     }
 
-    return cu_die;
+    if (mod->num_ranges > 0)
+        qsort(mod->ranges, mod->num_ranges, sizeof(*mod->ranges), compare_cu_ranges);
 }
 
-static Dwarf_Die
-find_cu_die(Dwarf_Debug dbg, Dwarf_Addr pc)
+/* Returns the CU whose range contains pc, or NULL. */
+static cu_info_t *
+find_cu(dwarf_module_t *mod, Dwarf_Addr pc)
 {
-    Dwarf_Error de = {0};
-    Dwarf_Die cu_die = NULL;
-    Dwarf_Arange *arlist;
-    Dwarf_Signed arcnt;
-    Dwarf_Arange ar;
-    Dwarf_Off die_offs;
-    if (dwarf_get_aranges(dbg, &arlist, &arcnt, &de) != DW_DLV_OK ||
-        dwarf_get_arange(arlist, arcnt, pc, &ar, &de) != DW_DLV_OK ||
-        dwarf_get_cu_die_offset(ar, &die_offs, &de) != DW_DLV_OK ||
-        dwarf_offdie(dbg, die_offs, &cu_die, &de) != DW_DLV_OK) {
-        NOTIFY_DWARF(de);
-        /* Try to find it by walking all CU's and looking at their lowpc+highpc
-         * entries, which should work if each has a single contiguous
-         * range.  Note that Cygwin and MinGW gcc don't seen to include
-         * lowpc+highpc in their CU's.
-         */
-        cu_die = find_cu_die_via_iter(dbg, pc);
+    uint lo = 0, hi = mod->num_ranges;
+    if (!mod->cus_indexed)
+        index_cus(mod);
+    if (mod->last_range < mod->num_ranges &&
+        mod->ranges[mod->last_range].lo <= pc && pc < mod->ranges[mod->last_range].hi)
+        return &mod->cus[mod->ranges[mod->last_range].cu];
+    /* Find the last range starting at or below pc. */
+    while (lo < hi) {
+        uint mid = lo + (hi - lo) / 2;
+        if (mod->ranges[mid].lo <= pc)
+            lo = mid + 1;
+        else
+            hi = mid;
     }
-    return cu_die;
+    if (lo == 0 || pc >= mod->ranges[lo - 1].hi)
+        return NULL;
+    mod->last_range = lo - 1;
+    return &mod->cus[mod->ranges[lo - 1].cu];
 }
 
 static int
 compare_lines(const void *a_in, const void *b_in)
 {
-    const Dwarf_Line a = *(const Dwarf_Line *)a_in;
-    const Dwarf_Line b = *(const Dwarf_Line *)b_in;
-    Dwarf_Addr addr_a, addr_b;
-    Dwarf_Error de = {0};
-    if (dwarf_lineaddr(a, &addr_a, &de) != DW_DLV_OK ||
-        dwarf_lineaddr(b, &addr_b, &de) != DW_DLV_OK)
-        return 0;
-    if (addr_a > addr_b)
+    const line_entry_t *a = (const line_entry_t *) a_in;
+    const line_entry_t *b = (const line_entry_t *) b_in;
+    if (a->addr > b->addr)
         return 1;
-    if (addr_a < addr_b)
+    if (a->addr < b->addr)
         return -1;
     return 0;
 }
 
+/* Returns the CU's line table sorted by address, or -1 if it has none. */
+static Dwarf_Signed
+get_lines_from_cu(dwarf_module_t *mod, cu_info_t *cu, line_entry_t **lines_out OUT)
+{
+    if (!cu->lines_read) {
+        Dwarf_Error de = {0};
+        Dwarf_Signed i;
+        cu->lines_read = true;
+        if (dwarf_srclines(cu->die, &cu->lines, &cu->num_lines, &de) != DW_DLV_OK) {
+            NOTIFY_DWARF(de);
+            cu->lines = NULL;
+            cu->num_lines = -1;
+            return -1;
+        }
+        /* XXX: we should fix libelftc to sort as it builds the table but for now
+         * it's easier to sort and store here.  We keep the table as returned
+         * for dwarf_srclines_dealloc().
+         */
+        if (cu->num_lines > 0) {
+            cu->sorted_lines = (line_entry_t *)
+                dr_global_alloc((size_t)cu->num_lines * sizeof(*cu->sorted_lines));
+            for (i = 0; i < cu->num_lines; i++) {
+                cu->sorted_lines[i].line = cu->lines[i];
+                if (dwarf_lineaddr(cu->lines[i], &cu->sorted_lines[i].addr,
+                                   &de) != DW_DLV_OK) {
+                    NOTIFY_DWARF(de);
+                    cu->sorted_lines[i].addr = 0;
+                }
+            }
+            qsort(cu->sorted_lines, (size_t)cu->num_lines, sizeof(*cu->sorted_lines),
+                  compare_lines);
+        }
+    }
+    *lines_out = cu->sorted_lines;
+    return cu->num_lines;
+}
+
 /* Given a function DIE and a PC, fill out sym_info with line information.
  */
 bool
 drsym_dwarf_search_addr2line(void *mod_in, Dwarf_Addr pc, drsym_info_t *sym_info INOUT)
 {
     dwarf_module_t *mod = (dwarf_module_t *) mod_in;
-    Dwarf_Error de = {0};
-    Dwarf_Die cu_die;
-    Dwarf_Unsigned cu_offset = 0;
-    bool success = false;
+    cu_info_t *cu;
+    uint i;
 
     /* On failure, these should be zeroed.
      */
@@ -192,142 +348,86 @@ drsym_dwarf_search_addr2line(void *mod_in, Dwarf_Addr pc, drsym_info_t *sym_info
     /* First try cutting down the search space by finding the CU (i.e., the .c
      * file) that this function belongs to.
      */
-    cu_die = find_cu_die(mod->dbg, pc);
-    if (cu_die == NULL) {
-        NOTIFY("%s: failed to find CU die for "PFX", searching all CUs\n",
-               __FUNCTION__, pc);
-    } else {
-        return search_addr2line_in_cu(mod, pc, cu_die, sym_info);
-    }
+    cu = find_cu(mod, pc);
+    if (cu != NULL)
+        return search_addr2line_in_cu(mod, pc, cu, sym_info);
+    NOTIFY("%s: failed to find CU die for "PFX", searching unranged CUs\n",
+           __FUNCTION__, pc);
 
     /* We failed to find a CU containing this PC.  Some compilers (clang) don't
      * put lo_pc hi_pc attributes on compilation units.  In this case, we
-     * iterate all the CUs and dig into the dwarf tag soup for all of them.
+     * dig into the line tables of all such CUs.
      */
-    while (dwarf_next_cu_header(mod->dbg, NULL, NULL, NULL, NULL,
-                                &cu_offset, &de) == DW_DLV_OK) {
-        /* Scan forward in the tag soup for a CU DIE. */
-        cu_die = next_die_matching_tag(mod->dbg, DW_TAG_compile_unit);
-
-        /* We found a CU die, now check if it's the one we wanted. */
-        if (cu_die != NULL && search_addr2line_in_cu(mod, pc, cu_die, sym_info)) {
-            success = true;
-            break;
-        }
-    }
-
-    while (dwarf_next_cu_header(mod->dbg, NULL, NULL, NULL, NULL,
-                                &cu_offset, &de) == DW_DLV_OK) {
-        /* Reset the internal CU header state. */
-    }
-
-    return success;
-}
-
-static Dwarf_Signed
-get_lines_from_cu(dwarf_module_t *mod, Dwarf_Die cu_die,
-                  Dwarf_Line **lines_out OUT)
-{
-    if (mod->lines_cu != cu_die) {
-        Dwarf_Line *lines;
-        Dwarf_Signed num_lines;
-        Dwarf_Error de = {0};
-        if (dwarf_srclines(cu_die, &lines, &num_lines, &de) != DW_DLV_OK) {
-            NOTIFY_DWARF(de);
-            return -1;
-        }
-        /* XXX: we should fix libelftc to sort as it builds the table but for now
-         * it's easier to sort and store here
-         */
-        qsort(lines, (size_t)num_lines, sizeof(*lines), compare_lines);
-        /* Save for next query */
-        dwarf_srclines_dealloc(mod->dbg, mod->lines, mod->num_lines);
-        mod->lines_cu = cu_die;
-        mod->lines = lines;
-        mod->num_lines = num_lines;
+    for (i = 0; i < mod->num_cus; i++) {
+        if (!mod->cus[i].has_range &&
+            search_addr2line_in_cu(mod, pc, &mod->cus[i], sym_info))
+            return true;
     }
-    *lines_out = mod->lines;
-    return mod->num_lines;
+    return false;
 }
 
 static bool
-search_addr2line_in_cu(dwarf_module_t *mod, Dwarf_Addr pc, Dwarf_Die cu_die,
+search_addr2line_in_cu(dwarf_module_t *mod, Dwarf_Addr pc, cu_info_t *cu,
                        drsym_info_t *sym_info INOUT)
 {
-    Dwarf_Line *lines;
-    Dwarf_Signed num_lines;
-    int i;
-    Dwarf_Addr lineaddr, next_lineaddr = 0;
-    Dwarf_Line dw_line;
-    bool success = false;
+    line_entry_t *lines;
+    Dwarf_Signed num_lines, lo, hi;
+    char *file;
+    Dwarf_Unsigned lineno;
     Dwarf_Error de = {0};
 
-    num_lines = get_lines_from_cu(mod, cu_die, &lines);
-    if (num_lines < 0)
+    num_lines = get_lines_from_cu(mod, cu, &lines);
+    if (num_lines <= 0)
         return false;
 
-    /* We could binary search this, but we assume dwarf_srclines is the
-     * bottleneck.
+    /* Find the last line starting at or below pc.  A pc past the start of
+     * the CU's last line is attributed to that line.
      */
-    dw_line = NULL;
-    for (i = 0; i < num_lines - 1; i++) {
-        if (dwarf_lineaddr(lines[i], &lineaddr, &de) != DW_DLV_OK ||
-            dwarf_lineaddr(lines[i + 1], &next_lineaddr, &de) != DW_DLV_OK) {
-            NOTIFY_DWARF(de);
-            break;
-        }
-        if (lineaddr <= pc && pc < next_lineaddr) {
-            dw_line = lines[i];
-            break;
-        }
+    lo = 0;
+    hi = num_lines;
+    while (lo < hi) {
+        Dwarf_Signed mid = lo + (hi - lo) / 2;
+        if (lines[mid].addr <= pc)
+            lo = mid + 1;
+        else
+            hi = mid;
     }
-    /* Handle the case when the PC is from the last line of the CU. */
-    if (i == num_lines - 1 && dw_line == NULL && next_lineaddr <= pc) {
-        dw_line = lines[num_lines - 1];
-    }
-
-    /* If we found dw_line, use it to fill out sym_info. */
-    if (dw_line != NULL) {
-        char *file;
-        Dwarf_Unsigned lineno;
+    if (lo == 0)
+        return false;
 
-        if (dwarf_linesrc(dw_line, &file, &de) != DW_DLV_OK ||
-            dwarf_lineno(dw_line, &lineno, &de) != DW_DLV_OK ||
-            dwarf_lineaddr(dw_line, &lineaddr, &de) != DW_DLV_OK) {
-            NOTIFY_DWARF(de);
-        } else {
-            /* We assume file comes from .debug_str and therefore lives until
-             * drsym_exit.
-             */
-            sym_info->file = file;
-            sym_info->line = lineno;
-            sym_info->line_offs = (size_t) (pc - lineaddr);
-            success = true;
-        }
+    if (dwarf_linesrc(lines[lo - 1].line, &file, &de) != DW_DLV_OK ||
+        dwarf_lineno(lines[lo - 1].line, &lineno, &de) != DW_DLV_OK) {
+        NOTIFY_DWARF(de);
+        return false;
     }
-
-    return success;
+    /* We assume file comes from .debug_str and therefore lives until
+     * drsym_exit.
+     */
+    sym_info->file = file;
+    sym_info->line = lineno;
+    sym_info->line_offs = (size_t) (pc - lines[lo - 1].addr);
+    return true;
 }
 
 /* Return value: 0 means success but break; 1 means success and continue;
  * -1 means error.
  */
 static int
-enumerate_lines_in_cu(dwarf_module_t *mod, Dwarf_Die cu_die,
+enumerate_lines_in_cu(dwarf_module_t *mod, cu_info_t *cu,
                       drsym_enumerate_lines_cb callback, void *data)
 {
-    Dwarf_Line *lines;
+    line_entry_t *lines;
     Dwarf_Signed num_lines;
     int i;
     Dwarf_Error de = {0};
     drsym_line_info_t info;
 
-    if (dwarf_diename(cu_die, (char **) &info.cu_name, &de) != DW_DLV_OK) {
+    if (dwarf_diename(cu->die, (char **) &info.cu_name, &de) != DW_DLV_OK) {
         NOTIFY_DWARF(de);
         return -1;
     }
 
-    num_lines = get_lines_from_cu(mod, cu_die, &lines);
+    num_lines = get_lines_from_cu(mod, cu, &lines);
     if (num_lines < 0) {
         /* This cu has no line info.  Don't bail: keep going. */
         info.file = NULL;
@@ -345,18 +445,18 @@ enumerate_lines_in_cu(dwarf_module_t *mod, Dwarf_Die cu_die,
         /* We do not want to bail on failure of any of these: we want to
          * provide as much information as possible.
          */
-        if (dwarf_linesrc(lines[i], (char **) &info.file, &de) != DW_DLV_OK) {
+        if (dwarf_linesrc(lines[i].line, (char **) &info.file, &de) != DW_DLV_OK) {
             NOTIFY_DWARF(de);
             info.file = NULL;
         }
 
-        if (dwarf_lineno(lines[i], &lineno, &de) != DW_DLV_OK) {
+        if (dwarf_lineno(lines[i].line, &lineno, &de) != DW_DLV_OK) {
             NOTIFY_DWARF(de);
             info.line = 0;
         } else
             info.line = lineno;
 
-        if (dwarf_lineaddr(lines[i], &lineaddr, &de) != DW_DLV_OK) {
+        if (dwarf_lineaddr(lines[i].line, &lineaddr, &de) != DW_DLV_OK) {
             NOTIFY_DWARF(de);
             info.line_addr = 0;
         } else
@@ -374,29 +474,18 @@ drsym_dwarf_enumerate_lines(void *mod_in, drsym_enumerate_lines_cb callback, voi
 {
     drsym_error_t success = DRSYM_SUCCESS;
     dwarf_module_t *mod = (dwarf_module_t *) mod_in;
-    Dwarf_Error de = {0};
-    Dwarf_Die cu_die;
-    Dwarf_Unsigned cu_offset = 0;
+    uint i;
 
+    if (!mod->cus_indexed)
+        index_cus(mod);
     /* Enumerate all CU's */
-    while (dwarf_next_cu_header(mod->dbg, NULL, NULL, NULL, NULL,
-                                &cu_offset, &de) == DW_DLV_OK) {
-        /* Scan forward in the tag soup for a CU DIE. */
-        cu_die = next_die_matching_tag(mod->dbg, DW_TAG_compile_unit);
-        if (cu_die != NULL) {
-            int res = enumerate_lines_in_cu(mod, cu_die, callback, data);
-            if (res < 0)
-                success = DRSYM_ERROR_LINE_NOT_AVAILABLE;
-            if (res <= 0)
-                break;
-        }
-    }
-
-    while (dwarf_next_cu_header(mod->dbg, NULL, NULL, NULL, NULL,
-                                &cu_offset, &de) == DW_DLV_OK) {
-        /* Reset the internal CU header state. */
+    for (i = 0; i < mod->num_cus; i++) {
+        int res = enumerate_lines_in_cu(mod, &mod->cus[i], callback, data);
+        if (res < 0)
+            success = DRSYM_ERROR_LINE_NOT_AVAILABLE;
+        if (res <= 0)
+            break;
     }
-
     return success;
 }
 
@@ -404,10 +493,9 @@ void *
 drsym_dwarf_init(Dwarf_Debug dbg, byte *load_base)
 {
     dwarf_module_t *mod = (dwarf_module_t *) dr_global_alloc(sizeof(*mod));
+    memset(mod, 0, sizeof(*mod));
     mod->load_base = load_base;
     mod->dbg = dbg;
-    mod->lines_cu = NULL;
-    mod->lines = NULL;
     return mod;
 }
 
@@ -415,8 +503,20 @@ void
 drsym_dwarf_exit(void *mod_in)
 {
     dwarf_module_t *mod = (dwarf_module_t *) mod_in;
-    if (mod->lines != NULL)
-        dwarf_srclines_dealloc(mod->dbg, mod->lines, mod->num_lines);
+    uint i;
+    for (i = 0; i < mod->num_cus; i++) {
+        cu_info_t *cu = &mod->cus[i];
+        if (cu->sorted_lines != NULL) {
+            dr_global_free(cu->sorted_lines,
+                           (size_t)cu->num_lines * sizeof(*cu->sorted_lines));
+        }
+        if (cu->lines != NULL)
+            dwarf_srclines_dealloc(mod->dbg, cu->lines, cu->num_lines);
+    }
+    if (mod->cus != NULL)
+        dr_global_free(mod->cus, mod->cus_alloc * sizeof(*mod->cus));
+    if (mod->ranges != NULL)
+        dr_global_free(mod->ranges, mod->ranges_alloc * sizeof(*mod->ranges));
     dwarf_finish(mod->dbg, NULL);
     dr_global_free(mod, sizeof(*mod));
 }
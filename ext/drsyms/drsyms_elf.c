@@ -44,6 +44,7 @@
 #include "libdwarf.h"
 
 #include <string.h>
+#include <stdlib.h> /* qsort */
 #include <sys/stat.h>
 #include <unistd.h>
 #include <errno.h>
@@ -92,6 +93,17 @@ static bool verbose;
 # define Elf_Sym  Elf32_Sym
 #endif
 
+/* Marks an address range covered by no symbol in the address index. */
+#define NO_SYMBOL ((uint)-1)
+
+/* One entry of the address index: the range from start up to the start of the
+ * next entry is covered by symbol idx, or by none if idx is NO_SYMBOL.
+ */
+typedef struct _addr_range_t {
+    ptr_uint_t start;
+    uint idx;
+} addr_range_t;
+
 typedef struct _elf_info_t {
     Elf *elf;
     Elf_Sym *syms;
@@ -100,6 +112,13 @@ typedef struct _elf_info_t {
     byte *map_base;
     ptr_uint_t load_base;
     drsym_debug_kind_t debug_kind;
+    /* Address index, built on the first address lookup.  Sorted by start and
+     * with no two adjacent entries naming the same symbol.
+     */
+    bool addr_index_built;
+    addr_range_t *ranges;
+    uint num_ranges;
+    uint ranges_alloc;
 } elf_info_t;
 
 /* Looks for a section with real data, not just a section with a header */
@@ -267,6 +286,8 @@ drsym_obj_mod_exit(void *mod_in)
         return;
     if (mod->elf != NULL)
         elf_end(mod->elf);
+    if (mod->ranges != NULL)
+        dr_global_free(mod->ranges, mod->ranges_alloc * sizeof(*mod->ranges));
     dr_global_free(mod, sizeof(*mod));
 }
 
@@ -334,28 +355,171 @@ drsym_obj_symbol_offs(void *mod_in, uint idx, size_t *offs_start OUT,
     return DRSYM_SUCCESS;
 }
 
+/******************************************************************************
+ * Address index.
+ *
+ * Symbols may overlap (aliases, nested local symbols), and a lookup has
+ * always returned the first symbol in table order that contains the address.
+ * We preserve that by sweeping over the sorted symbol boundaries and
+ * splitting the address space into disjoint ranges, each labeled with the
+ * lowest-indexed symbol covering it.  A lookup is then a binary search.
+ */
+
+static int
+compare_ranges(const void *a_in, const void *b_in)
+{
+    const addr_range_t *a = (const addr_range_t *) a_in;
+    const addr_range_t *b = (const addr_range_t *) b_in;
+    if (a->start != b->start)
+        return (a->start < b->start) ? -1 : 1;
+    if (a->idx != b->idx)
+        return (a->idx < b->idx) ? -1 : 1;
+    return 0;
+}
+
+/* Min-heap of symbol indices holding the symbols covering the sweep point. */
+static void
+heap_push(uint *heap, uint *count, uint idx)
+{
+    uint i = (*count)++;
+    while (i > 0 && heap[(i - 1) / 2] > idx) {
+        heap[i] = heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    heap[i] = idx;
+}
+
+static void
+heap_pop(uint *heap, uint *count)
+{
+    uint last = heap[--(*count)];
+    uint i = 0;
+    for (;;) {
+        uint child = 2 * i + 1;
+        if (child >= *count)
+            break;
+        if (child + 1 < *count && heap[child + 1] < heap[child])
+            child++;
+        if (last <= heap[child])
+            break;
+        heap[i] = heap[child];
+        i = child;
+    }
+    if (*count > 0)
+        heap[i] = last;
+}
+
+static void
+add_range(elf_info_t *mod, ptr_uint_t start, uint idx)
+{
+    /* Merge with the previous range if it names the same symbol. */
+    if (mod->num_ranges > 0) {
+        if (mod->ranges[mod->num_ranges - 1].idx == idx)
+            return;
+    } else if (idx == NO_SYMBOL)
+        return;
+    DR_ASSERT(mod->num_ranges < mod->ranges_alloc);
+    mod->ranges[mod->num_ranges].start = start;
+    mod->ranges[mod->num_ranges].idx = idx;
+    mod->num_ranges++;
+}
+
+static void
+build_addr_index(elf_info_t *mod)
+{
+    addr_range_t *starts, *ends;
+    uint *heap;
+    bool *active;
+    uint num = 0, si, ei, heap_count = 0;
+    int i;
+
+    for (i = 0; i < mod->num_syms; i++) {
+        if (mod->syms[i].st_size > 0)
+            num++;
+    }
+    mod->addr_index_built = true;
+    if (num == 0)
+        return;
+    /* Each symbol contributes at most two boundaries. */
+    mod->ranges_alloc = 2 * num;
+    mod->ranges = dr_global_alloc(mod->ranges_alloc * sizeof(*mod->ranges));
+    starts = dr_global_alloc(num * sizeof(*starts));
+    ends = dr_global_alloc(num * sizeof(*ends));
+    heap = dr_global_alloc(num * sizeof(*heap));
+    active = dr_global_alloc(mod->num_syms * sizeof(*active));
+    memset(active, 0, mod->num_syms * sizeof(*active));
+
+    for (i = 0, si = 0; i < mod->num_syms; i++) {
+        if (mod->syms[i].st_size > 0) {
+            starts[si].start = mod->syms[i].st_value;
+            starts[si].idx = i;
+            ends[si].start = mod->syms[i].st_value + mod->syms[i].st_size;
+            ends[si].idx = i;
+            si++;
+        }
+    }
+    qsort(starts, num, sizeof(*starts), compare_ranges);
+    qsort(ends, num, sizeof(*ends), compare_ranges);
+
+    /* Ranges are half-open, so at each boundary we retire the symbols ending
+     * there before adding the ones starting there.  Retired symbols are
+     * dropped from the heap lazily once they reach its top.
+     */
+    si = 0;
+    ei = 0;
+    while (ei < num) {
+        ptr_uint_t addr = ends[ei].start;
+        if (si < num && starts[si].start < addr)
+            addr = starts[si].start;
+        while (ei < num && ends[ei].start == addr)
+            active[ends[ei++].idx] = false;
+        while (si < num && starts[si].start == addr) {
+            active[starts[si].idx] = true;
+            heap_push(heap, &heap_count, starts[si++].idx);
+        }
+        while (heap_count > 0 && !active[heap[0]])
+            heap_pop(heap, &heap_count);
+        add_range(mod, addr, heap_count > 0 ? heap[0] : NO_SYMBOL);
+    }
+
+    dr_global_free(active, mod->num_syms * sizeof(*active));
+    dr_global_free(heap, num * sizeof(*heap));
+    dr_global_free(ends, num * sizeof(*ends));
+    dr_global_free(starts, num * sizeof(*starts));
+}
+
 drsym_error_t
 drsym_obj_addrsearch_symtab(void *mod_in, size_t modoffs, uint *idx OUT)
 {
     elf_info_t *mod = (elf_info_t *) mod_in;
-    int i;
+    ptr_uint_t addr;
+    uint lo, hi;
 
-    if (mod == NULL || mod->syms == NULL || idx == NULL || mod->syms == NULL)
+    if (mod == NULL || mod->syms == NULL || idx == NULL)
         return DRSYM_ERROR;
 
     /* XXX: if a function is split into non-contiguous pieces, will it
      * have multiple entries?
      */
-    for (i = 0; i < mod->num_syms; i++) {
-        size_t lo_offs = mod->syms[i].st_value - mod->load_base;
-        size_t hi_offs = lo_offs + mod->syms[i].st_size;
-        if (lo_offs <= modoffs && modoffs < hi_offs) {
-            *idx = i;
-            return DRSYM_SUCCESS;
-        }
+    /* We're protected by symbol_lock. */
+    if (!mod->addr_index_built)
+        build_addr_index(mod);
+
+    /* Find the last range starting at or below addr. */
+    addr = modoffs + mod->load_base;
+    lo = 0;
+    hi = mod->num_ranges;
+    while (lo < hi) {
+        uint mid = lo + (hi - lo) / 2;
+        if (mod->ranges[mid].start <= addr)
+            lo = mid + 1;
+        else
+            hi = mid;
     }
-
-    return DRSYM_ERROR_SYMBOL_NOT_FOUND;
+    if (lo == 0 || mod->ranges[lo - 1].idx == NO_SYMBOL)
+        return DRSYM_ERROR_SYMBOL_NOT_FOUND;
+    *idx = mod->ranges[lo - 1].idx;
+    return DRSYM_SUCCESS;
 }
 
 /******************************************************************************
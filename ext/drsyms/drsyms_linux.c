@@ -159,6 +159,36 @@ drsym_lookup_address_local(const char *modpath, size_t modoffs,
     return r;
 }
 
+static drsym_error_t
+drsym_lookup_addresses_local(const char *modpath, const size_t *modoffs, size_t count,
+                             drsym_info_t *out INOUT, drsym_lookup_addresses_cb callback,
+                             void *data, uint flags)
+{
+    void *mod;
+    drsym_error_t r;
+
+    if (modpath == NULL || (modoffs == NULL && count > 0) || out == NULL ||
+        callback == NULL)
+        return DRSYM_ERROR_INVALID_PARAMETER;
+    /* If we add fields in the future we would dispatch on out->struct_size */
+    if (out->struct_size != sizeof(*out))
+        return DRSYM_ERROR_INVALID_SIZE;
+
+    dr_recurlock_lock(symbol_lock);
+    mod = lookup_or_load(modpath);
+    if (mod == NULL) {
+        dr_recurlock_unlock(symbol_lock);
+        return DRSYM_ERROR_LOAD_FAILED;
+    }
+
+    recursive_context = true;
+    r = drsym_unix_lookup_addresses(mod, modoffs, count, out, callback, data, flags);
+    recursive_context = false;
+
+    dr_recurlock_unlock(symbol_lock);
+    return r;
+}
+
 static drsym_error_t
 drsym_enumerate_lines_local(const char *modpath, drsym_enumerate_lines_cb callback,
                             void *data)
@@ -249,6 +279,20 @@ drsym_lookup_address(const char *modpath, size_t modoffs, drsym_info_t *out INOU
     }
 }
 
+DR_EXPORT
+drsym_error_t
+drsym_lookup_addresses(const char *modpath, const size_t *modoffs, size_t count,
+                       drsym_info_t *out INOUT, drsym_lookup_addresses_cb callback,
+                       void *data, uint flags)
+{
+    if (IS_SIDELINE) {
+        return DRSYM_ERROR_NOT_IMPLEMENTED;
+    } else {
+        return drsym_lookup_addresses_local(modpath, modoffs, count, out, callback,
+                                            data, flags);
+    }
+}
+
 DR_EXPORT
 drsym_error_t
 drsym_lookup_symbol(const char *modpath, const char *symbol, size_t *modoffs OUT,
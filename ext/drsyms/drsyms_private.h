@@ -113,6 +113,11 @@ drsym_error_t
 drsym_unix_lookup_address(void *moddata, size_t modoffs,
                           drsym_info_t *out INOUT, uint flags);
 
+drsym_error_t
+drsym_unix_lookup_addresses(void *moddata, const size_t *modoffs, size_t count,
+                            drsym_info_t *out INOUT, drsym_lookup_addresses_cb callback,
+                            void *data, uint flags);
+
 drsym_error_t
 drsym_unix_lookup_symbol(void *moddata, const char *symbol, size_t *modoffs OUT,
                          uint flags);
@@ -57,6 +57,36 @@
 /* For debugging */
 static bool verbose = false;
 
+#define NO_SYMBOL ((uint)-1)
+
+/* Name lookup index kinds, one per way of demangling. */
+enum {
+    NAME_INDEX_MANGLED,
+    NAME_INDEX_DEMANGLED,
+    NAME_INDEX_DEMANGLED_FULL,
+    NAME_INDEX_KINDS,
+};
+
+/* Hash index from symbol names, as demangled for one index kind, to symbol
+ * indices.  The key is the name up to its first '(', so a search for a name
+ * with or without its parameter list hashes the same as the names it can
+ * match.  Each bucket chains its symbols in ascending table order.
+ */
+typedef struct _name_index_t {
+    uint num_buckets; /* power of 2 */
+    uint *buckets;    /* first symbol per bucket, or NO_SYMBOL */
+    uint *chain;      /* next symbol in the same bucket, or NO_SYMBOL */
+    uint *hashes;     /* full key hash per symbol */
+    uint num_syms;
+    /* The table walk stops at the first symbol without a name, so symbols
+     * past it are not visible to lookups either.
+     */
+    uint first_bad;
+    /* Scratch space for demangling candidates. */
+    char *name_buf;
+    size_t name_buf_sz;
+} name_index_t;
+
 typedef struct _dbg_module_t {
     file_t fd;
     size_t file_size;
@@ -70,6 +100,8 @@ typedef struct _dbg_module_t {
      * while the primary mod has symtab+strtab.
      */
     struct _dbg_module_t *mod_with_dwarf;
+    /* Built on the first name lookup of each kind. */
+    name_index_t *name_index[NAME_INDEX_KINDS];
 } dbg_module_t;
 
 /******************************************************************************
@@ -77,6 +109,7 @@ typedef struct _dbg_module_t {
  */
 
 static void unload_module(dbg_module_t *mod);
+static void free_name_index(name_index_t *idx);
 static bool follow_debuglink(const char * modpath, dbg_module_t *mod,
                              const char *debuglink, char debug_modpath[MAXIMUM_PATH]);
 
@@ -260,6 +293,11 @@ follow_debuglink(const char *modpath, dbg_module_t *mod, const char *debuglink,
 static void
 unload_module(dbg_module_t *mod)
 {
+    int i;
+    for (i = 0; i < NAME_INDEX_KINDS; i++) {
+        if (mod->name_index[i] != NULL)
+            free_name_index(mod->name_index[i]);
+    }
     if (mod->dwarf_info != NULL)
         drsym_dwarf_exit(mod->dwarf_info);
     if (mod->obj_info != NULL)
@@ -357,17 +395,12 @@ symsearch_symtab(dbg_module_t *mod, drsym_enumerate_cb callback,
     return res;
 }
 
+/* Fills in info's name from symbol idx. */
 static drsym_error_t
-addrsearch_symtab(dbg_module_t *mod, size_t modoffs, drsym_info_t *info INOUT,
-                  uint flags)
+fill_symbol_info(dbg_module_t *mod, uint idx, drsym_info_t *info INOUT, uint flags)
 {
     const char *symbol;
     size_t name_len = 0;
-    uint idx;
-    drsym_error_t res = drsym_obj_addrsearch_symtab(mod->obj_info, modoffs, &idx);
-
-    if (res != DRSYM_SUCCESS)
-        return res;
 
     symbol = drsym_obj_symbol_name(mod->obj_info, idx);
     if (symbol == NULL)
@@ -388,6 +421,166 @@ addrsearch_symtab(dbg_module_t *mod, size_t modoffs, drsym_info_t *info INOUT,
     return drsym_obj_symbol_offs(mod->obj_info, idx, &info->start_offs, &info->end_offs);
 }
 
+static drsym_error_t
+addrsearch_symtab(dbg_module_t *mod, size_t modoffs, drsym_info_t *info INOUT,
+                  uint flags)
+{
+    uint idx;
+    drsym_error_t res = drsym_obj_addrsearch_symtab(mod->obj_info, modoffs, &idx);
+
+    if (res != DRSYM_SUCCESS)
+        return res;
+    return fill_symbol_info(mod, idx, info, flags);
+}
+
+/******************************************************************************
+ * Name index
+ */
+
+/* Returns whether sym matches the search string: either exactly, or with a
+ * parameter list following it.  Since the parameter list starts where our
+ * search string ends, we assume the user doesn't care about possible
+ * overloads.
+ */
+static bool
+symbol_name_matches(const char *sym, const char *search_sym, size_t search_sym_len)
+{
+    return (strncmp(sym, search_sym, search_sym_len) == 0 &&
+            strlen(sym) >= search_sym_len &&
+            (sym[search_sym_len] == '\0' || sym[search_sym_len] == '('));
+}
+
+/* FNV-1a over the name up to its first '('. */
+static uint
+name_hash(const char *name)
+{
+    uint hash = 2166136261U;
+    for (; *name != '\0' && *name != '('; name++) {
+        hash ^= (byte) *name;
+        hash *= 16777619U;
+    }
+    return hash;
+}
+
+/* Returns the name that symbol idx is matched under for flags, demangling into
+ * *buf (which is grown as needed) the same way symsearch_symtab does.
+ */
+static const char *
+symbol_lookup_name(dbg_module_t *mod, uint idx, uint flags,
+                   char **buf INOUT, size_t *buf_sz INOUT)
+{
+    const char *mangled = drsym_obj_symbol_name(mod->obj_info, idx);
+    size_t len;
+    if (mangled == NULL || !TEST(DRSYM_DEMANGLE, flags))
+        return mangled;
+    while ((len = drsym_demangle_symbol(*buf, *buf_sz, mangled, flags)) > *buf_sz) {
+        dr_global_free(*buf, *buf_sz);
+        *buf_sz = len;
+        *buf = (char *) dr_global_alloc(*buf_sz);
+    }
+    return (len != 0) ? *buf : mangled;
+}
+
+static uint
+name_index_flags(int kind)
+{
+    if (kind == NAME_INDEX_MANGLED)
+        return DRSYM_LEAVE_MANGLED;
+    else if (kind == NAME_INDEX_DEMANGLED)
+        return DRSYM_DEMANGLE;
+    else
+        return DRSYM_DEMANGLE | DRSYM_DEMANGLE_FULL;
+}
+
+static name_index_t *
+build_name_index(dbg_module_t *mod, int kind)
+{
+    name_index_t *idx;
+    uint flags = name_index_flags(kind);
+    uint i;
+
+    idx = (name_index_t *) dr_global_alloc(sizeof(*idx));
+    idx->num_syms = drsym_obj_num_symbols(mod->obj_info);
+    idx->first_bad = idx->num_syms;
+    /* Keep the load factor at or below 1/2. */
+    for (idx->num_buckets = 16; idx->num_buckets < 2 * idx->num_syms;
+         idx->num_buckets *= 2)
+        ; /* nothing */
+    idx->buckets = (uint *) dr_global_alloc(idx->num_buckets * sizeof(uint));
+    memset(idx->buckets, 0xff, idx->num_buckets * sizeof(uint));
+    idx->chain = (uint *) dr_global_alloc(idx->num_syms * sizeof(uint));
+    idx->hashes = (uint *) dr_global_alloc(idx->num_syms * sizeof(uint));
+    idx->name_buf_sz = 1024;  /* C++ symbols can be quite long. */
+    idx->name_buf = (char *) dr_global_alloc(idx->name_buf_sz);
+
+    /* Insert in descending order so each chain ends up ascending. */
+    for (i = idx->num_syms; i-- > 0; ) {
+        const char *name = symbol_lookup_name(mod, i, flags, &idx->name_buf,
+                                              &idx->name_buf_sz);
+        uint bucket;
+        if (name == NULL) {
+            idx->first_bad = i;
+            idx->hashes[i] = 0;
+            idx->chain[i] = NO_SYMBOL;
+            continue;
+        }
+        idx->hashes[i] = name_hash(name);
+        bucket = idx->hashes[i] & (idx->num_buckets - 1);
+        idx->chain[i] = idx->buckets[bucket];
+        idx->buckets[bucket] = i;
+    }
+    return idx;
+}
+
+static void
+free_name_index(name_index_t *idx)
+{
+    dr_global_free(idx->name_buf, idx->name_buf_sz);
+    dr_global_free(idx->hashes, idx->num_syms * sizeof(uint));
+    dr_global_free(idx->chain, idx->num_syms * sizeof(uint));
+    dr_global_free(idx->buckets, idx->num_buckets * sizeof(uint));
+    dr_global_free(idx, sizeof(*idx));
+}
+
+/* Finds the first symbol in table order matching search_sym, which is what a
+ * walk of the whole table would find.
+ */
+static drsym_error_t
+name_index_lookup(dbg_module_t *mod, const char *search_sym, size_t *modoffs OUT,
+                  uint flags)
+{
+    int kind;
+    name_index_t *idx;
+    size_t search_sym_len = strlen(search_sym);
+    uint hash = name_hash(search_sym);
+    uint i;
+
+    if (!TEST(DRSYM_DEMANGLE, flags))
+        kind = NAME_INDEX_MANGLED;
+    else if (!TEST(DRSYM_DEMANGLE_FULL, flags))
+        kind = NAME_INDEX_DEMANGLED;
+    else
+        kind = NAME_INDEX_DEMANGLED_FULL;
+    /* We're protected by symbol_lock. */
+    if (mod->name_index[kind] == NULL)
+        mod->name_index[kind] = build_name_index(mod, kind);
+    idx = mod->name_index[kind];
+
+    for (i = idx->buckets[hash & (idx->num_buckets - 1)];
+         i != NO_SYMBOL && i < idx->first_bad; i = idx->chain[i]) {
+        const char *name;
+        if (idx->hashes[i] != hash)
+            continue;
+        name = symbol_lookup_name(mod, i, name_index_flags(kind), &idx->name_buf,
+                                  &idx->name_buf_sz);
+        if (name != NULL && symbol_name_matches(name, search_sym, search_sym_len)) {
+            NOTIFY("Looked up symbol: %s %s\n", search_sym, name);
+            return drsym_obj_symbol_offs(mod->obj_info, i, modoffs, NULL);
+        }
+    }
+    return (idx->first_bad < idx->num_syms) ? DRSYM_ERROR : DRSYM_SUCCESS;
+}
+
 /******************************************************************************
  * Exports
  */
@@ -429,36 +622,6 @@ drsym_unix_enumerate_symbols(void *mod_in, drsym_enumerate_cb callback,
     return symsearch_symtab(mod, callback, callback_ex, info_size, data, flags);
 }
 
-/* Params to sym_lookup_cb passed through data. */
-typedef struct _sym_lookup_params_t {
-    const char *search_sym;
-    size_t search_sym_len;
-    size_t *modoffs;
-} sym_lookup_params_t;
-
-/* Symbol enumeration callback for doing a single lookup.
- */
-static bool
-sym_lookup_cb(const char *sym, size_t modoffs, void *data INOUT)
-{
-    sym_lookup_params_t *p = (sym_lookup_params_t*)data;
-
-    if (strncmp(sym, p->search_sym, p->search_sym_len) == 0 &&
-        strlen(sym) >= p->search_sym_len &&
-        (sym[p->search_sym_len] == '\0' ||
-         /* Left paren means the beginning of the parameter list.  Since the
-          * parameter list starts where our search string ends, we assume the
-          * user doesn't care about possible overloads.
-          */
-         sym[p->search_sym_len] == '(')) {
-        NOTIFY("Looked up symbol: %s %s\n", p->search_sym, sym);
-        *p->modoffs = modoffs;
-        /* Stop after the first match. */
-        return false;
-    }
-    return true;
-}
-
 drsym_error_t
 drsym_unix_lookup_symbol(void *mod_in, const char *symbol, size_t *modoffs OUT,
                          uint flags)
@@ -466,7 +629,6 @@ drsym_unix_lookup_symbol(void *mod_in, const char *symbol, size_t *modoffs OUT,
     dbg_module_t *mod = (dbg_module_t *) mod_in;
     drsym_error_t r;
     const char *sym_no_mod;
-    sym_lookup_params_t params;
 
     if (symbol == NULL) {
         sym_no_mod = NULL;
@@ -487,29 +649,38 @@ drsym_unix_lookup_symbol(void *mod_in, const char *symbol, size_t *modoffs OUT,
 
     *modoffs = 0;
 
-    if (!TEST(DRSYM_SYMBOLS, mod->debug_kind)) {
-        /* XXX i#883: we have no symbols and we're just looking at exports so we
-         * should do a fast hashtable lookup instead of a linear walk.
-         * DR already has the code for this, accessible via dr_get_proc_address(),
-         * except that interface will only work for online (i.e., non-standalone)
-         * use.
-         */
-    }
+    /* Same as symsearch_symtab with no symbols to walk. */
+    if (drsym_obj_num_symbols(mod->obj_info) == 0)
+        return DRSYM_ERROR;
 
-    if (*modoffs == 0) {
-        params.search_sym = sym_no_mod;
-        params.search_sym_len = strlen(sym_no_mod);
-        params.modoffs = modoffs;
-        r = drsym_unix_enumerate_symbols(mod, sym_lookup_cb, NULL, sizeof(drsym_info_t),
-                                         &params, flags);
-        if (r != DRSYM_SUCCESS)
-            return r;
-    }
+    r = name_index_lookup(mod, sym_no_mod, modoffs, flags);
+    if (r != DRSYM_SUCCESS)
+        return r;
     if (*modoffs == 0)
         return DRSYM_ERROR_SYMBOL_NOT_FOUND;
     return DRSYM_SUCCESS;
 }
 
+/* Adds line information to the symbol found at modoffs. */
+static drsym_error_t
+lookup_line(dbg_module_t *mod, size_t modoffs, drsym_info_t *out INOUT)
+{
+    /* Search through .debug_line for line and file information.  We always
+     * report success even if we only get partial line information we at
+     * least have the name of the function.
+     */
+    dbg_module_t *mod4line = mod;
+    if (mod->mod_with_dwarf != NULL)
+        mod4line = mod->mod_with_dwarf;
+    if (mod4line->dwarf_info == NULL ||
+        !drsym_dwarf_search_addr2line
+        (mod4line->dwarf_info, (Dwarf_Addr)(ptr_uint_t)
+         (drsym_obj_load_base(mod->obj_info) + modoffs), out)) {
+        return DRSYM_ERROR_LINE_NOT_AVAILABLE;
+    }
+    return DRSYM_SUCCESS;
+}
+
 drsym_error_t
 drsym_unix_lookup_address(void *mod_in, size_t modoffs,
                           drsym_info_t *out INOUT, uint flags)
@@ -520,26 +691,45 @@ drsym_unix_lookup_address(void *mod_in, size_t modoffs,
     /* If we did find an address for the symbol, go look for its line number
      * information.
      */
-    if (r == DRSYM_SUCCESS) {
-        /* Search through .debug_line for line and file information.  We always
-         * report success even if we only get partial line information we at
-         * least have the name of the function.
-         */
-        dbg_module_t *mod4line = mod;
-        if (mod->mod_with_dwarf != NULL)
-            mod4line = mod->mod_with_dwarf;
-        if (mod4line->dwarf_info == NULL ||
-            !drsym_dwarf_search_addr2line
-            (mod4line->dwarf_info, (Dwarf_Addr)(ptr_uint_t)
-             (drsym_obj_load_base(mod->obj_info) + modoffs), out)) {
-            r = DRSYM_ERROR_LINE_NOT_AVAILABLE;
-        }
-    }
+    if (r == DRSYM_SUCCESS)
+        r = lookup_line(mod, modoffs, out);
 
     out->debug_kind = mod->debug_kind;
     return r;
 }
 
+drsym_error_t
+drsym_unix_lookup_addresses(void *mod_in, const size_t *modoffs, size_t count,
+                            drsym_info_t *out INOUT, drsym_lookup_addresses_cb callback,
+                            void *data, uint flags)
+{
+    dbg_module_t *mod = (dbg_module_t *) mod_in;
+    uint prev_idx = 0;
+    bool have_prev = false;
+    size_t i;
+
+    for (i = 0; i < count; i++) {
+        uint idx;
+        drsym_error_t r = drsym_obj_addrsearch_symtab(mod->obj_info, modoffs[i], &idx);
+        if (r == DRSYM_SUCCESS) {
+            /* Sorted offsets often land in the same symbol several times in a
+             * row: its name is still in out, so skip copying and demangling it.
+             */
+            if (!have_prev || idx != prev_idx)
+                r = fill_symbol_info(mod, idx, out, flags);
+            have_prev = (r == DRSYM_SUCCESS);
+            prev_idx = idx;
+        } else
+            have_prev = false;
+        if (r == DRSYM_SUCCESS)
+            r = lookup_line(mod, modoffs[i], out);
+        out->debug_kind = mod->debug_kind;
+        if (!(*callback)(i, out, r, data))
+            break;
+    }
+    return DRSYM_SUCCESS;
+}
+
 drsym_error_t
 drsym_unix_enumerate_lines(void *mod_in, drsym_enumerate_lines_cb callback, void *data)
 {
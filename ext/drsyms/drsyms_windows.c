@@ -509,6 +509,50 @@ drsym_lookup_address_local(const char *modpath, size_t modoffs,
     return DRSYM_SUCCESS;
 }
 
+static drsym_error_t
+drsym_lookup_addresses_local(const char *modpath, const size_t *modoffs, size_t count,
+                             drsym_info_t *out INOUT, drsym_lookup_addresses_cb callback,
+                             void *data, uint flags)
+{
+    mod_entry_t *mod;
+    size_t i;
+
+    if (modpath == NULL || (modoffs == NULL && count > 0) || out == NULL ||
+        callback == NULL)
+        return DRSYM_ERROR_INVALID_PARAMETER;
+    /* If we add fields in the future we would dispatch on out->struct_size */
+    if (out->struct_size != sizeof(*out) &&
+        out->struct_size != sizeof(drsym_info_legacy_t))
+        return DRSYM_ERROR_INVALID_SIZE;
+
+    dr_recurlock_lock(symbol_lock);
+    mod = lookup_or_load(modpath, true/*use dbghelp*/);
+    if (mod == NULL) {
+        dr_recurlock_unlock(symbol_lock);
+        return DRSYM_ERROR_LOAD_FAILED;
+    }
+    recursive_context = true;
+    if (mod->use_pecoff_symtable) {
+        drsym_error_t symerr =
+            drsym_unix_lookup_addresses(mod->u.pecoff_data, modoffs, count, out,
+                                        callback, data, flags);
+        recursive_context = false;
+        dr_recurlock_unlock(symbol_lock);
+        return symerr;
+    }
+    /* dbghelp has no batch interface, so we just save the repeated module
+     * lookups.  The recursive lock lets us hold it across the batch.
+     */
+    for (i = 0; i < count; i++) {
+        drsym_error_t r = drsym_lookup_address_local(modpath, modoffs[i], out, flags);
+        if (!(*callback)(i, out, r, data))
+            break;
+    }
+    recursive_context = false;
+    dr_recurlock_unlock(symbol_lock);
+    return DRSYM_SUCCESS;
+}
+
 static drsym_error_t
 drsym_lookup_symbol_local(const char *modpath, const char *symbol,
                           size_t *modoffs OUT, uint flags)
@@ -1218,6 +1262,20 @@ drsym_lookup_address(const char *modpath, size_t modoffs, drsym_info_t *out INOU
     }
 }
 
+DR_EXPORT
+drsym_error_t
+drsym_lookup_addresses(const char *modpath, const size_t *modoffs, size_t count,
+                       drsym_info_t *out INOUT, drsym_lookup_addresses_cb callback,
+                       void *data, uint flags)
+{
+    if (IS_SIDELINE) {
+        return DRSYM_ERROR_NOT_IMPLEMENTED;
+    } else {
+        return drsym_lookup_addresses_local(modpath, modoffs, count, out, callback,
+                                            data, flags);
+    }
+}
+
 DR_EXPORT
 drsym_error_t
 drsym_lookup_symbol(const char *modpath, const char *symbol, size_t *modoffs OUT,
@@ -51,6 +51,11 @@
 } while (0);
 #endif
 
+/* check if any bit in mask is set in var */
+#define TESTANY(mask, var) (((mask) & (var)) != 0)
+/* check if a single bit is set in var */
+#define TEST TESTANY
+
 #define PRE instrlist_meta_preinsert
 /* for inserting an app instruction, which must have a translation ("xl8") field */
 #define PREXL8 instrlist_preinsert
@@ -91,18 +96,274 @@ drutil_exit(void)
  * MEMORY TRACING
  */
 
-/* Could be optimized to have scratch==dst for many common cases, but
- * need way to get a 2nd reg for corner cases: simpler to ask caller
- * to give us scratch reg distinct from dst
- *
- * XXX: provide a version that calls clean call?  would have to hardcode
- * what gets included: memory size?  perhaps should try to create a
- * vararg clean call arg feature to chain things together.
+#ifdef ARM
+/* ARM memory operands name only a base register: the offset, and whether it
+ * is added or subtracted before or after the access, live in the containing
+ * instruction's other operands and its p/u/w flags.
  */
-DR_EXPORT
-bool
-drutil_insert_get_mem_addr(void *drcontext, instrlist_t *bb, instr_t *where,
-                           opnd_t memref, reg_id_t dst, reg_id_t scratch)
+
+static uint
+reg_list_count(reg_list_t list)
+{
+    uint count = 0;
+    for (; list != 0; list &= list - 1)
+        count++;
+    return count;
+}
+
+static bool
+opc_is_load_multiple(int opc)
+{
+    return (opc == OP_ldm || opc == OP_ldmia || opc == OP_ldmfd ||
+            opc == OP_ldmda || opc == OP_ldmfa || opc == OP_ldmdb ||
+            opc == OP_ldmea || opc == OP_ldmib || opc == OP_ldmed ||
+            opc == OP_pop);
+}
+
+/* Returns whether opc is a load or store multiple.  If so, sets *first to the
+ * offset from the base register of the lowest word accessed and *update to the
+ * amount writeback adds to the base, for a list of num_regs registers.
+ */
+static bool
+opc_multiple_offsets(int opc, uint num_regs, OUT int *first, OUT int *update)
+{
+    int size = (int) num_regs * sizeof(reg_t);
+    switch (opc) {
+    case OP_ldm: case OP_ldmia: case OP_ldmfd:
+    case OP_stm: case OP_stmia: case OP_stmea:
+    case OP_pop:
+        *first = 0;
+        *update = size;
+        return true;
+    case OP_ldmib: case OP_ldmed:
+    case OP_stmib: case OP_stmfa:
+        *first = sizeof(reg_t);
+        *update = size;
+        return true;
+    case OP_ldmda: case OP_ldmfa:
+    case OP_stmda: case OP_stmed:
+        *first = sizeof(reg_t) - size;
+        *update = -size;
+        return true;
+    case OP_ldmdb: case OP_ldmea:
+    case OP_stmdb: case OP_stmfd:
+    case OP_push:
+        *first = -size;
+        *update = -size;
+        return true;
+    default:
+        return false;
+    }
+}
+
+static bool
+opc_is_preload(int opc)
+{
+    return (opc == OP_pld_imm || opc == OP_pld_reg ||
+            opc == OP_pli_imm || opc == OP_pli_reg);
+}
+
+/* Returns the lowest 8-bit chunk of a nonzero left that starts at an even
+ * shift, which is always a modified immediate, and its field in *imm12.
+ */
+static uint
+next_imm_chunk(uint left, uint *imm12)
+{
+    uint shift = 0, chunk;
+    while (!TESTANY(3U << shift, left))
+        shift += 2;
+    chunk = left & (0xffU << shift);
+    if (!opnd_encode_modified_imm(chunk, imm12))
+        ASSERT(false, "8-bit chunk at an even shift must be encodable");
+    return chunk;
+}
+
+/* Computes src + disp into dst with as few adds or subs as there are
+ * immediate chunks in disp.
+ */
+static void
+insert_add_const(void *drcontext, instrlist_t *bb, instr_t *where,
+                 reg_id_t dst, reg_id_t src, int disp)
+{
+    uint left = (disp < 0) ? -(uint)disp : (uint)disp;
+    reg_id_t from = src;
+    while (left != 0) {
+        uint imm12;
+        left -= next_imm_chunk(left, &imm12);
+        if (disp < 0) {
+            PRE(bb, where,
+                INSTR_CREATE_sub_imm(drcontext, opnd_create_reg(dst),
+                                     opnd_create_reg(from), OPND_CREATE_IMM12(imm12),
+                                     COND_ALWAYS));
+        } else {
+            PRE(bb, where,
+                INSTR_CREATE_add_imm(drcontext, opnd_create_reg(dst),
+                                     opnd_create_reg(from), OPND_CREATE_IMM12(imm12),
+                                     COND_ALWAYS));
+        }
+        from = dst;
+    }
+    if (from != dst) {
+        PRE(bb, where,
+            INSTR_CREATE_mov_reg(drcontext, opnd_create_reg(dst), opnd_create_reg(src),
+                                 COND_ALWAYS));
+    }
+}
+
+static void
+insert_mov_const(void *drcontext, instrlist_t *bb, instr_t *where,
+                 reg_id_t dst, ptr_uint_t val)
+{
+    uint left = (uint) val, imm12;
+    bool first = true;
+    if (opnd_encode_modified_imm(left, &imm12)) {
+        PRE(bb, where,
+            INSTR_CREATE_mov_imm(drcontext, opnd_create_reg(dst),
+                                 OPND_CREATE_IMM12(imm12), COND_ALWAYS));
+        return;
+    }
+    while (left != 0) {
+        left -= next_imm_chunk(left, &imm12);
+        if (first) {
+            PRE(bb, where,
+                INSTR_CREATE_mov_imm(drcontext, opnd_create_reg(dst),
+                                     OPND_CREATE_IMM12(imm12), COND_ALWAYS));
+        } else {
+            PRE(bb, where,
+                INSTR_CREATE_add_imm(drcontext, opnd_create_reg(dst),
+                                     opnd_create_reg(dst), OPND_CREATE_IMM12(imm12),
+                                     COND_ALWAYS));
+        }
+        first = false;
+    }
+}
+
+/* Computes base +/- offs into dst, where offs is an immediate or a shifted
+ * register taken from inst.
+ */
+static bool
+insert_apply_offset(void *drcontext, instrlist_t *bb, instr_t *where, instr_t *inst,
+                    reg_id_t dst, reg_id_t base, opnd_t offs, opnd_t shift)
+{
+    bool add = !instr_has_u_flag(inst) || instr_get_u_flag(inst);
+    if (opnd_is_null(offs)) {
+        insert_add_const(drcontext, bb, where, dst, base, 0);
+    } else if (opnd_is_immed_int(offs)) {
+        int disp = (int) opnd_get_immed_int(offs);
+        insert_add_const(drcontext, bb, where, dst, base, add ? disp : -disp);
+    } else if (opnd_is_reg(offs) && opnd_get_reg(offs) != DR_REG_R15) {
+        instr_t *calc;
+        opnd_t amount = opnd_is_immed_int(shift) ? shift : OPND_CREATE_IMM5(0);
+        if (add) {
+            calc = INSTR_CREATE_add_reg(drcontext, opnd_create_reg(dst),
+                                        opnd_create_reg(base), offs, amount,
+                                        COND_ALWAYS);
+        } else {
+            calc = INSTR_CREATE_sub_reg(drcontext, opnd_create_reg(dst),
+                                        opnd_create_reg(base), offs, amount,
+                                        COND_ALWAYS);
+        }
+        instr_set_shift_type(drcontext, calc, instr_get_shift_type(inst));
+        PRE(bb, where, calc);
+    } else
+        return false;
+    return true;
+}
+
+static bool
+drutil_insert_get_mem_addr_arm(void *drcontext, instrlist_t *bb, instr_t *where,
+                               opnd_t memref, reg_id_t dst, reg_id_t scratch)
+{
+    int opc = instr_get_opcode(where);
+    int first, update;
+    opnd_t offs = opnd_create_null(), shift = opnd_create_null();
+    reg_id_t base;
+    int i;
+
+    if (opnd_is_base_disp(memref)) {
+        /* our own meta references, such as thread-local slots */
+        base = opnd_get_base(memref);
+        if (opnd_get_index(memref) != DR_REG_NULL) {
+            int scale = opnd_get_scale(memref), lsl = 0;
+            if (base == DR_REG_NULL)
+                return false;
+            while ((1 << lsl) < scale)
+                lsl++;
+            PRE(bb, where,
+                INSTR_CREATE_add_reg(drcontext, opnd_create_reg(dst),
+                                     opnd_create_reg(base),
+                                     opnd_create_reg(opnd_get_index(memref)),
+                                     OPND_CREATE_IMM5(lsl), COND_ALWAYS));
+            base = dst;
+        }
+        if (base == DR_REG_NULL) {
+            insert_mov_const(drcontext, bb, where, dst,
+                             (ptr_uint_t)(ptr_int_t) opnd_get_disp(memref));
+        } else {
+            insert_add_const(drcontext, bb, where, dst, base,
+                             opnd_get_disp(memref));
+        }
+        return true;
+    }
+
+    if (opc_multiple_offsets(opc, 0, &first, &update)) {
+        /* the lowest address accessed */
+        if (instr_num_srcs(where) == 0 || !opnd_is_reglist(instr_get_src(where, 0)))
+            return false;
+        opc_multiple_offsets(opc, reg_list_count
+                             (opnd_get_reg_list(instr_get_src(where, 0))),
+                             &first, &update);
+        if (opc == OP_push || opc == OP_pop)
+            base = DR_REG_R13;
+        else
+            base = opnd_get_reg(instr_get_dst(where, 0));
+        if (base == DR_REG_R15)
+            return false;
+        insert_add_const(drcontext, bb, where, dst, base, first);
+        return true;
+    } else if (opc_is_preload(opc)) {
+        /* no memory operand: the base is the lone dst */
+        base = opnd_get_reg(instr_get_dst(where, 0));
+        offs = instr_get_src(where, 0);
+        if (instr_num_srcs(where) > 1)
+            shift = instr_get_src(where, 1);
+    } else if (opnd_is_mem_reg(memref)) {
+        base = opnd_get_mem_reg(memref);
+        for (i = 0; i < instr_num_srcs(where); i++) {
+            opnd_t src = instr_get_src(where, i);
+            if (opnd_is_mem_reg(src) && opnd_get_mem_reg(src) == base)
+                break;
+        }
+        if (i == instr_num_srcs(where))
+            return false; /* memref is not from where */
+        /* post-indexed forms access the unmodified base */
+        if (instr_has_p_flag(where) && instr_get_p_flag(where)) {
+            if (i + 1 < instr_num_srcs(where))
+                offs = instr_get_src(where, i + 1);
+            if (i + 2 < instr_num_srcs(where))
+                shift = instr_get_src(where, i + 2);
+        }
+    } else {
+        /* unhandled memory reference */
+        return false;
+    }
+
+    if (base == DR_REG_R15) {
+        /* reads of the pc see the address of the instr plus 8 */
+        if (opnd_uses_reg(offs, scratch))
+            return false;
+        insert_mov_const(drcontext, bb, where, scratch,
+                         (ptr_uint_t) instr_get_app_pc(where) + 8);
+        base = scratch;
+    }
+    return insert_apply_offset(drcontext, bb, where, where, dst, base, offs, shift);
+}
+
+#else
+
+static bool
+drutil_insert_get_mem_addr_x86(void *drcontext, instrlist_t *bb, instr_t *where,
+                               opnd_t memref, reg_id_t dst, reg_id_t scratch)
 {
     if (opnd_is_far_base_disp(memref) &&
         /* We assume that far memory references via %ds and %es are flat,
@@ -196,11 +457,66 @@ drutil_insert_get_mem_addr(void *drcontext, instrlist_t *bb, instr_t *where,
     }
     return true;
 }
+#endif /* ARM */
+
+/* Could be optimized to have scratch==dst for many common cases, but
+ * need way to get a 2nd reg for corner cases: simpler to ask caller
+ * to give us scratch reg distinct from dst
+ *
+ * XXX: provide a version that calls clean call?  would have to hardcode
+ * what gets included: memory size?  perhaps should try to create a
+ * vararg clean call arg feature to chain things together.
+ */
+DR_EXPORT
+bool
+drutil_insert_get_mem_addr(void *drcontext, instrlist_t *bb, instr_t *where,
+                           opnd_t memref, reg_id_t dst, reg_id_t scratch)
+{
+#ifdef ARM
+    return drutil_insert_get_mem_addr_arm(drcontext, bb, where, memref, dst, scratch);
+#else
+    return drutil_insert_get_mem_addr_x86(drcontext, bb, where, memref, dst, scratch);
+#endif
+}
 
 DR_EXPORT
 uint
 drutil_opnd_mem_size_in_bytes(opnd_t memref, instr_t *inst)
 {
+#ifdef ARM
+    if (inst != NULL) {
+        int opc = instr_get_opcode(inst);
+        int first, update;
+        switch (opc) {
+        case OP_ldrd_imm: case OP_ldrd_reg: case OP_ldrd_lit:
+        case OP_strd_imm: case OP_strd_reg:
+        case OP_ldrexd: case OP_strexd:
+            return 2 * sizeof(reg_t);
+        case OP_ldrh_imm: case OP_ldrh_reg: case OP_ldrh_lit: case OP_ldrht:
+        case OP_ldrsh_imm: case OP_ldrsh_reg: case OP_ldrsh_lit: case OP_ldrsht:
+        case OP_strh_imm: case OP_strh_reg: case OP_strht:
+        case OP_ldrexh: case OP_strexh:
+            return 2;
+        case OP_ldrb_imm: case OP_ldrb_reg: case OP_ldrb_lit: case OP_ldrbt:
+        case OP_ldrsb_imm: case OP_ldrsb_reg: case OP_ldrsb_lit: case OP_ldrsbt:
+        case OP_strb_imm: case OP_strb_reg: case OP_strbt:
+        case OP_ldrexb: case OP_strexb:
+            return 1;
+        case OP_pld_imm: case OP_pld_reg: case OP_pld_lit:
+        case OP_pli_imm: case OP_pli_reg: case OP_pli_lit:
+            /* a hint: no memory is architecturally accessed */
+            return 0;
+        default:
+            if (opc_multiple_offsets(opc, 0, &first, &update) &&
+                instr_num_srcs(inst) > 0 && opnd_is_reglist(instr_get_src(inst, 0))) {
+                return reg_list_count(opnd_get_reg_list(instr_get_src(inst, 0))) *
+                    sizeof(reg_t);
+            }
+            break;
+        }
+    }
+    return opnd_size_in_bytes(opnd_get_size(memref));
+#else
     if (inst != NULL && instr_get_opcode(inst) == OP_enter) {
         uint extra_pushes = (uint) opnd_get_immed_int(instr_get_src(inst, 1));
         uint sz = opnd_size_in_bytes(opnd_get_size(instr_get_dst(inst, 1)));
@@ -208,8 +524,148 @@ drutil_opnd_mem_size_in_bytes(opnd_t memref, instr_t *inst)
         return sz*extra_pushes;
     } else
         return opnd_size_in_bytes(opnd_get_size(memref));
+#endif
+}
+
+#ifdef ARM
+static instr_t *
+create_single_transfer(void *drcontext, bool load, reg_id_t reg, reg_id_t base,
+                       int offs, int cond)
+{
+    instr_t *single;
+    opnd_t mem = opnd_create_mem_reg(base);
+    opnd_t imm = OPND_CREATE_IMM12(offs < 0 ? -offs : offs);
+    if (load)
+        single = INSTR_CREATE_ldr_imm(drcontext, opnd_create_reg(reg), mem, imm, cond);
+    else
+        single = INSTR_CREATE_str_imm(drcontext, opnd_create_reg(reg), mem, imm, cond);
+    instr_set_p_flag(drcontext, single, true);
+    instr_set_u_flag(drcontext, single, offs >= 0);
+    instr_set_w_flag(drcontext, single, false);
+    return single;
 }
 
+/* Replaces a load or store multiple with one ldr or str per register,
+ * followed by any writeback.  Loads of the base itself are placed last and
+ * the base is only updated at the end, so a fault on any piece can be
+ * handled by re-executing the original instr from the start.
+ */
+static bool
+expand_ldm_stm(void *drcontext, instrlist_t *bb, instr_t *inst)
+{
+    int opc = instr_get_opcode(inst);
+    int cond = instr_get_cond(inst);
+    app_pc xl8 = instr_get_app_pc(inst);
+    bool load = opc_is_load_multiple(opc);
+    bool writeback, load_base = false;
+    reg_list_t list;
+    reg_id_t base, reg;
+    int first, update, offs, base_offs = 0;
+
+    if (!opc_multiple_offsets(opc, 0, &first, &update) ||
+        instr_num_srcs(inst) == 0 || !opnd_is_reglist(instr_get_src(inst, 0)))
+        return false;
+    list = opnd_get_reg_list(instr_get_src(inst, 0));
+    if (!opc_multiple_offsets(opc, reg_list_count(list), &first, &update) ||
+        list == 0)
+        return false;
+    if (opc == OP_push || opc == OP_pop) {
+        base = DR_REG_R13;
+        writeback = true;
+    } else {
+        base = opnd_get_reg(instr_get_dst(inst, 0));
+        writeback = instr_get_w_flag(inst);
+    }
+    /* Loading the pc is a branch and storing it stores an implementation-defined
+     * value, and loading a base that is also written back is unpredictable:
+     * leave all of those alone.
+     */
+    if (base == DR_REG_R15 || TEST(REGLIST_R15, list) ||
+        (load && writeback && TEST(1 << (base - DR_REG_R0), list)))
+        return false;
+
+    offs = first;
+    for (reg = DR_REG_R0; reg <= DR_REG_R14; reg++) {
+        if (!TEST(1 << (reg - DR_REG_R0), list))
+            continue;
+        if (load && reg == base) {
+            load_base = true;
+            base_offs = offs;
+        } else {
+            PREXL8(bb, inst, INSTR_XL8(create_single_transfer
+                                       (drcontext, load, reg, base, offs, cond), xl8));
+        }
+        offs += sizeof(reg_t);
+    }
+    if (load_base) {
+        PREXL8(bb, inst, INSTR_XL8(create_single_transfer
+                                   (drcontext, true, base, base, base_offs, cond), xl8));
+    }
+    if (writeback) {
+        uint imm12;
+        opnd_t amount;
+        /* at most 16 words: always a single modified immediate */
+        if (!opnd_encode_modified_imm(update < 0 ? -update : update, &imm12))
+            ASSERT(false, "ldm/stm writeback not encodable");
+        amount = OPND_CREATE_IMM12(imm12);
+        if (update < 0) {
+            PREXL8(bb, inst, INSTR_XL8
+                   (INSTR_CREATE_sub_imm(drcontext, opnd_create_reg(base),
+                                         opnd_create_reg(base), amount, cond), xl8));
+        } else {
+            PREXL8(bb, inst, INSTR_XL8
+                   (INSTR_CREATE_add_imm(drcontext, opnd_create_reg(base),
+                                         opnd_create_reg(base), amount, cond), xl8));
+        }
+    }
+
+    instrlist_remove(bb, inst);
+    instr_destroy(drcontext, inst);
+    return true;
+}
+
+DR_EXPORT
+bool
+drutil_expand_ldm_stm(void *drcontext, instrlist_t *bb)
+{
+    instr_t *inst, *next_inst;
+
+    if (drmgr_current_bb_phase(drcontext) != DRMGR_PHASE_APP2APP) {
+        USAGE_ERROR("drutil_expand_ldm_stm must be called from "
+                    "drmgr's app2app phase");
+        return false;
+    }
+
+    for (inst = instrlist_first(bb);
+         inst != NULL;
+         inst = next_inst) {
+        next_inst = instr_get_next(inst);
+        if (instr_ok_to_mangle(inst))
+            expand_ldm_stm(drcontext, bb, inst);
+    }
+    return true;
+}
+
+DR_EXPORT
+bool
+drutil_expand_rep_string_ex(void *drcontext, instrlist_t *bb, bool *expanded OUT,
+                            instr_t **stringop OUT)
+{
+    if (drmgr_current_bb_phase(drcontext) != DRMGR_PHASE_APP2APP) {
+        USAGE_ERROR("drutil_expand_rep_string* must be called from "
+                    "drmgr's app2app phase");
+        return false;
+    }
+    /* ARM has no single-instruction string loops */
+    if (expanded != NULL)
+        *expanded = false;
+    if (stringop != NULL)
+        *stringop = NULL;
+    return true;
+}
+
+#else
+
 static bool
 opc_is_stringop_loop(uint opc)
 {
@@ -393,6 +849,20 @@ drutil_expand_rep_string_ex(void *drcontext, instrlist_t *bb, bool *expanded OUT
     return true;
 }
 
+DR_EXPORT
+bool
+drutil_expand_ldm_stm(void *drcontext, instrlist_t *bb)
+{
+    if (drmgr_current_bb_phase(drcontext) != DRMGR_PHASE_APP2APP) {
+        USAGE_ERROR("drutil_expand_ldm_stm must be called from "
+                    "drmgr's app2app phase");
+        return false;
+    }
+    /* there are no load or store multiple instructions to expand */
+    return true;
+}
+#endif /* ARM */
+
 DR_EXPORT
 bool
 drutil_expand_rep_string(void *drcontext, instrlist_t *bb)
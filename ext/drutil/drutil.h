@@ -79,6 +79,16 @@ DR_EXPORT
  * string loop, use drutil_expand_rep_string() to transform such loops
  * into regular loops containing (non-loop) string instructions.
  *
+ * On ARM, an application memory operand names only its base register,
+ * so \p where must be the instruction that contains \p memref: its
+ * offset operands and indexing flags determine the address, and
+ * post-indexed forms produce the unmodified base.  For load and store
+ * multiple instructions (including push and pop) the lowest address
+ * accessed is produced; use drutil_expand_ldm_stm() to obtain the
+ * address of each element.  Preload instructions, which have no memory
+ * operand, are also supported.  \p scratch is only clobbered when the
+ * base is the pc.
+ *
  * \return whether successful.
  */
 bool
@@ -92,6 +102,11 @@ DR_EXPORT
  * to be passed in.
  * For single-instruction string loops, returns the size referenced
  * by each iteration.
+ *
+ * On ARM, \p inst is required for all but meta memory references, as
+ * the access size is implied by the opcode: for example, 8 for ldrd and
+ * strd and 4 times the number of registers for load and store multiple
+ * instructions.  Preloads return 0.
  */
 uint
 drutil_opnd_mem_size_in_bytes(opnd_t memref, instr_t *inst);
@@ -128,6 +143,28 @@ DR_EXPORT
 bool
 drutil_expand_rep_string(void *drcontext, instrlist_t *bb);
 
+DR_EXPORT
+/**
+ * Expands ARM load and store multiple instructions (ldm, stm, and all of
+ * their addressing-mode variants, plus push and pop) into one ldr or str
+ * per register followed by an explicit update of the base register for
+ * writeback forms, so that each element has its own memory operand for
+ * drutil_insert_get_mem_addr().  The added instructions are predicated on
+ * the original's condition and all translate to its address; the base is
+ * updated last, so a fault partway through restarts the original
+ * instruction.  Forms that load or store the pc, or that load a base
+ * register which is also written back, are left unchanged.  On other
+ * architectures this routine does nothing.
+ *
+ * Like drutil_expand_rep_string(), this function must be called from
+ * drmgr's application-to-application ("app2app") stage, and the caller
+ * can return DR_EMIT_DEFAULT from its event.
+ *
+ * \return whether successful.
+ */
+bool
+drutil_expand_ldm_stm(void *drcontext, instrlist_t *bb);
+
 DR_EXPORT
 /**
  * Identical to drutil_expand_rep_string() but returns additional information.
@@ -55,6 +55,13 @@
 # define IF_WINDOWS(x) /* nothing */
 #endif
 
+/* the ARM dr_mcontext_t has no xsp alias for the stack pointer */
+#ifdef ARM
+# define MC_XSP(mc) ((mc)->r13)
+#else
+# define MC_XSP(mc) ((mc)->xsp)
+#endif
+
 #ifdef DEBUG
 static uint verbose = 0;
 # define NOTIFY(level, ...) do {         \
@@ -260,12 +267,152 @@ typedef struct _post_call_notify_t {
 /* protected by post_call_rwlock */
 post_call_notify_t *post_call_notify_list;
 
-/* FIFO cache read w/o a lock (which we assume is fine b/c it's word-aligned
- * and thus does not cross a cache line) and written under post_call_rwlock
+/* Lock-free mirror of the keys of post_call_table, so the per-call check in
+ * drwrap_ensure_postcall() and the per-bb check for post-call instru do not
+ * need post_call_rwlock.  This is an open-addressed array with linear probing,
+ * read w/o a lock (which we assume is fine b/c each slot is word-aligned)
+ * and written only under the post_call_rwlock write lock.  Removed entries
+ * become tombstones so that concurrent probes never stop short, and a
+ * tombstone that ends a probe run is turned back into an empty slot.  Once
+ * the array is too full to mirror every entry we set postcall_set_full, after
+ * which a miss is no longer authoritative and we fall back to the table.
+ * The flag is never cleared while threads may be reading it: a reader that
+ * saw it clear too early could trust a miss before the refilled keys were
+ * visible to it, and we have no barrier to order the two.
+ */
+#define POSTCALL_SET_BITS 12
+#define POSTCALL_SET_SIZE (1 << POSTCALL_SET_BITS)
+#define POSTCALL_SET_MASK (POSTCALL_SET_SIZE - 1)
+#define POSTCALL_SET_MAX_USED (POSTCALL_SET_SIZE / 2)
+#define POSTCALL_SET_TOMBSTONE ((app_pc)(ptr_uint_t)1)
+static app_pc postcall_set[POSTCALL_SET_SIZE];
+/* live entries plus tombstones: protected by post_call_rwlock */
+static uint postcall_set_used;
+/* tombstones alone: protected by post_call_rwlock */
+static uint postcall_set_tombstones;
+static bool postcall_set_full;
+
+static inline uint
+postcall_set_hash(app_pc pc)
+{
+    /* ignore the low bit: ARM and Thumb instructions are at least 2-byte aligned */
+    return (uint)(((ptr_uint_t)pc >> 1) & POSTCALL_SET_MASK);
+}
+
+/* may be called w/o holding any lock */
+static inline bool
+postcall_set_contains(app_pc pc)
+{
+    uint i, idx = postcall_set_hash(pc);
+    /* there is always an empty slot, but bound the probe in case of races */
+    for (i = 0; i < POSTCALL_SET_SIZE; i++) {
+        app_pc cur = postcall_set[idx];
+        if (cur == pc)
+            return true;
+        if (cur == NULL)
+            return false;
+        idx = (idx + 1) & POSTCALL_SET_MASK;
+    }
+    return false;
+}
+
+/* caller must hold write lock.  Returns false if there is no room. */
+static bool
+postcall_set_insert(app_pc pc)
+{
+    uint i, idx = postcall_set_hash(pc);
+    int reuse = -1;
+    for (i = 0; i < POSTCALL_SET_SIZE; i++) {
+        app_pc cur = postcall_set[idx];
+        if (cur == pc)
+            return true;
+        if (cur == POSTCALL_SET_TOMBSTONE && reuse == -1)
+            reuse = (int) idx;
+        else if (cur == NULL)
+            break;
+        idx = (idx + 1) & POSTCALL_SET_MASK;
+    }
+    if (reuse != -1) {
+        postcall_set[reuse] = pc;
+        postcall_set_tombstones--;
+        return true;
+    }
+    if (postcall_set_used + 1 > POSTCALL_SET_MAX_USED)
+        return false;
+    postcall_set_used++;
+    postcall_set[idx] = pc;
+    return true;
+}
+
+/* caller must hold write lock */
+static void
+postcall_set_add(app_pc pc)
+{
+    ASSERT(dr_rwlock_self_owns_write_lock(post_call_rwlock), "must hold write lock");
+    if (postcall_set_full)
+        return;
+    if (!postcall_set_insert(pc))
+        postcall_set_full = true;
+}
+
+/* Empties the run of tombstones that ends just before the empty slot idx.
+ * No probe for a live entry passes through them, as it would have to go
+ * on through idx, so this is safe w/ concurrent lock-free readers.
+ * Caller must hold write lock.
  */
-static uint postcall_cache_idx;
-#define POSTCALL_CACHE_SIZE 8
-static app_pc postcall_cache[POSTCALL_CACHE_SIZE];
+static void
+postcall_set_trim(uint idx)
+{
+    uint prev = (idx - 1) & POSTCALL_SET_MASK;
+    ASSERT(postcall_set[idx] == NULL, "must start at an empty slot");
+    while (postcall_set[prev] == POSTCALL_SET_TOMBSTONE) {
+        postcall_set[prev] = NULL;
+        postcall_set_used--;
+        postcall_set_tombstones--;
+        prev = (prev - 1) & POSTCALL_SET_MASK;
+    }
+}
+
+/* caller must hold write lock, and have removed pc from post_call_table */
+static void
+postcall_set_remove(app_pc pc)
+{
+    uint i, idx = postcall_set_hash(pc);
+    ASSERT(dr_rwlock_self_owns_write_lock(post_call_rwlock), "must hold write lock");
+    for (i = 0; i < POSTCALL_SET_SIZE; i++) {
+        app_pc cur = postcall_set[idx];
+        if (cur == pc) {
+            postcall_set[idx] = POSTCALL_SET_TOMBSTONE;
+            postcall_set_tombstones++;
+            idx = (idx + 1) & POSTCALL_SET_MASK;
+            if (postcall_set[idx] == NULL)
+                postcall_set_trim(idx);
+            break;
+        }
+        if (cur == NULL)
+            break;
+        idx = (idx + 1) & POSTCALL_SET_MASK;
+    }
+}
+
+/* caller must hold write lock, and have removed the range from post_call_table */
+static void
+postcall_set_remove_range(app_pc start, app_pc end)
+{
+    uint i;
+    ASSERT(dr_rwlock_self_owns_write_lock(post_call_rwlock), "must hold write lock");
+    for (i = 0; i < POSTCALL_SET_SIZE; i++) {
+        app_pc cur = postcall_set[i];
+        if (cur != NULL && cur != POSTCALL_SET_TOMBSTONE && cur >= start && cur < end) {
+            postcall_set[i] = POSTCALL_SET_TOMBSTONE;
+            postcall_set_tombstones++;
+        }
+    }
+    for (i = 0; i < POSTCALL_SET_SIZE && postcall_set_tombstones > 0; i++) {
+        if (postcall_set[i] == NULL)
+            postcall_set_trim(i);
+    }
+}
 
 static void
 post_call_entry_free(void *v)
@@ -288,6 +435,7 @@ post_call_entry_add(app_pc postcall, bool external)
         memset(e->prior, 0, sizeof(e->prior));
     }
     hashtable_add(&post_call_table, (void*)postcall, (void*)e);
+    postcall_set_add(postcall);
     if (!external && post_call_notify_list != NULL) {
         post_call_notify_t *cb = post_call_notify_list;
         while (cb != NULL) {
@@ -322,6 +470,10 @@ static bool
 post_call_lookup(app_pc pc)
 {
     bool res = false;
+    if (postcall_set_contains(pc))
+        return true;
+    if (!postcall_set_full)
+        return false;
     dr_rwlock_read_lock(post_call_rwlock);
     res = (hashtable_lookup(&post_call_table, (void*)pc) != NULL);
     dr_rwlock_read_unlock(post_call_rwlock);
@@ -334,23 +486,21 @@ post_call_lookup_for_instru(app_pc pc)
 {
     bool res = false;
     post_call_entry_t *e;
+    /* the common case of a non-post-call bb needs no lock */
+    if (!postcall_set_full && !postcall_set_contains(pc))
+        return false;
     dr_rwlock_read_lock(post_call_rwlock);
     e = (post_call_entry_t *) hashtable_lookup(&post_call_table, (void*)pc);
     if (e != NULL) {
         res = post_call_consistent(pc, e);
         if (!res) {
-            int i;
             /* need the write lock */
             dr_rwlock_read_unlock(post_call_rwlock);
             e = NULL; /* no longer safe */
             dr_rwlock_write_lock(post_call_rwlock);
             /* might not be found now if racily removed: but that's fine */
             hashtable_remove(&post_call_table, (void *)pc);
-            /* invalidate cache */
-            for (i = 0; i < POSTCALL_CACHE_SIZE; i++) {
-                if (pc == postcall_cache[i])
-                    postcall_cache[i] = NULL;
-            }
+            postcall_set_remove(pc);
             dr_rwlock_write_unlock(post_call_rwlock);
             return res;
         } else {
@@ -431,6 +581,9 @@ drwrap_mark_as_post_call(app_pc pc)
  * WRAPPING CONTEXT
  */
 
+/* The number of arguments passed in registers: r0-r3 */
+#define NUM_REG_ARGS 4
+
 /* An opaque pointer we pass to callbacks and the user passes back for queries */
 typedef struct _drwrap_context_t {
     void *drcontext;
@@ -438,6 +591,15 @@ typedef struct _drwrap_context_t {
     dr_mcontext_t *mc;
     app_pc retaddr;
     bool mc_modified;
+    /* For DRWRAP_FAST, the register values our clean call was passed
+     * directly: r0-r3 at function entry, or just r0 at a post-call point.
+     * These are used in place of mc until something asks for mc, which
+     * then picks up any changes made to them.
+     */
+    uint num_regs;
+    reg_t regs[NUM_REG_ARGS];
+    /* for DRWRAP_FAST, the application stack pointer */
+    reg_t xsp;
 } drwrap_context_t;
 
 static void
@@ -449,6 +611,14 @@ drwrap_context_init(void *drcontext, drwrap_context_t *wrapcxt, app_pc func,
     wrapcxt->mc = mc;
     wrapcxt->retaddr = retaddr;
     wrapcxt->mc_modified = false;
+    wrapcxt->num_regs = 0;
+}
+
+/* Whether the DRWRAP_FAST register values are still the only state we have */
+static inline bool
+drwrap_context_regs_only(drwrap_context_t *wrapcxt)
+{
+    return wrapcxt->num_regs > 0 && wrapcxt->mc->flags == 0;
 }
 
 DR_EXPORT
@@ -494,9 +664,18 @@ drwrap_get_mcontext_internal(drwrap_context_t *wrapcxt, dr_mcontext_flags_t flag
     if (!TESTALL(flags, wrapcxt->mc->flags)) {
         dr_mcontext_flags_t old_flags = wrapcxt->mc->flags;
         wrapcxt->mc->flags |= flags | DR_MC_INTEGER | DR_MC_CONTROL;
-        if (old_flags == 0) /* nothing to clobber */
+        if (old_flags == 0) { /* nothing to clobber */
             dr_get_mcontext(wrapcxt->drcontext, wrapcxt->mc);
-        else {
+#ifdef ARM
+            /* DRWRAP_FAST: carry over any drwrap_set_arg() or
+             * drwrap_set_retval() made before the mcontext was requested
+             */
+            if (wrapcxt->num_regs > 0) {
+                memcpy(&wrapcxt->mc->r0, wrapcxt->regs,
+                       wrapcxt->num_regs * sizeof(reg_t));
+            }
+#endif
+        } else {
             ASSERT(TEST(DR_MC_MULTIMEDIA, flags) && !TEST(DR_MC_MULTIMEDIA, old_flags) &&
                    TESTALL(DR_MC_INTEGER|DR_MC_CONTROL, old_flags), "logic error");
             /* the pre-ymm is smaller than ymm so we make a temp copy and then
@@ -571,11 +750,29 @@ drwrap_set_mcontext(void *wrapcxt_opaque)
     return true;
 }
 
+/* propagates changes made by callbacks to the application */
+static void
+drwrap_context_writeback(drwrap_context_t *wrapcxt)
+{
+    /* DRWRAP_FAST: only the passed-in registers were changed, but we have to
+     * fill in the rest before we can set the context
+     */
+    if (drwrap_context_regs_only(wrapcxt))
+        drwrap_get_mcontext_internal(wrapcxt, DR_MC_INTEGER | DR_MC_CONTROL);
+    dr_set_mcontext(wrapcxt->drcontext, wrapcxt->mc);
+}
+
 static inline reg_t *
 drwrap_arg_addr(drwrap_context_t *wrapcxt, int arg)
 {
     if (wrapcxt == NULL || wrapcxt->mc == NULL)
         return NULL;
+    if (drwrap_context_regs_only(wrapcxt)) {
+        /* DRWRAP_FAST: no need to fill in the mcontext */
+        if (arg < (int) wrapcxt->num_regs)
+            return &wrapcxt->regs[arg];
+        return (reg_t *)(wrapcxt->xsp + (arg - NUM_REG_ARGS)*sizeof(reg_t));
+    }
 #ifdef X64
     /* ensure we have the info we need. note that we always have xsp. */
     drwrap_get_mcontext_internal(wrapcxt, DR_MC_INTEGER);
@@ -611,6 +808,14 @@ drwrap_arg_addr(drwrap_context_t *wrapcxt, int arg)
     default: return (reg_t *)(wrapcxt->mc->xsp + (arg + 1/*retaddr*/)*sizeof(reg_t));
     }
 # endif
+#elif defined(ARM)
+    /* AAPCS: the first four args are in r0-r3 and the rest on the stack,
+     * where there is no retaddr: it's in lr
+     */
+    drwrap_get_mcontext_internal(wrapcxt, DR_MC_INTEGER);
+    if (arg < NUM_REG_ARGS)
+        return &wrapcxt->mc->r0 + arg;
+    return (reg_t *)(wrapcxt->mc->r13 + (arg - NUM_REG_ARGS)*sizeof(reg_t));
 #else
     return (reg_t *)(wrapcxt->mc->xsp + (arg + 1/*retaddr*/)*sizeof(reg_t));
 #endif
@@ -643,11 +848,13 @@ drwrap_set_arg(void *wrapcxt_opaque, int arg, void *val)
         return false;
     else {
         bool in_memory = true;
-#ifdef X64
+#if defined(X64) || defined(ARM)
         in_memory = !(addr >= (reg_t*)wrapcxt->mc && addr < (reg_t*)(wrapcxt->mc + 1));
+#endif
+        if (addr >= wrapcxt->regs && addr < wrapcxt->regs + wrapcxt->num_regs)
+            in_memory = false;
         if (!in_memory)
             wrapcxt->mc_modified = true;
-#endif
         if (in_memory && TEST(DRWRAP_SAFE_READ_ARGS, global_flags)) {
             size_t written;
             if (!dr_safe_write((void *)addr, sizeof(val), val, &written) ||
@@ -666,6 +873,8 @@ drwrap_get_retval(void *wrapcxt_opaque)
     drwrap_context_t *wrapcxt = (drwrap_context_t *) wrapcxt_opaque;
     if (wrapcxt == NULL || wrapcxt->mc == NULL)
         return NULL;
+    if (drwrap_context_regs_only(wrapcxt))
+        return (void *) wrapcxt->regs[0];
     /* ensure we have the info we need */
     drwrap_get_mcontext_internal(wrapcxt_opaque, DR_MC_INTEGER);
 #ifdef ARM
@@ -682,6 +891,11 @@ drwrap_set_retval(void *wrapcxt_opaque, void *val)
     drwrap_context_t *wrapcxt = (drwrap_context_t *) wrapcxt_opaque;
     if (wrapcxt == NULL || wrapcxt->mc == NULL)
         return false;
+    if (drwrap_context_regs_only(wrapcxt)) {
+        wrapcxt->regs[0] = (reg_t) val;
+        wrapcxt->mc_modified = true;
+        return true;
+    }
     /* ensure we have the info we need */
     drwrap_get_mcontext_internal(wrapcxt_opaque, DR_MC_INTEGER);
 #ifdef ARM
@@ -863,6 +1077,10 @@ drwrap_exit(void)
     hashtable_delete(&wrap_table);
     hashtable_delete(&call_site_table);
     hashtable_delete(&post_call_table);
+    memset(postcall_set, 0, sizeof(postcall_set));
+    postcall_set_used = 0;
+    postcall_set_tombstones = 0;
+    postcall_set_full = false;
     dr_rwlock_destroy(post_call_rwlock);
     dr_recurlock_destroy(wrap_lock);
     drmgr_exit();
@@ -1509,29 +1727,15 @@ drwrap_ensure_postcall(void *drcontext, wrap_entry_t *wrap,
                        drwrap_context_t *wrapcxt, app_pc pc)
 {
     app_pc retaddr = wrapcxt->retaddr;
-    int i;
-    /* avoid lock and hashtable lookup by caching prior retaddrs */
-    for (i = 0; i < POSTCALL_CACHE_SIZE; i++) {
-        if (retaddr == postcall_cache[i])
-            return;
-    }
-
-    /* to write to the cache we need a write lock */
-    dr_rwlock_write_lock(post_call_rwlock);
-
-    /* add to FIFO cache */
-    postcall_cache_idx++;
-    if (postcall_cache_idx >= POSTCALL_CACHE_SIZE)
-        postcall_cache_idx = 0;
-    postcall_cache[postcall_cache_idx] = retaddr;
-
-    if (hashtable_lookup(&post_call_table, (void*)retaddr) == NULL) {
+    /* avoid lock and hashtable lookup for retaddrs we've already set up */
+    if (post_call_lookup(retaddr))
+        return;
+    else {
         bool enabled = wrap->enabled;
         /* this function may not return: but in that case it will redirect
          * and we'll come back here to do the wrapping.
          * release all locks.
          */
-        dr_rwlock_write_unlock(post_call_rwlock);
         if (!TEST(DRWRAP_NO_FRILLS, global_flags))
             dr_recurlock_unlock(wrap_lock);
         drwrap_mark_retaddr_for_instru(drcontext, pc, wrapcxt, enabled);
@@ -1539,13 +1743,14 @@ drwrap_ensure_postcall(void *drcontext, wrap_entry_t *wrap,
         if (!TEST(DRWRAP_NO_FRILLS, global_flags))
             dr_recurlock_lock(wrap_lock);
         wrap = hashtable_lookup(&wrap_table, (void *)pc);
-    } else
-        dr_rwlock_write_unlock(post_call_rwlock);
+    }
 }
 
-/* called via clean call at the top of callee */
-static void
-drwrap_in_callee(void *arg1, reg_t xsp)
+/* Shared by our two clean call targets at the top of callee.  For DRWRAP_FAST,
+ * regs holds the passed-in r0-r3; otherwise it is NULL.
+ */
+static inline void
+drwrap_in_callee_common(void *arg1, reg_t xsp, app_pc retaddr, reg_t *regs)
 {
     void *drcontext = dr_get_current_drcontext();
     per_thread_t *pt = (per_thread_t *) drmgr_get_tls_field(drcontext, tls_idx);
@@ -1561,7 +1766,7 @@ drwrap_in_callee(void *arg1, reg_t xsp)
 
     mc.size = sizeof(mc);
     /* we use a passed-in xsp to avoid dr_get_mcontext */
-    mc.xsp = xsp;
+    MC_XSP(&mc) = xsp;
     mc.flags = 0; /* if anything else is asked for, lazily initialize */
 
     ASSERT(arg1 != NULL, "drwrap_in_callee: arg1 is NULL!");
@@ -1575,7 +1780,12 @@ drwrap_in_callee(void *arg1, reg_t xsp)
 
     NOTIFY(2, "%s: level %d function "PFX"\n", __FUNCTION__, pt->wrap_level+1, pc);
 
-    drwrap_context_init(drcontext, &wrapcxt, pc, &mc, get_retaddr_at_entry(xsp));
+    drwrap_context_init(drcontext, &wrapcxt, pc, &mc, retaddr);
+    if (regs != NULL) {
+        wrapcxt.num_regs = NUM_REG_ARGS;
+        memcpy(wrapcxt.regs, regs, sizeof(wrapcxt.regs));
+        wrapcxt.xsp = xsp;
+    }
 
     drwrap_in_callee_check_unwind(drcontext, pt, &mc);
 
@@ -1607,7 +1817,7 @@ drwrap_in_callee(void *arg1, reg_t xsp)
     pt->last_wrap_func[pt->wrap_level] = pc;
     if (TEST(DRWRAP_NO_FRILLS, global_flags))
         pt->last_wrap_entry[pt->wrap_level] = wrap;
-    pt->app_esp[pt->wrap_level] = mc.xsp;
+    pt->app_esp[pt->wrap_level] = MC_XSP(&mc);
 #ifdef DEBUG
     for (idx = 0; idx < (uint) pt->wrap_level; idx++) {
         /* note that this should no longer fire at all b/c of the check above but
@@ -1668,7 +1878,7 @@ drwrap_in_callee(void *arg1, reg_t xsp)
         ASSERT(false, "dr_redirect_execution should not return");
     }
     if (wrapcxt.mc_modified)
-        dr_set_mcontext(drcontext, wrapcxt.mc);
+        drwrap_context_writeback(&wrapcxt);
     if (!intercept_post) {
         /* we won't decrement in post so decrement now.  we needed to increment
          * to set up for pt->skip, etc.
@@ -1679,12 +1889,36 @@ drwrap_in_callee(void *arg1, reg_t xsp)
     }
 }
 
+/* called via clean call at the top of callee */
+static void
+drwrap_in_callee(void *arg1, reg_t xsp)
+{
+    drwrap_in_callee_common(arg1, xsp, get_retaddr_at_entry(xsp), NULL);
+}
+
+/* Called via clean call at the top of callee for DRWRAP_FAST.  The register
+ * arguments and the return address in lr are passed in directly, so callbacks
+ * that only look at the arguments need no dr_get_mcontext().
+ */
+static void
+drwrap_in_callee_fast(void *arg1, reg_t xsp, app_pc lr,
+                      reg_t r0, reg_t r1, reg_t r2, reg_t r3)
+{
+    reg_t regs[NUM_REG_ARGS];
+    regs[0] = r0;
+    regs[1] = r1;
+    regs[2] = r2;
+    regs[3] = r3;
+    drwrap_in_callee_common(arg1, xsp, lr, regs);
+}
+
 /* called via clean call at return address(es) of callee
- * if retaddr is NULL then this is a "fake" cleanup on abnormal stack unwind
+ * if retaddr is NULL then this is a "fake" cleanup on abnormal stack unwind.
+ * for DRWRAP_FAST, retval points at the passed-in r0; otherwise it is NULL.
  */
 static void
 drwrap_after_callee_func(void *drcontext, per_thread_t *pt, dr_mcontext_t *mc,
-                         int level, app_pc retaddr,
+                         int level, app_pc retaddr, reg_t *retval,
                          bool unwind, bool only_requested_unwind)
 {
     wrap_entry_t *wrap, *next;
@@ -1702,6 +1936,14 @@ drwrap_after_callee_func(void *drcontext, per_thread_t *pt, dr_mcontext_t *mc,
            unwind ? " abnormal" : "");
 
     drwrap_context_init(drcontext, &wrapcxt, pc, mc, retaddr);
+    if (retval != NULL) {
+        /* once a callback changes the retval mc is filled in and used by
+         * the remaining levels, so there is no need to copy back
+         */
+        wrapcxt.num_regs = 1;
+        wrapcxt.regs[0] = *retval;
+        wrapcxt.xsp = MC_XSP(mc);
+    }
 
     if (level >= MAX_WRAP_NESTING) {
         if (level == pt->wrap_level)
@@ -1825,7 +2067,7 @@ drwrap_after_callee_func(void *drcontext, per_thread_t *pt, dr_mcontext_t *mc,
     if (!TEST(DRWRAP_NO_FRILLS, global_flags))
         dr_recurlock_unlock(wrap_lock);
     if (wrapcxt.mc_modified && !unwind)
-        dr_set_mcontext(drcontext, wrapcxt.mc);
+        drwrap_context_writeback(&wrapcxt);
 
     if (do_flush) {
         /* handle delayed flushes while holding no lock 
@@ -1851,16 +2093,18 @@ drwrap_after_callee_func(void *drcontext, per_thread_t *pt, dr_mcontext_t *mc,
     } /* else, hopefully our unwind detection heuristics will */
 }
 
-/* called via clean call at return address(es) of callee */
-static void
-drwrap_after_callee(app_pc retaddr, reg_t xsp)
+/* Shared by our two clean call targets at return address(es) of callee.
+ * For DRWRAP_FAST, retval points at the passed-in r0; otherwise it is NULL.
+ */
+static inline void
+drwrap_after_callee_common(app_pc retaddr, reg_t xsp, reg_t *retval)
 {
     void *drcontext = dr_get_current_drcontext();
     per_thread_t *pt = (per_thread_t *) drmgr_get_tls_field(drcontext, tls_idx);
     dr_mcontext_t mc;
     mc.size = sizeof(mc);
     /* we use a passed-in xsp to avoid dr_get_mcontext */
-    mc.xsp = xsp;
+    MC_XSP(&mc) = xsp;
     mc.flags = 0; /* if anything else is asked for, lazily initialize */
 
     ASSERT(pt != NULL, "drwrap_after_callee: pt is NULL!");
@@ -1886,12 +2130,26 @@ drwrap_after_callee(app_pc retaddr, reg_t xsp)
      * check will identify whether we've left any wrapped routines we
      * entered.
      */
-    while (pt->wrap_level >= 0 && pt->app_esp[pt->wrap_level] < mc.xsp) {
+    while (pt->wrap_level >= 0 && pt->app_esp[pt->wrap_level] < MC_XSP(&mc)) {
         drwrap_after_callee_func(drcontext, pt, &mc, pt->wrap_level,
-                                 retaddr, false, false);
+                                 retaddr, retval, false, false);
     }
 }
 
+/* called via clean call at return address(es) of callee */
+static void
+drwrap_after_callee(app_pc retaddr, reg_t xsp)
+{
+    drwrap_after_callee_common(retaddr, xsp, NULL);
+}
+
+/* called via clean call at return address(es) of callee for DRWRAP_FAST */
+static void
+drwrap_after_callee_fast(app_pc retaddr, reg_t xsp, reg_t r0)
+{
+    drwrap_after_callee_common(retaddr, xsp, &r0);
+}
+
 static dr_emit_flags_t
 drwrap_event_bb_analysis(void *drcontext, void *tag, instrlist_t *bb,
                          bool for_trace, bool translating, OUT void **user_data)
@@ -1925,6 +2183,20 @@ drwrap_event_bb_insert(void *drcontext, void *tag, instrlist_t *bb, instr_t *ins
          */
         dr_cleancall_save_t flags = TEST(DRWRAP_FAST_CLEANCALLS, global_flags) ?
             (DR_CLEANCALL_NOSAVE_FLAGS|DR_CLEANCALL_NOSAVE_XMM_NONPARAM) : 0;
+#ifdef ARM
+        if (TEST(DRWRAP_FAST, global_flags)) {
+            /* pass the register args and lr so we need no dr_get_mcontext */
+            dr_insert_clean_call_ex(drcontext, bb, inst, (void *)drwrap_in_callee_fast,
+                                    flags, 7,
+                                    OPND_CREATE_INTPTR((ptr_int_t)arg1),
+                                    opnd_create_reg(DR_REG_R13),
+                                    opnd_create_reg(DR_REG_R14),
+                                    opnd_create_reg(DR_REG_R0),
+                                    opnd_create_reg(DR_REG_R1),
+                                    opnd_create_reg(DR_REG_R2),
+                                    opnd_create_reg(DR_REG_R3));
+        } else
+#endif
         dr_insert_clean_call_ex(drcontext, bb, inst, (void *)drwrap_in_callee,
                                 flags, 2,
                                 OPND_CREATE_INTPTR((ptr_int_t)arg1),
@@ -1941,6 +2213,16 @@ drwrap_event_bb_insert(void *drcontext, void *tag, instrlist_t *bb, instr_t *ins
          * vs other components' spill slots.
          */
         dr_cleancall_save_t flags = 0;
+#ifdef ARM
+        if (TEST(DRWRAP_FAST, global_flags)) {
+            dr_insert_clean_call_ex(drcontext, bb, inst,
+                                    (void *)drwrap_after_callee_fast, flags, 3,
+                                    OPND_CREATE_INTPTR((ptr_int_t)pc),
+                                    opnd_create_reg(DR_REG_R13),
+                                    /* pass in the retval to avoid dr_get_mcontext */
+                                    opnd_create_reg(DR_REG_R0));
+        } else
+#endif
         dr_insert_clean_call_ex(drcontext, bb, inst, (void *)drwrap_after_callee,
                                 flags, 2,
                                 OPND_CREATE_INTPTR((ptr_int_t)pc),
@@ -1962,6 +2244,7 @@ drwrap_event_module_unload(void *drcontext, const module_data_t *info)
 
     dr_rwlock_write_lock(post_call_rwlock);
     hashtable_remove_range(&post_call_table, (void *)info->start, (void *)info->end);
+    postcall_set_remove_range(info->start, info->end);
     dr_rwlock_write_unlock(post_call_rwlock);
 }
 
@@ -2109,13 +2392,9 @@ DR_EXPORT
 bool
 drwrap_is_post_wrap(app_pc pc)
 {
-    bool res = false;
     if (pc == NULL)
         return false;
-    dr_rwlock_read_lock(post_call_rwlock);
-    res = (hashtable_lookup(&post_call_table, (void*)pc) != NULL);
-    dr_rwlock_read_unlock(post_call_rwlock);
-    return res;
+    return post_call_lookup(pc);
 }
 
 /***************************************************************************
@@ -2136,11 +2415,11 @@ drwrap_in_callee_check_unwind(void *drcontext, per_thread_t *pt, dr_mcontext_t *
      * functions that change their retaddrs: still, it's not sufficient
      * due to stale values).
      */
-    if (pt->wrap_level >= 0 && pt->app_esp[pt->wrap_level] < mc->xsp
+    if (pt->wrap_level >= 0 && pt->app_esp[pt->wrap_level] < MC_XSP(mc)
         IF_WINDOWS(|| pt->hit_exception)) {
-        NOTIFY(1, "%s: checking for bypass @ xsp="PFX"\n", __FUNCTION__, mc->xsp);
+        NOTIFY(1, "%s: checking for bypass @ xsp="PFX"\n", __FUNCTION__, MC_XSP(mc));
         while (pt->wrap_level >= 0 &&
-               (pt->app_esp[pt->wrap_level] < mc->xsp
+               (pt->app_esp[pt->wrap_level] < MC_XSP(mc)
                 /* if we hit an exception, look for same xsp, b/c longjmp
                  * or handler may be at same level as aborted callee.
                  * we thus give up on correctly handling
@@ -2148,8 +2427,9 @@ drwrap_in_callee_check_unwind(void *drcontext, per_thread_t *pt, dr_mcontext_t *
                  * hard anyway.
                  */
                 IF_WINDOWS(|| (pt->hit_exception &&
-                               pt->app_esp[pt->wrap_level] <= mc->xsp)))) {
-            drwrap_after_callee_func(drcontext, pt, mc, pt->wrap_level, NULL, true, false);
+                               pt->app_esp[pt->wrap_level] <= MC_XSP(mc))))) {
+            drwrap_after_callee_func(drcontext, pt, mc, pt->wrap_level, NULL, NULL,
+                                     true, false);
         }
         /* Try to clean up entries we unrolled past and then came back
          * down past in the other direction.  Note that there's a
@@ -2168,7 +2448,8 @@ drwrap_in_callee_check_unwind(void *drcontext, per_thread_t *pt, dr_mcontext_t *
                 post_call_lookup(ret))
                 break;
             NOTIFY(2, "%s: found clobbered retaddr "PFX"\n", __FUNCTION__, ret);
-            drwrap_after_callee_func(drcontext, pt, mc, pt->wrap_level, NULL, true, false);
+            drwrap_after_callee_func(drcontext, pt, mc, pt->wrap_level, NULL, NULL,
+                                     true, false);
         }
         IF_WINDOWS(pt->hit_exception = false;)
     }
@@ -2203,7 +2484,7 @@ drwrap_event_pre_syscall(void *drcontext, int sysnum)
             while (pt->wrap_level >= 0 && pt->app_esp[pt->wrap_level] < tgt_xsp) {
                 NOTIFY(2, "%s: level %d\n", __FUNCTION__, pt->wrap_level);
                 drwrap_after_callee_func(drcontext, pt, &mc, pt->wrap_level, NULL,
-                                         true, false);
+                                         NULL, true, false);
             }
         }
     }
@@ -2226,7 +2507,7 @@ drwrap_event_exception(void *drcontext, dr_exception_t *excpt)
         for (idx = pt->wrap_level; idx >= 0; idx--) {
             NOTIFY(2, "%s: level %d\n", __FUNCTION__, idx);
             drwrap_after_callee_func(drcontext, pt, excpt->mcontext, idx,
-                                     NULL, true, true);
+                                     NULL, NULL, true, true);
         }
     }
     return true;
@@ -591,6 +591,23 @@ typedef enum {
      * Once set, this flag cannot be unset.
      */
     DRWRAP_FAST_CLEANCALLS      = 0x08,
+    /**
+     * If this flag is set, then on ARM the clean calls that invoke wrap
+     * callbacks pass the register arguments r0-r3, the stack pointer, and
+     * the return address in lr at function entry, and r0 at post-call
+     * points, directly as parameters rather than retrieving the machine
+     * context.  drwrap_get_arg(), drwrap_set_arg(), drwrap_get_retval(),
+     * and drwrap_set_retval() then operate on those values, so callbacks
+     * that use only those routines never incur the cost of
+     * dr_get_mcontext().  The full machine context is still retrieved
+     * lazily if a callback calls drwrap_get_mcontext() or
+     * drwrap_skip_call(), or changes an argument or the return value.
+     *
+     * This flag assumes that all wrap requests are for function entrance
+     * points that follow the standard ABI, where the return address is in
+     * lr at entry.  Once set, this flag cannot be unset.
+     */
+    DRWRAP_FAST                 = 0x10,
 } drwrap_global_flags_t;
 
 DR_EXPORT
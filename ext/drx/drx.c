@@ -0,0 +1,587 @@
+/* **********************************************************
+ * Copyright (c) 2013 Google, Inc.   All rights reserved.
+ * **********************************************************/
+
+/* drx: DynamoRIO Instrumentation Utilities Extension
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;
+ * version 2.1 of the License, and no later version.
+
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Library General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* DynamoRIO Instrumentation Utilities Extension: inline counter updates
+ * that avoid clean calls and, where possible, the arithmetic flags.
+ */
+
+#include "dr_api.h"
+#include "drmgr.h"
+#include "drreg.h"
+#include "drx.h"
+#include <string.h> /* memset */
+
+/* currently using asserts on internal logic sanity checks (never on
+ * input from user)
+ */
+#ifdef DEBUG
+# define ASSERT(x, msg) DR_ASSERT_MSG(x, msg)
+#else
+# define ASSERT(x, msg) /* nothing */
+#endif
+
+/* check if all bits in mask are set in var */
+#define TESTALL(mask, var) (((mask) & (var)) == (mask))
+/* check if any bit in mask is set in var */
+#define TESTANY(mask, var) (((mask) & (var)) != 0)
+/* check if a single bit is set in var */
+#define TEST TESTANY
+
+#define PRE instrlist_meta_preinsert
+
+/* The most scratch registers one update holds at once: the address, the
+ * two counter words, and a value too large for an immediate.
+ */
+#define DRX_SPILL_SLOTS 4
+
+/* Largest value added with an immediate operand: up to here the
+ * rotate:imm8 field is the value itself.
+ */
+#define MAX_IMM_VALUE 0xff
+
+/* Largest offset of an ldrd/strd immediate */
+#define MAX_LDRD_OFFSET 0xff
+
+/* ldrd and strd need an even first register, and r12:r13 is no pair */
+#define ALLOW_EVEN (DRREG_ALLOW(DR_REG_R0) | DRREG_ALLOW(DR_REG_R2) | \
+                    DRREG_ALLOW(DR_REG_R4) | DRREG_ALLOW(DR_REG_R6) | \
+                    DRREG_ALLOW(DR_REG_R8) | DRREG_ALLOW(DR_REG_R10))
+
+struct _drx_thread_counters_t {
+    size_t size;
+    drx_thread_counters_cb_t exit_cb;
+    reg_id_t tls_seg;
+    uint tls_offs;
+    /* Each thread's copy, for C code and for inline updates when DR has no
+     * TLS base; the raw slot above only mirrors it when there is one.
+     */
+    int tls_idx;
+    struct _drx_thread_counters_t *next;
+};
+
+static int drx_init_count;
+
+/* all per-thread counters, for thread events */
+static drx_thread_counters_t *counters_list;
+static void *counters_list_lock;
+
+/***************************************************************************
+ * THREADS
+ */
+
+/* The raw slot can only be reached inline through TPIDRURW if DR installed
+ * its TLS base there, which it does only when built with HAVE_TLS.
+ */
+static bool
+counters_in_tpidrurw(drx_thread_counters_t *counters)
+{
+    return dr_get_dr_segment_base(counters->tls_seg) != (byte *)(ptr_int_t)-1;
+}
+
+static void
+thread_counters_set(void *drcontext, drx_thread_counters_t *counters, void *mem)
+{
+    drmgr_set_tls_field(drcontext, counters->tls_idx, mem);
+    if (counters_in_tpidrurw(counters)) {
+        *(void **) ((byte *) dr_get_dr_segment_base(counters->tls_seg) +
+                    counters->tls_offs) = mem;
+    }
+}
+
+static void
+drx_thread_init(void *drcontext)
+{
+    drx_thread_counters_t *counters;
+    dr_mutex_lock(counters_list_lock);
+    for (counters = counters_list; counters != NULL; counters = counters->next) {
+        void *mem = dr_thread_alloc(drcontext, counters->size);
+        memset(mem, 0, counters->size);
+        thread_counters_set(drcontext, counters, mem);
+    }
+    dr_mutex_unlock(counters_list_lock);
+}
+
+static void
+drx_thread_exit(void *drcontext)
+{
+    drx_thread_counters_t *counters;
+    dr_mutex_lock(counters_list_lock);
+    for (counters = counters_list; counters != NULL; counters = counters->next) {
+        void *mem = drmgr_get_tls_field(drcontext, counters->tls_idx);
+        if (mem == NULL)
+            continue;
+        if (counters->exit_cb != NULL)
+            counters->exit_cb(drcontext, mem, counters->size);
+        dr_thread_free(drcontext, mem, counters->size);
+        thread_counters_set(drcontext, counters, NULL);
+    }
+    dr_mutex_unlock(counters_list_lock);
+}
+
+/***************************************************************************
+ * INIT
+ */
+
+DR_EXPORT
+bool
+drx_init(void)
+{
+    drreg_options_t ops = {sizeof(ops), DRX_SPILL_SLOTS};
+    /* handle multiple sets of init/exit calls */
+    int count = dr_atomic_add32_return_sum(&drx_init_count, 1);
+    if (count > 1)
+        return true;
+
+    drmgr_init();
+    if (drreg_init(&ops) != DRREG_SUCCESS)
+        return false;
+    counters_list_lock = dr_mutex_create();
+    if (!drmgr_register_thread_init_event(drx_thread_init) ||
+        !drmgr_register_thread_exit_event(drx_thread_exit))
+        return false;
+    return true;
+}
+
+DR_EXPORT
+void
+drx_exit(void)
+{
+    /* handle multiple sets of init/exit calls */
+    int count = dr_atomic_add32_return_sum(&drx_init_count, -1);
+    if (count != 0)
+        return;
+
+    ASSERT(counters_list == NULL, "drx_thread_counters_destroy not called");
+    drmgr_unregister_thread_init_event(drx_thread_init);
+    drmgr_unregister_thread_exit_event(drx_thread_exit);
+    dr_mutex_destroy(counters_list_lock);
+    drreg_exit();
+    drmgr_exit();
+}
+
+/***************************************************************************
+ * INSTRUCTION SEQUENCES
+ */
+
+/* Sets dst to val with a mov and as few adds as there are disjoint 8-bit
+ * chunks at even shifts.  Leaves the flags alone.
+ */
+static void
+insert_mov_const(void *drcontext, instrlist_t *ilist, instr_t *where,
+                 reg_id_t dst, ptr_uint_t val)
+{
+    uint left = (uint) val, imm12;
+    bool first = true;
+    if (opnd_encode_modified_imm(left, &imm12)) {
+        PRE(ilist, where,
+            INSTR_CREATE_mov_imm(drcontext, opnd_create_reg(dst),
+                                 OPND_CREATE_IMM12(imm12), COND_ALWAYS));
+        return;
+    }
+    while (left != 0) {
+        uint shift = 0, chunk;
+        while (!TESTANY(3U << shift, left))
+            shift += 2;
+        chunk = left & (0xffU << shift);
+        if (!opnd_encode_modified_imm(chunk, &imm12))
+            ASSERT(false, "8-bit chunk at an even shift must be encodable");
+        if (first) {
+            PRE(ilist, where,
+                INSTR_CREATE_mov_imm(drcontext, opnd_create_reg(dst),
+                                     OPND_CREATE_IMM12(imm12), COND_ALWAYS));
+        } else {
+            PRE(ilist, where,
+                INSTR_CREATE_add_imm(drcontext, opnd_create_reg(dst),
+                                     opnd_create_reg(dst), OPND_CREATE_IMM12(imm12),
+                                     COND_ALWAYS));
+        }
+        first = false;
+        left -= chunk;
+    }
+}
+
+/* pre-indexed, positive offset, no writeback */
+static instr_t *
+offset_addressing(void *drcontext, instr_t *instr)
+{
+    instr_set_p_flag(drcontext, instr, true);
+    instr_set_u_flag(drcontext, instr, true);
+    instr_set_w_flag(drcontext, instr, false);
+    return instr;
+}
+
+static void
+insert_load(void *drcontext, instrlist_t *ilist, instr_t *where, reg_id_t dst,
+            reg_id_t base, uint offs)
+{
+    PRE(ilist, where, offset_addressing
+        (drcontext, INSTR_CREATE_ldr_imm(drcontext, opnd_create_reg(dst),
+                                         opnd_create_mem_reg(base),
+                                         OPND_CREATE_IMM12(offs), COND_ALWAYS)));
+}
+
+static void
+insert_store(void *drcontext, instrlist_t *ilist, instr_t *where, reg_id_t src,
+             reg_id_t base, uint offs)
+{
+    PRE(ilist, where, offset_addressing
+        (drcontext, INSTR_CREATE_str_imm(drcontext, opnd_create_reg(src),
+                                         opnd_create_mem_reg(base),
+                                         OPND_CREATE_IMM12(offs), COND_ALWAYS)));
+}
+
+static bool
+value_is_imm(int value)
+{
+    return value >= -MAX_IMM_VALUE && value <= MAX_IMM_VALUE;
+}
+
+/* Inserts reg += value, setting the flags if set_flags.  value_reg holds
+ * value if it does not fit in an immediate.
+ */
+static void
+insert_add_value(void *drcontext, instrlist_t *ilist, instr_t *where, reg_id_t reg,
+                 int value, reg_id_t value_reg, bool set_flags)
+{
+    instr_t *add;
+    if (!value_is_imm(value)) {
+        add = INSTR_CREATE_add_reg(drcontext, opnd_create_reg(reg),
+                                   opnd_create_reg(reg), opnd_create_reg(value_reg),
+                                   OPND_CREATE_IMM5(0), COND_ALWAYS);
+    } else if (value >= 0) {
+        add = INSTR_CREATE_add_imm(drcontext, opnd_create_reg(reg),
+                                   opnd_create_reg(reg), OPND_CREATE_IMM12(value),
+                                   COND_ALWAYS);
+    } else {
+        add = INSTR_CREATE_sub_imm(drcontext, opnd_create_reg(reg),
+                                   opnd_create_reg(reg), OPND_CREATE_IMM12(-value),
+                                   COND_ALWAYS);
+    }
+    instr_set_s_flag(drcontext, add, set_flags);
+    PRE(ilist, where, add);
+}
+
+/* Inserts the carry (or borrow) of the low word into the high word: the
+ * sign extension of value plus the carry flag.
+ */
+static void
+insert_carry(void *drcontext, instrlist_t *ilist, instr_t *where, reg_id_t hi,
+             int value)
+{
+    if (value >= 0) {
+        PRE(ilist, where, INSTR_CREATE_adc_imm(drcontext, opnd_create_reg(hi),
+                                               opnd_create_reg(hi),
+                                               OPND_CREATE_IMM12(0), COND_ALWAYS));
+    } else {
+        /* hi - 0 - !C == hi + 0xffffffff + C */
+        PRE(ilist, where, INSTR_CREATE_sbc_imm(drcontext, opnd_create_reg(hi),
+                                               opnd_create_reg(hi),
+                                               OPND_CREATE_IMM12(0), COND_ALWAYS));
+    }
+}
+
+/* Reserves a consecutive even:odd pair for ldrd/strd.  Returns false, having
+ * reserved nothing, if drreg cannot supply one.
+ */
+static bool
+reserve_pair(void *drcontext, instrlist_t *ilist, instr_t *where,
+             reg_id_t *lo, reg_id_t *hi)
+{
+    if (drreg_reserve_register(drcontext, ilist, where, ALLOW_EVEN, lo) !=
+        DRREG_SUCCESS)
+        return false;
+    if (drreg_reserve_register(drcontext, ilist, where, DRREG_ALLOW(*lo + 1), hi) !=
+        DRREG_SUCCESS) {
+        drreg_unreserve_register(drcontext, ilist, where, *lo);
+        return false;
+    }
+    return true;
+}
+
+/* Inserts the update of the counter at offs from base, which the caller has
+ * reserved and set.
+ */
+static bool
+insert_update(void *drcontext, instrlist_t *ilist, instr_t *where, reg_id_t base,
+              uint offs, int value, uint flags)
+{
+    reg_id_t lo, hi, value_reg = DR_REG_NULL;
+    bool ok = true, use_pair = false, aflags = false;
+    uint allowed = DRREG_ALLOW_ALL & ~DRREG_ALLOW(base);
+
+    if (!value_is_imm(value)) {
+        if (drreg_reserve_register(drcontext, ilist, where, allowed, &value_reg) !=
+            DRREG_SUCCESS)
+            return false;
+        allowed &= ~DRREG_ALLOW(value_reg);
+        insert_mov_const(drcontext, ilist, where, value_reg, (ptr_uint_t) value);
+    }
+
+    if (!TEST(DRX_COUNTER_64BIT, flags)) {
+        if (drreg_reserve_register(drcontext, ilist, where, allowed, &lo) !=
+            DRREG_SUCCESS) {
+            ok = false;
+            goto done;
+        }
+        /* add without the s bit: the flags are untouched */
+        insert_load(drcontext, ilist, where, lo, base, offs);
+        insert_add_value(drcontext, ilist, where, lo, value, value_reg, false);
+        insert_store(drcontext, ilist, where, lo, base, offs);
+        drreg_unreserve_register(drcontext, ilist, where, lo);
+        goto done;
+    }
+
+    if (drreg_reserve_aflags(drcontext, ilist, where) != DRREG_SUCCESS) {
+        ok = false;
+        goto done;
+    }
+    aflags = true;
+    if (offs <= MAX_LDRD_OFFSET && TESTANY(ALLOW_EVEN, allowed))
+        use_pair = reserve_pair(drcontext, ilist, where, &lo, &hi);
+    if (!use_pair) {
+        if (drreg_reserve_register(drcontext, ilist, where, allowed, &lo) !=
+            DRREG_SUCCESS) {
+            ok = false;
+            goto done;
+        }
+        if (drreg_reserve_register(drcontext, ilist, where,
+                                   allowed & ~DRREG_ALLOW(lo), &hi) != DRREG_SUCCESS) {
+            drreg_unreserve_register(drcontext, ilist, where, lo);
+            ok = false;
+            goto done;
+        }
+    }
+    if (use_pair) {
+        PRE(ilist, where, offset_addressing
+            (drcontext, INSTR_CREATE_ldrd_imm(drcontext, opnd_create_reg(lo),
+                                              opnd_create_reg(base),
+                                              OPND_CREATE_IMM8(offs), COND_ALWAYS)));
+    } else {
+        insert_load(drcontext, ilist, where, lo, base, offs);
+        insert_load(drcontext, ilist, where, hi, base, offs + sizeof(uint));
+    }
+    insert_add_value(drcontext, ilist, where, lo, value, value_reg, true);
+    insert_carry(drcontext, ilist, where, hi, value);
+    if (use_pair) {
+        PRE(ilist, where, offset_addressing
+            (drcontext, INSTR_CREATE_strd_imm(drcontext, opnd_create_reg(lo),
+                                              opnd_create_reg(base),
+                                              OPND_CREATE_IMM8(offs), COND_ALWAYS)));
+    } else {
+        insert_store(drcontext, ilist, where, lo, base, offs);
+        insert_store(drcontext, ilist, where, hi, base, offs + sizeof(uint));
+    }
+    drreg_unreserve_register(drcontext, ilist, where, hi);
+    drreg_unreserve_register(drcontext, ilist, where, lo);
+
+ done:
+    if (aflags)
+        drreg_unreserve_aflags(drcontext, ilist, where);
+    if (value_reg != DR_REG_NULL)
+        drreg_unreserve_register(drcontext, ilist, where, value_reg);
+    return ok;
+}
+
+/* Inserts an ldrex/strex loop adding value to the word at base */
+static bool
+insert_locked_update(void *drcontext, instrlist_t *ilist, instr_t *where,
+                     reg_id_t base, int value)
+{
+    reg_id_t val, status, value_reg = DR_REG_NULL;
+    uint allowed = DRREG_ALLOW_ALL & ~DRREG_ALLOW(base);
+    instr_t *retry;
+    bool ok = false;
+
+    if (!value_is_imm(value)) {
+        if (drreg_reserve_register(drcontext, ilist, where, allowed, &value_reg) !=
+            DRREG_SUCCESS)
+            return false;
+        allowed &= ~DRREG_ALLOW(value_reg);
+        insert_mov_const(drcontext, ilist, where, value_reg, (ptr_uint_t) value);
+    }
+    /* the retry branch needs the flags */
+    if (drreg_reserve_aflags(drcontext, ilist, where) != DRREG_SUCCESS)
+        goto done_value;
+    if (drreg_reserve_register(drcontext, ilist, where, allowed, &val) !=
+        DRREG_SUCCESS)
+        goto done_aflags;
+    if (drreg_reserve_register(drcontext, ilist, where, allowed & ~DRREG_ALLOW(val),
+                               &status) != DRREG_SUCCESS)
+        goto done_val;
+
+    retry = INSTR_CREATE_label(drcontext);
+    PRE(ilist, where, retry);
+    PRE(ilist, where, INSTR_CREATE_ldrex(drcontext, opnd_create_reg(val),
+                                         opnd_create_reg(base), COND_ALWAYS));
+    insert_add_value(drcontext, ilist, where, val, value, value_reg, false);
+    PRE(ilist, where, INSTR_CREATE_strex(drcontext, opnd_create_reg(status),
+                                         opnd_create_reg(base), opnd_create_reg(val),
+                                         COND_ALWAYS));
+    PRE(ilist, where, INSTR_CREATE_cmp_imm(drcontext, opnd_create_reg(status),
+                                           OPND_CREATE_IMM12(0), COND_ALWAYS));
+    PRE(ilist, where, INSTR_CREATE_b(drcontext, opnd_create_instr(retry),
+                                     COND_NOT_EQUAL));
+    ok = true;
+
+    drreg_unreserve_register(drcontext, ilist, where, status);
+ done_val:
+    drreg_unreserve_register(drcontext, ilist, where, val);
+ done_aflags:
+    drreg_unreserve_aflags(drcontext, ilist, where);
+ done_value:
+    if (value_reg != DR_REG_NULL)
+        drreg_unreserve_register(drcontext, ilist, where, value_reg);
+    return ok;
+}
+
+/***************************************************************************
+ * COUNTERS
+ */
+
+DR_EXPORT
+bool
+drx_insert_counter_update(void *drcontext, instrlist_t *ilist, instr_t *where,
+                          void *addr, int value, uint flags)
+{
+    reg_id_t base;
+    bool ok;
+
+    if (TESTALL(DRX_COUNTER_64BIT | DRX_COUNTER_LOCK, flags) ||
+        ((ptr_uint_t) addr & (TEST(DRX_COUNTER_64BIT, flags) ? 7 : 3)) != 0)
+        return false;
+    if (value == 0)
+        return true;
+    if (drreg_reserve_register(drcontext, ilist, where, DRREG_ALLOW_ALL, &base) !=
+        DRREG_SUCCESS)
+        return false;
+    insert_mov_const(drcontext, ilist, where, base, (ptr_uint_t) addr);
+    if (TEST(DRX_COUNTER_LOCK, flags))
+        ok = insert_locked_update(drcontext, ilist, where, base, value);
+    else
+        ok = insert_update(drcontext, ilist, where, base, 0, value, flags);
+    drreg_unreserve_register(drcontext, ilist, where, base);
+    return ok;
+}
+
+DR_EXPORT
+drx_thread_counters_t *
+drx_thread_counters_create(size_t size, drx_thread_counters_cb_t exit_cb)
+{
+    drx_thread_counters_t *counters;
+    if (size == 0)
+        return NULL;
+    counters = (drx_thread_counters_t *) dr_global_alloc(sizeof(*counters));
+    memset(counters, 0, sizeof(*counters));
+    counters->size = size;
+    counters->exit_cb = exit_cb;
+    counters->tls_idx = drmgr_register_tls_field();
+    if (counters->tls_idx == -1) {
+        dr_global_free(counters, sizeof(*counters));
+        return NULL;
+    }
+    if (!dr_raw_tls_calloc(&counters->tls_seg, &counters->tls_offs, 1, 0)) {
+        drmgr_unregister_tls_field(counters->tls_idx);
+        dr_global_free(counters, sizeof(*counters));
+        return NULL;
+    }
+    /* without a TLS base updates name each thread's copy by a constant */
+    if (!counters_in_tpidrurw(counters) && !dr_using_all_private_caches()) {
+        dr_raw_tls_cfree(counters->tls_offs, 1);
+        drmgr_unregister_tls_field(counters->tls_idx);
+        dr_global_free(counters, sizeof(*counters));
+        return NULL;
+    }
+    dr_mutex_lock(counters_list_lock);
+    counters->next = counters_list;
+    counters_list = counters;
+    dr_mutex_unlock(counters_list_lock);
+    return counters;
+}
+
+DR_EXPORT
+bool
+drx_thread_counters_destroy(drx_thread_counters_t *counters)
+{
+    drx_thread_counters_t *prev;
+    if (counters == NULL)
+        return false;
+    dr_mutex_lock(counters_list_lock);
+    if (counters_list == counters)
+        counters_list = counters->next;
+    else {
+        for (prev = counters_list; prev != NULL && prev->next != counters;
+             prev = prev->next)
+            ; /* nothing */
+        if (prev == NULL) {
+            dr_mutex_unlock(counters_list_lock);
+            return false;
+        }
+        prev->next = counters->next;
+    }
+    dr_mutex_unlock(counters_list_lock);
+    dr_raw_tls_cfree(counters->tls_offs, 1);
+    drmgr_unregister_tls_field(counters->tls_idx);
+    dr_global_free(counters, sizeof(*counters));
+    return true;
+}
+
+DR_EXPORT
+void *
+drx_thread_counters_get(void *drcontext, drx_thread_counters_t *counters)
+{
+    return drmgr_get_tls_field(drcontext, counters->tls_idx);
+}
+
+DR_EXPORT
+bool
+drx_insert_thread_counter_update(void *drcontext, drx_thread_counters_t *counters,
+                                 instrlist_t *ilist, instr_t *where, uint offset,
+                                 int value, uint flags)
+{
+    size_t width = TEST(DRX_COUNTER_64BIT, flags) ? sizeof(uint64) : sizeof(uint);
+    reg_id_t base;
+    bool ok;
+
+    if (TEST(DRX_COUNTER_LOCK, flags) || (offset & (width - 1)) != 0 ||
+        offset + width > counters->size ||
+        /* the hi word is at offset + 4 */
+        offset + width - sizeof(uint) > 0xfff)
+        return false;
+    if (value == 0)
+        return true;
+    if (drreg_reserve_register(drcontext, ilist, where, DRREG_ALLOW_ALL, &base) !=
+        DRREG_SUCCESS)
+        return false;
+    if (counters_in_tpidrurw(counters)) {
+        /* the slot is reached through DR's TLS base in TPIDRURW */
+        PRE(ilist, where, INSTR_CREATE_mrc(drcontext, opnd_create_reg(base),
+                                           opnd_create_reg(DR_REG_TPIDRURW),
+                                           COND_ALWAYS));
+        insert_load(drcontext, ilist, where, base, base, counters->tls_offs);
+    } else {
+        /* caches are thread-private: this thread's copy is a constant */
+        insert_mov_const(drcontext, ilist, where, base, (ptr_uint_t)
+                         drmgr_get_tls_field(drcontext, counters->tls_idx));
+    }
+    ok = insert_update(drcontext, ilist, where, base, offset, value, flags);
+    drreg_unreserve_register(drcontext, ilist, where, base);
+    return ok;
+}
@@ -0,0 +1,168 @@
+/* **********************************************************
+ * Copyright (c) 2013 Google, Inc.   All rights reserved.
+ * **********************************************************/
+
+/* drx: DynamoRIO Instrumentation Utilities Extension
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;
+ * version 2.1 of the License, and no later version.
+
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Library General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* DynamoRIO Instrumentation Utilities Extension */
+
+#ifndef _DRX_H_
+#define _DRX_H_ 1
+
+/**
+ * @file drx.h
+ * @brief Header for DynamoRIO Instrumentation Utilities Extension
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * \addtogroup drx Instrumentation Utilities
+ */
+/*@{*/ /* begin doxygen group */
+
+/** Flags for drx_insert_counter_update() and drx_insert_thread_counter_update(). */
+enum {
+    /**
+     * The counter is 64 bits wide and 8-byte aligned, with its low word
+     * first.  Otherwise it is a 32-bit word.
+     */
+    DRX_COUNTER_64BIT = 0x01,
+    /**
+     * The update is atomic with respect to other threads, using an
+     * ldrex/strex loop.  Only supported for 32-bit global counters.
+     */
+    DRX_COUNTER_LOCK  = 0x10,
+};
+
+/** Opaque handle to a set of per-thread counters. */
+typedef struct _drx_thread_counters_t drx_thread_counters_t;
+
+/**
+ * Callback that receives a thread's counters at thread exit, typically to
+ * add them into process-wide totals.  \p counters points to the \p size
+ * bytes passed to drx_thread_counters_create().
+ */
+typedef void (*drx_thread_counters_cb_t)(void *drcontext, void *counters, size_t size);
+
+/***************************************************************************
+ * INIT
+ */
+
+DR_EXPORT
+/**
+ * Initializes the drx extension.  Must be called prior to any of the
+ * other routines, and prior to any thread being created.  Can be called
+ * multiple times (by separate components, normally) but each call must be
+ * paired with a corresponding call to drx_exit().
+ *
+ * drx initializes drmgr and drreg, asking drreg for four spill slots.
+ * A client that initializes drreg itself before calling drx_init() must
+ * request at least that many.
+ *
+ * \return whether successful.
+ */
+bool
+drx_init(void);
+
+DR_EXPORT
+/**
+ * Cleans up the drx extension.
+ */
+void
+drx_exit(void);
+
+/***************************************************************************
+ * COUNTERS
+ */
+
+DR_EXPORT
+/**
+ * Inserts meta instructions prior to \p where that add \p value to the
+ * counter at \p addr.  \p flags is a combination of #DRX_COUNTER_64BIT
+ * and #DRX_COUNTER_LOCK.  Must be called from a drmgr insertion event,
+ * with \p where the application instruction being instrumented, as
+ * scratch registers are reserved through drreg.
+ *
+ * A 32-bit update does not touch the arithmetic flags.  A 64-bit update
+ * carries into the high word with adds/adc: when the flags are live at
+ * \p where, drreg saves and restores them around it.  A locked update
+ * loops on ldrex/strex and likewise needs the flags for its retry
+ * branch.  Without #DRX_COUNTER_LOCK concurrent updates from different
+ * threads may be lost; drx_insert_thread_counter_update() avoids both
+ * the loss and the cache-line sharing.
+ *
+ * \return whether successful.
+ */
+bool
+drx_insert_counter_update(void *drcontext, instrlist_t *ilist, instr_t *where,
+                          void *addr, int value, uint flags);
+
+DR_EXPORT
+/**
+ * Creates \p size bytes of zero-initialized counters private to each
+ * thread, to be updated with drx_insert_thread_counter_update().  \p
+ * exit_cb, which may be NULL, is called with each thread's counters at
+ * its exit.  Must be called prior to any thread being created.
+ *
+ * \return the new counters, or NULL on failure.
+ */
+drx_thread_counters_t *
+drx_thread_counters_create(size_t size, drx_thread_counters_cb_t exit_cb);
+
+DR_EXPORT
+/**
+ * Destroys \p counters.  Should be called from the client's exit event,
+ * after the final thread's exit callback.
+ *
+ * \return whether successful.
+ */
+bool
+drx_thread_counters_destroy(drx_thread_counters_t *counters);
+
+DR_EXPORT
+/**
+ * Returns the current thread's copy of \p counters.
+ */
+void *
+drx_thread_counters_get(void *drcontext, drx_thread_counters_t *counters);
+
+DR_EXPORT
+/**
+ * Identical to drx_insert_counter_update() except that the counter is the
+ * one at byte offset \p offset of the current thread's copy of \p
+ * counters.  \p offset must be aligned to the counter size and less than
+ * the size of the counters.  #DRX_COUNTER_LOCK is not supported, as no
+ * other thread writes the counter.
+ *
+ * \return whether successful.
+ */
+bool
+drx_insert_thread_counter_update(void *drcontext, drx_thread_counters_t *counters,
+                                 instrlist_t *ilist, instr_t *where, uint offset,
+                                 int value, uint flags);
+
+/*@}*/ /* end doxygen group */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _DRX_H_ */
@@ -0,0 +1,201 @@
+/* **********************************************************
+ * Copyright (c) 2013 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * 
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * 
+ * * Neither the name of Google, Inc. nor the names of its contributors may be
+ *   used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL GOOGLE, INC. OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+
+/* Tests the drbuf extension */
+
+#include "dr_api.h"
+#include "drmgr.h"
+#include "drreg.h"
+#include "drbuf.h"
+#include <stddef.h> /* offsetof */
+
+#define CHECK(x, msg) do {               \
+    if (!(x)) {                          \
+        dr_fprintf(STDERR, "%s\n", msg); \
+        dr_abort();                      \
+    }                                    \
+} while (0);
+
+#define MARKER 0xab
+
+/* Small buffers so that the app fills them many times over */
+#define NUM_RECORDS 64
+
+typedef struct _record_t {
+    uint marker;
+    app_pc sp;
+} record_t;
+
+static drbuf_t *thread_buf;
+static drbuf_t *writer_buf;
+static int thread_bytes;
+static int writer_bytes;
+
+static void event_exit(void);
+static dr_emit_flags_t event_bb_analysis(void *drcontext, void *tag, instrlist_t *bb,
+                                         bool for_trace, bool translating,
+                                         OUT void **user_data);
+static dr_emit_flags_t event_bb_insert(void *drcontext, void *tag, instrlist_t *bb,
+                                       instr_t *inst, bool for_trace, bool translating,
+                                       void *user_data);
+
+static void
+check_records(void *buf_base, size_t size)
+{
+    record_t *rec;
+    CHECK(size % sizeof(record_t) == 0, "partial record handed off");
+    CHECK(size <= NUM_RECORDS * sizeof(record_t), "buffer overflowed");
+    for (rec = (record_t *) buf_base; (byte *) rec < (byte *) buf_base + size; rec++)
+        CHECK(rec->marker == MARKER, "record not filled in");
+}
+
+static void
+thread_full(void *drcontext, void *buf_base, size_t size)
+{
+    check_records(buf_base, size);
+    dr_atomic_add32_return_sum(&thread_bytes, (int) size);
+}
+
+static void
+writer_full(void *drcontext, void *buf_base, size_t size)
+{
+    check_records(buf_base, size);
+    /* only the writer thread and drbuf_free() call this */
+    writer_bytes += (int) size;
+}
+
+DR_EXPORT void 
+dr_init(client_id_t id)
+{
+    drmgr_priority_t priority = {sizeof(priority), "drbuf-test", NULL, NULL, 0};
+    drreg_options_t ops = {sizeof(ops), 3};
+    bool ok;
+
+    drmgr_init();
+    CHECK(drreg_init(&ops) == DRREG_SUCCESS, "drreg init failed");
+    CHECK(drbuf_init(), "drbuf init failed");
+    CHECK(drbuf_create_buffer(3, NUM_RECORDS, thread_full) == NULL,
+          "unaligned record size accepted");
+    thread_buf = drbuf_create_buffer(sizeof(record_t), NUM_RECORDS, thread_full);
+    CHECK(thread_buf != NULL, "failed to create per-thread buffer");
+    writer_buf = drbuf_create_writer_buffer(sizeof(record_t), NUM_RECORDS, writer_full);
+    CHECK(writer_buf != NULL, "failed to create writer buffer");
+    dr_register_exit_event(event_exit);
+
+    ok = drmgr_register_bb_instrumentation_event(event_bb_analysis,
+                                                 event_bb_insert,
+                                                 &priority);
+    CHECK(ok, "drmgr register bb failed");
+}
+
+static void 
+event_exit(void)
+{
+    CHECK(drbuf_free(thread_buf), "failed to free per-thread buffer");
+    CHECK(drbuf_free(writer_buf), "failed to free writer buffer");
+    /* every record must come out exactly once through each buffer */
+    CHECK(thread_bytes > NUM_RECORDS * sizeof(record_t), "per-thread buffer never full");
+    CHECK(thread_bytes == writer_bytes, "buffers disagree on record count");
+    drbuf_exit();
+    CHECK(drreg_exit() == DRREG_SUCCESS, "drreg exit failed");
+    drmgr_exit();
+    dr_fprintf(STDERR, "all done\n");
+}
+
+static dr_emit_flags_t
+event_bb_analysis(void *drcontext, void *tag, instrlist_t *bb,
+                  bool for_trace, bool translating, OUT void **user_data)
+{
+    instr_t *first;
+    for (first = instrlist_first(bb); first != NULL; first = instr_get_next(first)) {
+        if (instr_ok_to_mangle(first))
+            break;
+    }
+    *user_data = (void *) first;
+    return DR_EMIT_DEFAULT;
+}
+
+static void
+insert_record(void *drcontext, drbuf_t *buf, instrlist_t *bb, instr_t *where,
+              reg_id_t reg_ptr, reg_id_t reg_val, reg_id_t reg_tmp)
+{
+    drbuf_insert_load_buf_ptr(drcontext, buf, bb, where, reg_ptr);
+    CHECK(drbuf_insert_buf_store(drcontext, buf, bb, where, reg_ptr, reg_val, OPSZ_4,
+                                 offsetof(record_t, marker)),
+          "failed to insert marker store");
+    CHECK(drbuf_insert_buf_store(drcontext, buf, bb, where, reg_ptr, DR_REG_R13, OPSZ_4,
+                                 offsetof(record_t, sp)),
+          "failed to insert sp store");
+    CHECK(!drbuf_insert_update_buf_ptr(drcontext, buf, bb, where, reg_ptr, reg_ptr),
+          "scratch aliasing the buffer pointer accepted");
+    CHECK(drbuf_insert_update_buf_ptr(drcontext, buf, bb, where, reg_ptr, reg_tmp),
+          "failed to insert buffer pointer update");
+}
+
+/* Writes one record per block to each buffer */
+static dr_emit_flags_t
+event_bb_insert(void *drcontext, void *tag, instrlist_t *bb, instr_t *instr,
+                bool for_trace, bool translating, void *user_data)
+{
+    reg_id_t reg_ptr, reg_val, reg_tmp;
+
+    if (instr != (instr_t *) user_data)
+        return DR_EMIT_DEFAULT;
+
+    CHECK(drreg_reserve_register(drcontext, bb, instr, DRREG_ALLOW_ALL, &reg_ptr) ==
+          DRREG_SUCCESS, "failed to reserve pointer register");
+    CHECK(drreg_reserve_register(drcontext, bb, instr, DRREG_ALLOW_ALL &
+                                 ~DRREG_ALLOW(reg_ptr), &reg_val) == DRREG_SUCCESS,
+          "failed to reserve value register");
+    CHECK(drreg_reserve_register(drcontext, bb, instr, DRREG_ALLOW_ALL &
+                                 ~DRREG_ALLOW(reg_ptr) & ~DRREG_ALLOW(reg_val),
+                                 &reg_tmp) == DRREG_SUCCESS,
+          "failed to reserve scratch register");
+    /* the bounds check in the update clobbers the flags */
+    CHECK(drreg_reserve_aflags(drcontext, bb, instr) == DRREG_SUCCESS,
+          "failed to reserve aflags");
+    instrlist_meta_preinsert(bb, instr, INSTR_CREATE_mov_imm
+                             (drcontext, opnd_create_reg(reg_val),
+                              OPND_CREATE_IMM12(MARKER), COND_ALWAYS));
+    insert_record(drcontext, thread_buf, bb, instr, reg_ptr, reg_val, reg_tmp);
+    insert_record(drcontext, writer_buf, bb, instr, reg_ptr, reg_val, reg_tmp);
+    CHECK(drreg_unreserve_aflags(drcontext, bb, instr) == DRREG_SUCCESS,
+          "failed to unreserve aflags");
+    CHECK(drreg_unreserve_register(drcontext, bb, instr, reg_tmp) == DRREG_SUCCESS,
+          "failed to unreserve scratch register");
+    CHECK(drreg_unreserve_register(drcontext, bb, instr, reg_val) == DRREG_SUCCESS,
+          "failed to unreserve value register");
+    CHECK(drreg_unreserve_register(drcontext, bb, instr, reg_ptr) == DRREG_SUCCESS,
+          "failed to unreserve pointer register");
+    return DR_EMIT_DEFAULT;
+}
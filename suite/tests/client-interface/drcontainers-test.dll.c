@@ -0,0 +1,264 @@
+/* **********************************************************
+ * Copyright (c) 2013 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * 
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * 
+ * * Neither the name of Google, Inc. nor the names of its contributors may be
+ *   used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL GOOGLE, INC. OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+
+/* Tests the drcontainers striped hashtable and the drvector and drtable
+ * bulk and per-thread operations.  Also serves as a benchmark of the
+ * striped hashtable against the chained hashtable if built w/o
+ * NIGHTLY_REGRESSION: each application thread hammers both tables from its
+ * thread init event, concurrently with the others.
+ */
+
+#include "dr_api.h"
+#include "drmgr.h"
+#include "hashtable.h"
+#include "drvector.h"
+#include "drtable.h"
+
+#define CHECK(x, msg) do {               \
+    if (!(x)) {                          \
+        dr_fprintf(STDERR, "%s\n", msg); \
+        dr_abort();                      \
+    }                                    \
+} while (0);
+
+#ifdef NIGHTLY_REGRESSION
+# define BENCH_ITERS 10*1000
+#else
+# define BENCH_ITERS 1000*1000
+#endif
+
+/* Looked up by every thread.  Keys are small integers, well below any
+ * drcontext, which is used to form the keys private to each thread.
+ */
+#define SHARED_KEYS 1024
+#define SHARED_KEY(i) ((void *)(ptr_uint_t)(((i) + 1) * 4))
+#define PRIVATE_KEYS 64
+#define PRIVATE_KEY(drcontext, i) ((void *)((ptr_uint_t)(drcontext) + (i) * 4))
+/* every Nth iteration adds and removes a private key */
+#define WRITE_FREQ 16
+
+/* records appended by each thread through drvector_local_append() and
+ * drtable_cache_alloc()
+ */
+#define RECORDS_PER_THREAD 1000
+
+static hashtable_t chained;
+static hashtable_striped_t striped;
+static int chained_ms;
+static int striped_ms;
+static drvector_t records;
+static void *record_table;
+static int num_threads;
+
+static void event_exit(void);
+static void event_thread_init(void *drcontext);
+
+static void
+test_striped_api(void)
+{
+    hashtable_striped_t table;
+    hashtable_config_t config = {sizeof(config), false, 75};
+    char key[16];
+    uint i;
+    bool ok;
+
+    /* string keys, and a table too small and not resizable, which must
+     * still grow rather than fill up
+     */
+    hashtable_striped_init_ex(&table, 4, HASH_STRING, true/*strdup*/, true,
+                              NULL, NULL, NULL);
+    hashtable_striped_configure(&table, &config);
+    for (i = 0; i < 1000; i++) {
+        dr_snprintf(key, sizeof(key)/sizeof(key[0]), "key%d", i);
+        ok = hashtable_striped_add(&table, key, (void *)(ptr_uint_t)(i + 1));
+        CHECK(ok, "striped add failed");
+    }
+    CHECK(!hashtable_striped_add(&table, "key7", (void *)1), "duplicate add succeeded");
+    CHECK(hashtable_striped_add_replace(&table, "key7", (void *)42) == (void *)8,
+          "striped add_replace failed");
+    CHECK(hashtable_striped_lookup(&table, "key7") == (void *)42,
+          "striped replace lost");
+    for (i = 0; i < 1000; i += 2) {
+        dr_snprintf(key, sizeof(key)/sizeof(key[0]), "key%d", i);
+        CHECK(hashtable_striped_remove(&table, key), "striped remove failed");
+    }
+    CHECK(!hashtable_striped_remove(&table, "key0"), "double remove succeeded");
+    CHECK(hashtable_striped_entries(&table) == 500, "striped entry count wrong");
+    for (i = 1; i < 1000; i += 2) {
+        dr_snprintf(key, sizeof(key)/sizeof(key[0]), "key%d", i);
+        CHECK(hashtable_striped_lookup(&table, key) ==
+              (void *)(ptr_uint_t)(i == 7 ? 42 : i + 1), "striped lookup failed");
+    }
+    hashtable_striped_delete(&table);
+
+    /* removing a range of integer keys */
+    hashtable_striped_init(&table, 8, HASH_INTPTR, false);
+    for (i = 0; i < SHARED_KEYS; i++)
+        hashtable_striped_add(&table, SHARED_KEY(i), SHARED_KEY(i));
+    CHECK(hashtable_striped_remove_range(&table, SHARED_KEY(0), SHARED_KEY(100)),
+          "striped remove_range failed");
+    CHECK(hashtable_striped_lookup(&table, SHARED_KEY(99)) == NULL &&
+          hashtable_striped_lookup(&table, SHARED_KEY(100)) == SHARED_KEY(100),
+          "striped remove_range removed the wrong keys");
+    CHECK(hashtable_striped_entries(&table) == SHARED_KEYS - 100,
+          "striped entry count wrong");
+    hashtable_striped_clear(&table);
+    CHECK(hashtable_striped_entries(&table) == 0, "striped clear failed");
+    hashtable_striped_delete(&table);
+}
+
+static int
+compare_ints(void *entry1, void *entry2)
+{
+    ptr_int_t a = (ptr_int_t)entry1, b = (ptr_int_t)entry2;
+    return (a < b) ? -1 : ((a > b) ? 1 : 0);
+}
+
+static void
+test_drvector_api(void)
+{
+    drvector_t vec;
+    void *batch[3] = {(void *)30, (void *)10, (void *)20};
+    uint i, idx;
+    drvector_init(&vec, 0, false, NULL);
+    CHECK(drvector_reserve(&vec, 100) && vec.capacity == 100, "reserve failed");
+    CHECK(drvector_append_batch(&vec, batch, 3) && vec.entries == 3,
+          "batch append failed");
+    /* descending values, with duplicates of the batch */
+    for (i = 0; i < 500; i++)
+        drvector_append(&vec, (void *)(ptr_uint_t)(500 - i));
+    drvector_sort(&vec, compare_ints);
+    for (i = 1; i < vec.entries; i++)
+        CHECK((ptr_int_t)vec.array[i-1] <= (ptr_int_t)vec.array[i], "sort failed");
+    CHECK(drvector_search(&vec, (void *)20, compare_ints, &idx) &&
+          vec.array[idx] == (void *)20 && vec.array[idx-1] == (void *)19,
+          "search for duplicate failed");
+    CHECK(!drvector_search(&vec, (void *)1000, compare_ints, &idx) &&
+          idx == vec.entries, "search past the end failed");
+    CHECK(drvector_resize(&vec, 10) && vec.entries == 10, "shrink failed");
+    CHECK(drvector_resize(&vec, 20) && vec.array[19] == NULL, "grow failed");
+    drvector_delete(&vec);
+}
+
+DR_EXPORT void
+dr_init(client_id_t id)
+{
+    uint i;
+    drmgr_init();
+    dr_register_exit_event(event_exit);
+    drmgr_register_thread_init_event(event_thread_init);
+
+    test_striped_api();
+    test_drvector_api();
+    drvector_init(&records, 16, true, NULL);
+    record_table = drtable_create(16, sizeof(uint), 0, true, NULL);
+
+    hashtable_init(&chained, 8, HASH_INTPTR, false);
+    hashtable_striped_init(&striped, 8, HASH_INTPTR, false);
+    for (i = 0; i < SHARED_KEYS; i++) {
+        hashtable_add(&chained, SHARED_KEY(i), SHARED_KEY(i));
+        hashtable_striped_add(&striped, SHARED_KEY(i), SHARED_KEY(i));
+    }
+}
+
+static int
+run_bench(void *drcontext, bool use_striped)
+{
+    uint64 start = dr_get_milliseconds();
+    uint i;
+    for (i = 0; i < BENCH_ITERS; i++) {
+        void *key = SHARED_KEY(i % SHARED_KEYS);
+        void *payload = use_striped ? hashtable_striped_lookup(&striped, key) :
+            hashtable_lookup(&chained, key);
+        CHECK(payload == key, "shared lookup failed");
+        if (i % WRITE_FREQ == 0) {
+            void *mine = PRIVATE_KEY(drcontext, (i / WRITE_FREQ) % PRIVATE_KEYS);
+            bool ok;
+            if (use_striped) {
+                ok = hashtable_striped_add(&striped, mine, mine) &&
+                    hashtable_striped_lookup(&striped, mine) == mine &&
+                    hashtable_striped_remove(&striped, mine);
+            } else {
+                ok = hashtable_add(&chained, mine, mine) &&
+                    hashtable_lookup(&chained, mine) == mine &&
+                    hashtable_remove(&chained, mine);
+            }
+            CHECK(ok, "private key update failed");
+        }
+    }
+    return (int)(dr_get_milliseconds() - start);
+}
+
+static void
+event_thread_init(void *drcontext)
+{
+    void *local = drvector_local_create(&records, 64);
+    void *cache = drtable_cache_create(record_table, 32);
+    uint i;
+    dr_atomic_add32_return_sum(&chained_ms, run_bench(drcontext, false));
+    dr_atomic_add32_return_sum(&striped_ms, run_bench(drcontext, true));
+    for (i = 0; i < RECORDS_PER_THREAD; i++) {
+        ptr_uint_t idx;
+        uint *entry = drtable_cache_alloc(cache, 1, &idx);
+        CHECK(entry != NULL && *entry == 0, "cached alloc failed");
+        CHECK(drtable_get_entry(record_table, idx) == entry, "cached index wrong");
+        *entry = i + 1;
+        CHECK(drvector_local_append(local, (void *)(ptr_uint_t)(i + 1)),
+              "local append failed");
+    }
+    drtable_cache_destroy(cache);
+    drvector_local_destroy(local);
+    dr_atomic_add32_return_sum(&num_threads, 1);
+}
+
+static void
+event_exit(void)
+{
+    CHECK(chained.entries == SHARED_KEYS, "chained entries leaked");
+    CHECK(hashtable_striped_entries(&striped) == SHARED_KEYS, "striped entries leaked");
+    CHECK(records.entries == num_threads * RECORDS_PER_THREAD, "local appends lost");
+    CHECK(drtable_num_entries(record_table) >= records.entries, "cached allocs lost");
+    drvector_sort(&records, compare_ints);
+    CHECK(records.array[0] == (void *)1 &&
+          records.array[records.entries - 1] == (void *)RECORDS_PER_THREAD,
+          "local appends corrupted");
+    drvector_delete(&records);
+    drtable_destroy(record_table, NULL);
+#ifndef NIGHTLY_REGRESSION
+    dr_fprintf(STDERR, "chained: %d ms, striped: %d ms\n", chained_ms, striped_ms);
+#endif
+    hashtable_delete(&chained);
+    hashtable_striped_delete(&striped);
+    drmgr_exit();
+    dr_fprintf(STDERR, "all done\n");
+}
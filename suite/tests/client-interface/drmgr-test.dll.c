@@ -50,6 +50,7 @@
  */
 static int tls_idx;
 static int cls_idx;
+static int instr_idx;
 static thread_id_t main_thread;
 static int cb_depth;
 static bool in_syscall_A;
@@ -64,6 +65,8 @@ static bool checked_tls_from_cache;
 static bool checked_cls_from_cache;
 static bool checked_tls_write_from_cache;
 static bool checked_cls_write_from_cache;
+static int app_loads_checked;
+static int app_stores_checked;
 
 static void event_exit(void);
 static void event_thread_init(void *drcontext);
@@ -127,6 +130,8 @@ dr_init(client_id_t id)
     cls_idx = drmgr_register_cls_field(event_thread_context_init,
                                        event_thread_context_exit);
     CHECK(cls_idx != -1, "drmgr_register_tls_field failed");
+    instr_idx = drmgr_register_instr_field();
+    CHECK(instr_idx != -1, "drmgr_register_instr_field failed");
 
     dr_register_filter_syscall_event(event_filter_syscall);
     ok = drmgr_register_pre_syscall_event_ex(event_pre_sys_A, &sys_pri_A) &&
@@ -147,9 +152,12 @@ event_exit(void)
     CHECK(checked_cls_from_cache, "failed to hit clean call");
     CHECK(checked_tls_write_from_cache, "failed to hit clean call");
     CHECK(checked_cls_write_from_cache, "failed to hit clean call");
+    CHECK(app_loads_checked > 0 && app_stores_checked > 0,
+          "failed to see app ldr and str");
     drmgr_unregister_cls_field(event_thread_context_init,
                                event_thread_context_exit,
                                cls_idx);
+    CHECK(drmgr_unregister_instr_field(instr_idx), "unregister instr field failed");
     drmgr_exit();
     dr_fprintf(STDERR, "all done\n");
 }
@@ -206,12 +214,58 @@ event_thread_context_exit(void *drcontext, bool thread_exit)
     }
 }
 
+/* The app's own ldr and str: the memory operand is the mem_reg the decoder
+ * produced, its direction comes from the opcode, and a store's Rt is read.
+ */
+static void
+check_app_load_store(void *drcontext, instr_t *inst)
+{
+    int opc = instr_get_opcode(inst);
+    opnd_t opnd;
+    bool is_write;
+    uint live;
+    if (opc != OP_ldr_imm && opc != OP_str_imm)
+        return;
+    CHECK(drmgr_get_mem_opnd(drcontext, inst, 0, &opnd, &is_write),
+          "app ldr/str memory operand not recorded");
+    CHECK(opnd_is_mem_reg(opnd), "ldr/str memory operand is not the base");
+    CHECK(is_write == (opc == OP_str_imm), "ldr/str direction wrong");
+    CHECK(!drmgr_get_mem_opnd(drcontext, inst, 1, NULL, NULL),
+          "ldr/str has one memory operand");
+    if (opc == OP_str_imm) {
+        opnd_t rt = instr_get_dst(inst, 0);
+        CHECK(drmgr_get_liveness(drcontext, inst, &live), "liveness failed");
+        CHECK(!opnd_is_reg(rt) || opnd_get_reg(rt) > DR_REG_R14 ||
+              (DRMGR_LIVE_REG(opnd_get_reg(rt)) & live) != 0,
+              "stored register not live before str");
+        app_stores_checked++;
+    } else
+        app_loads_checked++;
+}
+
 static dr_emit_flags_t
 event_bb_analysis(void *drcontext, void *tag, instrlist_t *bb,
                   bool for_trace, bool translating, OUT void **user_data)
 {
+    instr_t *inst;
     /* point at first instr */
     *user_data = (void *) instrlist_first(bb);
+    /* test shared analysis and per-instr fields: tag each app instr with
+     * its own address plus its memory operand count
+     */
+    for (inst = instrlist_first(bb); inst != NULL; inst = instr_get_next(inst)) {
+        uint live, num_mem = 0;
+        if (!instr_ok_to_mangle(inst))
+            continue;
+        CHECK(drmgr_get_instr_field(drcontext, inst, instr_idx) == NULL,
+              "instr field not cleared");
+        CHECK(drmgr_get_liveness(drcontext, inst, &live), "liveness failed");
+        while (drmgr_get_mem_opnd(drcontext, inst, num_mem, NULL, NULL))
+            num_mem++;
+        check_app_load_store(drcontext, inst);
+        drmgr_set_instr_field(drcontext, inst, instr_idx,
+                              (void *)((ptr_uint_t)inst + num_mem));
+    }
     return DR_EMIT_DEFAULT;
 }
 
@@ -261,6 +315,14 @@ event_bb_insert(void *drcontext, void *tag, instrlist_t *bb, instr_t *inst,
 {
     /* hack to instrument every nth bb.  assumes DR serializes bb events. */
     static int freq;
+    if (instr_ok_to_mangle(inst)) {
+        uint live, num_mem = 0;
+        CHECK(drmgr_get_liveness(drcontext, inst, &live), "liveness failed");
+        while (drmgr_get_mem_opnd(drcontext, inst, num_mem, NULL, NULL))
+            num_mem++;
+        CHECK(drmgr_get_instr_field(drcontext, inst, instr_idx) ==
+              (void *)((ptr_uint_t)inst + num_mem), "instr field not preserved");
+    }
     freq++;
     if (freq % 100 == 0 && inst == (instr_t*)user_data/*first instr*/) {
         /* test read from cache */
@@ -0,0 +1,127 @@
+/* **********************************************************
+ * Copyright (c) 2013 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * 
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * 
+ * * Neither the name of Google, Inc. nor the names of its contributors may be
+ *   used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL GOOGLE, INC. OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+/* Tests the drreg extension */
+
+#include "dr_api.h"
+#include "drmgr.h"
+#include "drreg.h"
+
+#define CHECK(x, msg) do {               \
+    if (!(x)) {                          \
+        dr_fprintf(STDERR, "%s\n", msg); \
+        dr_abort();                      \
+    }                                    \
+} while (0);
+
+static void event_exit(void);
+static dr_emit_flags_t event_bb_analysis(void *drcontext, void *tag, instrlist_t *bb,
+                                         bool for_trace, bool translating,
+                                         OUT void **user_data);
+static dr_emit_flags_t event_bb_insert(void *drcontext, void *tag, instrlist_t *bb,
+                                       instr_t *inst, bool for_trace, bool translating,
+                                       void *user_data);
+
+DR_EXPORT void 
+dr_init(client_id_t id)
+{
+    drmgr_priority_t priority = {sizeof(priority), "drreg-test", NULL, NULL, 0};
+    drreg_options_t ops = {sizeof(ops), 2};
+    bool ok;
+
+    drmgr_init();
+    CHECK(drreg_init(&ops) == DRREG_SUCCESS, "drreg init failed");
+    dr_register_exit_event(event_exit);
+
+    ok = drmgr_register_bb_instrumentation_event(event_bb_analysis,
+                                                 event_bb_insert,
+                                                 &priority);
+    CHECK(ok, "drmgr register bb failed");
+}
+
+static void 
+event_exit(void)
+{
+    CHECK(drreg_exit() == DRREG_SUCCESS, "drreg exit failed");
+    drmgr_exit();
+    dr_fprintf(STDERR, "all done\n");
+}
+
+static dr_emit_flags_t
+event_bb_analysis(void *drcontext, void *tag, instrlist_t *bb,
+                  bool for_trace, bool translating, OUT void **user_data)
+{
+    return DR_EMIT_DEFAULT;
+}
+
+/* Clobbers scratch registers before every app instr: if drreg spills or
+ * restores incorrectly the app will not produce its expected output.
+ */
+static dr_emit_flags_t
+event_bb_insert(void *drcontext, void *tag, instrlist_t *bb, instr_t *instr,
+                bool for_trace, bool translating, void *user_data)
+{
+    reg_id_t reg1, reg2;
+    bool dead;
+
+    if (!instr_ok_to_mangle(instr))
+        return DR_EMIT_DEFAULT;
+
+    CHECK(drreg_reserve_aflags(drcontext, bb, instr) == DRREG_SUCCESS,
+          "failed to reserve aflags");
+    CHECK(drreg_reserve_aflags(drcontext, bb, instr) == DRREG_ERROR_IN_USE,
+          "double aflags reservation not caught");
+
+    CHECK(drreg_reserve_register(drcontext, bb, instr, DRREG_ALLOW_ALL, &reg1) ==
+          DRREG_SUCCESS, "failed to reserve first register");
+    CHECK(drreg_reserve_register(drcontext, bb, instr, DRREG_ALLOW_ALL &
+                                 ~DRREG_ALLOW(reg1), &reg2) == DRREG_SUCCESS,
+          "failed to reserve second register");
+    CHECK(reg1 != reg2, "same register handed out twice");
+
+    instrlist_meta_preinsert(bb, instr, INSTR_CREATE_mov_imm
+                             (drcontext, opnd_create_reg(reg1),
+                              OPND_CREATE_IMM12(0xbad), COND_ALWAYS));
+    if (drreg_is_register_dead(drcontext, DR_REG_R0, &dead) == DRREG_SUCCESS &&
+        !dead) {
+        CHECK(drreg_get_app_value(drcontext, bb, instr, DR_REG_R0, reg2) ==
+              DRREG_SUCCESS, "failed to get app value of live register");
+    }
+
+    CHECK(drreg_unreserve_register(drcontext, bb, instr, reg2) == DRREG_SUCCESS,
+          "failed to unreserve second register");
+    CHECK(drreg_unreserve_register(drcontext, bb, instr, reg1) == DRREG_SUCCESS,
+          "failed to unreserve first register");
+    CHECK(drreg_unreserve_aflags(drcontext, bb, instr) == DRREG_SUCCESS,
+          "failed to unreserve aflags");
+    return DR_EMIT_DEFAULT;
+}
@@ -38,6 +38,7 @@
 #include "client_tools.h"
 
 #include <limits.h>
+#include <stdlib.h>
 #include <string.h>
 
 /* DR's build system usually disables warnings we're not interested in, but the
@@ -462,6 +463,82 @@ test_line_iteration(const module_data_t *dll_data)
     ASSERT(res == DRSYM_SUCCESS);
 }
 
+#define MAX_BULK_OFFS 64
+
+typedef struct _bulk_offs_t {
+    size_t offs[MAX_BULK_OFFS];
+    size_t count;
+    const char *modpath;
+} bulk_offs_t;
+
+static bool
+collect_line_cb(drsym_line_info_t *info, void *data)
+{
+    bulk_offs_t *bulk = (bulk_offs_t *) data;
+    if (info->file != NULL && info->line_addr != 0)
+        bulk->offs[bulk->count++] = info->line_addr;
+    return bulk->count < MAX_BULK_OFFS;
+}
+
+static int
+compare_offs(const void *a, const void *b)
+{
+    size_t offs_a = *(const size_t *)a;
+    size_t offs_b = *(const size_t *)b;
+    return (offs_a > offs_b) ? 1 : ((offs_a < offs_b) ? -1 : 0);
+}
+
+/* Checks each batch result against a single lookup of the same offset. */
+static bool
+bulk_lookup_cb(size_t index, drsym_info_t *info, drsym_error_t status, void *data)
+{
+    bulk_offs_t *bulk = (bulk_offs_t *) data;
+    drsym_info_t *single;
+    char sbuf[sizeof(*single) + MAX_FUNC_LEN];
+    drsym_error_t r;
+
+    single = (drsym_info_t *)sbuf;
+    single->struct_size = sizeof(*single);
+    single->name_size = MAX_FUNC_LEN;
+    r = drsym_lookup_address(bulk->modpath, bulk->offs[index], single,
+                             DRSYM_DEFAULT_FLAGS);
+    ASSERT(r == status);
+    if (r == DRSYM_SUCCESS || r == DRSYM_ERROR_LINE_NOT_AVAILABLE) {
+        ASSERT(strcmp(single->name, info->name) == 0);
+        ASSERT(single->start_offs == info->start_offs);
+    }
+    if (r == DRSYM_SUCCESS) {
+        ASSERT(single->line == info->line);
+        ASSERT(single->line_offs == info->line_offs);
+    }
+    return true;
+}
+
+static void
+test_bulk_lookup(const module_data_t *dll_data)
+{
+    static bulk_offs_t bulk;
+    drsym_info_t *info;
+    char sbuf[sizeof(*info) + MAX_FUNC_LEN];
+    drsym_error_t r;
+
+    bulk.count = 0;
+    bulk.modpath = dll_data->full_path;
+    r = drsym_enumerate_lines(dll_data->full_path, collect_line_cb, &bulk);
+    ASSERT(r == DRSYM_SUCCESS);
+    qsort(bulk.offs, bulk.count, sizeof(bulk.offs[0]), compare_offs);
+
+    info = (drsym_info_t *)sbuf;
+    info->struct_size = sizeof(*info);
+    info->name_size = MAX_FUNC_LEN;
+    r = drsym_lookup_addresses(dll_data->full_path, bulk.offs, bulk.count, info,
+                               bulk_lookup_cb, &bulk, DRSYM_DEFAULT_FLAGS);
+    ASSERT(r == DRSYM_SUCCESS);
+    r = drsym_lookup_addresses(NULL, bulk.offs, bulk.count, info, bulk_lookup_cb,
+                               &bulk, DRSYM_DEFAULT_FLAGS);
+    ASSERT(r == DRSYM_ERROR_INVALID_PARAMETER);
+}
+
 /* Lookup symbols in the appdll and wrap them. */
 static void
 lookup_dll_syms(void *dc, const module_data_t *dll_data, bool loaded)
@@ -534,6 +611,8 @@ lookup_dll_syms(void *dc, const module_data_t *dll_data, bool loaded)
 
     test_line_iteration(dll_data);
 
+    test_bulk_lookup(dll_data);
+
     drsym_free_resources(dll_path);
 }
 
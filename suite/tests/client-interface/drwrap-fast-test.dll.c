@@ -0,0 +1,104 @@
+/* **********************************************************
+ * Copyright (c) 2013 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * 
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * 
+ * * Neither the name of Google, Inc. nor the names of its contributors may be
+ *   used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL GOOGLE, INC. OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+/* Tests the drwrap extension's DRWRAP_FAST mode by wrapping malloc */
+
+#include "dr_api.h"
+#include "drwrap.h"
+#include "drmgr.h"
+#include <string.h> /* strstr */
+
+#define CHECK(x, msg) do {               \
+    if (!(x)) {                          \
+        dr_fprintf(STDERR, "%s\n", msg); \
+        dr_abort();                      \
+    }                                    \
+} while (0);
+
+/* must match the app */
+#define MALLOC_SIZE 1234
+
+static int pre_count;
+static int post_count;
+
+static void event_exit(void);
+
+static void
+wrap_pre(void *wrapcxt, OUT void **user_data)
+{
+    /* only the register args are needed so no mcontext is ever retrieved */
+    size_t size = (size_t) drwrap_get_arg(wrapcxt, 0);
+    *user_data = (void *) size;
+    if (size == MALLOC_SIZE)
+        dr_atomic_add32_return_sum(&pre_count, 1);
+}
+
+static void
+wrap_post(void *wrapcxt, void *user_data)
+{
+    if (wrapcxt == NULL || (size_t) user_data != MALLOC_SIZE)
+        return;
+    CHECK(drwrap_get_retval(wrapcxt) != NULL, "malloc retval not passed through");
+    dr_atomic_add32_return_sum(&post_count, 1);
+}
+
+static void
+module_load_event(void *drcontext, const module_data_t *mod, bool loaded)
+{
+    if (strstr(dr_module_preferred_name(mod), "libc.") == dr_module_preferred_name(mod)) {
+        app_pc addr = (app_pc) dr_get_proc_address(mod->handle, "malloc");
+        bool ok;
+        CHECK(addr != NULL, "cannot find malloc");
+        ok = drwrap_wrap(addr, wrap_pre, wrap_post);
+        CHECK(ok, "wrap failed");
+    }
+}
+
+DR_EXPORT void
+dr_init(client_id_t id)
+{
+    bool ok;
+    drwrap_init();
+    ok = drwrap_set_global_flags(DRWRAP_FAST);
+    CHECK(ok, "failed to set DRWRAP_FAST");
+    dr_register_exit_event(event_exit);
+    drmgr_register_module_load_event(module_load_event);
+}
+
+static void
+event_exit(void)
+{
+    CHECK(pre_count == post_count, "pre and post counts differ");
+    dr_fprintf(STDERR, "wrapped %d mallocs\n", post_count);
+    drwrap_exit();
+    dr_fprintf(STDERR, "all done\n");
+}
@@ -0,0 +1,169 @@
+/* **********************************************************
+ * Copyright (c) 2013 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * 
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * 
+ * * Neither the name of Google, Inc. nor the names of its contributors may be
+ *   used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL GOOGLE, INC. OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+
+/* Tests the drx extension */
+
+#include "dr_api.h"
+#include "drmgr.h"
+#include "drx.h"
+#include <stddef.h> /* offsetof */
+
+#define CHECK(x, msg) do {               \
+    if (!(x)) {                          \
+        dr_fprintf(STDERR, "%s\n", msg); \
+        dr_abort();                      \
+    }                                    \
+} while (0);
+
+/* Too large for an immediate, and carries out of the low word quickly */
+#define BIG_VALUE 0x10001
+
+typedef struct _counters_t {
+    uint count;
+    uint pad;
+    uint64 big;
+    uint64 down;
+} counters_t;
+
+static drx_thread_counters_t *thread_counters;
+static void *totals_lock;
+static counters_t totals;
+
+/* updated inline from all threads */
+static uint locked_count;
+static uint racy_count;
+static uint64 racy_big;
+
+static void event_exit(void);
+static dr_emit_flags_t event_bb_analysis(void *drcontext, void *tag, instrlist_t *bb,
+                                         bool for_trace, bool translating,
+                                         OUT void **user_data);
+static dr_emit_flags_t event_bb_insert(void *drcontext, void *tag, instrlist_t *bb,
+                                       instr_t *inst, bool for_trace, bool translating,
+                                       void *user_data);
+
+static void
+thread_exit(void *drcontext, void *counters, size_t size)
+{
+    counters_t *mine = (counters_t *) counters;
+    CHECK(size == sizeof(counters_t), "wrong counters size");
+    dr_mutex_lock(totals_lock);
+    totals.count += mine->count;
+    totals.big += mine->big;
+    totals.down += mine->down;
+    dr_mutex_unlock(totals_lock);
+}
+
+DR_EXPORT void 
+dr_init(client_id_t id)
+{
+    drmgr_priority_t priority = {sizeof(priority), "drx-test", NULL, NULL, 0};
+    bool ok;
+
+    drmgr_init();
+    CHECK(drx_init(), "drx init failed");
+    thread_counters = drx_thread_counters_create(sizeof(counters_t), thread_exit);
+    CHECK(thread_counters != NULL, "failed to create thread counters");
+    totals_lock = dr_mutex_create();
+    dr_register_exit_event(event_exit);
+
+    ok = drmgr_register_bb_instrumentation_event(event_bb_analysis,
+                                                 event_bb_insert,
+                                                 &priority);
+    CHECK(ok, "drmgr register bb failed");
+}
+
+static void 
+event_exit(void)
+{
+    /* the per-thread copies and the locked counter see every update */
+    CHECK(locked_count > 0, "no blocks counted");
+    CHECK(totals.count == locked_count, "per-thread counts disagree with locked count");
+    CHECK(totals.big == (uint64) locked_count * BIG_VALUE,
+          "64-bit per-thread count wrong");
+    CHECK(totals.down == (uint64) 0 - locked_count, "64-bit decrement wrong");
+    /* concurrent unlocked updates can only be lost */
+    CHECK(racy_count > 0 && racy_count <= locked_count, "32-bit global count wrong");
+    CHECK(racy_big > 0 && racy_big <= (uint64) locked_count * BIG_VALUE,
+          "64-bit global count wrong");
+    CHECK(drx_thread_counters_destroy(thread_counters), "failed to destroy counters");
+    dr_mutex_destroy(totals_lock);
+    drx_exit();
+    drmgr_exit();
+    dr_fprintf(STDERR, "all done\n");
+}
+
+static dr_emit_flags_t
+event_bb_analysis(void *drcontext, void *tag, instrlist_t *bb,
+                  bool for_trace, bool translating, OUT void **user_data)
+{
+    instr_t *first;
+    for (first = instrlist_first(bb); first != NULL; first = instr_get_next(first)) {
+        if (instr_ok_to_mangle(first))
+            break;
+    }
+    *user_data = (void *) first;
+    return DR_EMIT_DEFAULT;
+}
+
+/* Counts each block execution several ways */
+static dr_emit_flags_t
+event_bb_insert(void *drcontext, void *tag, instrlist_t *bb, instr_t *instr,
+                bool for_trace, bool translating, void *user_data)
+{
+    if (instr != (instr_t *) user_data)
+        return DR_EMIT_DEFAULT;
+
+    CHECK(drx_insert_counter_update(drcontext, bb, instr, &locked_count, 1,
+                                    DRX_COUNTER_LOCK), "locked update failed");
+    CHECK(drx_insert_counter_update(drcontext, bb, instr, &racy_count, 1, 0),
+          "32-bit update failed");
+    CHECK(drx_insert_counter_update(drcontext, bb, instr, &racy_big, BIG_VALUE,
+                                    DRX_COUNTER_64BIT), "64-bit update failed");
+    CHECK(drx_insert_thread_counter_update(drcontext, thread_counters, bb, instr,
+                                           offsetof(counters_t, count), 1, 0),
+          "per-thread update failed");
+    CHECK(drx_insert_thread_counter_update(drcontext, thread_counters, bb, instr,
+                                           offsetof(counters_t, big), BIG_VALUE,
+                                           DRX_COUNTER_64BIT),
+          "64-bit per-thread update failed");
+    CHECK(drx_insert_thread_counter_update(drcontext, thread_counters, bb, instr,
+                                           offsetof(counters_t, down), -1,
+                                           DRX_COUNTER_64BIT),
+          "64-bit per-thread decrement failed");
+    CHECK(!drx_insert_thread_counter_update(drcontext, thread_counters, bb, instr,
+                                            offsetof(counters_t, count), 1,
+                                            DRX_COUNTER_LOCK),
+          "locked per-thread update accepted");
+    return DR_EMIT_DEFAULT;
+}